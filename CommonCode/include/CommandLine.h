@@ -1,3 +1,6 @@
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
 #include <map>
 #include <vector>
 #include <iostream>
@@ -520,3 +523,4 @@ std::vector<bool> CommandLine::ParseBool(std::string Input, char Delimiter)
    return Result;
 }
 
+#endif
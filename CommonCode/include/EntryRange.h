@@ -0,0 +1,183 @@
+#ifndef ENTRY_RANGE_H
+#define ENTRY_RANGE_H
+
+// Entry range of one job, from the command line options shared by the executables:
+//    --Fraction 0.1                       first 10% of the entries (default 1)
+//    --FirstEntry 1000 --NEntries 5000    explicit range, applied on top of Fraction
+//    --Shard 3/20                         block 3 (counting from 0) of 20 contiguous blocks of that range
+//
+// Usage:
+//    EntryRange Range(CL, M.GetEntries());
+//    for(long long iE = Range.Begin; iE < Range.End; iE++) ...
+//    Range.Write(&OutputFile, {"HEfficiency=HMatched/HAll"});
+//
+// Write stores a "ShardInfo" record (and the optional list of derived histograms in "ShardDerived")
+// that MergeShards uses to check that all shards are present once, and to recompute histograms
+// that are ratios of other histograms instead of adding them up.
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "TDirectory.h"
+#include "TNamed.h"
+
+#include "CommandLine.h"
+
+class EntryRange
+{
+public:
+   long long Total;
+   long long Begin;
+   long long End;
+   int       Shard;
+   int       ShardCount;
+   bool      Valid;
+public:
+   EntryRange(long long total, double fraction = 1, long long first = 0, long long count = -1,
+      int shard = 0, int shardCount = 1);
+   EntryRange(CommandLine &CL, long long total);
+   long long GetCount() const {return End - Begin;}
+   bool IsValid() const {return Valid;}
+   bool IsPartial() const {return (Begin > 0 || End < Total);}
+   std::string ToString() const;
+   void Write(TDirectory *directory, const std::vector<std::string> &derived = {}) const;
+public:
+   static bool ParseShard(const std::string &text, int &shard, int &count);
+   static bool ParseCount(const std::string &text, long long &value);
+   static bool ParseInfo(const std::string &text, EntryRange &range);
+private:
+   void Setup(long long total, double fraction, long long first, long long count, int shard, int shardCount);
+};
+
+inline EntryRange::EntryRange(long long total, double fraction, long long first, long long count,
+   int shard, int shardCount)
+{
+   Setup(total, fraction, first, count, shard, shardCount);
+}
+
+inline EntryRange::EntryRange(CommandLine &CL, long long total)
+{
+   double Fraction      = CL.GetDouble("Fraction", 1.00);
+   std::string FirstText = CL.Get("FirstEntry", "0");
+   std::string CountText = CL.Get("NEntries", "-1");
+   std::string Sharding  = CL.Get("Shard", "0/1");
+
+   long long First = 0, Count = -1;
+   int Shard = 0, ShardCount = 1;
+   bool Good = true;
+   if(ParseCount(FirstText, First) == false)
+   {
+      std::cerr << "[EntryRange] Cannot parse --FirstEntry \"" << FirstText << "\", expected an entry number" << std::endl;
+      Good = false;
+   }
+   if(ParseCount(CountText, Count) == false)
+   {
+      std::cerr << "[EntryRange] Cannot parse --NEntries \"" << CountText << "\", expected a number of entries (-1 = all)" << std::endl;
+      Good = false;
+   }
+   if(ParseShard(Sharding, Shard, ShardCount) == false)
+   {
+      std::cerr << "[EntryRange] Cannot parse --Shard \"" << Sharding << "\", expected i/N with 0 <= i < N" << std::endl;
+      Good = false;
+   }
+   if(Good == false)
+   {
+      Setup(total, 1, 0, 0, 0, 1);
+      Valid = false;
+      return;
+   }
+
+   Setup(total, Fraction, First, Count, Shard, ShardCount);
+}
+
+inline void EntryRange::Setup(long long total, double fraction, long long first, long long count,
+   int shard, int shardCount)
+{
+   Total      = total;
+   Shard      = shard;
+   ShardCount = shardCount;
+   Valid      = true;
+
+   long long Last = total * fraction;
+   if(Last > total)
+      Last = total;
+   if(first < 0)
+      first = 0;
+   if(first > Last)
+      first = Last;
+   if(count >= 0 && first + count < Last)
+      Last = first + count;
+
+   // Same split as ParallelProcessor: the first (Length % ShardCount) blocks are one entry longer
+   long long Length = Last - first;
+   Begin = first;
+   for(int i = 0; i < shard; i++)
+      Begin = Begin + Length / shardCount + ((i < Length % shardCount) ? 1 : 0);
+   End = Begin + Length / shardCount + ((shard < Length % shardCount) ? 1 : 0);
+}
+
+inline bool EntryRange::ParseShard(const std::string &text, int &shard, int &count)
+{
+   int Index = -1, Count = -1;
+   char Rest = 0;
+   if(sscanf(text.c_str(), "%d/%d%c", &Index, &Count, &Rest) != 2)
+      return false;
+   if(Count < 1 || Index < 0 || Index >= Count)
+      return false;
+   shard = Index;
+   count = Count;
+   return true;
+}
+
+inline bool EntryRange::ParseCount(const std::string &text, long long &value)
+{
+   long long Value = 0;
+   char Rest = 0;
+   if(sscanf(text.c_str(), "%lld%c", &Value, &Rest) != 1)
+      return false;
+   value = Value;
+   return true;
+}
+
+inline std::string EntryRange::ToString() const
+{
+   return "Shard " + std::to_string(Shard) + "/" + std::to_string(ShardCount)
+      + " Entries " + std::to_string(Begin) + " " + std::to_string(End)
+      + " Total " + std::to_string(Total);
+}
+
+inline bool EntryRange::ParseInfo(const std::string &text, EntryRange &range)
+{
+   long long Begin = 0, End = 0, Total = 0;
+   int Shard = 0, ShardCount = 0;
+   if(sscanf(text.c_str(), "Shard %d/%d Entries %lld %lld Total %lld", &Shard, &ShardCount, &Begin, &End, &Total) != 5)
+      return false;
+   range.Total      = Total;
+   range.Begin      = Begin;
+   range.End        = End;
+   range.Shard      = Shard;
+   range.ShardCount = ShardCount;
+   range.Valid      = true;
+   return true;
+}
+
+inline void EntryRange::Write(TDirectory *directory, const std::vector<std::string> &derived) const
+{
+   if(directory == nullptr)
+      return;
+   TDirectory::TContext Context(directory);
+
+   TNamed("ShardInfo", ToString().c_str()).Write();
+
+   if(derived.size() == 0)
+      return;
+   std::string List;
+   for(const std::string &Item : derived)
+      List = List + Item + "\n";
+   TNamed("ShardDerived", List.c_str()).Write();
+}
+
+#endif
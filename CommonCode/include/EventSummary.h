@@ -0,0 +1,132 @@
+#ifndef EVENT_SUMMARY_H
+#define EVENT_SUMMARY_H
+
+#include <string>
+#include <vector>
+#include "TTree.h"
+
+// Per-event derived quantities, stored one entry per entry of the strangeness tree so that
+// the two can be read together as friends.  The tree is written once by
+// MainAnalysis/20260218_KtoPiInversion/tools/build_event_summary_friend.cc and read back with
+//    M.AttachSummary("EventSummary.root");
+//    M.GetEntry(i);   // fills M.Summary as well
+//
+// All counts are raw: no overflow clamping, so every consumer applies its own maximum.
+// Reco counts use RecoGoodTrack == 1 and nonzero charge.  Truth counts use status 1 particles
+// passing TruthCountingPolicy::IsCountedChargedForActivity, and are only filled when
+// HasTruth == 1.  The thresholds used are saved next to the tree as TParameter<double>
+// (NtagPtMin, YieldPtMin, YieldPtMax, PIDAbsCosMin, PIDAbsCosMax) together with a
+// "SummaryProvenance" TNamed.
+
+#define EVENT_SUMMARY_TREE  "EventSummary"
+
+struct EventSummary
+{
+   int    EventPassAll;
+   int    HasThrustAxis;        // |thrust| > 0
+   double ThrustUnitX;          // unit thrust axis; (0, 0, 1) without an axis
+   double ThrustUnitY;
+   double ThrustUnitZ;
+
+   int    NchGoodReco;          // all good charged tracks
+   int    NchTagReco;           // pT >= NtagPtMin
+   int    NchTagRecoCentral;    // pT >= NtagPtMin and |eta| < 0.5
+   int    NchEta05Reco;         // |eta| < 0.5, no pT threshold
+   int    NchY05Reco;           // |y| < 0.5 along the thrust axis
+
+   int    HasTruth;
+   int    NchTagTrue;
+   int    NchTagTrueCentral;
+   int    NchEta05True;
+   int    NchY05True;
+   int    NKTrue;               // YieldPtMin <= pT < YieldPtMax and inside the PID fiducial |cos(theta)| range
+   int    NPiTrue;
+   int    NPTrue;
+   int    NKTrueNoFid;          // same pT window, no fiducial requirement
+   int    NPiTrueNoFid;
+   int    NPTrueNoFid;
+
+   EventSummary() {Clear();}
+
+   void Clear()
+   {
+      EventPassAll = 0;
+      HasThrustAxis = 0;
+      ThrustUnitX = 0;
+      ThrustUnitY = 0;
+      ThrustUnitZ = 1;
+      NchGoodReco = 0;
+      NchTagReco = 0;
+      NchTagRecoCentral = 0;
+      NchEta05Reco = 0;
+      NchY05Reco = 0;
+      HasTruth = 0;
+      NchTagTrue = 0;
+      NchTagTrueCentral = 0;
+      NchEta05True = 0;
+      NchY05True = 0;
+      NKTrue = 0;
+      NPiTrue = 0;
+      NPTrue = 0;
+      NKTrueNoFid = 0;
+      NPiTrueNoFid = 0;
+      NPTrueNoFid = 0;
+   }
+
+   // Name, address and leaf type of every field; the single place that defines the layout
+   struct Field
+   {
+      std::string Name;
+      void *Address;
+      char Type;
+   };
+   std::vector<Field> Fields()
+   {
+      return {
+         {"EventPassAll", &EventPassAll, 'I'},
+         {"HasThrustAxis", &HasThrustAxis, 'I'},
+         {"ThrustUnitX", &ThrustUnitX, 'D'},
+         {"ThrustUnitY", &ThrustUnitY, 'D'},
+         {"ThrustUnitZ", &ThrustUnitZ, 'D'},
+         {"NchGoodReco", &NchGoodReco, 'I'},
+         {"NchTagReco", &NchTagReco, 'I'},
+         {"NchTagRecoCentral", &NchTagRecoCentral, 'I'},
+         {"NchEta05Reco", &NchEta05Reco, 'I'},
+         {"NchY05Reco", &NchY05Reco, 'I'},
+         {"HasTruth", &HasTruth, 'I'},
+         {"NchTagTrue", &NchTagTrue, 'I'},
+         {"NchTagTrueCentral", &NchTagTrueCentral, 'I'},
+         {"NchEta05True", &NchEta05True, 'I'},
+         {"NchY05True", &NchY05True, 'I'},
+         {"NKTrue", &NKTrue, 'I'},
+         {"NPiTrue", &NPiTrue, 'I'},
+         {"NPTrue", &NPTrue, 'I'},
+         {"NKTrueNoFid", &NKTrueNoFid, 'I'},
+         {"NPiTrueNoFid", &NPiTrueNoFid, 'I'},
+         {"NPTrueNoFid", &NPTrueNoFid, 'I'}
+      };
+   }
+
+   void CreateBranches(TTree *tree)
+   {
+      for(const Field &F : Fields())
+         tree->Branch(F.Name.c_str(), F.Address, (F.Name + "/" + F.Type).c_str());
+   }
+
+   bool SetBranchAddresses(TTree *tree)
+   {
+      bool Complete = true;
+      for(const Field &F : Fields())
+      {
+         if(tree->GetBranch(F.Name.c_str()) == nullptr)
+         {
+            Complete = false;
+            continue;
+         }
+         tree->SetBranchAddress(F.Name.c_str(), F.Address);
+      }
+      return Complete;
+   }
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+// Scalar per-track helpers: the passAcceptance / buildMass of the Make*Histograms programs and
+// the thrust-axis rapidity of the activity estimators, in one place.  KinematicsBatch.h has the
+// same expressions over arrays, and TestKinematicsBatch checks the two against each other.
+//
+// Undefined values (p == 0, no valid rapidity) give NaN or false, as in KinematicsBatch.
+
+#include <cmath>
+#include <limits>
+
+namespace Kinematics
+{
+// sqrt(px*px + py*py + pz*pz)
+inline double Momentum(double px, double py, double pz)
+{
+   return std::sqrt(px * px + py * py + pz * pz);
+}
+
+// sqrt(px*px + py*py)
+inline double TransverseMomentum(double px, double py)
+{
+   return std::sqrt(px * px + py * py);
+}
+
+// |pz / p|, NaN for p == 0
+inline double AbsCosTheta(double px, double py, double pz)
+{
+   const double P = Momentum(px, py, pz);
+   if(P <= 0)
+      return std::numeric_limits<double>::quiet_NaN();
+   return std::fabs(pz / P);
+}
+
+// absCosMin <= |cos(theta)| <= absCosMax, false for p == 0
+inline bool PassAcceptance(double px, double py, double pz, double absCosMin, double absCosMax)
+{
+   const double AbsCos = AbsCosTheta(px, py, pz);
+   return (AbsCos >= absCosMin && AbsCos <= absCosMax);
+}
+
+// sqrt(p*p + mass*mass)
+inline double Energy(double px, double py, double pz, double mass)
+{
+   return std::sqrt(px * px + py * py + pz * pz + mass * mass);
+}
+
+// Rapidity along the (not necessarily unit) axis (ax, ay, az); false if the axis is zero, e <= 0,
+// the particle is at or beyond the light cone along the axis, or the result is not finite
+inline bool AxisRapidity(double px, double py, double pz, double e,
+   double ax, double ay, double az, double &rapidity)
+{
+   const double Norm = std::sqrt(ax * ax + ay * ay + az * az);
+   if(Norm <= 0 || e <= 0)
+      return false;
+
+   const double PLong = (px * ax + py * ay + pz * az) / Norm;
+   const double Plus  = e + PLong;
+   const double Minus = e - PLong;
+   if(Plus <= 0 || Minus <= 0)
+      return false;
+
+   rapidity = 0.5 * std::log(Plus / Minus);
+   return std::isfinite(rapidity);
+}
+
+// Invariant mass of two four-momenta, 0 if m^2 <= 0
+inline double PairMass(double px1, double py1, double pz1, double e1,
+   double px2, double py2, double pz2, double e2)
+{
+   const double X = px1 + px2;
+   const double Y = py1 + py2;
+   const double Z = pz1 + pz2;
+   const double E = e1 + e2;
+   const double M2 = E * E - (X * X + Y * Y + Z * Z);
+   return (M2 > 0) ? std::sqrt(M2) : 0;
+}
+}
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef KINEMATICS_BATCH_H
+#define KINEMATICS_BATCH_H
+
+// Batch versions of the scalar per-track helpers of Kinematics.h (Momentum, AbsCosTheta,
+// PassAcceptance, AxisRapidity, PairMass), over contiguous arrays:
+//
+//    KinematicsBatch::Energy(M.RecoPx, M.RecoPy, M.RecoPz, 0.493677, EKaon, M.NReco);
+//    KinematicsBatch::AcceptanceMask(M.RecoPx, M.RecoPy, M.RecoPz, 0.15, 0.675, Pass, M.NReco);
+//    KinematicsBatch::PairMass(Px, Py, Pz, E, First, Second, Mass, NPair);
+//
+// The SIMD path is picked at compile time: AVX-512 with -mavx512f, AVX2 with -mavx2, otherwise
+// (or with -DKINEMATICS_BATCH_SCALAR) plain loops.  Every lane performs the same IEEE operations
+// in the same order as the scalar expression quoted next to each function (add, mul, div and sqrt
+// are correctly rounded in both), so the results agree bit for bit with the scalar code, as long
+// as the compiler does not contract a*b+c into an FMA.  With FMA available (-mfma; -mavx512f,
+// which has FMA without defining __FMA__; usually -march=native) contraction is switched off for
+// the functions of this header, by pragma for GCC and clang; other compilers stop with an error
+// unless the build uses -ffp-contract=off (or equivalent) and defines
+// KINEMATICS_BATCH_NO_FMA_CONTRACTION.  The caller's own scalar code is not covered: compare
+// against it with -ffp-contract=off.
+// TestKinematicsBatch (program/) checks every function against Kinematics.h and times both.
+// log and asinh have no SIMD form here; they stay scalar libm calls.
+//
+// Undefined values (p == 0, no valid rapidity) come out non-finite so that every cut fails.
+
+#include <cmath>
+#include <limits>
+
+#if !defined(KINEMATICS_BATCH_SCALAR) && (defined(__AVX512F__) || defined(__AVX2__))
+#include <immintrin.h>
+#define KINEMATICS_BATCH_SIMD
+#endif
+
+// No a*b+c contraction in this header (popped again at the end); clang takes the pragma per
+// function body, see KINEMATICS_BATCH_NO_CONTRACT
+#if (defined(__FMA__) || defined(__FP_FAST_FMA) || defined(__AVX512F__)) && !defined(KINEMATICS_BATCH_NO_FMA_CONTRACTION)
+#if defined(__clang__)
+#define KINEMATICS_BATCH_NO_CONTRACT _Pragma("clang fp contract(off)")
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#define KINEMATICS_BATCH_POP_OPTIONS
+#else
+#error "KinematicsBatch.h: FMA contraction would break the bit-for-bit agreement; build with -ffp-contract=off and -DKINEMATICS_BATCH_NO_FMA_CONTRACTION"
+#endif
+#endif
+#ifndef KINEMATICS_BATCH_NO_CONTRACT
+#define KINEMATICS_BATCH_NO_CONTRACT
+#endif
+
+namespace KinematicsBatch
+{
+namespace Detail
+{
+#if defined(KINEMATICS_BATCH_SIMD) && defined(__AVX512F__)
+   typedef __m512d Vec;
+   const long long Width = 8;
+   inline Vec  Load(const double *x)            {return _mm512_loadu_pd(x);}
+   inline void Store(double *x, Vec v)          {_mm512_storeu_pd(x, v);}
+   inline Vec  Set(double x)                    {return _mm512_set1_pd(x);}
+   inline Vec  Add(Vec a, Vec b)                {return _mm512_add_pd(a, b);}
+   inline Vec  Sub(Vec a, Vec b)                {return _mm512_sub_pd(a, b);}
+   inline Vec  Mul(Vec a, Vec b)                {return _mm512_mul_pd(a, b);}
+   inline Vec  Div(Vec a, Vec b)                {return _mm512_div_pd(a, b);}
+   inline Vec  Sqrt(Vec a)                      {return _mm512_sqrt_pd(a);}
+   inline Vec  Abs(Vec a)                       {return _mm512_abs_pd(a);}
+   inline Vec  Gather(const double *x, const int *index)
+   {
+      return _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)index), x, 8);
+   }
+   // a > 0 && b > 0 ? yes : no
+   inline Vec  SelectBothPositive(Vec a, Vec b, Vec yes, Vec no)
+   {
+      __mmask8 Mask = _mm512_cmp_pd_mask(a, _mm512_setzero_pd(), _CMP_GT_OQ)
+         & _mm512_cmp_pd_mask(b, _mm512_setzero_pd(), _CMP_GT_OQ);
+      return _mm512_mask_blend_pd(Mask, no, yes);
+   }
+   // bit i set if low <= x[i] <= high
+   inline int  InRange(Vec x, Vec low, Vec high)
+   {
+      return _mm512_cmp_pd_mask(x, low, _CMP_GE_OQ) & _mm512_cmp_pd_mask(x, high, _CMP_LE_OQ);
+   }
+#elif defined(KINEMATICS_BATCH_SIMD)
+   typedef __m256d Vec;
+   const long long Width = 4;
+   inline Vec  Load(const double *x)            {return _mm256_loadu_pd(x);}
+   inline void Store(double *x, Vec v)          {_mm256_storeu_pd(x, v);}
+   inline Vec  Set(double x)                    {return _mm256_set1_pd(x);}
+   inline Vec  Add(Vec a, Vec b)                {return _mm256_add_pd(a, b);}
+   inline Vec  Sub(Vec a, Vec b)                {return _mm256_sub_pd(a, b);}
+   inline Vec  Mul(Vec a, Vec b)                {return _mm256_mul_pd(a, b);}
+   inline Vec  Div(Vec a, Vec b)                {return _mm256_div_pd(a, b);}
+   inline Vec  Sqrt(Vec a)                      {return _mm256_sqrt_pd(a);}
+   inline Vec  Abs(Vec a)                       {return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a);}
+   inline Vec  Gather(const double *x, const int *index)
+   {
+      return _mm256_i32gather_pd(x, _mm_loadu_si128((const __m128i *)index), 8);
+   }
+   inline Vec  SelectBothPositive(Vec a, Vec b, Vec yes, Vec no)
+   {
+      Vec Mask = _mm256_and_pd(_mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_GT_OQ),
+         _mm256_cmp_pd(b, _mm256_setzero_pd(), _CMP_GT_OQ));
+      return _mm256_blendv_pd(no, yes, Mask);
+   }
+   inline int  InRange(Vec x, Vec low, Vec high)
+   {
+      return _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(x, low, _CMP_GE_OQ), _mm256_cmp_pd(x, high, _CMP_LE_OQ)));
+   }
+#endif
+}
+
+// Name of the code path compiled in, for log files
+inline const char *Backend()
+{
+#if defined(KINEMATICS_BATCH_SIMD) && defined(__AVX512F__)
+   return "AVX-512";
+#elif defined(KINEMATICS_BATCH_SIMD)
+   return "AVX2";
+#else
+   return "scalar";
+#endif
+}
+
+// p[i] = sqrt(px*px + py*py + pz*pz)
+inline void Momentum(const double *px, const double *py, const double *pz, double *p, long long n)
+{
+   KINEMATICS_BATCH_NO_CONTRACT
+   long long i = 0;
+#ifdef KINEMATICS_BATCH_SIMD
+   using namespace Detail;
+   for(; i + Width <= n; i = i + Width)
+   {
+      Vec X = Load(px + i), Y = Load(py + i), Z = Load(pz + i);
+      Store(p + i, Sqrt(Add(Add(Mul(X, X), Mul(Y, Y)), Mul(Z, Z))));
+   }
+#endif
+   for(; i < n; i++)
+      p[i] = std::sqrt(px[i] * px[i] + py[i] * py[i] + pz[i] * pz[i]);
+}
+
+// pt[i] = sqrt(px*px + py*py)
+inline void TransverseMomentum(const double *px, const double *py, double *pt, long long n)
+{
+   KINEMATICS_BATCH_NO_CONTRACT
+   long long i = 0;
+#ifdef KINEMATICS_BATCH_SIMD
+   using namespace Detail;
+   for(; i + Width <= n; i = i + Width)
+   {
+      Vec X = Load(px + i), Y = Load(py + i);
+      Store(pt + i, Sqrt(Add(Mul(X, X), Mul(Y, Y))));
+   }
+#endif
+   for(; i < n; i++)
+      pt[i] = std::sqrt(px[i] * px[i] + py[i] * py[i]);
+}
+
+// absCos[i] = fabs(pz) / sqrt(px*px + py*py + pz*pz), identical to fabs(pz / p); NaN for p == 0
+inline void AbsCosTheta(const double *px, const double *py, const double *pz, double *absCos, long long n)
+{
+   KINEMATICS_BATCH_NO_CONTRACT
+   long long i = 0;
+#ifdef KINEMATICS_BATCH_SIMD
+   using namespace Detail;
+   for(; i + Width <= n; i = i + Width)
+   {
+      Vec X = Load(px + i), Y = Load(py + i), Z = Load(pz + i);
+      Store(absCos + i, Div(Abs(Z), Sqrt(Add(Add(Mul(X, X), Mul(Y, Y)), Mul(Z, Z)))));
+   }
+#endif
+   for(; i < n; i++)
+      absCos[i] = std::fabs(pz[i]) / std::sqrt(px[i] * px[i] + py[i] * py[i] + pz[i] * pz[i]);
+}
+
+// pass[i] = (absCosMin <= |cos(theta)| <= absCosMax), ie. passAcceptance of the Make*Histograms
+inline void AcceptanceMask(const double *px, const double *py, const double *pz,
+   double absCosMin, double absCosMax, unsigned char *pass, long long n)
+{
+   KINEMATICS_BATCH_NO_CONTRACT
+   long long i = 0;
+#ifdef KINEMATICS_BATCH_SIMD
+   using namespace Detail;
+   Vec Low = Set(absCosMin), High = Set(absCosMax);
+   for(; i + Width <= n; i = i + Width)
+   {
+      Vec X = Load(px + i), Y = Load(py + i), Z = Load(pz + i);
+      int Bits = InRange(Div(Abs(Z), Sqrt(Add(Add(Mul(X, X), Mul(Y, Y)), Mul(Z, Z)))), Low, High);
+      for(long long j = 0; j < Width; j++)
+         pass[i+j] = (Bits >> j) & 1;
+   }
+#endif
+   for(; i < n; i++)
+   {
+      double AbsCos = std::fabs(pz[i]) / std::sqrt(px[i] * px[i] + py[i] * py[i] + pz[i] * pz[i]);
+      pass[i] = (AbsCos >= absCosMin && AbsCos <= absCosMax);
+   }
+}
+
+// e[i] = sqrt(px*px + py*py + pz*pz + mass*mass)
+inline void Energy(const double *px, const double *py, const double *pz, double mass, double *e, long long n)
+{
+   KINEMATICS_BATCH_NO_CONTRACT
+   const double M2 = mass * mass;
+   long long i = 0;
+#ifdef KINEMATICS_BATCH_SIMD
+   using namespace Detail;
+   Vec VM2 = Set(M2);
+   for(; i + Width <= n; i = i + Width)
+   {
+      Vec X = Load(px + i), Y = Load(py + i), Z = Load(pz + i);
+      Store(e + i, Sqrt(Add(Add(Add(Mul(X, X), Mul(Y, Y)), Mul(Z, Z)), VM2)));
+   }
+#endif
+   for(; i < n; i++)
+      e[i] = std::sqrt(px[i] * px[i] + py[i] * py[i] + pz[i] * pz[i] + M2);
+}
+
+// Rapidity along the (not necessarily unit) axis (ax, ay, az), ie. Kinematics::AxisRapidity:
+//    norm = sqrt(ax*ax + ay*ay + az*az);  pLong = (px*ax + py*ay + pz*az) / norm
+//    y = 0.5 * log((e + pLong) / (e - pLong))
+// NaN wherever the scalar version returns false: zero axis, e <= 0, e + pLong or e - pLong not
+// positive, or a non-finite result.  The norm is computed once; the projection is divided by it
+// rather than the axis scaled beforehand, so that the lanes round like the scalar version.
+inline void AxisRapidity(const double *px, const double *py, const double *pz, const double *e,
+   double ax, double ay, double az, double *y, long long n)
+{
+   KINEMATICS_BATCH_NO_CONTRACT
+   const double NaN = std::numeric_limits<double>::quiet_NaN();
+   const double Norm = std::sqrt(ax * ax + ay * ay + az * az);
+   if(!(Norm > 0))
+   {
+      for(long long i = 0; i < n; i++)
+         y[i] = NaN;
+      return;
+   }
+
+   long long i = 0;
+#ifdef KINEMATICS_BATCH_SIMD
+   using namespace Detail;
+   Vec AX = Set(ax), AY = Set(ay), AZ = Set(az), VNorm = Set(Norm), VNaN = Set(NaN);
+   for(; i + Width <= n; i = i + Width)
+   {
+      Vec PLong = Div(Add(Add(Mul(Load(px + i), AX), Mul(Load(py + i), AY)), Mul(Load(pz + i), AZ)), VNorm);
+      Vec E = Load(e + i);
+      Vec Plus = Add(E, PLong), Minus = Sub(E, PLong);
+      // per lane: e > 0, then e + pLong > 0 and e - pLong > 0
+      Store(y + i, SelectBothPositive(E, E, SelectBothPositive(Plus, Minus, Div(Plus, Minus), VNaN), VNaN));
+   }
+   for(long long j = 0; j < i; j++)
+   {
+      y[j] = 0.5 * std::log(y[j]);
+      if(std::isfinite(y[j]) == false)
+         y[j] = NaN;
+   }
+#endif
+   for(; i < n; i++)
+   {
+      const double PLong = (px[i] * ax + py[i] * ay + pz[i] * az) / Norm;
+      const double Plus  = e[i] + PLong;
+      const double Minus = e[i] - PLong;
+      y[i] = (e[i] > 0 && Plus > 0 && Minus > 0) ? 0.5 * std::log(Plus / Minus) : NaN;
+      if(std::isfinite(y[i]) == false)
+         y[i] = NaN;
+   }
+}
+
+// Invariant mass of the pairs (first[k], second[k]) of tracks with four-momenta (px, py, pz, e):
+//    e = e1 + e2;  m2 = e*e - (px*px + py*py + pz*pz);  m = m2 > 0 ? sqrt(m2) : 0
+// with px = px1 + px2 etc., ie. buildMass with the energies from Energy()
+inline void PairMass(const double *px, const double *py, const double *pz, const double *e,
+   const int *first, const int *second, double *mass, long long n)
+{
+   KINEMATICS_BATCH_NO_CONTRACT
+   long long k = 0;
+#ifdef KINEMATICS_BATCH_SIMD
+   using namespace Detail;
+   Vec Zero = Set(0);
+   for(; k + Width <= n; k = k + Width)
+   {
+      Vec X = Add(Gather(px, first + k), Gather(px, second + k));
+      Vec Y = Add(Gather(py, first + k), Gather(py, second + k));
+      Vec Z = Add(Gather(pz, first + k), Gather(pz, second + k));
+      Vec E = Add(Gather(e, first + k), Gather(e, second + k));
+      Vec M2 = Sub(Mul(E, E), Add(Add(Mul(X, X), Mul(Y, Y)), Mul(Z, Z)));
+      Store(mass + k, SelectBothPositive(M2, M2, Sqrt(M2), Zero));
+   }
+#endif
+   for(; k < n; k++)
+   {
+      const int i = first[k], j = second[k];
+      const double X = px[i] + px[j];
+      const double Y = py[i] + py[j];
+      const double Z = pz[i] + pz[j];
+      const double E = e[i] + e[j];
+      const double M2 = E * E - (X * X + Y * Y + Z * Z);
+      mass[k] = (M2 > 0) ? std::sqrt(M2) : 0;
+   }
+}
+}
+
+#ifdef KINEMATICS_BATCH_POP_OPTIONS
+#pragma GCC pop_options
+#undef KINEMATICS_BATCH_POP_OPTIONS
+#endif
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef PARALLEL_PROCESSOR_H
+#define PARALLEL_PROCESSOR_H
+
+// Entry-range parallel event loop over StrangenessTreeMessenger
+//
+// The entry range is cut into one contiguous block per thread.  Every thread owns its own
+// messenger (own TFile/TChain, own buffers) and its own worker object holding the outputs.
+// At the end the workers are merged into worker 0 in thread order, so the result does not
+// depend on scheduling.  With one thread everything runs in the calling thread.
+//
+// The worker class needs
+//    void ProcessEntry(StrangenessTreeMessenger &M, long long iEntry);   // M is already loaded
+//    void Merge(const Worker &other);                                    // fold other into *this
+//
+// Usage:
+//    ParallelProcessor<MyWorker> Processor(InputFileName, "Tree", Threads);
+//    Processor.SetConfigure([](StrangenessTreeMessenger &M) { M.SetBranchGroups("Event,Reco"); });
+//    MyWorker &Result = Processor.Run([](int thread) { return new MyWorker(thread); });
+//
+// Workers are created in the calling thread before any thread starts; histograms inside
+// them should not be attached to a directory (TH1::AddDirectory(false) or SetDirectory(nullptr)).
+//
+// Run() throws std::runtime_error when the input cannot be opened (check Open() or IsOpen()
+// first to handle it without an exception); an exception thrown inside a worker is rethrown
+// from Run() after all threads have joined.
+//
+// Processor.SetBlockSize(4096, Fold) switches to a fixed-block schedule for reductions that have
+// to come out bit-identical for any thread count (floating point sums): the entry range is cut
+// into blocks of that many entries, independent of the thread count, and dealt round-robin to the
+// threads; after finishing a block a thread waits for its turn and calls Fold(worker, block), so
+// Fold runs once per block, in block order, one call at a time.  The worker typically adds its
+// per-block partial sums into a shared total there and clears them.
+//
+// Processor.SetProgress(&std::cout) draws one combined progress bar for all threads from a
+// separate reporter thread (see ProgressMonitor.h); the event loops only bump a per-thread counter.
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TROOT.h"
+
+#include "StrangenessMessenger.h"
+#include "ProgressMonitor.h"
+
+template <class Worker>
+class ParallelProcessor
+{
+public:
+   typedef std::function<StrangenessTreeMessenger *()> MessengerFactory;
+   typedef std::function<Worker *(int)> WorkerFactory;
+   typedef std::function<void(StrangenessTreeMessenger &)> Configuration;
+   typedef std::function<void(Worker &, long long)> BlockFold;
+private:
+   // Hands the blocks to Fold in order in the fixed-block schedule
+   struct BlockSequence
+   {
+      std::mutex Mutex;
+      std::condition_variable Turn;
+      long long Next;
+      bool Abort;
+      BlockSequence() : Next(0), Abort(false) {}
+   };
+   MessengerFactory NewMessenger;
+   Configuration Configure;
+   int ThreadCount;
+   std::vector<std::unique_ptr<StrangenessTreeMessenger>> Messengers;
+   std::vector<std::unique_ptr<Worker>> Workers;
+   std::vector<long long> Processed;
+   std::ostream *ProgressOut;
+   double ProgressInterval;
+   long long BlockSize;
+   BlockFold Fold;
+public:
+   ParallelProcessor(const std::string &inputs, const std::string &treeName = "Tree", int threads = 0);
+   ParallelProcessor(MessengerFactory factory, int threads = 0);
+   ~ParallelProcessor() {}
+   void SetConfigure(Configuration configure) {Configure = configure;}
+   void SetProgress(std::ostream *out, double interval = 0.5) {ProgressOut = out; ProgressInterval = interval;}
+   void SetBlockSize(long long size, BlockFold fold) {BlockSize = size; Fold = fold;}
+   bool Open();   // opens and configures one messenger per thread; Run calls it if needed
+   bool IsOpen() const {return (int)Messengers.size() == ThreadCount;}
+   Worker &Run(WorkerFactory factory, double fraction = 1);
+   Worker &Run(WorkerFactory factory, long long begin, long long end);
+public:
+   int GetThreadCount() const {return ThreadCount;}
+   long long GetEntries();
+   long long GetProcessed(int thread) const {return Processed[thread];}
+   StrangenessTreeMessenger &GetMessenger(int thread) {return *Messengers[thread];}
+   Worker &GetWorker(int thread) {return *Workers[thread];}
+private:
+   void SetThreadCount(int threads);
+   static void ProcessRange(StrangenessTreeMessenger &M, Worker &W, long long begin, long long end,
+      long long &processed, std::exception_ptr &error, ProgressMonitor *monitor, int slot);
+   static void ProcessBlocks(StrangenessTreeMessenger &M, Worker &W, long long begin, long long end,
+      long long blockSize, int thread, int threadCount, const BlockFold &fold, BlockSequence &sequence,
+      long long &processed, std::exception_ptr &error, ProgressMonitor *monitor);
+};
+
+template <class Worker>
+ParallelProcessor<Worker>::ParallelProcessor(const std::string &inputs, const std::string &treeName, int threads)
+   : ProgressOut(nullptr), ProgressInterval(0.5), BlockSize(0)
+{
+   SetThreadCount(threads);
+
+   // Split the usual cache budget over the threads instead of giving each one the full size
+   long long CacheSize = STRANGE_DEFAULT_CACHE / ThreadCount;
+   if(CacheSize < 8 * 1024 * 1024)
+      CacheSize = 8 * 1024 * 1024;
+
+   NewMessenger = [inputs, treeName, CacheSize]()
+   {
+      StrangenessTreeMessenger *M = new StrangenessTreeMessenger(inputs, treeName, CacheSize);
+      M->SetBufferMode(StrangenessTreeMessenger::BufferDynamic);
+      return M;
+   };
+}
+
+template <class Worker>
+ParallelProcessor<Worker>::ParallelProcessor(MessengerFactory factory, int threads)
+   : NewMessenger(factory), ProgressOut(nullptr), ProgressInterval(0.5), BlockSize(0)
+{
+   SetThreadCount(threads);
+}
+
+template <class Worker>
+void ParallelProcessor<Worker>::SetThreadCount(int threads)
+{
+   ThreadCount = threads;
+   if(ThreadCount <= 0)
+      ThreadCount = std::thread::hardware_concurrency();
+   if(ThreadCount <= 0)
+      ThreadCount = 1;
+
+   if(ThreadCount > 1)
+      ROOT::EnableThreadSafety();
+}
+
+template <class Worker>
+bool ParallelProcessor<Worker>::Open()
+{
+   // Opened serially in the calling thread; only the event loops run concurrently
+   while((int)Messengers.size() < ThreadCount)
+   {
+      Messengers.emplace_back(NewMessenger());
+      if(Messengers.back() == nullptr || Messengers.back()->Tree == nullptr)
+      {
+         std::cerr << "[ParallelProcessor] Failed to open input for thread " << Messengers.size() - 1 << std::endl;
+         Messengers.pop_back();
+         return false;
+      }
+      if(Configure)
+         Configure(*Messengers.back());
+   }
+   return true;
+}
+
+template <class Worker>
+long long ParallelProcessor<Worker>::GetEntries()
+{
+   if(Open() == false)
+      return 0;
+   return Messengers[0]->GetEntries();
+}
+
+template <class Worker>
+Worker &ParallelProcessor<Worker>::Run(WorkerFactory factory, double fraction)
+{
+   long long EntryCount = GetEntries() * fraction;
+   return Run(factory, 0, EntryCount);
+}
+
+template <class Worker>
+Worker &ParallelProcessor<Worker>::Run(WorkerFactory factory, long long begin, long long end)
+{
+   if(Open() == false)
+      throw std::runtime_error("[ParallelProcessor] Cannot open the input");
+
+   Workers.clear();
+   for(int i = 0; i < ThreadCount; i++)
+      Workers.emplace_back(factory(i));
+   Processed.assign(ThreadCount, 0);
+
+   if(begin < 0)
+      begin = 0;
+   if(end > Messengers[0]->GetEntries())
+      end = Messengers[0]->GetEntries();
+   if(end < begin)
+      end = begin;
+
+   // Contiguous blocks, first (Total % ThreadCount) blocks one entry longer
+   long long Total = end - begin;
+   std::vector<long long> Edges(ThreadCount + 1, begin);
+   for(int i = 0; i < ThreadCount; i++)
+      Edges[i+1] = Edges[i] + Total / ThreadCount + ((i < Total % ThreadCount) ? 1 : 0);
+
+   std::vector<std::exception_ptr> Errors(ThreadCount);
+
+   std::unique_ptr<ProgressMonitor> Monitor;
+   if(ProgressOut != nullptr)
+   {
+      Monitor.reset(new ProgressMonitor(*ProgressOut, Total, ThreadCount, ProgressInterval));
+      Monitor->GetBar().SetShowRate(true);
+      Monitor->Start();
+   }
+
+   if(BlockSize > 0)
+   {
+      BlockSequence Sequence;
+      std::vector<std::thread> Threads;
+      for(int i = 1; i < ThreadCount; i++)
+         Threads.emplace_back(ProcessBlocks, std::ref(*Messengers[i]), std::ref(*Workers[i]), begin, end,
+            BlockSize, i, ThreadCount, std::cref(Fold), std::ref(Sequence), std::ref(Processed[i]),
+            std::ref(Errors[i]), Monitor.get());
+      ProcessBlocks(*Messengers[0], *Workers[0], begin, end, BlockSize, 0, ThreadCount, Fold, Sequence,
+         Processed[0], Errors[0], Monitor.get());
+      for(std::thread &T : Threads)
+         T.join();
+   }
+   else if(ThreadCount == 1)
+      ProcessRange(*Messengers[0], *Workers[0], Edges[0], Edges[1], Processed[0], Errors[0], Monitor.get(), 0);
+   else
+   {
+      std::vector<std::thread> Threads;
+      for(int i = 0; i < ThreadCount; i++)
+         Threads.emplace_back(ProcessRange, std::ref(*Messengers[i]), std::ref(*Workers[i]),
+            Edges[i], Edges[i+1], std::ref(Processed[i]), std::ref(Errors[i]), Monitor.get(), i);
+      for(std::thread &T : Threads)
+         T.join();
+   }
+
+   if(Monitor != nullptr)
+      Monitor->Stop();
+
+   for(int i = 0; i < ThreadCount; i++)
+      if(Errors[i])
+         std::rethrow_exception(Errors[i]);
+
+   // Fixed merge order: 0 <- 1 <- 2 <- ...
+   for(int i = 1; i < ThreadCount; i++)
+      Workers[0]->Merge(*Workers[i]);
+
+   return *Workers[0];
+}
+
+template <class Worker>
+void ParallelProcessor<Worker>::ProcessRange(StrangenessTreeMessenger &M, Worker &W, long long begin, long long end,
+   long long &processed, std::exception_ptr &error, ProgressMonitor *monitor, int slot)
+{
+   try
+   {
+      for(long long iE = begin; iE < end; iE++)
+      {
+         if(monitor != nullptr)
+            monitor->Set(slot, iE - begin + 1);
+         if(M.GetEntry(iE) == false)
+            continue;
+         W.ProcessEntry(M, iE);
+         processed = processed + 1;
+      }
+   }
+   catch(...)
+   {
+      error = std::current_exception();
+   }
+}
+
+template <class Worker>
+void ParallelProcessor<Worker>::ProcessBlocks(StrangenessTreeMessenger &M, Worker &W, long long begin, long long end,
+   long long blockSize, int thread, int threadCount, const BlockFold &fold, BlockSequence &sequence,
+   long long &processed, std::exception_ptr &error, ProgressMonitor *monitor)
+{
+   try
+   {
+      long long Count = 0;
+      for(long long B = thread; begin + B * blockSize < end; B = B + threadCount)
+      {
+         long long First = begin + B * blockSize;
+         long long Last = std::min(end, First + blockSize);
+         for(long long iE = First; iE < Last; iE++)
+         {
+            Count = Count + 1;
+            if(monitor != nullptr)
+               monitor->Set(thread, Count);
+            if(M.GetEntry(iE) == false)
+               continue;
+            W.ProcessEntry(M, iE);
+            processed = processed + 1;
+         }
+
+         std::unique_lock<std::mutex> Lock(sequence.Mutex);
+         sequence.Turn.wait(Lock, [&sequence, B]() {return sequence.Next == B || sequence.Abort;});
+         if(sequence.Abort == true)
+            return;
+         if(fold)
+            fold(W, B);
+         sequence.Next = B + 1;
+         sequence.Turn.notify_all();
+      }
+   }
+   catch(...)
+   {
+      error = std::current_exception();
+      std::lock_guard<std::mutex> Lock(sequence.Mutex);
+      sequence.Abort = true;
+      sequence.Turn.notify_all();
+   }
+}
+
+#endif
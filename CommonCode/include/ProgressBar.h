@@ -1,10 +1,53 @@
 // Progress bar class
 // Author: Yi Chen
+//
+// Optional throughput display (SetShowRate): events/s, MB/s from a byte counter, ETA and peak RSS, eg.
+//    Bar.SetShowRate(true);
+//    Bar.SetByteCounter([]() {return (double)TFile::GetFileBytesRead();});   // compressed bytes read
+// StageTimer splits the wall time of an event loop into named stages; WriteSummary writes the
+// totals as JSON (file name ending in .json) or as one CSV line with header; the label and the
+// stage names are escaped for either format.
+// For loops running in several threads use ProgressMonitor (ProgressMonitor.h) instead.
+
+#ifndef PROGRESS_BAR_H
+#define PROGRESS_BAR_H
 
 #include <iostream>
 #include <iomanip>
 #include <ostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
 #include <cstdlib>
+#include <sys/resource.h>
+
+class StageTimer
+{
+private:
+   typedef std::chrono::steady_clock Clock;
+   std::vector<std::string> Names;
+   std::vector<double> Seconds;
+   std::vector<long long> Calls;
+   int Current;
+   Clock::time_point CurrentStart;
+public:
+   StageTimer() : Current(-1) {}
+   ~StageTimer() {}
+   int Register(std::string Name);   // returns the stage index; registering twice returns the same index
+   void Switch(int Stage);           // stops the running stage (if any) and starts this one
+   void Stop();
+   void Reset();
+   void Add(const StageTimer &other);   // adds the accumulated times of stages with the same name
+public:
+   int GetStageCount() const {return Names.size();}
+   std::string GetName(int Stage) const {return Names[Stage];}
+   double GetSeconds(int Stage) const {return Seconds[Stage];}
+   long long GetCalls(int Stage) const {return Calls[Stage];}
+   double GetTotalSeconds() const;
+};
 
 class ProgressBar
 {
@@ -15,12 +58,22 @@ private:
    int Column;
    double Progress;
    int Style;
+   bool ShowRate;
+   std::chrono::steady_clock::time_point StartTime;
+   std::function<double()> ByteCounter;
+   double StartBytes;
+   StageTimer *Stages;
    void SanityCheck();
+   void PrintRate(double progress);
+   static std::string JSONString(const std::string &Text);   // quoted, with " \ and control characters escaped
+   static std::string CSVField(const std::string &Text, bool Quote = false);   // quoted, " as "", if Quote or needed
 public:
    ProgressBar(std::ostream &out, double max = 100, double min = 0, int column = 80)
-      : Out(&out), Max(max), Min(min), Column(column), Progress(0), Style(0) {SanityCheck();}
+      : Out(&out), Max(max), Min(min), Column(column), Progress(0), Style(0), ShowRate(false),
+        StartTime(std::chrono::steady_clock::now()), StartBytes(0), Stages(nullptr) {SanityCheck();}
    ProgressBar(std::ostream *out, double max = 100, double min = 0, int column = 80)
-      : Out(out), Max(max), Min(min), Column(column), Progress(0), Style(0) {SanityCheck();}
+      : Out(out), Max(max), Min(min), Column(column), Progress(0), Style(0), ShowRate(false),
+        StartTime(std::chrono::steady_clock::now()), StartBytes(0), Stages(nullptr) {SanityCheck();}
    ~ProgressBar() {}
    void Print();
    void PrintWithMod(int Mod);
@@ -37,6 +90,12 @@ public:
    int GetStyle() {return Style;}
    std::ostream *GetStream() {return Out;}
    double GetPercentage() {return (Progress - Min) / (Max - Min);}
+   double GetElapsed();                         // seconds since construction or ResetTimer()
+   double GetRate();                            // (progress - min) per second
+   double GetETA();                             // seconds, -1 if unknown
+   double GetBytesRead();                       // from the byte counter since ResetTimer(), 0 without one
+   static double GetPeakRSS();                  // MB
+   bool WriteSummary(std::string FileName, std::string Label = "");
 public:
    void SetMin(double min) {Min = min;   SanityCheck();}
    void SetMax(double max) {Max = max;   SanityCheck();}
@@ -45,8 +104,67 @@ public:
    void SetStyle(int style) {if(style == -1) Style = rand() % 6; else Style = style;   SanityCheck();}
    void SetStream(std::ostream &out) {Out = &out;   SanityCheck();}
    void SetStream(std::ostream *out) {Out = out;   SanityCheck();}
+   void SetShowRate(bool show) {ShowRate = show;}
+   void SetByteCounter(std::function<double()> counter) {ByteCounter = counter; StartBytes = counter ? counter() : 0;}
+   void SetStageTimer(StageTimer *stages) {Stages = stages;}
+   void ResetTimer() {StartTime = std::chrono::steady_clock::now(); StartBytes = ByteCounter ? ByteCounter() : 0;}
 };
 
+int StageTimer::Register(std::string Name)
+{
+   for(int i = 0; i < (int)Names.size(); i++)
+      if(Names[i] == Name)
+         return i;
+   Names.push_back(Name);
+   Seconds.push_back(0);
+   Calls.push_back(0);
+   return Names.size() - 1;
+}
+
+void StageTimer::Switch(int Stage)
+{
+   Clock::time_point Now = Clock::now();
+   if(Current >= 0)
+      Seconds[Current] = Seconds[Current] + std::chrono::duration<double>(Now - CurrentStart).count();
+   Current = Stage;
+   CurrentStart = Now;
+   if(Current >= 0)
+      Calls[Current] = Calls[Current] + 1;
+}
+
+void StageTimer::Stop()
+{
+   Switch(-1);
+}
+
+void StageTimer::Reset()
+{
+   for(int i = 0; i < (int)Names.size(); i++)
+   {
+      Seconds[i] = 0;
+      Calls[i] = 0;
+   }
+   Current = -1;
+}
+
+void StageTimer::Add(const StageTimer &other)
+{
+   for(int i = 0; i < other.GetStageCount(); i++)
+   {
+      int Stage = Register(other.Names[i]);
+      Seconds[Stage] = Seconds[Stage] + other.Seconds[i];
+      Calls[Stage] = Calls[Stage] + other.Calls[i];
+   }
+}
+
+double StageTimer::GetTotalSeconds() const
+{
+   double Total = 0;
+   for(double S : Seconds)
+      Total = Total + S;
+   return Total;
+}
+
 void ProgressBar::SanityCheck()
 {
    if(Min == Max)
@@ -114,6 +232,149 @@ void ProgressBar::Print()
    Print(Progress);
 }
 
+double ProgressBar::GetElapsed()
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+}
+
+double ProgressBar::GetRate()
+{
+   double Elapsed = GetElapsed();
+   if(Elapsed <= 0)
+      return 0;
+   return (Progress - Min) / Elapsed;
+}
+
+double ProgressBar::GetETA()
+{
+   double Rate = GetRate();
+   if(Rate <= 0)
+      return -1;
+   return (Max - Progress) / Rate;
+}
+
+double ProgressBar::GetBytesRead()
+{
+   if(!ByteCounter)
+      return 0;
+   return ByteCounter() - StartBytes;
+}
+
+double ProgressBar::GetPeakRSS()
+{
+   struct rusage Usage;
+   if(getrusage(RUSAGE_SELF, &Usage) != 0)
+      return 0;
+   return Usage.ru_maxrss / 1024.0;   // kB on Linux
+}
+
+void ProgressBar::PrintRate(double progress)
+{
+   double Elapsed = GetElapsed();
+   if(Elapsed <= 0)
+      return;
+
+   double Rate = (progress - Min) / Elapsed;
+   *Out << "  " << std::fixed << std::setprecision(1);
+   if(Rate >= 1000)
+      *Out << Rate / 1000 << " kHz";
+   else
+      *Out << Rate << " Hz";
+   if(ByteCounter)
+      *Out << "  " << GetBytesRead() / 1024 / 1024 / Elapsed << " MB/s";
+   if(Rate > 0)
+   {
+      long long ETA = (long long)((Max - progress) / Rate + 0.5);
+      *Out << "  ETA " << ETA / 3600 << ":" << std::setw(2) << std::setfill('0') << ETA / 60 % 60
+         << ":" << std::setw(2) << std::setfill('0') << ETA % 60;
+   }
+   *Out << "  RSS " << std::setprecision(0) << GetPeakRSS() << " MB";
+   *Out << std::defaultfloat << std::setprecision(6) << std::setfill(' ') << "\033[K" << std::flush;
+}
+
+bool ProgressBar::WriteSummary(std::string FileName, std::string Label)
+{
+   std::ofstream File(FileName.c_str());
+   if(File.is_open() == false)
+   {
+      std::cerr << "[ProgressBar] Cannot write summary to " << FileName << std::endl;
+      return false;
+   }
+
+   double Elapsed = GetElapsed();
+   double Entries = Progress - Min;
+   double Bytes = GetBytesRead();
+   std::vector<std::string> Keys = {"label", "entries", "seconds", "entries_per_second", "bytes_read",
+      "mb_per_second", "peak_rss_mb"};
+   // Values[0] is the label, the only text value; the rest are numbers
+   std::vector<std::string> Values = {Label, std::to_string(Entries), std::to_string(Elapsed),
+      std::to_string(Elapsed > 0 ? Entries / Elapsed : 0), std::to_string(Bytes),
+      std::to_string(Elapsed > 0 ? Bytes / 1024 / 1024 / Elapsed : 0), std::to_string(GetPeakRSS())};
+   for(int i = 0; Stages != nullptr && i < Stages->GetStageCount(); i++)
+   {
+      Keys.push_back("stage_" + Stages->GetName(i) + "_seconds");
+      Values.push_back(std::to_string(Stages->GetSeconds(i)));
+      Keys.push_back("stage_" + Stages->GetName(i) + "_calls");
+      Values.push_back(std::to_string(Stages->GetCalls(i)));
+   }
+
+   bool JSON = (FileName.size() >= 5 && FileName.substr(FileName.size() - 5) == ".json");
+   if(JSON == true)
+   {
+      File << "{" << std::endl;
+      for(int i = 0; i < (int)Keys.size(); i++)
+         File << "   " << JSONString(Keys[i]) << ": " << ((i == 0) ? JSONString(Values[i]) : Values[i])
+            << ((i + 1 < (int)Keys.size()) ? "," : "") << std::endl;
+      File << "}" << std::endl;
+   }
+   else
+   {
+      for(int i = 0; i < (int)Keys.size(); i++)
+         File << CSVField(Keys[i]) << ((i + 1 < (int)Keys.size()) ? "," : "\n");
+      for(int i = 0; i < (int)Values.size(); i++)
+         File << ((i == 0) ? CSVField(Values[i], true) : Values[i])
+            << ((i + 1 < (int)Values.size()) ? "," : "\n");
+   }
+
+   return true;
+}
+
+std::string ProgressBar::JSONString(const std::string &Text)
+{
+   std::ostringstream Result;
+   Result << "\"";
+   for(char c : Text)
+   {
+      if(c == '"' || c == '\\')
+         Result << "\\" << c;
+      else if(c == '\n')
+         Result << "\\n";
+      else if(c == '\t')
+         Result << "\\t";
+      else if((unsigned char)c < 0x20)
+         Result << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+      else
+         Result << c;
+   }
+   Result << "\"";
+   return Result.str();
+}
+
+std::string ProgressBar::CSVField(const std::string &Text, bool Quote)
+{
+   if(Quote == false && Text.find_first_of(",\"\r\n") == std::string::npos)
+      return Text;
+   std::string Result = "\"";
+   for(char c : Text)
+   {
+      if(c == '"')
+         Result = Result + "\"\"";
+      else
+         Result = Result + c;
+   }
+   return Result + "\"";
+}
+
 void ProgressBar::PrintWithMod(int Mod)
 {
    if((int)Progress % Mod == 0)
@@ -232,10 +493,9 @@ void ProgressBar::Print(double progress)
    }
    if(Style == 7)
       *Out << "\033[1GCurrent progress: " << progress - Min << std::flush;
-}
-
-
-
-
 
+   if(ShowRate == true)
+      PrintRate(progress);
+}
 
+#endif
@@ -0,0 +1,114 @@
+#ifndef PROGRESS_MONITOR_H
+#define PROGRESS_MONITOR_H
+
+// Progress of a loop shared by several threads
+//
+// Every worker owns one slot and only bumps its own atomic counter (relaxed, on its own cache
+// line), so there is no lock and no output on the hot path.  A single reporter thread sums the
+// slots at a fixed interval and draws the combined ProgressBar.
+//
+// Usage:
+//    ProgressMonitor Monitor(std::cout, TotalEntries, ThreadCount);
+//    Monitor.GetBar().SetShowRate(true);
+//    Monitor.Start();
+//    ... in thread i:   Monitor.Add(i);   (or Monitor.Set(i, DoneSoFar))
+//    Monitor.Stop();    // final 100% line; also done by the destructor
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ProgressBar.h"
+
+class ProgressMonitor
+{
+private:
+   struct alignas(64) Slot
+   {
+      std::atomic<long long> Count;
+      Slot() : Count(0) {}
+   };
+private:
+   ProgressBar Bar;
+   std::vector<Slot> Slots;
+   double Interval;
+   std::thread Reporter;
+   std::mutex WakeMutex;
+   std::condition_variable Wake;
+   bool Running;
+public:
+   ProgressMonitor(std::ostream &out, long long total, int slots, double interval = 0.5);
+   ~ProgressMonitor() {Stop();}
+   ProgressBar &GetBar() {return Bar;}
+   void Start();
+   void Stop();
+   void Add(int slot, long long count = 1) {Slots[slot].Count.fetch_add(count, std::memory_order_relaxed);}
+   void Set(int slot, long long count) {Slots[slot].Count.store(count, std::memory_order_relaxed);}
+   long long GetCount() const;
+   int GetSlotCount() const {return Slots.size();}
+private:
+   void Report();
+};
+
+inline ProgressMonitor::ProgressMonitor(std::ostream &out, long long total, int slots, double interval)
+   : Bar(out, total), Slots(slots > 0 ? slots : 1), Interval(interval), Running(false)
+{
+   if(Interval <= 0)
+      Interval = 0.5;
+   Bar.SetStyle(1);
+}
+
+inline long long ProgressMonitor::GetCount() const
+{
+   long long Total = 0;
+   for(const Slot &S : Slots)
+      Total = Total + S.Count.load(std::memory_order_relaxed);
+   return Total;
+}
+
+inline void ProgressMonitor::Start()
+{
+   if(Running == true)
+      return;
+
+   for(Slot &S : Slots)
+      S.Count.store(0, std::memory_order_relaxed);
+   Bar.ResetTimer();
+   Running = true;
+   Reporter = std::thread(&ProgressMonitor::Report, this);
+}
+
+inline void ProgressMonitor::Stop()
+{
+   if(Running == false)
+      return;
+
+   {
+      std::lock_guard<std::mutex> Lock(WakeMutex);
+      Running = false;
+   }
+   Wake.notify_all();
+   Reporter.join();
+
+   Bar.Update(GetCount());
+   Bar.Print();
+   Bar.PrintLine();
+}
+
+inline void ProgressMonitor::Report()
+{
+   std::chrono::duration<double> Period(Interval);
+   std::unique_lock<std::mutex> Lock(WakeMutex);
+   while(Running == true)
+   {
+      Bar.Update(GetCount());
+      Bar.Print();
+      Wake.wait_for(Lock, Period, [this]() {return Running == false;});
+   }
+}
+
+#endif
@@ -2,9 +2,14 @@
 #define STRANGENESS_MESSENGER_H
 
 #include <string>
+#include <vector>
 #include "TTree.h"
 #include "TFile.h"
 
+#include "EventSummary.h"
+
+class TChain;
+
 // These are generous upper bounds; adjust if you learn better maxima from the file
 #define STRANGE_MAX_GEN     10000
 #define STRANGE_MAX_RECO    10000
@@ -12,8 +17,120 @@
 #define STRANGE_MAX_KSHORT  4096
 #define STRANGE_MAX_PHI     4096
 
+// Starting capacity of every array in BufferDynamic mode; grows on demand
+#define STRANGE_DYNAMIC_INITIAL  64
+
+// TTreeCache size used when the messenger builds its own TChain from an input list
+#define STRANGE_DEFAULT_CACHE    (64LL * 1024 * 1024)
+
+// Compact trees may store the five RecoPID* tags in one RecoPIDPacked[NReco]/s branch,
+// STRANGE_PID_PACK_BITS bits each, as (tag + 1) in the order of PackedPIDBranches()
+#define STRANGE_PID_PACK_BITS    3
+
+// Mass hypotheses for the track cache energies (GeV)
+#define STRANGE_MASS_PION    0.13957039
+#define STRANGE_MASS_KAON    0.493677
+#define STRANGE_MASS_PROTON  0.93827208816
+
 class StrangenessTreeMessenger
 {
+   friend class StrangenessTreeWriter;   // walks the branch table to mirror the layout
+
+public:
+   // Branch groups for selective reading.  Combine with |, e.g.
+   //    M.SetBranchGroups(StrangenessTreeMessenger::GroupEventScalars | StrangenessTreeMessenger::GroupRecoKinematics);
+   // Counter branches (NReco, NGen, ...) are switched on automatically with their arrays.
+   enum BranchGroup
+   {
+      GroupNone           = 0,
+      GroupEventScalars   = 1 << 0,
+      GroupRecoKinematics = 1 << 1,
+      GroupRecoPID        = 1 << 2,
+      GroupRecoEfficiency = 1 << 3,
+      GroupGen            = 1 << 4,
+      GroupSim            = 1 << 5,
+      GroupKShort         = 1 << 6,
+      GroupPhi            = 1 << 7,
+      GroupAll            = (1 << 8) - 1
+   };
+
+   // Array storage.  Both modes keep the arrays on the heap (64-byte aligned) and check the
+   // counter branches before each read, growing the arrays if an event would not fit.
+   //    BufferFixed:   arrays start at STRANGE_MAX_* (default, same footprint as before)
+   //    BufferDynamic: arrays start at STRANGE_DYNAMIC_INITIAL and follow the largest event seen
+   // Array pointers may change inside GetEntry, so do not cache them across entries.
+   enum BufferMode
+   {
+      BufferFixed,
+      BufferDynamic
+   };
+
+   // Derived quantities of the Reco arrays, one array per field, filled on the first
+   // GetTrackCache() after each GetEntry and reused until the next one.  The expressions are
+   // those of Kinematics.h (eg. sqrt(px*px + py*py + pz*pz + m*m)), so the values agree bit for
+   // bit with the per-track helpers.  Undefined values (pt == 0, p == 0, no thrust axis) are left non-finite,
+   // so every cut on them fails.
+   enum TrackCacheField
+   {
+      CacheNone     = 0,
+      CacheP        = 1 << 0,   // sqrt(px^2 + py^2 + pz^2)
+      CachePt       = 1 << 1,   // sqrt(px^2 + py^2)
+      CacheEta      = 1 << 2,   // asinh(pz / pt)
+      CacheAbsCos   = 1 << 3,   // |pz| / p
+      CacheYThrust  = 1 << 4,   // rapidity along the thrust axis, from RecoE; NaN if undefined
+      CacheEnergies = 1 << 5,   // sqrt(p^2 + m^2) for STRANGE_MASS_PION/KAON/PROTON
+      CacheAll      = (1 << 6) - 1
+   };
+   struct TrackCache
+   {
+      long long N;   // = NReco
+      double   *P;
+      double   *Pt;
+      double   *Eta;
+      double   *AbsCos;
+      double   *YThrust;
+      double   *EPion;
+      double   *EKaon;
+      double   *EProton;
+   };
+
+private:
+   struct BranchRecord
+   {
+      std::string Name;
+      void       *Address;      // scalars only
+      void      **Buffer;       // arrays only: points at the member pointer (eg. &RecoPx)
+      size_t      ElementSize;
+      char        Type;         // ROOT leaf type code: 'D' or 'L'
+      char        StoredType;   // leaf type in the file; narrower types are read into Staging and widened
+      std::vector<long long> Staging;
+      int         PackShift;    // bit offset inside RecoPIDPacked, -1 if not a packed field
+      bool        Packed;       // filled from RecoPIDPacked instead of its own branch
+      int         Group;
+      std::string Counter;      // empty for scalars
+      bool        Present;      // branch exists in the attached tree (or can be unpacked)
+      bool        Active;
+   };
+   struct CounterRecord
+   {
+      std::string Name;
+      long long  *Value;
+      long long   Capacity;
+      long long   FixedCapacity;
+   };
+   std::vector<BranchRecord> Branches;
+   std::vector<CounterRecord> Counters;
+   BufferMode Mode;
+   TChain    *Chain;       // owned, only when constructed from an input list
+   long long  CacheSize;
+   long long *RecoPIDPacked;   // compact trees only, see STRANGE_PID_PACK_BITS
+   TChain    *SummaryChain;    // owned, friend of Tree once AttachSummary succeeds
+   int        CacheFields;
+   long long  CacheCapacity;
+   long long  CacheEntry;      // entry the track cache was filled for, -1 if stale
+   long long  CurrentEntry;    // last entry read successfully, -1 if none
+   TrackCache Cache;
+
 public:
    TTree *Tree;
 
@@ -39,109 +156,178 @@ public:
 
    // Generator-level (truth) particles
    long long  NGen;
-   double     GenPx[STRANGE_MAX_GEN];
-   double     GenPy[STRANGE_MAX_GEN];
-   double     GenPz[STRANGE_MAX_GEN];
-   double     GenE[STRANGE_MAX_GEN];
-   double     GenM[STRANGE_MAX_GEN];
-   long long  GenID[STRANGE_MAX_GEN];
-   long long  GenStatus[STRANGE_MAX_GEN];
-   long long  GenParent[STRANGE_MAX_GEN];
-   long long  GenMatchIndex[STRANGE_MAX_GEN];
-   double     GenMatchAngle[STRANGE_MAX_GEN];
+   double    *GenPx;
+   double    *GenPy;
+   double    *GenPz;
+   double    *GenE;
+   double    *GenM;
+   long long *GenID;
+   long long *GenStatus;
+   long long *GenParent;
+   long long *GenMatchIndex;
+   double    *GenMatchAngle;
 
    // Reconstructed particles
    long long  NReco;
-   double     RecoPx[STRANGE_MAX_RECO];
-   double     RecoPy[STRANGE_MAX_RECO];
-   double     RecoPz[STRANGE_MAX_RECO];
-   double     RecoE[STRANGE_MAX_RECO];
-   double     RecoCharge[STRANGE_MAX_RECO];
-   long long  RecoID[STRANGE_MAX_RECO];
-   double     RecoTrackLength[STRANGE_MAX_RECO];
-   double     RecoTrackD0[STRANGE_MAX_RECO];
-   double     RecoTrackZ0[STRANGE_MAX_RECO];
-   long long  RecoPIDElectron[STRANGE_MAX_RECO];
-   long long  RecoPIDProton[STRANGE_MAX_RECO];
-   long long  RecoPIDKaon[STRANGE_MAX_RECO];
-   long long  RecoPIDPion[STRANGE_MAX_RECO];
-   long long  RecoPIDHeavy[STRANGE_MAX_RECO];
-   double     RecoPIDQProton[STRANGE_MAX_RECO];
-   double     RecoPIDQKaon[STRANGE_MAX_RECO];
-   long long  RecoMuID[STRANGE_MAX_RECO];
-   long long  RecoEleID[STRANGE_MAX_RECO];
-   long long  RecoConversionID[STRANGE_MAX_RECO];
-   long long  RecoGoodTrack[STRANGE_MAX_RECO];
-   long long  RecoGoodNeutral[STRANGE_MAX_RECO];
-   double     RecoGenEfficiencyK[STRANGE_MAX_RECO];
-   double     RecoGenEfficiencyPi[STRANGE_MAX_RECO];
-   double     RecoGenEfficiencyP[STRANGE_MAX_RECO];
-   double     RecoEfficiencyK[STRANGE_MAX_RECO];
-   double     RecoEfficiencyPi[STRANGE_MAX_RECO];
-   double     RecoEfficiencyP[STRANGE_MAX_RECO];
-   double     RecoEfficiencyKAsK[STRANGE_MAX_RECO];
-   double     RecoEfficiencyKAsPi[STRANGE_MAX_RECO];
-   double     RecoEfficiencyKAsP[STRANGE_MAX_RECO];
-   double     RecoEfficiencyPiAsK[STRANGE_MAX_RECO];
-   double     RecoEfficiencyPiAsPi[STRANGE_MAX_RECO];
-   double     RecoEfficiencyPiAsP[STRANGE_MAX_RECO];
-   double     RecoEfficiencyPAsK[STRANGE_MAX_RECO];
-   double     RecoEfficiencyPAsPi[STRANGE_MAX_RECO];
-   double     RecoEfficiencyPAsP[STRANGE_MAX_RECO];
+   double    *RecoPx;
+   double    *RecoPy;
+   double    *RecoPz;
+   double    *RecoE;
+   double    *RecoCharge;
+   long long *RecoID;
+   double    *RecoTrackLength;
+   double    *RecoTrackD0;
+   double    *RecoTrackZ0;
+   long long *RecoPIDElectron;
+   long long *RecoPIDProton;
+   long long *RecoPIDKaon;
+   long long *RecoPIDPion;
+   long long *RecoPIDHeavy;
+   double    *RecoPIDQProton;
+   double    *RecoPIDQKaon;
+   long long *RecoMuID;
+   long long *RecoEleID;
+   long long *RecoConversionID;
+   long long *RecoGoodTrack;
+   long long *RecoGoodNeutral;
+   double    *RecoGenEfficiencyK;
+   double    *RecoGenEfficiencyPi;
+   double    *RecoGenEfficiencyP;
+   double    *RecoEfficiencyK;
+   double    *RecoEfficiencyPi;
+   double    *RecoEfficiencyP;
+   double    *RecoEfficiencyKAsK;
+   double    *RecoEfficiencyKAsPi;
+   double    *RecoEfficiencyKAsP;
+   double    *RecoEfficiencyPiAsK;
+   double    *RecoEfficiencyPiAsPi;
+   double    *RecoEfficiencyPiAsP;
+   double    *RecoEfficiencyPAsK;
+   double    *RecoEfficiencyPAsPi;
+   double    *RecoEfficiencyPAsP;
 
    // Simulation-level particles
    long long  NSim;
-   double     SimPx[STRANGE_MAX_SIM];
-   double     SimPy[STRANGE_MAX_SIM];
-   double     SimPz[STRANGE_MAX_SIM];
-   double     SimE[STRANGE_MAX_SIM];
-   long long  SimID[STRANGE_MAX_SIM];
+   double    *SimPx;
+   double    *SimPy;
+   double    *SimPz;
+   double    *SimE;
+   long long *SimID;
 
    // K0S candidates
    long long  NKShort;
-   double     KShortPx[STRANGE_MAX_KSHORT];
-   double     KShortPy[STRANGE_MAX_KSHORT];
-   double     KShortPz[STRANGE_MAX_KSHORT];
-   double     KShortE[STRANGE_MAX_KSHORT];
-   long long  KShortSim1ID[STRANGE_MAX_KSHORT];
-   long long  KShortSim2ID[STRANGE_MAX_KSHORT];
-   long long  KShortReco1ID[STRANGE_MAX_KSHORT];
-   long long  KShortReco2ID[STRANGE_MAX_KSHORT];
-   double     KShortReco1Angle[STRANGE_MAX_KSHORT];
-   double     KShortReco2Angle[STRANGE_MAX_KSHORT];
-   double     KShortRecoPx[STRANGE_MAX_KSHORT];
-   double     KShortRecoPy[STRANGE_MAX_KSHORT];
-   double     KShortRecoPz[STRANGE_MAX_KSHORT];
-   double     KShortRecoE[STRANGE_MAX_KSHORT];
+   double    *KShortPx;
+   double    *KShortPy;
+   double    *KShortPz;
+   double    *KShortE;
+   long long *KShortSim1ID;
+   long long *KShortSim2ID;
+   long long *KShortReco1ID;
+   long long *KShortReco2ID;
+   double    *KShortReco1Angle;
+   double    *KShortReco2Angle;
+   double    *KShortRecoPx;
+   double    *KShortRecoPy;
+   double    *KShortRecoPz;
+   double    *KShortRecoE;
 
    // Phi meson candidates
    long long  NPhi;
-   double     PhiPx[STRANGE_MAX_PHI];
-   double     PhiPy[STRANGE_MAX_PHI];
-   double     PhiPz[STRANGE_MAX_PHI];
-   double     PhiE[STRANGE_MAX_PHI];
-   long long  PhiGen1ID[STRANGE_MAX_PHI];
-   long long  PhiGen2ID[STRANGE_MAX_PHI];
-   long long  PhiReco1ID[STRANGE_MAX_PHI];
-   long long  PhiReco2ID[STRANGE_MAX_PHI];
-   double     PhiReco1Angle[STRANGE_MAX_PHI];
-   double     PhiReco2Angle[STRANGE_MAX_PHI];
-   double     PhiRecoPx[STRANGE_MAX_PHI];
-   double     PhiRecoPy[STRANGE_MAX_PHI];
-   double     PhiRecoPz[STRANGE_MAX_PHI];
-   double     PhiRecoE[STRANGE_MAX_PHI];
+   double    *PhiPx;
+   double    *PhiPy;
+   double    *PhiPz;
+   double    *PhiE;
+   long long *PhiGen1ID;
+   long long *PhiGen2ID;
+   long long *PhiReco1ID;
+   long long *PhiReco2ID;
+   double    *PhiReco1Angle;
+   double    *PhiReco2Angle;
+   double    *PhiRecoPx;
+   double    *PhiRecoPy;
+   double    *PhiRecoPz;
+   double    *PhiRecoE;
+
+   // Derived per-event quantities from an attached EventSummary friend tree, see EventSummary.h
+   EventSummary Summary;
 
 public:
    StrangenessTreeMessenger();
    StrangenessTreeMessenger(TFile &file, const std::string &treeName = "Tree");
    StrangenessTreeMessenger(TFile *file, const std::string &treeName = "Tree");
    StrangenessTreeMessenger(TTree *tree);
+   // Input list: comma separated entries, each either a file, a wildcard (eg. "Samples/run_*.root",
+   // expanded by TChain::Add) or a .txt/.list file with one entry per line ('#' starts a comment)
+   StrangenessTreeMessenger(const std::string &inputs, const std::string &treeName = "Tree",
+      long long cacheSize = STRANGE_DEFAULT_CACHE);
+   ~StrangenessTreeMessenger();
+
+   // owns heap buffers and has the tree bound to them
+   StrangenessTreeMessenger(const StrangenessTreeMessenger &other) = delete;
+   StrangenessTreeMessenger &operator=(const StrangenessTreeMessenger &other) = delete;
 
    bool Initialize(TTree *tree);   // attach to given tree and set branch addresses
    bool Initialize();              // reuse existing Tree pointer
 
    bool       GetEntry(long long iEntry);
    long long  GetEntries() const;
+
+   // Selective reading: everything outside the requested groups is SetBranchStatus(0).
+   // Individual branches can be added on top with EnableBranch.
+   bool       SetBranchGroups(int groups);
+   bool       SetBranchGroups(const std::string &groups);   // e.g. "EventScalars,RecoKinematics"
+   bool       EnableBranch(const std::string &name);
+   bool       EnableBranches(const std::vector<std::string> &names);
+   bool       EnableOnlyBranches(const std::vector<std::string> &names);
+   void       EnableAllBranches();
+   bool       IsBranchActive(const std::string &name) const;
+   bool       HasBranch(const std::string &name) const;
+   std::vector<std::string> GetActiveBranches() const;
+
+   static int ParseBranchGroups(const std::string &groups);   // -1 on unknown group name
+
+   void       SetBufferMode(BufferMode mode);   // reallocates all arrays to the starting capacity
+   BufferMode GetBufferMode() const;
+   long long  GetCapacity(const std::string &counter) const;   // eg. GetCapacity("NReco")
+   size_t     GetBufferBytes() const;
+
+   // TTreeCache restricted to the active branches; refreshed whenever the active set changes.
+   // 0 leaves the cache alone.
+   void       SetCacheSize(long long bytes);
+   static std::vector<std::string> ExpandInputList(const std::string &inputs);
+
+   // Friend tree written by build_event_summary_friend, same input list syntax as above.  It
+   // must have exactly as many entries as Tree; its branches stay on whatever branch groups
+   // are selected, so SetBranchGroups(GroupNone) reads the summary alone.
+   bool       AttachSummary(const std::string &inputs, const std::string &treeName = EVENT_SUMMARY_TREE);
+   bool       HasSummary() const;
+
+   // Opt-in track cache, see TrackCacheField.  Switches on the branches the fields need, so call
+   // it after any EnableOnlyBranches / SetBranchGroups.  Fields not requested stay nullptr.
+   bool       EnableTrackCache(int fields = CacheAll);
+   const TrackCache &GetTrackCache();
+   static std::vector<std::string> PackedPIDBranches();
+
+private:
+   void       Setup();
+   void       BuildBranchTable();
+   template <class T>
+   void       AddBranch(const std::string &name, T *address, int group);
+   template <class T>
+   void       AddArray(const std::string &name, T *&buffer, int group, const std::string &counter);
+   void       AddCounter(const std::string &name, long long *value, long long fixedCapacity);
+   void       ResizeBuffers(CounterRecord &counter, long long capacity);
+   bool       ReserveForEntry(long long iEntry);
+   bool       MarkBranchActive(const std::string &name);
+   BranchRecord *FindBranch(const std::string &name);
+   void       BindBranch(BranchRecord &B);
+   bool       NeedsStaging(const BranchRecord &B) const;
+   void       WidenBranch(BranchRecord &B);
+   void       UnpackPID();
+   void       FillTrackCache();
+   static char LeafTypeCode(const std::string &typeName);
+   void       ApplyBranchStatus();
+   void       UpdateCacheBranches();
 };
 
 #endif
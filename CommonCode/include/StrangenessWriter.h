@@ -0,0 +1,131 @@
+#ifndef STRANGENESS_WRITER_H
+#define STRANGENESS_WRITER_H
+
+#include <string>
+#include <vector>
+#include "TTree.h"
+#include "TDirectory.h"
+
+#include "StrangenessMessenger.h"
+
+// Writes a slimmed copy of the events read through a StrangenessTreeMessenger, with the same
+// branch names and types, so the output can be read back with the messenger unchanged.
+//
+//    StrangenessTreeWriter W(&OutputFile, "Tree");
+//    W.SetBranchGroups(StrangenessTreeMessenger::GroupEventScalars | StrangenessTreeMessenger::GroupRecoKinematics);
+//    W.SetTrackFilter(StrangenessTreeWriter::FilterGoodTrack);
+//    W.Initialize(M);
+//    for(...) { M.GetEntry(i); if(M.PassAll != 1) continue; W.Fill(M); }
+//    W.Write();
+//
+// With a track filter the Reco arrays only keep the selected tracks.  Indices pointing into the
+// Reco arrays (GenMatchIndex, KShortReco1/2ID, PhiReco1/2ID) are renumbered; references to dropped
+// tracks become -1 and the corresponding match angle is set to STRANGE_WRITER_NO_MATCH.
+//
+// SetSchema selects a compact on-disk layout.  The messenger widens every narrow type back into
+// its double / long long arrays on read, so analysis code does not change.
+
+#define STRANGE_WRITER_NO_MATCH  999
+
+class StrangenessTreeWriter
+{
+public:
+   enum TrackFilter
+   {
+      FilterNone       = 0,
+      FilterGoodTrack  = 1 << 0,   // RecoGoodTrack == 1
+      FilterAcceptance = 1 << 1    // AbsCosMin <= |cos(theta)| <= AbsCosMax
+   };
+   enum Schema
+   {
+      SchemaFull      = 0,        // same types as the input
+      SchemaFloat     = 1 << 0,   // doubles as Float_t
+      SchemaTruncated = 1 << 1,   // doubles as Double32_t with MantissaBits bits (wins over SchemaFloat)
+      SchemaSmallInt  = 1 << 2,   // flags as Char_t/Short_t, counters, indices and IDs as Int_t
+      SchemaPackPID   = 1 << 3,   // RecoPID{Electron,Proton,Kaon,Pion,Heavy} in one RecoPIDPacked
+      SchemaCompact   = SchemaTruncated | SchemaSmallInt | SchemaPackPID
+   };
+
+private:
+   enum BranchRole
+   {
+      RoleCopy,          // copied as is
+      RoleRecoCounter,   // NReco, replaced by the number of kept tracks
+      RoleRecoArray,     // per-track array, compacted
+      RoleRecoIndex,     // index into the Reco arrays, renumbered
+      RoleMatchAngle,    // angle belonging to a RoleRecoIndex entry
+      RolePackedPID      // RecoPIDPacked, built from the five PID tag arrays
+   };
+   struct OutputBranch
+   {
+      std::string Name;
+      char        Type;        // in memory: 'D' or 'L'
+      char        StoredType;  // on disk
+      std::string Counter;
+      int         Role;
+      int         Partner;     // RoleRecoIndex: the matching angle branch (-1 if none)
+      void       *Source;      // messenger scalar
+      void      **SourceArray; // messenger array pointer
+      long long  *SourceCount; // messenger counter of the array
+      double      ScalarD;
+      long long   ScalarL;
+      std::vector<double>    ArrayD;
+      std::vector<long long> ArrayL;
+      std::vector<long long> Encoded;     // raw storage for narrow StoredType
+      long long   Count;                  // entries filled for this event
+      std::vector<void **>   PackSources; // RolePackedPID only
+   };
+
+   TDirectory *Directory;
+   std::string TreeName;
+   TTree      *Tree;
+   int         Groups;
+   int         Filter;
+   double      AbsCosMin;
+   double      AbsCosMax;
+   int         StorageSchema;      // as requested
+   int         EffectiveSchema;    // as written (PackPID dropped if a PID tag is not read)
+   std::vector<std::string> PackPIDMissing;
+   int         MantissaBits;
+   std::vector<OutputBranch> Branches;
+   std::vector<long long> RecoMap;   // old reco index -> new index or -1
+   std::vector<std::string> Provenance;
+   long long   EventsSeen;
+   long long   EventsWritten;
+   long long   TracksSeen;
+   long long   TracksWritten;
+   long long   Overflows;   // values clamped to fit a narrow type
+
+public:
+   StrangenessTreeWriter(TDirectory *directory, const std::string &treeName = "Tree");
+   ~StrangenessTreeWriter();
+
+   void       SetBranchGroups(int groups);
+   bool       SetBranchGroups(const std::string &groups);
+   void       SetTrackFilter(int filter);
+   void       SetAcceptance(double absCosMin, double absCosMax);
+   void       SetSchema(int schema, int mantissaBits = 16);
+   bool       SetSchema(const std::string &schema, int mantissaBits = 16);   // "Full", "Float", "Compact", ...
+   void       AddProvenance(const std::string &line);   // free text, one line each
+
+   bool       Initialize(StrangenessTreeMessenger &M);   // builds the output branches
+   bool       Fill(StrangenessTreeMessenger &M);         // copies the current event
+   void       CountSkipped(long long events = 1);        // events rejected by the caller
+   void       Write();                                   // tree + "SkimProvenance" record
+
+   TTree     *GetTree()            {return Tree;}
+   int        GetEffectiveSchema() const {return EffectiveSchema;}
+   long long  GetEventsWritten() const {return EventsWritten;}
+   long long  GetTracksWritten() const {return TracksWritten;}
+   std::string GetProvenance() const;
+
+private:
+   bool       KeepTrack(StrangenessTreeMessenger &M, long long i) const;
+   void       Reserve(OutputBranch &B, long long size);
+   void       BindBranch(OutputBranch &B);
+   void      *OutputAddress(OutputBranch &B);
+   char       StorageType(const std::string &name, char type) const;
+   void       Encode(OutputBranch &B);
+};
+
+#endif
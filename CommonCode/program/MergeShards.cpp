@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <glob.h>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+using namespace std;
+
+#include "TFile.h"
+#include "TKey.h"
+#include "TH1.h"
+#include "TNamed.h"
+#include "TParameter.h"
+#include "TTree.h"
+#include "TChain.h"
+
+#include "CommandLine.h"
+#include "EntryRange.h"
+#include "StrangenessMessenger.h"
+
+// Merges the outputs of one executable run with --Shard i/N (or --FirstEntry/--NEntries):
+//    MergeShards --Input "Output_shard*.root" --Output Output.root [--Strict false] [--AllowIncomplete false]
+//
+// Per object type, at every directory level:
+//    TH1 and derived       added (histograms listed in ShardDerived are recomputed as ratios afterwards)
+//    TParameter<long long>, TParameter<int>    summed
+//    TParameter<double>    must agree between shards (settings such as mass windows)
+//    TTree                 concatenated in shard order
+//    TNamed                identical lines kept; lines that differ become "shard0 | shard1 | ..."
+//                          (with --Strict true a difference is an error)
+//    ShardInfo             checked: same N and total, every shard present once
+//    ShardFinalize         kept, and printed: the step that turns the merged sums into results
+//                          (for outputs that are not additive, e.g. KtoPiAnalysis --Finalize)
+//    anything else         first copy kept, with a warning
+
+struct MergeSettings
+{
+   bool Strict;
+   vector<string> Files;
+};
+
+vector<string> ExpandFiles(const string &inputs);
+bool CheckShards(vector<TFile *> &files, vector<string> &names, bool allowIncomplete, string &summary);
+bool MergeDirectory(const vector<TDirectory *> &inputs, TDirectory *output, const string &path, const MergeSettings &settings);
+string ReconcileText(const vector<string> &texts, bool &differs);
+bool RecomputeDerived(TDirectory *output, const string &list);
+
+int main(int argc, char *argv[])
+{
+   CommandLine CL(argc, argv);
+
+   string Inputs          = CL.Get("Input");
+   string OutputFileName  = CL.Get("Output");
+   bool Strict            = CL.GetBool("Strict", false);
+   bool AllowIncomplete   = CL.GetBool("AllowIncomplete", false);
+
+   vector<string> FileNames = ExpandFiles(Inputs);
+   if(FileNames.size() == 0)
+   {
+      cerr << "No input files in \"" << Inputs << "\"" << endl;
+      return 1;
+   }
+
+   vector<TFile *> Files;
+   for(const string &Name : FileNames)
+   {
+      TFile *File = TFile::Open(Name.c_str(), "READ");
+      if(File == nullptr || File->IsZombie())
+      {
+         cerr << "Cannot open " << Name << endl;
+         return 1;
+      }
+      Files.push_back(File);
+   }
+
+   // Sorts the files into shard order, so that trees are concatenated in entry order
+   string ShardSummary;
+   if(CheckShards(Files, FileNames, AllowIncomplete, ShardSummary) == false)
+      return 1;
+
+   MergeSettings Settings;
+   Settings.Strict = Strict;
+   Settings.Files  = FileNames;
+
+   TFile OutputFile(OutputFileName.c_str(), "RECREATE");
+
+   vector<TDirectory *> Directories(Files.begin(), Files.end());
+   bool Success = MergeDirectory(Directories, &OutputFile, "", Settings);
+
+   OutputFile.cd();
+   TNamed("ShardInfo", ShardSummary.c_str()).Write();
+   OutputFile.Close();
+
+   for(TFile *File : Files)
+      File->Close();
+
+   if(Success == false)
+   {
+      cerr << "Merge failed, " << OutputFileName << " is incomplete" << endl;
+      return 1;
+   }
+
+   cout << "Merged " << FileNames.size() << " shards into " << OutputFileName << endl;
+   return 0;
+}
+
+vector<string> ExpandFiles(const string &inputs)
+{
+   vector<string> Result;
+   for(const string &Item : StrangenessTreeMessenger::ExpandInputList(inputs))
+   {
+      if(Item.find_first_of("*?[") == string::npos)
+      {
+         Result.push_back(Item);
+         continue;
+      }
+
+      glob_t Matches;
+      if(glob(Item.c_str(), 0, nullptr, &Matches) == 0)
+         for(size_t i = 0; i < Matches.gl_pathc; i++)
+            Result.push_back(Matches.gl_pathv[i]);
+      else
+         cerr << "Nothing matches \"" << Item << "\"" << endl;
+      globfree(&Matches);
+   }
+   return Result;
+}
+
+bool CheckShards(vector<TFile *> &files, vector<string> &names, bool allowIncomplete, string &summary)
+{
+   vector<EntryRange> Ranges;
+   for(int i = 0; i < (int)files.size(); i++)
+   {
+      TNamed *Info = nullptr;
+      files[i]->GetObject("ShardInfo", Info);
+      EntryRange Range(0);
+      if(Info == nullptr || EntryRange::ParseInfo(Info->GetTitle(), Range) == false)
+      {
+         cerr << names[i] << " has no ShardInfo record" << endl;
+         if(allowIncomplete == false)
+            return false;
+         Range = EntryRange(0, 1, 0, -1, i, (int)files.size());
+         Range.Valid = false;
+      }
+      Ranges.push_back(Range);
+   }
+
+   vector<int> Order(files.size());
+   for(int i = 0; i < (int)Order.size(); i++)
+      Order[i] = i;
+   stable_sort(Order.begin(), Order.end(), [&Ranges](int a, int b) {return Ranges[a].Begin < Ranges[b].Begin;});
+
+   vector<TFile *> SortedFiles;
+   vector<string> SortedNames;
+   vector<EntryRange> SortedRanges;
+   for(int i : Order)
+   {
+      SortedFiles.push_back(files[i]);
+      SortedNames.push_back(names[i]);
+      SortedRanges.push_back(Ranges[i]);
+   }
+   files = SortedFiles;
+   names = SortedNames;
+
+   // Shards must tile one range: same total, no gap, no overlap
+   bool Good = true;
+   set<int> Seen;
+   for(int i = 0; i < (int)SortedRanges.size(); i++)
+   {
+      const EntryRange &R = SortedRanges[i];
+      if(R.Valid == false)
+         continue;
+      if(R.Total != SortedRanges[0].Total || R.ShardCount != SortedRanges[0].ShardCount)
+      {
+         cerr << names[i] << " comes from a different job: " << R.ToString() << endl;
+         Good = false;
+      }
+      if(Seen.count(R.Shard) > 0)
+      {
+         cerr << "Shard " << R.Shard << " appears more than once (" << names[i] << ")" << endl;
+         Good = false;
+      }
+      Seen.insert(R.Shard);
+      if(i > 0 && SortedRanges[i-1].Valid == true && SortedRanges[i-1].End != R.Begin)
+      {
+         cerr << "Entries " << SortedRanges[i-1].End << " to " << R.Begin << " are not covered by exactly one shard" << endl;
+         Good = false;
+      }
+   }
+   if(SortedRanges[0].Valid == true && (int)Seen.size() != SortedRanges[0].ShardCount)
+   {
+      cerr << "Found " << Seen.size() << " of " << SortedRanges[0].ShardCount << " shards" << endl;
+      Good = false;
+   }
+
+   if(Good == false && allowIncomplete == false)
+      return false;
+
+   EntryRange Merged = SortedRanges[0];
+   Merged.End        = SortedRanges.back().End;
+   Merged.Shard      = 0;
+   Merged.ShardCount = 1;
+   summary = Merged.ToString();
+   if(Good == false)
+      summary = summary + " (incomplete)";
+   return true;
+}
+
+bool MergeDirectory(const vector<TDirectory *> &inputs, TDirectory *output, const string &path, const MergeSettings &settings)
+{
+   bool Success = true;
+   string DerivedList = "";
+
+   TIter Next(inputs[0]->GetListOfKeys());
+   set<string> Done;
+   while(TKey *Key = (TKey *)Next())
+   {
+      string Name = Key->GetName();
+      string Class = Key->GetClassName();
+      if(Done.count(Name) > 0)   // older cycles of the same object
+         continue;
+      Done.insert(Name);
+      if(path == "" && Name == "ShardInfo")
+         continue;
+
+      vector<TObject *> Objects;
+      for(int i = 0; i < (int)inputs.size(); i++)
+      {
+         TObject *Object = inputs[i]->Get(Name.c_str());
+         if(Object == nullptr)
+         {
+            cerr << settings.Files[i] << ": missing " << path << Name << endl;
+            Success = false;
+            break;
+         }
+         Objects.push_back(Object);
+      }
+      if((int)Objects.size() != (int)inputs.size())
+         continue;
+
+      output->cd();
+
+      if(Objects[0]->InheritsFrom("TDirectory"))
+      {
+         vector<TDirectory *> SubInputs;
+         for(TObject *Object : Objects)
+            SubInputs.push_back((TDirectory *)Object);
+         TDirectory *SubOutput = output->mkdir(Name.c_str());
+         Success = MergeDirectory(SubInputs, SubOutput, path + Name + "/", settings) && Success;
+      }
+      else if(Objects[0]->InheritsFrom("TH1"))
+      {
+         TH1 *Sum = (TH1 *)Objects[0]->Clone();
+         Sum->SetDirectory(output);
+         for(int i = 1; i < (int)Objects.size(); i++)
+            if(Sum->Add((TH1 *)Objects[i]) == false)
+            {
+               cerr << "Cannot add " << path << Name << " from " << settings.Files[i] << endl;
+               Success = false;
+            }
+         Sum->Write();
+      }
+      else if(Objects[0]->InheritsFrom("TTree"))
+      {
+         TChain Chain(Name.c_str());
+         for(const string &File : settings.Files)
+            Chain.Add((File + "/" + path + Name).c_str());
+         TTree *Merged = Chain.CloneTree(-1, "fast");
+         if(Merged == nullptr)
+         {
+            cerr << "Cannot merge tree " << path << Name << endl;
+            Success = false;
+            continue;
+         }
+         Merged->SetDirectory(output);
+         Merged->Write();
+      }
+      else if(Class == "TParameter<long long>" || Class == "TParameter<Long64_t>")
+      {
+         long long Sum = 0;
+         for(TObject *Object : Objects)
+            Sum = Sum + ((TParameter<long long> *)Object)->GetVal();
+         TParameter<long long>(Name.c_str(), Sum).Write();
+      }
+      else if(Class == "TParameter<int>")
+      {
+         int Sum = 0;
+         for(TObject *Object : Objects)
+            Sum = Sum + ((TParameter<int> *)Object)->GetVal();
+         TParameter<int>(Name.c_str(), Sum).Write();
+      }
+      else if(Class == "TParameter<double>")
+      {
+         double Value = ((TParameter<double> *)Objects[0])->GetVal();
+         for(int i = 1; i < (int)Objects.size(); i++)
+         {
+            if(((TParameter<double> *)Objects[i])->GetVal() == Value)
+               continue;
+            cerr << path << Name << " differs between shards (" << Value << " vs "
+               << ((TParameter<double> *)Objects[i])->GetVal() << " in " << settings.Files[i] << ")" << endl;
+            Success = false;
+         }
+         TParameter<double>(Name.c_str(), Value).Write();
+      }
+      else if(Class == "TNamed")
+      {
+         vector<string> Texts;
+         for(TObject *Object : Objects)
+            Texts.push_back(((TNamed *)Object)->GetTitle());
+         bool Differs = false;
+         string Text = ReconcileText(Texts, Differs);
+         if(Differs == true)
+         {
+            cerr << (settings.Strict ? "Error" : "Warning") << ": " << path << Name << " differs between shards" << endl;
+            if(settings.Strict == true)
+               Success = false;
+         }
+         if(Name == "ShardDerived")
+            DerivedList = Text;
+         if(Name == "ShardFinalize")
+            cout << "The merged file holds sums only; next run " << Text << endl;
+         TNamed(Name.c_str(), Text.c_str()).Write();
+      }
+      else
+      {
+         cerr << "Warning: " << path << Name << " (" << Class << ") is copied from the first shard only" << endl;
+         Objects[0]->Write(Name.c_str());
+      }
+   }
+
+   if(DerivedList != "")
+      Success = RecomputeDerived(output, DerivedList) && Success;
+
+   return Success;
+}
+
+string ReconcileText(const vector<string> &texts, bool &differs)
+{
+   vector<vector<string>> Lines;
+   size_t MaxLines = 0;
+   for(const string &Text : texts)
+   {
+      vector<string> Split;
+      stringstream Stream(Text);
+      string Line;
+      while(getline(Stream, Line))
+         Split.push_back(Line);
+      MaxLines = max(MaxLines, Split.size());
+      Lines.push_back(Split);
+   }
+
+   differs = false;
+   string Result;
+   for(size_t l = 0; l < MaxLines; l++)
+   {
+      vector<string> Values;
+      for(const vector<string> &Split : Lines)
+      {
+         string Value = (l < Split.size()) ? Split[l] : "";
+         if(find(Values.begin(), Values.end(), Value) == Values.end())
+            Values.push_back(Value);
+      }
+      if(Values.size() > 1)
+         differs = true;
+
+      string Line = Values[0];
+      for(size_t i = 1; i < Values.size(); i++)
+         Line = Line + " | " + Values[i];
+      Result = Result + Line + ((l + 1 < MaxLines) ? "\n" : "");
+   }
+   if(texts.size() > 0 && texts[0].size() > 0 && texts[0].back() == '\n')
+      Result = Result + "\n";
+
+   return Result;
+}
+
+bool RecomputeDerived(TDirectory *output, const string &list)
+{
+   // Lines of the form Name=Numerator/Denominator
+   bool Success = true;
+   stringstream Stream(list);
+   string Line;
+   while(getline(Stream, Line))
+   {
+      if(Line == "")
+         continue;
+      size_t Equal = Line.find('=');
+      size_t Slash = Line.find('/', Equal);
+      if(Equal == string::npos || Slash == string::npos)
+      {
+         cerr << "Cannot parse ShardDerived line \"" << Line << "\"" << endl;
+         Success = false;
+         continue;
+      }
+      string Name        = Line.substr(0, Equal);
+      string Numerator   = Line.substr(Equal + 1, Slash - Equal - 1);
+      string Denominator = Line.substr(Slash + 1);
+
+      TH1 *N = nullptr, *D = nullptr;
+      output->GetObject(Numerator.c_str(), N);
+      output->GetObject(Denominator.c_str(), D);
+      if(N == nullptr || D == nullptr)
+      {
+         cerr << "Cannot recompute " << Name << ": missing " << Numerator << " or " << Denominator << endl;
+         Success = false;
+         continue;
+      }
+
+      TH1 *Ratio = (TH1 *)N->Clone(Name.c_str());
+      TH1 *Summed = nullptr;
+      output->GetObject(Name.c_str(), Summed);
+      if(Summed != nullptr)
+         Ratio->SetTitle(Summed->GetTitle());
+      Ratio->Divide(D);
+      Ratio->SetDirectory(output);
+      output->cd();
+      Ratio->Write(Name.c_str(), TObject::kOverwrite);
+   }
+   return Success;
+}
@@ -0,0 +1,133 @@
+#include <iostream>
+#include <ctime>
+using namespace std;
+
+#include "TFile.h"
+
+#include "StrangenessMessenger.h"
+#include "StrangenessWriter.h"
+#include "CommandLine.h"
+#include "EntryRange.h"
+#include "ProgressBar.h"
+
+// Writes a slimmed strangeness tree:
+//    SkimStrangenessTree --Input "Samples/run_*.root" --Output Skim.root --Groups Event,Reco,PID
+//       [--PassAll true] [--GoodTrack true] [--Acceptance true --AbsCosMin 0.15 --AbsCosMax 0.675]
+//       [--Schema Full|Float|Truncated|SmallInt|PackPID|Compact (comma separated)] [--MantissaBits 16]
+//       [--Fraction 1.0] [--FirstEntry 0 --NEntries -1] [--Shard i/N]
+
+int main(int argc, char *argv[])
+{
+   CommandLine CL(argc, argv);
+
+   string InputFileName  = CL.Get("Input");
+   string OutputFileName = CL.Get("Output", "Skim.root");
+   string TreeName       = CL.Get("Tree", "Tree");
+   string Groups         = CL.Get("Groups", "All");
+   bool RequirePassAll   = CL.GetBool("PassAll", true);
+   bool GoodTrack        = CL.GetBool("GoodTrack", false);
+   bool Acceptance       = CL.GetBool("Acceptance", false);
+   double AbsCosMin      = CL.GetDouble("AbsCosMin", 0.00);
+   double AbsCosMax      = CL.GetDouble("AbsCosMax", 1.00);
+   string Schema         = CL.Get("Schema", "Full");
+   int MantissaBits      = CL.GetInt("MantissaBits", 16);
+
+   int GroupMask = StrangenessTreeMessenger::ParseBranchGroups(Groups);
+   if(GroupMask < 0)
+      return 1;
+
+   StrangenessTreeMessenger M(InputFileName, TreeName);
+   if(M.Tree == nullptr)
+   {
+      cerr << "Cannot open tree " << TreeName << " from " << InputFileName << endl;
+      return 1;
+   }
+   M.SetBufferMode(StrangenessTreeMessenger::BufferDynamic);
+
+   EntryRange Range(CL, M.GetEntries());
+   if(Range.IsValid() == false)
+      return 1;
+
+   // Read what is written, plus whatever the selection needs
+   vector<string> Needed;
+   if(RequirePassAll == true)
+      Needed.push_back("PassAll");
+   if(GoodTrack == true)
+      Needed.push_back("RecoGoodTrack");
+   if(Acceptance == true)
+   {
+      Needed.push_back("RecoPx");
+      Needed.push_back("RecoPy");
+      Needed.push_back("RecoPz");
+   }
+   M.SetBranchGroups(GroupMask);
+   if(M.EnableBranches(Needed) == false)
+   {
+      cerr << "Input is missing branches needed for the selection" << endl;
+      return 1;
+   }
+
+   TFile OutputFile(OutputFileName.c_str(), "RECREATE");
+
+   StrangenessTreeWriter Writer(&OutputFile, TreeName);
+   Writer.SetBranchGroups(GroupMask);
+   Writer.SetTrackFilter((GoodTrack ? StrangenessTreeWriter::FilterGoodTrack : 0)
+      | (Acceptance ? StrangenessTreeWriter::FilterAcceptance : 0));
+   Writer.SetAcceptance(AbsCosMin, AbsCosMax);
+   if(Writer.SetSchema(Schema, MantissaBits) == false)
+      return 1;
+
+   time_t Now = time(nullptr);
+   char Date[64];
+   strftime(Date, 64, "%Y-%m-%d %H:%M:%S", localtime(&Now));
+
+   Writer.AddProvenance("Tool: SkimStrangenessTree");
+   Writer.AddProvenance(string("Date: ") + Date);
+   Writer.AddProvenance("Input: " + InputFileName);
+   Writer.AddProvenance("Groups: " + Groups);
+   Writer.AddProvenance("SchemaName: " + Schema);
+   Writer.AddProvenance(string("EventSelection: ") + (RequirePassAll ? "PassAll==1" : "none"));
+   Writer.AddProvenance("Range: " + Range.ToString());
+
+   if(Writer.Initialize(M) == false)
+      return 1;
+
+   ProgressBar Bar(cout, Range.GetCount());
+   Bar.SetStyle(1);
+   long long DeltaI = Range.GetCount() / 300 + 1;
+
+   for(long long iE = Range.Begin; iE < Range.End; iE++)
+   {
+      if((iE - Range.Begin) % DeltaI == 0)
+      {
+         Bar.Update(iE - Range.Begin);
+         Bar.Print();
+      }
+
+      if(M.GetEntry(iE) == false)
+      {
+         Writer.CountSkipped();
+         continue;
+      }
+      if(RequirePassAll == true && M.PassAll != 1)
+      {
+         Writer.CountSkipped();
+         continue;
+      }
+
+      Writer.Fill(M);
+   }
+
+   Bar.Update(Range.GetCount());
+   Bar.Print();
+   Bar.PrintLine();
+
+   Writer.Write();
+   Range.Write(&OutputFile);
+   OutputFile.Close();
+
+   cout << "Wrote " << Writer.GetEventsWritten() << " events, " << Writer.GetTracksWritten()
+      << " tracks to " << OutputFileName << endl;
+
+   return 0;
+}
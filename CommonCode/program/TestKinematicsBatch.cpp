@@ -0,0 +1,285 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "CommandLine.h"
+#include "KinematicsBatch.h"
+
+// Checks every KinematicsBatch function against the scalar helper of Kinematics.h it stands in
+// for, bit for bit (NaN matches NaN), on random tracks mixed with edge cases (p == 0, signed
+// zeros, pure longitudinal or transverse tracks, huge and tiny momenta, tracks on the rapidity
+// axis, axes that are not unit vectors or zero), then times the scalar and the batch loops:
+//    TestKinematicsBatch [--Count 100003] [--Seed 1] [--Repeat 100]
+// Returns 1 if anything differs.  Build it with the flags of the analysis (-march=native etc.);
+// the makefile target TestKinematicsBatch runs it for the scalar, AVX2+FMA and native paths.
+
+// The scalar helpers are compiled without a*b+c contraction, whatever the command line says;
+// KinematicsBatch.h, included above, has to manage that on its own
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "Kinematics.h"
+
+bool Same(double a, double b);
+long long Compare(const string &Name, const vector<double> &Batch, const vector<double> &Expected);
+double AxisRapidityOrNaN(double px, double py, double pz, double e, double ax, double ay, double az);
+template<class ScalarLoop, class BatchLoop>
+void Benchmark(const string &Name, long long Count, int Repeat, ScalarLoop Scalar, BatchLoop Batch);
+
+int main(int argc, char *argv[])
+{
+   CommandLine CL(argc, argv);
+
+   long long Count = CL.GetInt("Count", 100003);   // not a multiple of the SIMD width: tails too
+   int Seed        = CL.GetInt("Seed", 1);
+   int Repeat      = CL.GetInt("Repeat", 100);  // timing passes, 0 to skip the timing
+
+   cout << "KinematicsBatch backend: " << KinematicsBatch::Backend() << endl;
+
+   mt19937_64 Random(Seed);
+   uniform_real_distribution<double> Uniform(-5, 5);
+   uniform_real_distribution<double> Exponent(-12, 12);
+   uniform_int_distribution<int> Kind(0, 9);
+
+   vector<double> PX(Count), PY(Count), PZ(Count);
+   for(long long i = 0; i < Count; i++)
+   {
+      PX[i] = Uniform(Random);
+      PY[i] = Uniform(Random);
+      PZ[i] = Uniform(Random);
+      switch(Kind(Random))
+      {
+      case 0:   // p == 0, with either sign of zero
+         PX[i] = (i % 2 == 0) ? 0.0 : -0.0;
+         PY[i] = 0;
+         PZ[i] = (i % 3 == 0) ? -0.0 : 0.0;
+         break;
+      case 1:   // along the beam
+         PX[i] = PY[i] = 0;
+         break;
+      case 2:   // transverse, cos(theta) = 0
+         PZ[i] = (i % 2 == 0) ? 0.0 : -0.0;
+         break;
+      case 3:   // very different scales
+         PX[i] = PX[i] * pow(10, Exponent(Random));
+         PY[i] = PY[i] * pow(10, Exponent(Random));
+         PZ[i] = PZ[i] * pow(10, Exponent(Random));
+         break;
+      default:
+         break;
+      }
+   }
+
+   // Thrust-like axis as it is stored, not a unit vector: AxisRapidity normalises it
+   double AX = 3.7 * Uniform(Random), AY = 3.7 * Uniform(Random), AZ = 3.7 * Uniform(Random);
+   double Norm = sqrt(AX * AX + AY * AY + AZ * AZ);
+
+   // Some tracks exactly on the axis: massless ones give e - pLong <= 0
+   for(long long i = 5; i < Count; i = i + 97)
+   {
+      double Scale = Uniform(Random);
+      PX[i] = AX / Norm * Scale;
+      PY[i] = AY / Norm * Scale;
+      PZ[i] = AZ / Norm * Scale;
+   }
+
+   const double MassKaon = 0.493677;
+   const double AbsCosMin = 0.15, AbsCosMax = 0.675;
+
+   long long Failed = 0;
+   vector<double> Batch(Count), Expected(Count);
+
+   KinematicsBatch::Momentum(PX.data(), PY.data(), PZ.data(), Batch.data(), Count);
+   for(long long i = 0; i < Count; i++)
+      Expected[i] = Kinematics::Momentum(PX[i], PY[i], PZ[i]);
+   Failed = Failed + Compare("Momentum", Batch, Expected);
+
+   KinematicsBatch::TransverseMomentum(PX.data(), PY.data(), Batch.data(), Count);
+   for(long long i = 0; i < Count; i++)
+      Expected[i] = Kinematics::TransverseMomentum(PX[i], PY[i]);
+   Failed = Failed + Compare("TransverseMomentum", Batch, Expected);
+
+   KinematicsBatch::AbsCosTheta(PX.data(), PY.data(), PZ.data(), Batch.data(), Count);
+   for(long long i = 0; i < Count; i++)
+      Expected[i] = Kinematics::AbsCosTheta(PX[i], PY[i], PZ[i]);
+   Failed = Failed + Compare("AbsCosTheta", Batch, Expected);
+
+   vector<unsigned char> Pass(Count);
+   KinematicsBatch::AcceptanceMask(PX.data(), PY.data(), PZ.data(), AbsCosMin, AbsCosMax, Pass.data(), Count);
+   for(long long i = 0; i < Count; i++)
+   {
+      Batch[i] = Pass[i];
+      Expected[i] = Kinematics::PassAcceptance(PX[i], PY[i], PZ[i], AbsCosMin, AbsCosMax);
+   }
+   Failed = Failed + Compare("AcceptanceMask", Batch, Expected);
+
+   // Massive and massless energies; the massless ones feed the rapidity edge cases, and a copy
+   // with some zero, negative and NaN energies checks the e > 0 guard
+   vector<double> E(Count), E0(Count), EBad(Count);
+   KinematicsBatch::Energy(PX.data(), PY.data(), PZ.data(), MassKaon, E.data(), Count);
+   for(long long i = 0; i < Count; i++)
+      Expected[i] = Kinematics::Energy(PX[i], PY[i], PZ[i], MassKaon);
+   Failed = Failed + Compare("Energy", E, Expected);
+
+   KinematicsBatch::Energy(PX.data(), PY.data(), PZ.data(), 0, E0.data(), Count);
+   for(long long i = 0; i < Count; i++)
+      Expected[i] = Kinematics::Energy(PX[i], PY[i], PZ[i], 0);
+   Failed = Failed + Compare("Energy (massless)", E0, Expected);
+
+   for(long long i = 0; i < Count; i++)
+   {
+      const double Bad[4] = {0.0, -0.0, -E[i], numeric_limits<double>::quiet_NaN()};
+      EBad[i] = (i % 3 == 0) ? Bad[(i / 3) % 4] : E[i];
+   }
+
+   // Along the stored axis, the beam axis with a non-unit length, and a zero axis (no thrust)
+   const double Axes[3][3] = {{AX, AY, AZ}, {0, 0, 2.5}, {0, 0, 0}};
+   const char *AxisNames[3] = {"", ", beam axis", ", zero axis"};
+   const vector<double> *Energies[3] = {&E, &E0, &EBad};
+   const char *EnergyNames[3] = {"", " (massless)", " (bad e)"};
+   for(int a = 0; a < 3; a++)
+   {
+      for(int m = 0; m < 3; m++)
+      {
+         const double *Axis = Axes[a];
+         const vector<double> &EAxis = *Energies[m];
+         KinematicsBatch::AxisRapidity(PX.data(), PY.data(), PZ.data(), EAxis.data(),
+            Axis[0], Axis[1], Axis[2], Batch.data(), Count);
+         for(long long i = 0; i < Count; i++)
+            Expected[i] = AxisRapidityOrNaN(PX[i], PY[i], PZ[i], EAxis[i], Axis[0], Axis[1], Axis[2]);
+         Failed = Failed + Compare(string("AxisRapidity") + EnergyNames[m] + AxisNames[a], Batch, Expected);
+      }
+   }
+
+   // Random pairs, including a track paired with itself
+   uniform_int_distribution<int> Index(0, Count - 1);
+   vector<int> First(Count), Second(Count);
+   for(long long k = 0; k < Count; k++)
+   {
+      First[k] = Index(Random);
+      Second[k] = (k % 50 == 0) ? First[k] : Index(Random);
+   }
+   for(int Massless = 0; Massless < 2; Massless++)
+   {
+      const vector<double> &EPair = (Massless == 0) ? E : E0;
+      KinematicsBatch::PairMass(PX.data(), PY.data(), PZ.data(), EPair.data(), First.data(), Second.data(),
+         Batch.data(), Count);
+      for(long long k = 0; k < Count; k++)
+      {
+         int i = First[k], j = Second[k];
+         Expected[k] = Kinematics::PairMass(PX[i], PY[i], PZ[i], EPair[i], PX[j], PY[j], PZ[j], EPair[j]);
+      }
+      Failed = Failed + Compare((Massless == 0) ? "PairMass" : "PairMass (massless)", Batch, Expected);
+   }
+
+   if(Failed > 0)
+   {
+      cout << "FAILED: " << Failed << " values differ from the scalar helpers" << endl;
+      return 1;
+   }
+   cout << "All functions agree bit for bit with the scalar helpers" << endl;
+
+   // Throughput of the scalar helper in a plain loop against the batch call, on the same tracks
+   if(Repeat > 0)
+   {
+      cout << "Entries/s over " << Repeat << " passes of " << Count << " (scalar helper -> batch):" << endl;
+      const double *X = PX.data(), *Y = PY.data(), *Z = PZ.data(), *EK = E.data();
+      double *Out = Batch.data();
+      unsigned char *PassOut = Pass.data();
+
+      Benchmark("Momentum", Count, Repeat,
+         [&]() {for(long long i = 0; i < Count; i++) Out[i] = Kinematics::Momentum(X[i], Y[i], Z[i]);},
+         [&]() {KinematicsBatch::Momentum(X, Y, Z, Out, Count);});
+      Benchmark("AbsCosTheta", Count, Repeat,
+         [&]() {for(long long i = 0; i < Count; i++) Out[i] = Kinematics::AbsCosTheta(X[i], Y[i], Z[i]);},
+         [&]() {KinematicsBatch::AbsCosTheta(X, Y, Z, Out, Count);});
+      Benchmark("AcceptanceMask", Count, Repeat,
+         [&]() {for(long long i = 0; i < Count; i++)
+            PassOut[i] = Kinematics::PassAcceptance(X[i], Y[i], Z[i], AbsCosMin, AbsCosMax);},
+         [&]() {KinematicsBatch::AcceptanceMask(X, Y, Z, AbsCosMin, AbsCosMax, PassOut, Count);});
+      Benchmark("Energy", Count, Repeat,
+         [&]() {for(long long i = 0; i < Count; i++) Out[i] = Kinematics::Energy(X[i], Y[i], Z[i], MassKaon);},
+         [&]() {KinematicsBatch::Energy(X, Y, Z, MassKaon, Out, Count);});
+      Benchmark("AxisRapidity", Count, Repeat,
+         [&]() {for(long long i = 0; i < Count; i++) Out[i] = AxisRapidityOrNaN(X[i], Y[i], Z[i], EK[i], AX, AY, AZ);},
+         [&]() {KinematicsBatch::AxisRapidity(X, Y, Z, EK, AX, AY, AZ, Out, Count);});
+      Benchmark("PairMass", Count, Repeat,
+         [&]() {for(long long k = 0; k < Count; k++)
+         {
+            int i = First[k], j = Second[k];
+            Out[k] = Kinematics::PairMass(X[i], Y[i], Z[i], EK[i], X[j], Y[j], Z[j], EK[j]);
+         }},
+         [&]() {KinematicsBatch::PairMass(X, Y, Z, EK, First.data(), Second.data(), Out, Count);});
+   }
+
+   return 0;
+}
+
+double AxisRapidityOrNaN(double px, double py, double pz, double e, double ax, double ay, double az)
+{
+   double Rapidity = 0;
+   if(Kinematics::AxisRapidity(px, py, pz, e, ax, ay, az, Rapidity) == false)
+      return numeric_limits<double>::quiet_NaN();
+   return Rapidity;
+}
+
+template<class ScalarLoop, class BatchLoop>
+void Benchmark(const string &Name, long long Count, int Repeat, ScalarLoop Scalar, BatchLoop Batch)
+{
+   double Seconds[2] = {0, 0};
+   for(int Path = 0; Path < 2; Path++)
+   {
+      auto Start = chrono::steady_clock::now();
+      for(int r = 0; r < Repeat; r++)
+      {
+         if(Path == 0)
+            Scalar();
+         else
+            Batch();
+      }
+      Seconds[Path] = chrono::duration<double>(chrono::steady_clock::now() - Start).count();
+   }
+
+   double Entries = (double)Count * Repeat;
+   cout << "   " << left << setw(16) << Name << right << fixed << setprecision(1)
+      << setw(9) << Entries / Seconds[0] / 1e6 << " M/s -> " << setw(9) << Entries / Seconds[1] / 1e6 << " M/s"
+      << "   (x" << setprecision(2) << Seconds[0] / Seconds[1] << ")" << endl;
+   cout.unsetf(ios::floatfield);
+   cout << setprecision(6);
+}
+
+bool Same(double a, double b)
+{
+   if(std::isnan(a) && std::isnan(b))
+      return true;
+   uint64_t A, B;
+   memcpy(&A, &a, sizeof(double));
+   memcpy(&B, &b, sizeof(double));
+   return A == B;
+}
+
+long long Compare(const string &Name, const vector<double> &Batch, const vector<double> &Expected)
+{
+   long long Count = 0;
+   for(long long i = 0; i < (long long)Batch.size(); i++)
+   {
+      if(Same(Batch[i], Expected[i]) == true)
+         continue;
+      if(Count < 5)
+         cout << "   " << Name << "[" << i << "]: " << Batch[i] << " instead of " << Expected[i] << endl;
+      Count = Count + 1;
+   }
+   cout << (Count == 0 ? "   OK   " : "   FAIL ") << Name << " (" << Count << " / " << Batch.size() << " differ)" << endl;
+   return Count;
+}
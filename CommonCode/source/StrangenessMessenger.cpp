@@ -1,14 +1,29 @@
 #include "StrangenessMessenger.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <type_traits>
+
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TChain.h"
+
+#include "KinematicsBatch.h"
 
 StrangenessTreeMessenger::StrangenessTreeMessenger()
    : Tree(nullptr)
 {
+   Setup();
 }
 
 StrangenessTreeMessenger::StrangenessTreeMessenger(TFile &file, const std::string &treeName)
    : Tree(nullptr)
 {
+   Setup();
+
    TTree *t = nullptr;
    file.GetObject(treeName.c_str(), t);
    Initialize(t);
@@ -17,6 +32,8 @@ StrangenessTreeMessenger::StrangenessTreeMessenger(TFile &file, const std::strin
 StrangenessTreeMessenger::StrangenessTreeMessenger(TFile *file, const std::string &treeName)
    : Tree(nullptr)
 {
+   Setup();
+
    if(file == nullptr)
       return;
 
@@ -28,129 +45,305 @@ StrangenessTreeMessenger::StrangenessTreeMessenger(TFile *file, const std::strin
 StrangenessTreeMessenger::StrangenessTreeMessenger(TTree *tree)
    : Tree(nullptr)
 {
+   Setup();
    Initialize(tree);
 }
 
-bool StrangenessTreeMessenger::Initialize(TTree *tree)
+StrangenessTreeMessenger::StrangenessTreeMessenger(const std::string &inputs, const std::string &treeName,
+   long long cacheSize)
+   : Tree(nullptr)
 {
-   if(tree == nullptr)
-      return false;
+   Setup();
 
-   Tree = tree;
+   std::vector<std::string> Files = ExpandInputList(inputs);
+   if(Files.size() == 0)
+   {
+      std::cerr << "[StrangenessTreeMessenger] No input files in \"" << inputs << "\"" << std::endl;
+      return;
+   }
+
+   Chain = new TChain(treeName.c_str());
+   for(const std::string &File : Files)
+      if(Chain->Add(File.c_str()) == 0)
+         std::cerr << "[StrangenessTreeMessenger] Nothing matches \"" << File << "\"" << std::endl;
+
+   if(Chain->GetNtrees() == 0)
+   {
+      delete Chain;
+      Chain = nullptr;
+      return;
+   }
+
+   Initialize(Chain);
+   SetCacheSize(cacheSize);
+}
+
+StrangenessTreeMessenger::~StrangenessTreeMessenger()
+{
+   if(SummaryChain != nullptr)
+   {
+      if(Tree != nullptr)
+         Tree->RemoveFriend(SummaryChain);
+      delete SummaryChain;
+   }
+   if(Chain != nullptr)
+      delete Chain;
+
+   for(double *Field : {Cache.P, Cache.Pt, Cache.Eta, Cache.AbsCos, Cache.YThrust, Cache.EPion, Cache.EKaon, Cache.EProton})
+      std::free(Field);
+
+   for(BranchRecord &B : Branches)
+   {
+      if(B.Buffer == nullptr)
+         continue;
+      std::free(*B.Buffer);
+      *B.Buffer = nullptr;
+   }
+}
+
+void StrangenessTreeMessenger::Setup()
+{
+   Mode      = BufferFixed;
+   Chain     = nullptr;
+   CacheSize = 0;
+   SummaryChain = nullptr;
+
+   CacheFields   = CacheNone;
+   CacheCapacity = 0;
+   CacheEntry    = -1;
+   CurrentEntry  = -1;
+   Cache         = TrackCache{0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+
+   BuildBranchTable();
+   for(CounterRecord &C : Counters)
+      ResizeBuffers(C, C.FixedCapacity);
+}
+
+template <class T>
+void StrangenessTreeMessenger::AddBranch(const std::string &name, T *address, int group)
+{
+   BranchRecord Record;
+   Record.Name        = name;
+   Record.Address     = address;
+   Record.Buffer      = nullptr;
+   Record.ElementSize = sizeof(T);
+   Record.Type        = std::is_same<T, double>::value ? 'D' : 'L';
+   Record.StoredType  = Record.Type;
+   Record.PackShift   = -1;
+   Record.Packed      = false;
+   Record.Group       = group;
+   Record.Counter     = "";
+   Record.Present     = false;
+   Record.Active      = false;
+   Branches.push_back(Record);
+}
+
+template <class T>
+void StrangenessTreeMessenger::AddArray(const std::string &name, T *&buffer, int group, const std::string &counter)
+{
+   buffer = nullptr;
+
+   BranchRecord Record;
+   Record.Name        = name;
+   Record.Address     = nullptr;
+   Record.Buffer      = reinterpret_cast<void **>(&buffer);
+   Record.ElementSize = sizeof(T);
+   Record.Type        = std::is_same<T, double>::value ? 'D' : 'L';
+   Record.StoredType  = Record.Type;
+   Record.PackShift   = -1;
+   Record.Packed      = false;
+   Record.Group       = group;
+   Record.Counter     = counter;
+   Record.Present     = false;
+   Record.Active      = false;
+   Branches.push_back(Record);
+}
+
+void StrangenessTreeMessenger::AddCounter(const std::string &name, long long *value, long long fixedCapacity)
+{
+   CounterRecord Record;
+   Record.Name          = name;
+   Record.Value         = value;
+   Record.Capacity      = 0;
+   Record.FixedCapacity = fixedCapacity;
+   Counters.push_back(Record);
+}
+
+void StrangenessTreeMessenger::BuildBranchTable()
+{
+   Branches.clear();
+   Counters.clear();
+
+   AddCounter("NGen",    &NGen,    STRANGE_MAX_GEN);
+   AddCounter("NReco",   &NReco,   STRANGE_MAX_RECO);
+   AddCounter("NSim",    &NSim,    STRANGE_MAX_SIM);
+   AddCounter("NKShort", &NKShort, STRANGE_MAX_KSHORT);
+   AddCounter("NPhi",    &NPhi,    STRANGE_MAX_PHI);
 
    // Event-level
-   Tree->SetBranchAddress("Ecm",          &Ecm);
-   Tree->SetBranchAddress("Nch",          &Nch);
-   Tree->SetBranchAddress("Run",          &Run);
-   Tree->SetBranchAddress("Event",        &Event);
-   Tree->SetBranchAddress("Fill",         &Fill);
-   Tree->SetBranchAddress("GoodNch",      &GoodNch);
-   Tree->SetBranchAddress("GoodNneu",     &GoodNneu);
-   Tree->SetBranchAddress("TotalEch",     &TotalEch);
-   Tree->SetBranchAddress("TotalEneu",    &TotalEneu);
-   Tree->SetBranchAddress("PassNch",      &PassNch);
-   Tree->SetBranchAddress("PassThrust",   &PassThrust);
-   Tree->SetBranchAddress("PassTotalE",   &PassTotalE);
-   Tree->SetBranchAddress("PassAll",      &PassAll);
-   Tree->SetBranchAddress("Thrust",       &Thrust);
-   Tree->SetBranchAddress("ThrustX",      &ThrustX);
-   Tree->SetBranchAddress("ThrustY",      &ThrustY);
-   Tree->SetBranchAddress("ThrustZ",      &ThrustZ);
-   Tree->SetBranchAddress("ThrustTheta",  &ThrustTheta);
+   AddBranch("Ecm",                 &Ecm,                 GroupEventScalars);
+   AddBranch("Nch",                 &Nch,                 GroupEventScalars);
+   AddBranch("Run",                 &Run,                 GroupEventScalars);
+   AddBranch("Event",               &Event,               GroupEventScalars);
+   AddBranch("Fill",                &Fill,                GroupEventScalars);
+   AddBranch("GoodNch",             &GoodNch,             GroupEventScalars);
+   AddBranch("GoodNneu",            &GoodNneu,            GroupEventScalars);
+   AddBranch("TotalEch",            &TotalEch,            GroupEventScalars);
+   AddBranch("TotalEneu",           &TotalEneu,           GroupEventScalars);
+   AddBranch("PassNch",             &PassNch,             GroupEventScalars);
+   AddBranch("PassThrust",          &PassThrust,          GroupEventScalars);
+   AddBranch("PassTotalE",          &PassTotalE,          GroupEventScalars);
+   AddBranch("PassAll",             &PassAll,             GroupEventScalars);
+   AddBranch("Thrust",              &Thrust,              GroupEventScalars);
+   AddBranch("ThrustX",             &ThrustX,             GroupEventScalars);
+   AddBranch("ThrustY",             &ThrustY,             GroupEventScalars);
+   AddBranch("ThrustZ",             &ThrustZ,             GroupEventScalars);
+   AddBranch("ThrustTheta",         &ThrustTheta,         GroupEventScalars);
 
    // Generator-level
-   Tree->SetBranchAddress("NGen",         &NGen);
-   Tree->SetBranchAddress("GenPx",        GenPx);
-   Tree->SetBranchAddress("GenPy",        GenPy);
-   Tree->SetBranchAddress("GenPz",        GenPz);
-   Tree->SetBranchAddress("GenE",         GenE);
-   Tree->SetBranchAddress("GenM",         GenM);
-   Tree->SetBranchAddress("GenID",        GenID);
-   Tree->SetBranchAddress("GenStatus",    GenStatus);
-   Tree->SetBranchAddress("GenParent",    GenParent);
-   Tree->SetBranchAddress("GenMatchIndex",GenMatchIndex);
-   Tree->SetBranchAddress("GenMatchAngle",GenMatchAngle);
+   AddBranch("NGen",                &NGen,                GroupGen);
+   AddArray("GenPx",               GenPx,                GroupGen, "NGen");
+   AddArray("GenPy",               GenPy,                GroupGen, "NGen");
+   AddArray("GenPz",               GenPz,                GroupGen, "NGen");
+   AddArray("GenE",                GenE,                 GroupGen, "NGen");
+   AddArray("GenM",                GenM,                 GroupGen, "NGen");
+   AddArray("GenID",               GenID,                GroupGen, "NGen");
+   AddArray("GenStatus",           GenStatus,            GroupGen, "NGen");
+   AddArray("GenParent",           GenParent,            GroupGen, "NGen");
+   AddArray("GenMatchIndex",       GenMatchIndex,        GroupGen, "NGen");
+   AddArray("GenMatchAngle",       GenMatchAngle,        GroupGen, "NGen");
 
    // Reco-level
-   Tree->SetBranchAddress("NReco",                 &NReco);
-   Tree->SetBranchAddress("RecoPx",                RecoPx);
-   Tree->SetBranchAddress("RecoPy",                RecoPy);
-   Tree->SetBranchAddress("RecoPz",                RecoPz);
-   Tree->SetBranchAddress("RecoE",                 RecoE);
-   Tree->SetBranchAddress("RecoCharge",            RecoCharge);
-   Tree->SetBranchAddress("RecoID",                RecoID);
-   Tree->SetBranchAddress("RecoTrackLength",       RecoTrackLength);
-   Tree->SetBranchAddress("RecoTrackD0",           RecoTrackD0);
-   Tree->SetBranchAddress("RecoTrackZ0",           RecoTrackZ0);
-   Tree->SetBranchAddress("RecoPIDElectron",       RecoPIDElectron);
-   Tree->SetBranchAddress("RecoPIDProton",         RecoPIDProton);
-   Tree->SetBranchAddress("RecoPIDKaon",           RecoPIDKaon);
-   Tree->SetBranchAddress("RecoPIDPion",           RecoPIDPion);
-   Tree->SetBranchAddress("RecoPIDHeavy",          RecoPIDHeavy);
-   Tree->SetBranchAddress("RecoPIDQProton",        RecoPIDQProton);
-   Tree->SetBranchAddress("RecoPIDQKaon",          RecoPIDQKaon);
-   Tree->SetBranchAddress("RecoMuID",              RecoMuID);
-   Tree->SetBranchAddress("RecoEleID",             RecoEleID);
-   Tree->SetBranchAddress("RecoConversionID",      RecoConversionID);
-   Tree->SetBranchAddress("RecoGoodTrack",         RecoGoodTrack);
-   Tree->SetBranchAddress("RecoGoodNeutral",       RecoGoodNeutral);
-   Tree->SetBranchAddress("RecoGenEfficiencyK",    RecoGenEfficiencyK);
-   Tree->SetBranchAddress("RecoGenEfficiencyPi",   RecoGenEfficiencyPi);
-   Tree->SetBranchAddress("RecoGenEfficiencyP",    RecoGenEfficiencyP);
-   Tree->SetBranchAddress("RecoEfficiencyK",       RecoEfficiencyK);
-   Tree->SetBranchAddress("RecoEfficiencyPi",      RecoEfficiencyPi);
-   Tree->SetBranchAddress("RecoEfficiencyP",       RecoEfficiencyP);
-   Tree->SetBranchAddress("RecoEfficiencyKAsK",    RecoEfficiencyKAsK);
-   Tree->SetBranchAddress("RecoEfficiencyKAsPi",   RecoEfficiencyKAsPi);
-   Tree->SetBranchAddress("RecoEfficiencyKAsP",    RecoEfficiencyKAsP);
-   Tree->SetBranchAddress("RecoEfficiencyPiAsK",   RecoEfficiencyPiAsK);
-   Tree->SetBranchAddress("RecoEfficiencyPiAsPi",  RecoEfficiencyPiAsPi);
-   Tree->SetBranchAddress("RecoEfficiencyPiAsP",   RecoEfficiencyPiAsP);
-   Tree->SetBranchAddress("RecoEfficiencyPAsK",    RecoEfficiencyPAsK);
-   Tree->SetBranchAddress("RecoEfficiencyPAsPi",   RecoEfficiencyPAsPi);
-   Tree->SetBranchAddress("RecoEfficiencyPAsP",    RecoEfficiencyPAsP);
+   AddBranch("NReco",               &NReco,               GroupRecoKinematics | GroupRecoPID | GroupRecoEfficiency);
+   AddArray("RecoPx",              RecoPx,               GroupRecoKinematics, "NReco");
+   AddArray("RecoPy",              RecoPy,               GroupRecoKinematics, "NReco");
+   AddArray("RecoPz",              RecoPz,               GroupRecoKinematics, "NReco");
+   AddArray("RecoE",               RecoE,                GroupRecoKinematics, "NReco");
+   AddArray("RecoCharge",          RecoCharge,           GroupRecoKinematics, "NReco");
+   AddArray("RecoID",              RecoID,               GroupRecoKinematics, "NReco");
+   AddArray("RecoTrackLength",     RecoTrackLength,      GroupRecoKinematics, "NReco");
+   AddArray("RecoTrackD0",         RecoTrackD0,          GroupRecoKinematics, "NReco");
+   AddArray("RecoTrackZ0",         RecoTrackZ0,          GroupRecoKinematics, "NReco");
+   AddArray("RecoPIDElectron",     RecoPIDElectron,      GroupRecoPID, "NReco");
+   AddArray("RecoPIDProton",       RecoPIDProton,        GroupRecoPID, "NReco");
+   AddArray("RecoPIDKaon",         RecoPIDKaon,          GroupRecoPID, "NReco");
+   AddArray("RecoPIDPion",         RecoPIDPion,          GroupRecoPID, "NReco");
+   AddArray("RecoPIDHeavy",        RecoPIDHeavy,         GroupRecoPID, "NReco");
+   AddArray("RecoPIDPacked",       RecoPIDPacked,        GroupRecoPID, "NReco");
+   AddArray("RecoPIDQProton",      RecoPIDQProton,       GroupRecoPID, "NReco");
+   AddArray("RecoPIDQKaon",        RecoPIDQKaon,         GroupRecoPID, "NReco");
+   AddArray("RecoMuID",            RecoMuID,             GroupRecoPID, "NReco");
+   AddArray("RecoEleID",           RecoEleID,            GroupRecoPID, "NReco");
+   AddArray("RecoConversionID",    RecoConversionID,     GroupRecoPID, "NReco");
+   AddArray("RecoGoodTrack",       RecoGoodTrack,        GroupRecoKinematics, "NReco");
+   AddArray("RecoGoodNeutral",     RecoGoodNeutral,      GroupRecoKinematics, "NReco");
+   AddArray("RecoGenEfficiencyK",  RecoGenEfficiencyK,   GroupRecoEfficiency, "NReco");
+   AddArray("RecoGenEfficiencyPi", RecoGenEfficiencyPi,  GroupRecoEfficiency, "NReco");
+   AddArray("RecoGenEfficiencyP",  RecoGenEfficiencyP,   GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyK",     RecoEfficiencyK,      GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyPi",    RecoEfficiencyPi,     GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyP",     RecoEfficiencyP,      GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyKAsK",  RecoEfficiencyKAsK,   GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyKAsPi", RecoEfficiencyKAsPi,  GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyKAsP",  RecoEfficiencyKAsP,   GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyPiAsK", RecoEfficiencyPiAsK,  GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyPiAsPi",RecoEfficiencyPiAsPi, GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyPiAsP", RecoEfficiencyPiAsP,  GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyPAsK",  RecoEfficiencyPAsK,   GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyPAsPi", RecoEfficiencyPAsPi,  GroupRecoEfficiency, "NReco");
+   AddArray("RecoEfficiencyPAsP",  RecoEfficiencyPAsP,   GroupRecoEfficiency, "NReco");
 
    // Sim-level
-   Tree->SetBranchAddress("NSim",         &NSim);
-   Tree->SetBranchAddress("SimPx",        SimPx);
-   Tree->SetBranchAddress("SimPy",        SimPy);
-   Tree->SetBranchAddress("SimPz",        SimPz);
-   Tree->SetBranchAddress("SimE",         SimE);
-   Tree->SetBranchAddress("SimID",        SimID);
+   AddBranch("NSim",                &NSim,                GroupSim);
+   AddArray("SimPx",               SimPx,                GroupSim, "NSim");
+   AddArray("SimPy",               SimPy,                GroupSim, "NSim");
+   AddArray("SimPz",               SimPz,                GroupSim, "NSim");
+   AddArray("SimE",                SimE,                 GroupSim, "NSim");
+   AddArray("SimID",               SimID,                GroupSim, "NSim");
 
    // KShort candidates
-   Tree->SetBranchAddress("NKShort",          &NKShort);
-   Tree->SetBranchAddress("KShortPx",         KShortPx);
-   Tree->SetBranchAddress("KShortPy",         KShortPy);
-   Tree->SetBranchAddress("KShortPz",         KShortPz);
-   Tree->SetBranchAddress("KShortE",          KShortE);
-   Tree->SetBranchAddress("KShortSim1ID",     KShortSim1ID);
-   Tree->SetBranchAddress("KShortSim2ID",     KShortSim2ID);
-   Tree->SetBranchAddress("KShortReco1ID",    KShortReco1ID);
-   Tree->SetBranchAddress("KShortReco2ID",    KShortReco2ID);
-   Tree->SetBranchAddress("KShortReco1Angle", KShortReco1Angle);
-   Tree->SetBranchAddress("KShortReco2Angle", KShortReco2Angle);
-   Tree->SetBranchAddress("KShortRecoPx",     KShortRecoPx);
-   Tree->SetBranchAddress("KShortRecoPy",     KShortRecoPy);
-   Tree->SetBranchAddress("KShortRecoPz",     KShortRecoPz);
-   Tree->SetBranchAddress("KShortRecoE",      KShortRecoE);
+   AddBranch("NKShort",             &NKShort,             GroupKShort);
+   AddArray("KShortPx",            KShortPx,             GroupKShort, "NKShort");
+   AddArray("KShortPy",            KShortPy,             GroupKShort, "NKShort");
+   AddArray("KShortPz",            KShortPz,             GroupKShort, "NKShort");
+   AddArray("KShortE",             KShortE,              GroupKShort, "NKShort");
+   AddArray("KShortSim1ID",        KShortSim1ID,         GroupKShort, "NKShort");
+   AddArray("KShortSim2ID",        KShortSim2ID,         GroupKShort, "NKShort");
+   AddArray("KShortReco1ID",       KShortReco1ID,        GroupKShort, "NKShort");
+   AddArray("KShortReco2ID",       KShortReco2ID,        GroupKShort, "NKShort");
+   AddArray("KShortReco1Angle",    KShortReco1Angle,     GroupKShort, "NKShort");
+   AddArray("KShortReco2Angle",    KShortReco2Angle,     GroupKShort, "NKShort");
+   AddArray("KShortRecoPx",        KShortRecoPx,         GroupKShort, "NKShort");
+   AddArray("KShortRecoPy",        KShortRecoPy,         GroupKShort, "NKShort");
+   AddArray("KShortRecoPz",        KShortRecoPz,         GroupKShort, "NKShort");
+   AddArray("KShortRecoE",         KShortRecoE,          GroupKShort, "NKShort");
 
    // Phi candidates
-   Tree->SetBranchAddress("NPhi",          &NPhi);
-   Tree->SetBranchAddress("PhiPx",         PhiPx);
-   Tree->SetBranchAddress("PhiPy",         PhiPy);
-   Tree->SetBranchAddress("PhiPz",         PhiPz);
-   Tree->SetBranchAddress("PhiE",          PhiE);
-   Tree->SetBranchAddress("PhiGen1ID",     PhiGen1ID);
-   Tree->SetBranchAddress("PhiGen2ID",     PhiGen2ID);
-   Tree->SetBranchAddress("PhiReco1ID",    PhiReco1ID);
-   Tree->SetBranchAddress("PhiReco2ID",    PhiReco2ID);
-   Tree->SetBranchAddress("PhiReco1Angle", PhiReco1Angle);
-   Tree->SetBranchAddress("PhiReco2Angle", PhiReco2Angle);
-   Tree->SetBranchAddress("PhiRecoPx",     PhiRecoPx);
-   Tree->SetBranchAddress("PhiRecoPy",     PhiRecoPy);
-   Tree->SetBranchAddress("PhiRecoPz",     PhiRecoPz);
-   Tree->SetBranchAddress("PhiRecoE",      PhiRecoE);
+   AddBranch("NPhi",                &NPhi,                GroupPhi);
+   AddArray("PhiPx",               PhiPx,                GroupPhi, "NPhi");
+   AddArray("PhiPy",               PhiPy,                GroupPhi, "NPhi");
+   AddArray("PhiPz",               PhiPz,                GroupPhi, "NPhi");
+   AddArray("PhiE",                PhiE,                 GroupPhi, "NPhi");
+   AddArray("PhiGen1ID",           PhiGen1ID,            GroupPhi, "NPhi");
+   AddArray("PhiGen2ID",           PhiGen2ID,            GroupPhi, "NPhi");
+   AddArray("PhiReco1ID",          PhiReco1ID,           GroupPhi, "NPhi");
+   AddArray("PhiReco2ID",          PhiReco2ID,           GroupPhi, "NPhi");
+   AddArray("PhiReco1Angle",       PhiReco1Angle,        GroupPhi, "NPhi");
+   AddArray("PhiReco2Angle",       PhiReco2Angle,        GroupPhi, "NPhi");
+   AddArray("PhiRecoPx",           PhiRecoPx,            GroupPhi, "NPhi");
+   AddArray("PhiRecoPy",           PhiRecoPy,            GroupPhi, "NPhi");
+   AddArray("PhiRecoPz",           PhiRecoPz,            GroupPhi, "NPhi");
+   AddArray("PhiRecoE",            PhiRecoE,             GroupPhi, "NPhi");
+
+   std::vector<std::string> PackedNames = PackedPIDBranches();
+   for(int i = 0; i < (int)PackedNames.size(); i++)
+      FindBranch(PackedNames[i])->PackShift = i * STRANGE_PID_PACK_BITS;
+}
+
+bool StrangenessTreeMessenger::Initialize(TTree *tree)
+{
+   if(tree == nullptr)
+      return false;
+
+   Tree = tree;
+
+   // Branches missing from older productions are skipped instead of triggering ROOT errors
+   for(BranchRecord &B : Branches)
+   {
+      B.Present    = (Tree->GetBranch(B.Name.c_str()) != nullptr);
+      B.Active     = B.Present;
+      B.Packed     = false;
+      B.StoredType = B.Type;
+      B.Staging.clear();
+
+      TLeaf *Leaf = (B.Present == true) ? Tree->GetLeaf(B.Name.c_str()) : nullptr;
+      if(Leaf != nullptr)
+         B.StoredType = LeafTypeCode(Leaf->GetTypeName());
+      if(B.StoredType == 0)
+      {
+         std::cerr << "[StrangenessTreeMessenger] Unsupported leaf type " << Leaf->GetTypeName()
+            << " for " << B.Name << ", branch skipped" << std::endl;
+         B.Present = false;
+         B.Active  = false;
+         B.StoredType = B.Type;
+      }
+   }
+
+   // Compact trees: PID tags are unpacked from RecoPIDPacked
+   if(FindBranch("RecoPIDPacked")->Present == true)
+   {
+      for(BranchRecord &B : Branches)
+      {
+         if(B.PackShift < 0 || B.Present == true)
+            continue;
+         B.Present = true;
+         B.Active  = true;
+         B.Packed  = true;
+      }
+   }
+
+   for(BranchRecord &B : Branches)
+      BindBranch(B);
 
    return true;
 }
@@ -164,14 +357,29 @@ bool StrangenessTreeMessenger::Initialize()
 
 bool StrangenessTreeMessenger::GetEntry(long long iEntry)
 {
+   CurrentEntry = -1;
+   CacheEntry   = -1;
+
    if(Tree == nullptr)
       return false;
    if(iEntry < 0)
       return false;
    if(iEntry >= Tree->GetEntries())
       return false;
+   if(ReserveForEntry(iEntry) == false)
+      return false;
+
+   if(Tree->GetEntry(iEntry) <= 0)
+      return false;
+
+   for(BranchRecord &B : Branches)
+      if(B.Active == true && B.Packed == false && NeedsStaging(B) == true)
+         WidenBranch(B);
+   UnpackPID();
 
-   return (Tree->GetEntry(iEntry) > 0);
+   CurrentEntry = iEntry;
+
+   return true;
 }
 
 long long StrangenessTreeMessenger::GetEntries() const
@@ -180,3 +388,565 @@ long long StrangenessTreeMessenger::GetEntries() const
       return 0;
    return Tree->GetEntries();
 }
+
+int StrangenessTreeMessenger::ParseBranchGroups(const std::string &groups)
+{
+   int Result = GroupNone;
+
+   std::stringstream Stream(groups);
+   std::string Token;
+   while(std::getline(Stream, Token, ','))
+   {
+      // strip spaces around the group name
+      while(Token.size() > 0 && Token[0] == ' ')
+         Token.erase(Token.begin());
+      while(Token.size() > 0 && Token[Token.size()-1] == ' ')
+         Token.erase(Token.size() - 1);
+      if(Token == "")
+         continue;
+
+      if(Token == "EventScalars" || Token == "Event")               Result = Result | GroupEventScalars;
+      else if(Token == "RecoKinematics" || Token == "Reco")         Result = Result | GroupRecoKinematics;
+      else if(Token == "RecoPID" || Token == "PID")                 Result = Result | GroupRecoPID;
+      else if(Token == "RecoEfficiency" || Token == "Efficiency")   Result = Result | GroupRecoEfficiency;
+      else if(Token == "Gen")                                       Result = Result | GroupGen;
+      else if(Token == "Sim")                                       Result = Result | GroupSim;
+      else if(Token == "KShort")                                    Result = Result | GroupKShort;
+      else if(Token == "Phi")                                       Result = Result | GroupPhi;
+      else if(Token == "All")                                       Result = Result | GroupAll;
+      else if(Token == "None")                                      Result = Result | GroupNone;
+      else
+      {
+         std::cerr << "[StrangenessTreeMessenger] Unknown branch group \"" << Token << "\"" << std::endl;
+         return -1;
+      }
+   }
+
+   return Result;
+}
+
+bool StrangenessTreeMessenger::SetBranchGroups(int groups)
+{
+   if(Tree == nullptr)
+      return false;
+
+   for(BranchRecord &B : Branches)
+      B.Active = (B.Present == true && (B.Group & groups) != 0);
+
+   ApplyBranchStatus();
+   return true;
+}
+
+bool StrangenessTreeMessenger::SetBranchGroups(const std::string &groups)
+{
+   int Groups = ParseBranchGroups(groups);
+   if(Groups < 0)
+      return false;
+   return SetBranchGroups(Groups);
+}
+
+bool StrangenessTreeMessenger::EnableBranch(const std::string &name)
+{
+   if(Tree == nullptr)
+      return false;
+
+   bool Success = MarkBranchActive(name);
+   ApplyBranchStatus();
+   return Success;
+}
+
+bool StrangenessTreeMessenger::EnableBranches(const std::vector<std::string> &names)
+{
+   if(Tree == nullptr)
+      return false;
+
+   bool Success = true;
+   for(const std::string &Name : names)
+      Success = MarkBranchActive(Name) && Success;
+   ApplyBranchStatus();
+   return Success;
+}
+
+bool StrangenessTreeMessenger::EnableOnlyBranches(const std::vector<std::string> &names)
+{
+   if(SetBranchGroups(GroupNone) == false)
+      return false;
+   return EnableBranches(names);
+}
+
+void StrangenessTreeMessenger::EnableAllBranches()
+{
+   SetBranchGroups(GroupAll);
+}
+
+bool StrangenessTreeMessenger::IsBranchActive(const std::string &name) const
+{
+   for(const BranchRecord &B : Branches)
+      if(B.Name == name)
+         return B.Active;
+   return false;
+}
+
+bool StrangenessTreeMessenger::HasBranch(const std::string &name) const
+{
+   for(const BranchRecord &B : Branches)
+      if(B.Name == name)
+         return B.Present;
+   return false;
+}
+
+std::vector<std::string> StrangenessTreeMessenger::GetActiveBranches() const
+{
+   std::vector<std::string> Result;
+   for(const BranchRecord &B : Branches)
+      if(B.Active == true)
+         Result.push_back(B.Name);
+   return Result;
+}
+
+bool StrangenessTreeMessenger::MarkBranchActive(const std::string &name)
+{
+   for(BranchRecord &B : Branches)
+   {
+      if(B.Name != name)
+         continue;
+      if(B.Present == false)
+         return false;
+
+      B.Active = true;
+      if(B.Counter != "")
+         MarkBranchActive(B.Counter);
+      if(B.Packed == true)
+         MarkBranchActive("RecoPIDPacked");
+      return true;
+   }
+
+   std::cerr << "[StrangenessTreeMessenger] Unknown branch \"" << name << "\"" << std::endl;
+   return false;
+}
+
+void StrangenessTreeMessenger::ApplyBranchStatus()
+{
+   if(Tree == nullptr)
+      return;
+
+   // Switch everything off first so that branches unknown to the messenger are not read either
+   Tree->SetBranchStatus("*", 0);
+   for(BranchRecord &B : Branches)
+      if(B.Active == true && B.Packed == false)
+         Tree->SetBranchStatus(B.Name.c_str(), 1);
+
+   // The "*" above reaches into friends as well
+   if(SummaryChain != nullptr)
+      SummaryChain->SetBranchStatus("*", 1);
+
+   UpdateCacheBranches();
+}
+
+void StrangenessTreeMessenger::SetCacheSize(long long bytes)
+{
+   CacheSize = bytes;
+   if(Tree == nullptr || CacheSize <= 0)
+      return;
+
+   Tree->SetCacheSize(CacheSize);
+   UpdateCacheBranches();
+}
+
+void StrangenessTreeMessenger::UpdateCacheBranches()
+{
+   if(Tree == nullptr || CacheSize <= 0)
+      return;
+
+   // The active set is known up front, so skip the learning phase and prefetch exactly those baskets
+   Tree->DropBranchFromCache("*", true);
+   for(BranchRecord &B : Branches)
+      if(B.Active == true && B.Packed == false)
+         Tree->AddBranchToCache(B.Name.c_str(), true);
+   Tree->StopCacheLearningPhase();
+}
+
+std::vector<std::string> StrangenessTreeMessenger::ExpandInputList(const std::string &inputs)
+{
+   std::vector<std::string> Result;
+
+   std::stringstream Stream(inputs);
+   std::string Token;
+   while(std::getline(Stream, Token, ','))
+   {
+      while(Token.size() > 0 && (Token[0] == ' ' || Token[0] == '\t'))
+         Token.erase(Token.begin());
+      while(Token.size() > 0 && (Token[Token.size()-1] == ' ' || Token[Token.size()-1] == '\t' || Token[Token.size()-1] == '\r'))
+         Token.erase(Token.size() - 1);
+      if(Token == "")
+         continue;
+
+      bool IsList = (Token.size() > 4 && Token.substr(Token.size() - 4) == ".txt")
+         || (Token.size() > 5 && Token.substr(Token.size() - 5) == ".list");
+      if(IsList == false)
+      {
+         Result.push_back(Token);
+         continue;
+      }
+
+      std::ifstream in(Token.c_str());
+      if(in.is_open() == false)
+      {
+         std::cerr << "[StrangenessTreeMessenger] Cannot open input list \"" << Token << "\"" << std::endl;
+         continue;
+      }
+
+      std::string Line;
+      while(std::getline(in, Line))
+      {
+         if(Line.find('#') != std::string::npos)
+            Line.erase(Line.find('#'));
+
+         std::vector<std::string> Entries = ExpandInputList(Line);
+         Result.insert(Result.end(), Entries.begin(), Entries.end());
+      }
+   }
+
+   return Result;
+}
+
+bool StrangenessTreeMessenger::AttachSummary(const std::string &inputs, const std::string &treeName)
+{
+   if(Tree == nullptr)
+      return false;
+   if(SummaryChain != nullptr)
+   {
+      std::cerr << "[StrangenessTreeMessenger] A summary tree is already attached" << std::endl;
+      return false;
+   }
+
+   std::vector<std::string> Files = ExpandInputList(inputs);
+   if(Files.size() == 0)
+   {
+      std::cerr << "[StrangenessTreeMessenger] No summary files in \"" << inputs << "\"" << std::endl;
+      return false;
+   }
+
+   TChain *NewChain = new TChain(treeName.c_str());
+   for(const std::string &File : Files)
+      if(NewChain->Add(File.c_str()) == 0)
+         std::cerr << "[StrangenessTreeMessenger] Nothing matches \"" << File << "\"" << std::endl;
+
+   // Entries are matched by number only, so anything but an exact match is a different sample
+   if(NewChain->GetNtrees() == 0 || NewChain->GetEntries() != Tree->GetEntries())
+   {
+      std::cerr << "[StrangenessTreeMessenger] Summary \"" << inputs << "\" has " << NewChain->GetEntries()
+         << " entries, tree has " << Tree->GetEntries() << std::endl;
+      delete NewChain;
+      return false;
+   }
+   if(Summary.SetBranchAddresses(NewChain) == false)
+   {
+      std::cerr << "[StrangenessTreeMessenger] Summary \"" << inputs << "\" is missing branches" << std::endl;
+      delete NewChain;
+      return false;
+   }
+
+   SummaryChain = NewChain;
+   Tree->AddFriend(SummaryChain);
+
+   return true;
+}
+
+bool StrangenessTreeMessenger::HasSummary() const
+{
+   return (SummaryChain != nullptr);
+}
+
+bool StrangenessTreeMessenger::EnableTrackCache(int fields)
+{
+   std::vector<std::string> Needed = {"RecoPx", "RecoPy", "RecoPz"};
+   if((fields & CacheYThrust) != 0)
+      Needed.insert(Needed.end(), {"RecoE", "ThrustX", "ThrustY", "ThrustZ"});
+
+   // Reallocated on the next fill, so newly requested fields get their arrays
+   CacheFields   = fields & CacheAll;
+   CacheEntry    = -1;
+   CacheCapacity = 0;
+   if(CacheFields == CacheNone)
+      return true;
+   return EnableBranches(Needed);
+}
+
+const StrangenessTreeMessenger::TrackCache &StrangenessTreeMessenger::GetTrackCache()
+{
+   if(CacheEntry != CurrentEntry || CurrentEntry < 0)
+      FillTrackCache();
+   return Cache;
+}
+
+void StrangenessTreeMessenger::FillTrackCache()
+{
+   Cache.N = 0;
+   if(CurrentEntry < 0 || CacheFields == CacheNone)
+      return;
+
+   long long N = (NReco < GetCapacity("NReco")) ? NReco : GetCapacity("NReco");
+
+   if(N > CacheCapacity)
+   {
+      long long Capacity = (N + 7) / 8 * 8;
+      if(Capacity < 2 * CacheCapacity)
+         Capacity = 2 * CacheCapacity;
+
+      std::pair<double **, int> Fields[] = {{&Cache.P, CacheP}, {&Cache.Pt, CachePt}, {&Cache.Eta, CacheEta},
+         {&Cache.AbsCos, CacheAbsCos}, {&Cache.YThrust, CacheYThrust}, {&Cache.EPion, CacheEnergies},
+         {&Cache.EKaon, CacheEnergies}, {&Cache.EProton, CacheEnergies}};
+      for(std::pair<double **, int> &F : Fields)
+      {
+         std::free(*F.first);
+         *F.first = nullptr;
+         if((CacheFields & F.second) == 0)
+            continue;
+         *F.first = (double *)std::aligned_alloc(64, Capacity * sizeof(double));
+         if(*F.first == nullptr)
+         {
+            std::cerr << "[StrangenessTreeMessenger] Failed to allocate the track cache" << std::endl;
+            std::abort();
+         }
+      }
+      CacheCapacity = Capacity;
+   }
+
+   // Batch kernels over the aligned Reco arrays; eta has no batch form (asinh) and stays a plain loop
+   if((CacheFields & CacheP) != 0)
+      KinematicsBatch::Momentum(RecoPx, RecoPy, RecoPz, Cache.P, N);
+   if((CacheFields & CachePt) != 0)
+      KinematicsBatch::TransverseMomentum(RecoPx, RecoPy, Cache.Pt, N);
+   if((CacheFields & CacheEta) != 0)
+      for(long long i = 0; i < N; i++)
+         Cache.Eta[i] = std::asinh(RecoPz[i] / std::sqrt(RecoPx[i] * RecoPx[i] + RecoPy[i] * RecoPy[i]));
+   if((CacheFields & CacheAbsCos) != 0)
+      KinematicsBatch::AbsCosTheta(RecoPx, RecoPy, RecoPz, Cache.AbsCos, N);
+   if((CacheFields & CacheEnergies) != 0)
+   {
+      KinematicsBatch::Energy(RecoPx, RecoPy, RecoPz, STRANGE_MASS_PION, Cache.EPion, N);
+      KinematicsBatch::Energy(RecoPx, RecoPy, RecoPz, STRANGE_MASS_KAON, Cache.EKaon, N);
+      KinematicsBatch::Energy(RecoPx, RecoPy, RecoPz, STRANGE_MASS_PROTON, Cache.EProton, N);
+   }
+   if((CacheFields & CacheYThrust) != 0)
+      KinematicsBatch::AxisRapidity(RecoPx, RecoPy, RecoPz, RecoE, ThrustX, ThrustY, ThrustZ, Cache.YThrust, N);
+
+   Cache.N    = N;
+   CacheEntry = CurrentEntry;
+}
+
+void StrangenessTreeMessenger::SetBufferMode(BufferMode mode)
+{
+   Mode = mode;
+   for(CounterRecord &C : Counters)
+      ResizeBuffers(C, (Mode == BufferFixed) ? C.FixedCapacity : STRANGE_DYNAMIC_INITIAL);
+}
+
+StrangenessTreeMessenger::BufferMode StrangenessTreeMessenger::GetBufferMode() const
+{
+   return Mode;
+}
+
+long long StrangenessTreeMessenger::GetCapacity(const std::string &counter) const
+{
+   for(const CounterRecord &C : Counters)
+      if(C.Name == counter)
+         return C.Capacity;
+   return 0;
+}
+
+size_t StrangenessTreeMessenger::GetBufferBytes() const
+{
+   size_t Bytes = 0;
+   for(const BranchRecord &B : Branches)
+   {
+      if(B.Buffer == nullptr)
+         continue;
+      for(const CounterRecord &C : Counters)
+         if(C.Name == B.Counter)
+            Bytes = Bytes + C.Capacity * B.ElementSize;
+   }
+   return Bytes;
+}
+
+void StrangenessTreeMessenger::ResizeBuffers(CounterRecord &counter, long long capacity)
+{
+   // whole cache lines, so that the vectorised loops downstream never straddle a partial line
+   if(capacity < 8)
+      capacity = 8;
+   capacity = (capacity + 7) / 8 * 8;
+
+   for(BranchRecord &B : Branches)
+   {
+      if(B.Buffer == nullptr || B.Counter != counter.Name)
+         continue;
+
+      size_t Bytes = (capacity * B.ElementSize + 63) / 64 * 64;
+      void *NewBuffer = std::aligned_alloc(64, Bytes);
+      if(NewBuffer == nullptr)
+      {
+         std::cerr << "[StrangenessTreeMessenger] Failed to allocate " << Bytes << " bytes for " << B.Name << std::endl;
+         std::abort();
+      }
+      std::memset(NewBuffer, 0, Bytes);
+
+      std::free(*B.Buffer);
+      *B.Buffer = NewBuffer;
+   }
+
+   counter.Capacity = capacity;
+
+   for(BranchRecord &B : Branches)
+      if(B.Buffer != nullptr && B.Counter == counter.Name)
+         BindBranch(B);
+}
+
+bool StrangenessTreeMessenger::ReserveForEntry(long long iEntry)
+{
+   // Read the counters on their own first, so the arrays can be enlarged before ROOT writes into them
+   long long LocalEntry = Tree->LoadTree(iEntry);
+   if(LocalEntry < 0)
+      return false;
+
+   TTree *Current = Tree->GetTree();
+   if(Current == nullptr)
+      return false;
+
+   for(CounterRecord &C : Counters)
+   {
+      if(IsBranchActive(C.Name) == false)
+         continue;
+
+      TBranch *Branch = Current->GetBranch(C.Name.c_str());
+      if(Branch == nullptr)
+         continue;
+      if(Branch->GetEntry(LocalEntry) <= 0)
+         continue;
+      BranchRecord *Record = FindBranch(C.Name);
+      if(NeedsStaging(*Record) == true)
+         WidenBranch(*Record);
+
+      if(*C.Value > C.Capacity)
+      {
+         long long Capacity = C.Capacity * 2;
+         if(Capacity < *C.Value)
+            Capacity = *C.Value;
+         ResizeBuffers(C, Capacity);
+      }
+   }
+
+   return true;
+}
+
+std::vector<std::string> StrangenessTreeMessenger::PackedPIDBranches()
+{
+   return {"RecoPIDElectron", "RecoPIDProton", "RecoPIDKaon", "RecoPIDPion", "RecoPIDHeavy"};
+}
+
+StrangenessTreeMessenger::BranchRecord *StrangenessTreeMessenger::FindBranch(const std::string &name)
+{
+   for(BranchRecord &B : Branches)
+      if(B.Name == name)
+         return &B;
+   return nullptr;
+}
+
+char StrangenessTreeMessenger::LeafTypeCode(const std::string &typeName)
+{
+   if(typeName == "Double_t" || typeName == "double")             return 'D';
+   if(typeName == "Double32_t")                                   return 'd';   // read straight into double
+   if(typeName == "Float_t" || typeName == "float")               return 'F';
+   if(typeName == "Long64_t" || typeName == "long long")          return 'L';
+   if(typeName == "ULong64_t" || typeName == "unsigned long long") return 'l';
+   if(typeName == "Int_t" || typeName == "int")                   return 'I';
+   if(typeName == "UInt_t" || typeName == "unsigned int")         return 'i';
+   if(typeName == "Short_t" || typeName == "short")               return 'S';
+   if(typeName == "UShort_t" || typeName == "unsigned short")     return 's';
+   if(typeName == "Char_t" || typeName == "char")                 return 'B';
+   if(typeName == "UChar_t" || typeName == "unsigned char")       return 'b';
+   if(typeName == "Bool_t" || typeName == "bool")                 return 'O';
+   return 0;
+}
+
+bool StrangenessTreeMessenger::NeedsStaging(const BranchRecord &B) const
+{
+   if(B.StoredType == B.Type)
+      return false;
+   if(B.Type == 'D' && B.StoredType == 'd')
+      return false;
+   return true;
+}
+
+void StrangenessTreeMessenger::BindBranch(BranchRecord &B)
+{
+   if(Tree == nullptr || B.Present == false || B.Packed == true)
+      return;
+
+   void *Target = (B.Buffer != nullptr) ? *B.Buffer : B.Address;
+   if(NeedsStaging(B) == true)
+   {
+      // one 8-byte slot per element is enough for any of the narrow types
+      long long Size = (B.Buffer != nullptr) ? GetCapacity(B.Counter) : 1;
+      B.Staging.assign(Size, 0);
+      Target = B.Staging.data();
+   }
+
+   Tree->SetBranchAddress(B.Name.c_str(), Target);
+}
+
+template <class T>
+static void WidenArray(T *target, char storedType, const void *source, long long n)
+{
+   for(long long i = 0; i < n; i++)
+   {
+      switch(storedType)
+      {
+         case 'D': target[i] = (T)((const double *)source)[i];             break;
+         case 'F': target[i] = (T)((const float *)source)[i];              break;
+         case 'L': target[i] = (T)((const long long *)source)[i];          break;
+         case 'l': target[i] = (T)((const unsigned long long *)source)[i]; break;
+         case 'I': target[i] = (T)((const int *)source)[i];                break;
+         case 'i': target[i] = (T)((const unsigned int *)source)[i];       break;
+         case 'S': target[i] = (T)((const short *)source)[i];              break;
+         case 's': target[i] = (T)((const unsigned short *)source)[i];     break;
+         case 'B': target[i] = (T)((const signed char *)source)[i];        break;
+         case 'b': target[i] = (T)((const unsigned char *)source)[i];      break;
+         case 'O': target[i] = (T)((const bool *)source)[i];               break;
+      }
+   }
+}
+
+void StrangenessTreeMessenger::WidenBranch(BranchRecord &B)
+{
+   long long N = 1;
+   void *Target = B.Address;
+   if(B.Buffer != nullptr)
+   {
+      N = 0;
+      for(const CounterRecord &C : Counters)
+         if(C.Name == B.Counter)
+            N = (*C.Value < C.Capacity) ? *C.Value : C.Capacity;
+      Target = *B.Buffer;
+   }
+
+   if(B.Type == 'D')
+      WidenArray((double *)Target, B.StoredType, B.Staging.data(), N);
+   else
+      WidenArray((long long *)Target, B.StoredType, B.Staging.data(), N);
+}
+
+void StrangenessTreeMessenger::UnpackPID()
+{
+   long long Mask = (1LL << STRANGE_PID_PACK_BITS) - 1;
+
+   for(BranchRecord &B : Branches)
+   {
+      if(B.Packed == false || B.Active == false)
+         continue;
+
+      long long *Target = (long long *)(*B.Buffer);
+      for(long long i = 0; i < NReco; i++)
+         Target[i] = ((RecoPIDPacked[i] >> B.PackShift) & Mask) - 1;
+   }
+}
@@ -0,0 +1,580 @@
+#include "StrangenessWriter.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+#include "TNamed.h"
+#include "TParameter.h"
+
+StrangenessTreeWriter::StrangenessTreeWriter(TDirectory *directory, const std::string &treeName)
+   : Directory(directory), TreeName(treeName), Tree(nullptr),
+     Groups(StrangenessTreeMessenger::GroupAll), Filter(FilterNone), AbsCosMin(0), AbsCosMax(1),
+     StorageSchema(SchemaFull), EffectiveSchema(SchemaFull), MantissaBits(16),
+     EventsSeen(0), EventsWritten(0), TracksSeen(0), TracksWritten(0), Overflows(0)
+{
+}
+
+StrangenessTreeWriter::~StrangenessTreeWriter()
+{
+   // the output tree belongs to its directory
+}
+
+void StrangenessTreeWriter::SetBranchGroups(int groups)
+{
+   Groups = groups;
+}
+
+bool StrangenessTreeWriter::SetBranchGroups(const std::string &groups)
+{
+   int Result = StrangenessTreeMessenger::ParseBranchGroups(groups);
+   if(Result < 0)
+      return false;
+   Groups = Result;
+   return true;
+}
+
+void StrangenessTreeWriter::SetTrackFilter(int filter)
+{
+   Filter = filter;
+}
+
+void StrangenessTreeWriter::SetAcceptance(double absCosMin, double absCosMax)
+{
+   AbsCosMin = absCosMin;
+   AbsCosMax = absCosMax;
+}
+
+void StrangenessTreeWriter::SetSchema(int schema, int mantissaBits)
+{
+   StorageSchema = schema;
+   EffectiveSchema = schema;
+   MantissaBits = mantissaBits;
+   if(MantissaBits < 2)
+      MantissaBits = 2;
+   if(MantissaBits > 23)
+      MantissaBits = 23;
+}
+
+bool StrangenessTreeWriter::SetSchema(const std::string &schema, int mantissaBits)
+{
+   int Result = SchemaFull;
+
+   std::stringstream Stream(schema);
+   std::string Token;
+   while(std::getline(Stream, Token, ','))
+   {
+      if(Token == "Full")               Result = Result | SchemaFull;
+      else if(Token == "Float")         Result = Result | SchemaFloat;
+      else if(Token == "Truncated")     Result = Result | SchemaTruncated;
+      else if(Token == "SmallInt")      Result = Result | SchemaSmallInt;
+      else if(Token == "PackPID")       Result = Result | SchemaPackPID;
+      else if(Token == "Compact")       Result = Result | SchemaCompact;
+      else
+      {
+         std::cerr << "[StrangenessTreeWriter] Unknown schema \"" << Token << "\"" << std::endl;
+         return false;
+      }
+   }
+
+   SetSchema(Result, mantissaBits);
+   return true;
+}
+
+char StrangenessTreeWriter::StorageType(const std::string &name, char type) const
+{
+   bool SmallInt = ((StorageSchema & SchemaSmallInt) != 0);
+
+   if(type == 'D')
+   {
+      if(SmallInt == true && name == "RecoCharge")
+         return 'B';
+      if((StorageSchema & SchemaTruncated) != 0)
+         return 'd';
+      if((StorageSchema & SchemaFloat) != 0)
+         return 'F';
+      return 'D';
+   }
+
+   if(SmallInt == false)
+      return 'L';
+
+   if(name == "PassNch" || name == "PassThrust" || name == "PassTotalE" || name == "PassAll"
+      || name == "RecoPIDElectron" || name == "RecoPIDProton" || name == "RecoPIDKaon"
+      || name == "RecoPIDPion" || name == "RecoPIDHeavy" || name == "RecoMuID" || name == "RecoEleID"
+      || name == "RecoConversionID" || name == "RecoGoodTrack" || name == "RecoGoodNeutral")
+      return 'B';
+   if(name == "GenStatus")
+      return 'S';
+   if(name == "Run" || name == "Event" || name == "Fill")
+      return 'L';
+   return 'I';
+}
+
+void StrangenessTreeWriter::AddProvenance(const std::string &line)
+{
+   Provenance.push_back(line);
+}
+
+bool StrangenessTreeWriter::Initialize(StrangenessTreeMessenger &M)
+{
+   if(M.Tree == nullptr || Directory == nullptr)
+      return false;
+   if(Tree != nullptr)
+   {
+      std::cerr << "[StrangenessTreeWriter] Already initialized" << std::endl;
+      return false;
+   }
+
+   // The filter needs its inputs even if they are not written out
+   std::vector<std::string> Needed;
+   if((Filter & FilterGoodTrack) != 0)
+      Needed.push_back("RecoGoodTrack");
+   if((Filter & FilterAcceptance) != 0)
+   {
+      Needed.push_back("RecoPx");
+      Needed.push_back("RecoPy");
+      Needed.push_back("RecoPz");
+   }
+   for(const std::string &Name : Needed)
+   {
+      if(M.IsBranchActive(Name) == false)
+      {
+         std::cerr << "[StrangenessTreeWriter] Track filter needs branch " << Name << " to be read" << std::endl;
+         return false;
+      }
+   }
+
+   // Only branches that are actually being read carry valid data
+   int N = M.Branches.size();
+   std::vector<bool> Selected(N, false);
+   for(int i = 0; i < N; i++)
+      if(M.Branches[i].Active == true && (M.Branches[i].Group & Groups) != 0)
+         Selected[i] = true;
+
+   // RecoPIDPacked on the input is already unpacked into the PID arrays by the messenger
+   for(int i = 0; i < N; i++)
+      if(M.Branches[i].Name == "RecoPIDPacked")
+         Selected[i] = false;
+
+   // Packing needs all five tags; without them the tags that are there are written unpacked
+   std::vector<std::string> PackedNames = StrangenessTreeMessenger::PackedPIDBranches();
+   bool PackPID = ((StorageSchema & SchemaPackPID) != 0);
+   PackPIDMissing.clear();
+   for(const std::string &Name : PackedNames)
+      for(int i = 0; i < N; i++)
+         if(M.Branches[i].Name == Name && Selected[i] == false)
+            PackPIDMissing.push_back(Name);
+   EffectiveSchema = StorageSchema;
+   if(PackPID == true && PackPIDMissing.size() > 0)
+   {
+      PackPID = false;
+      EffectiveSchema = EffectiveSchema & ~SchemaPackPID;
+      std::cerr << "[StrangenessTreeWriter] Warning: PackPID needs all five PID tags, not packing; not selected:";
+      for(const std::string &Name : PackPIDMissing)
+         std::cerr << " " << Name;
+      std::cerr << std::endl;
+   }
+   for(int i = 0; i < N; i++)
+   {
+      if(Selected[i] == false || M.Branches[i].Counter == "")
+         continue;
+      for(int j = 0; j < N; j++)
+         if(M.Branches[j].Name == M.Branches[i].Counter)
+            Selected[j] = true;
+   }
+
+   bool Filtering = (Filter != FilterNone);
+
+   Branches.clear();
+   for(int i = 0; i < N; i++)
+   {
+      if(Selected[i] == false)
+         continue;
+
+      const StrangenessTreeMessenger::BranchRecord &R = M.Branches[i];
+
+      if(PackPID == true && R.PackShift >= 0)
+      {
+         // the packed branch takes the place of the first PID tag
+         if(R.PackShift > 0)
+            continue;
+
+         OutputBranch B;
+         B.Name        = "RecoPIDPacked";
+         B.Type        = 'L';
+         B.StoredType  = 's';
+         B.Counter     = "NReco";
+         B.Role        = RolePackedPID;
+         B.Partner     = -1;
+         B.Source      = nullptr;
+         B.SourceArray = nullptr;
+         B.SourceCount = &M.NReco;
+         B.ScalarD     = 0;
+         B.ScalarL     = 0;
+         B.Count       = 0;
+         for(const std::string &Name : PackedNames)
+            for(int j = 0; j < N; j++)
+               if(M.Branches[j].Name == Name)
+                  B.PackSources.push_back(M.Branches[j].Buffer);
+         Branches.push_back(B);
+         continue;
+      }
+
+      OutputBranch B;
+      B.Name        = R.Name;
+      B.Type        = R.Type;
+      B.StoredType  = StorageType(R.Name, R.Type);
+      B.Counter     = R.Counter;
+      B.Role        = RoleCopy;
+      B.Partner     = -1;
+      B.Source      = R.Address;
+      B.SourceArray = R.Buffer;
+      B.SourceCount = nullptr;
+      B.ScalarD     = 0;
+      B.ScalarL     = 0;
+      B.Count       = 0;
+
+      for(const StrangenessTreeMessenger::CounterRecord &C : M.Counters)
+         if(C.Name == R.Counter)
+            B.SourceCount = C.Value;
+
+      if(Filtering == true)
+      {
+         if(R.Name == "NReco")
+            B.Role = RoleRecoCounter;
+         else if(R.Counter == "NReco")
+            B.Role = RoleRecoArray;
+         else if(R.Name == "GenMatchIndex" || R.Name == "KShortReco1ID" || R.Name == "KShortReco2ID"
+            || R.Name == "PhiReco1ID" || R.Name == "PhiReco2ID")
+            B.Role = RoleRecoIndex;
+         else if(R.Name == "GenMatchAngle" || R.Name == "KShortReco1Angle" || R.Name == "KShortReco2Angle"
+            || R.Name == "PhiReco1Angle" || R.Name == "PhiReco2Angle")
+            B.Role = RoleMatchAngle;
+      }
+
+      Branches.push_back(B);
+   }
+
+   // Pair every renumbered index with its match angle (XXXIndex -> XXXAngle, XXXID -> XXXAngle)
+   for(OutputBranch &B : Branches)
+   {
+      if(B.Role != RoleRecoIndex)
+         continue;
+      std::string Angle = B.Name;
+      if(Angle.size() > 5 && Angle.substr(Angle.size() - 5) == "Index")
+         Angle = Angle.substr(0, Angle.size() - 5) + "Angle";
+      else if(Angle.size() > 2 && Angle.substr(Angle.size() - 2) == "ID")
+         Angle = Angle.substr(0, Angle.size() - 2) + "Angle";
+      for(int j = 0; j < (int)Branches.size(); j++)
+         if(Branches[j].Name == Angle)
+            B.Partner = j;
+   }
+
+   // Branches is final from here on, so the scalar addresses stay valid
+   TDirectory *Previous = gDirectory;
+   Directory->cd();
+   Tree = new TTree(TreeName.c_str(), TreeName.c_str());
+   for(OutputBranch &B : Branches)
+   {
+      std::string Type = std::string("/") + B.StoredType;
+      if(B.StoredType == 'd')
+         Type = "/d[0,0," + std::to_string(MantissaBits) + "]";
+
+      std::string Leaf = B.Name + Type;
+      if(B.Counter != "")
+         Leaf = B.Name + "[" + B.Counter + "]" + Type;
+
+      if(B.Counter != "")
+         Reserve(B, STRANGE_DYNAMIC_INITIAL);
+      else
+         B.Encoded.assign(1, 0);
+
+      Tree->Branch(B.Name.c_str(), OutputAddress(B), Leaf.c_str());
+   }
+   if(Previous != nullptr)
+      Previous->cd();
+
+   return true;
+}
+
+bool StrangenessTreeWriter::KeepTrack(StrangenessTreeMessenger &M, long long i) const
+{
+   if((Filter & FilterGoodTrack) != 0 && M.RecoGoodTrack[i] != 1)
+      return false;
+
+   if((Filter & FilterAcceptance) != 0)
+   {
+      double P = std::sqrt(M.RecoPx[i] * M.RecoPx[i] + M.RecoPy[i] * M.RecoPy[i] + M.RecoPz[i] * M.RecoPz[i]);
+      if(P <= 0)
+         return false;
+      double AbsCosTheta = std::fabs(M.RecoPz[i] / P);
+      if(AbsCosTheta < AbsCosMin || AbsCosTheta > AbsCosMax)
+         return false;
+   }
+
+   return true;
+}
+
+void StrangenessTreeWriter::Reserve(OutputBranch &B, long long size)
+{
+   long long Current = (B.Type == 'D') ? B.ArrayD.size() : B.ArrayL.size();
+   if(size <= Current && Current > 0)
+      return;
+
+   long long Capacity = (Current * 2 > size) ? Current * 2 : size;
+   if(Capacity < 1)
+      Capacity = 1;
+
+   if(B.Type == 'D')
+      B.ArrayD.resize(Capacity);
+   else
+      B.ArrayL.resize(Capacity);
+   B.Encoded.resize(Capacity);
+
+   if(Tree != nullptr && Tree->GetBranch(B.Name.c_str()) != nullptr)
+      BindBranch(B);
+}
+
+void StrangenessTreeWriter::BindBranch(OutputBranch &B)
+{
+   Tree->SetBranchAddress(B.Name.c_str(), OutputAddress(B));
+}
+
+void *StrangenessTreeWriter::OutputAddress(OutputBranch &B)
+{
+   // Double32_t is handed a double buffer; ROOT truncates while streaming
+   bool Direct = (B.StoredType == B.Type || (B.Type == 'D' && B.StoredType == 'd'));
+   if(Direct == false)
+      return B.Encoded.data();
+
+   if(B.Counter == "")
+      return (B.Type == 'D') ? (void *)&B.ScalarD : (void *)&B.ScalarL;
+   return (B.Type == 'D') ? (void *)B.ArrayD.data() : (void *)B.ArrayL.data();
+}
+
+template <class T, class S>
+static long long Narrow(T *target, const S *source, long long n, double low, double high)
+{
+   long long Clamped = 0;
+   for(long long i = 0; i < n; i++)
+   {
+      S Value = source[i];
+      if(Value < low)       { Value = low;  Clamped = Clamped + 1; }
+      else if(Value > high) { Value = high; Clamped = Clamped + 1; }
+      target[i] = (T)Value;
+   }
+   return Clamped;
+}
+
+template <class S>
+static long long NarrowTo(char type, void *target, const S *source, long long n)
+{
+   switch(type)
+   {
+      case 'F': return Narrow((float *)target, source, n, -3.4e38, 3.4e38);
+      case 'I': return Narrow((int *)target, source, n, -2147483648.0, 2147483647.0);
+      case 'S': return Narrow((short *)target, source, n, -32768, 32767);
+      case 's': return Narrow((unsigned short *)target, source, n, 0, 65535);
+      case 'B': return Narrow((signed char *)target, source, n, -128, 127);
+   }
+   return 0;
+}
+
+void StrangenessTreeWriter::Encode(OutputBranch &B)
+{
+   if(OutputAddress(B) != B.Encoded.data())
+      return;
+
+   long long N = (B.Counter == "") ? 1 : B.Count;
+   if(B.Type == 'D')
+      Overflows = Overflows + NarrowTo(B.StoredType, B.Encoded.data(), (B.Counter == "") ? &B.ScalarD : B.ArrayD.data(), N);
+   else
+      Overflows = Overflows + NarrowTo(B.StoredType, B.Encoded.data(), (B.Counter == "") ? &B.ScalarL : B.ArrayL.data(), N);
+}
+
+void StrangenessTreeWriter::CountSkipped(long long events)
+{
+   EventsSeen = EventsSeen + events;
+}
+
+bool StrangenessTreeWriter::Fill(StrangenessTreeMessenger &M)
+{
+   if(Tree == nullptr)
+      return false;
+
+   EventsSeen = EventsSeen + 1;
+
+   long long NReco = M.NReco;
+   long long NKept = NReco;
+   if(Filter != FilterNone)
+   {
+      RecoMap.assign(NReco, -1);
+      NKept = 0;
+      for(long long i = 0; i < NReco; i++)
+      {
+         if(KeepTrack(M, i) == false)
+            continue;
+         RecoMap[i] = NKept;
+         NKept = NKept + 1;
+      }
+   }
+   TracksSeen = TracksSeen + NReco;
+   TracksWritten = TracksWritten + NKept;
+
+   // First pass: plain copies and compaction of the Reco arrays
+   for(OutputBranch &B : Branches)
+   {
+      if(B.Counter == "")
+      {
+         if(B.Type == 'D')
+            B.ScalarD = *(double *)B.Source;
+         else
+            B.ScalarL = *(long long *)B.Source;
+         if(B.Role == RoleRecoCounter)
+            B.ScalarL = NKept;
+         continue;
+      }
+
+      long long Count = (B.SourceCount != nullptr) ? *B.SourceCount : 0;
+      if(Count < 0)
+         Count = 0;
+      Reserve(B, Count);
+      B.Count = Count;
+
+      if(B.Role == RolePackedPID)
+      {
+         long long Mask = (1LL << STRANGE_PID_PACK_BITS) - 1;
+         for(long long i = 0; i < NReco; i++)
+         {
+            long long j = (Filter != FilterNone) ? RecoMap[i] : i;
+            if(j < 0)
+               continue;
+
+            long long Packed = 0;
+            for(int k = 0; k < (int)B.PackSources.size(); k++)
+            {
+               long long Tag = ((long long *)(*B.PackSources[k]))[i] + 1;
+               if(Tag < 0 || Tag > Mask)
+               {
+                  Tag = (Tag < 0) ? 0 : Mask;
+                  Overflows = Overflows + 1;
+               }
+               Packed = Packed | (Tag << (k * STRANGE_PID_PACK_BITS));
+            }
+            B.ArrayL[j] = Packed;
+         }
+         B.Count = NKept;
+      }
+      else if(B.Role == RoleRecoArray)
+      {
+         for(long long i = 0; i < NReco; i++)
+         {
+            if(RecoMap[i] < 0)
+               continue;
+            if(B.Type == 'D')
+               B.ArrayD[RecoMap[i]] = ((double *)(*B.SourceArray))[i];
+            else
+               B.ArrayL[RecoMap[i]] = ((long long *)(*B.SourceArray))[i];
+         }
+         B.Count = NKept;
+      }
+      else
+      {
+         if(B.Type == 'D')
+            std::copy((double *)(*B.SourceArray), (double *)(*B.SourceArray) + Count, B.ArrayD.begin());
+         else
+            std::copy((long long *)(*B.SourceArray), (long long *)(*B.SourceArray) + Count, B.ArrayL.begin());
+      }
+   }
+
+   // Second pass: renumber references into the Reco arrays
+   for(OutputBranch &B : Branches)
+   {
+      if(B.Role != RoleRecoIndex)
+         continue;
+
+      long long Count = (B.SourceCount != nullptr) ? *B.SourceCount : 0;
+      for(long long i = 0; i < Count; i++)
+      {
+         long long Old = B.ArrayL[i];
+         if(Old < 0 || Old >= NReco)
+            continue;
+         B.ArrayL[i] = RecoMap[Old];
+         if(RecoMap[Old] < 0 && B.Partner >= 0)
+            Branches[B.Partner].ArrayD[i] = STRANGE_WRITER_NO_MATCH;
+      }
+   }
+
+   for(OutputBranch &B : Branches)
+      Encode(B);
+
+   Tree->Fill();
+   EventsWritten = EventsWritten + 1;
+
+   return true;
+}
+
+std::string StrangenessTreeWriter::GetProvenance() const
+{
+   std::stringstream Out;
+
+   for(const std::string &Line : Provenance)
+      Out << Line << std::endl;
+
+   Out << "BranchGroups: 0x" << std::hex << Groups << std::dec << std::endl;
+   Out << "TrackFilter:";
+   if(Filter == FilterNone)
+      Out << " none";
+   if((Filter & FilterGoodTrack) != 0)
+      Out << " RecoGoodTrack==1";
+   if((Filter & FilterAcceptance) != 0)
+      Out << " " << AbsCosMin << "<=|cos(theta)|<=" << AbsCosMax;
+   Out << std::endl;
+   if(Filter != FilterNone)
+      Out << "RecoIndexRemap: GenMatchIndex, KShortReco1/2ID, PhiReco1/2ID renumbered; dropped tracks -> -1, angle "
+         << STRANGE_WRITER_NO_MATCH << std::endl;
+   Out << "Schema: 0x" << std::hex << EffectiveSchema << std::dec;
+   if((EffectiveSchema & SchemaTruncated) != 0)
+      Out << " (Double32 mantissa " << MantissaBits << " bits)";
+   Out << std::endl;
+   if(EffectiveSchema != StorageSchema)
+   {
+      Out << "SchemaRequested: 0x" << std::hex << StorageSchema << std::dec << "; PackPID dropped, not selected:";
+      for(const std::string &Name : PackPIDMissing)
+         Out << " " << Name;
+      Out << std::endl;
+   }
+   if(Overflows > 0)
+      Out << "NarrowingOverflows: " << Overflows << " values clamped" << std::endl;
+   Out << "Events: " << EventsWritten << " written of " << EventsSeen << std::endl;
+   Out << "Tracks: " << TracksWritten << " written of " << TracksSeen << std::endl;
+
+   Out << "Branches:";
+   for(const OutputBranch &B : Branches)
+      Out << " " << B.Name << "/" << B.StoredType;
+   Out << std::endl;
+
+   return Out.str();
+}
+
+void StrangenessTreeWriter::Write()
+{
+   if(Tree == nullptr)
+      return;
+
+   TDirectory *Previous = gDirectory;
+   Directory->cd();
+
+   Tree->Write();
+
+   TNamed Record("SkimProvenance", GetProvenance().c_str());
+   Record.Write();
+   TParameter<long long>("SkimEventsSeen", EventsSeen).Write();
+   TParameter<long long>("SkimEventsWritten", EventsWritten).Write();
+   TParameter<long long>("SkimTracksSeen", TracksSeen).Write();
+   TParameter<long long>("SkimTracksWritten", TracksWritten).Write();
+
+   if(Previous != nullptr)
+      Previous->cd();
+}
@@ -16,6 +16,10 @@
 //   IsGen=true  -> count K/π at generator level using GenID (PDG ID)
 //   IsGen=false -> (default) use reconstructed PID info
 //
+//   IsGen=both  -> reco mode, plus the generator-level histograms of the
+//                  same events written to GenOutput (default:
+//                  <Output without .root>_Gen.root), one pass over the tree
+//
 // In reco mode (IsGen=false), we now also apply a simple PID
 // matrix correction using the nine RecoEfficiency*As* arrays:
 //   - KAsK, KAsPi, PiAsK, PiAsPi
@@ -61,6 +65,8 @@ struct KtoPiParameters
    double MaxTheta;    // in radians
 
    bool   IsGen;       // if true, count K/π at generator level
+   bool   FillGenToo;  // reco mode plus the generator level into GenOutput (IsGen=both)
+   std::string GenOutput;
 
    KtoPiParameters()
       : input("sample/Strangeness/merged_mc_v2.root")
@@ -72,6 +78,8 @@ struct KtoPiParameters
       , MinTheta(30.0 * TMath::Pi() / 180.0)
       , MaxTheta(150.0 * TMath::Pi() / 180.0)
       , IsGen(false)
+      , FillGenToo(false)
+      , GenOutput("")
    {
    }
 };
@@ -106,8 +114,14 @@ public:
    double sumPiAsPi;
    long long countEffTracks;
 
+   // IsGen=both: generator-level analyzer filled from the events read by this one
+   KtoPiAnalyzer *genCompanion;
+   bool ownsMessenger;
+
 public:
-   KtoPiAnalyzer(const KtoPiParameters &apar)
+   // With shared != nullptr the entries are read by another analyzer through shared; only the
+   // output file is opened here
+   KtoPiAnalyzer(const KtoPiParameters &apar, StrangenessTreeMessenger *shared = nullptr)
       : inf(nullptr)
       , outf(nullptr)
       , M(nullptr)
@@ -123,7 +137,17 @@ public:
       , sumPiAsK(0.0)
       , sumPiAsPi(0.0)
       , countEffTracks(0)
+      , genCompanion(nullptr)
+      , ownsMessenger(shared == nullptr)
    {
+      if (shared != nullptr)
+      {
+         M = shared;
+         if (openOutput())
+            book();
+         return;
+      }
+
       // Open input
       inf = new TFile(par.input.c_str());
       if (inf == nullptr || inf->IsZombie())
@@ -136,14 +160,35 @@ public:
       M = new StrangenessTreeMessenger(*inf, std::string("Tree"));
 
       // Open output
+      if (!openOutput())
+         return;
+
+      book();
+
+      if (par.FillGenToo)
+      {
+         KtoPiParameters genPar = par;
+         genPar.IsGen = true;
+         genPar.FillGenToo = false;
+         genPar.output = par.GenOutput;
+         genCompanion = new KtoPiAnalyzer(genPar, M);
+      }
+   }
+
+   bool openOutput()
+   {
       outf = new TFile(par.output.c_str(), "RECREATE");
       if (outf == nullptr || outf->IsZombie())
       {
          cerr << "Error: cannot create output file '" << par.output << "'" << endl;
-         return;
+         return false;
       }
       outf->cd();
+      return true;
+   }
 
+   void book()
+   {
       // Book histograms
       const int maxNchTag = par.MaxNchTag;
       const int nbins     = maxNchTag / 4 + 1;   // same as your macro
@@ -175,6 +220,8 @@ public:
 
    ~KtoPiAnalyzer()
    {
+      delete genCompanion;
+
       // Clean up histograms (the file should own them after writing, but be safe)
       delete hK;
       delete hPi;
@@ -193,13 +240,16 @@ public:
          outf->Close();
          delete outf;
       }
-      delete M;
+      if (ownsMessenger)
+         delete M;
    }
 
    void analyze()
    {
       if (M == nullptr || inf == nullptr || outf == nullptr)
          return;
+      if (genCompanion != nullptr && genCompanion->outf == nullptr)
+         return;
 
       // Event loop
       long long nEntries = M->GetEntries();
@@ -241,7 +291,7 @@ public:
 
          // Optionally prepare NGen if we are doing generator-level counting
          int ngen = 0;
-         if (par.IsGen)
+         if (par.IsGen || genCompanion != nullptr)
          {
             if (M->NGen > STRANGE_MAX_GEN)
             {
@@ -279,95 +329,113 @@ public:
          if (theta >= MaxTheta)
             continue;
 
-         //-------------------------
-         // Build NchTag, nK, nPi
-         //-------------------------
-         int NchTag = 0;
-         int nK     = 0;
-         int nPi    = 0;
+         countEvent(nreco, ngen);
+         if (genCompanion != nullptr)
+            genCompanion->countEvent(nreco, ngen);
+      }
 
-         if (par.IsGen)
-         {
-            // NchTag is still defined by reconstructed tagged tracks
-            for (int i = 0; i < nreco; ++i)
-            {
-               bool isKaonTag   = (M->RecoPIDKaon[i] >= 2);
-               bool isPionTag   = (M->RecoPIDPion[i] >= 2);
-               bool isProtonTag = (M->RecoPIDProton[i] >= 2);
+      cout << endl << "Event loop finished." << endl;
 
-               // NchTag = Sum(RecoPIDKaon>=2 || RecoPIDPion>=2 || RecoPIDProton>=2)
-               if (isKaonTag || isPionTag || isProtonTag)
-                  ++NchTag;
-            }
+      finish();
+      if (genCompanion != nullptr)
+         genCompanion->finish();
+   }
 
-            // Count generator-level kaons and pions using PDG ID
-            for (int i = 0; i < ngen; ++i)
-            {
-               const int pdg    = static_cast<int>(M->GenID[i]);
-               const int absPdg = (pdg >= 0 ? pdg : -pdg);
+   // NchTag and K, pi counts of one selected event (entry loaded in M)
+   void countEvent(int nreco, int ngen)
+   {
+      //-------------------------
+      // Build NchTag, nK, nPi
+      //-------------------------
+      int NchTag = 0;
+      int nK     = 0;
+      int nPi    = 0;
 
-               // Charged kaons: K+, K-
-               if (absPdg == 321)
-                  ++nK;
+      if (par.IsGen)
+      {
+         // NchTag is still defined by reconstructed tagged tracks
+         for (int i = 0; i < nreco; ++i)
+         {
+            bool isKaonTag   = (M->RecoPIDKaon[i] >= 2);
+            bool isPionTag   = (M->RecoPIDPion[i] >= 2);
+            bool isProtonTag = (M->RecoPIDProton[i] >= 2);
 
-               // Charged pions: pi+, pi-
-               if (absPdg == 211)
-                  ++nPi;
-            }
+            // NchTag = Sum(RecoPIDKaon>=2 || RecoPIDPion>=2 || RecoPIDProton>=2)
+            if (isKaonTag || isPionTag || isProtonTag)
+               ++NchTag;
          }
-         else
-         {
-            // Reco-based PID counting (to be corrected later)
-            for (int i = 0; i < nreco; ++i)
-            {
-               bool isKaonTag   = (M->RecoPIDKaon[i] >= 2);
-               bool isPionTag   = (M->RecoPIDPion[i] >= 2);
-               bool isProtonTag = (M->RecoPIDProton[i] >= 2);
 
-               // NchTag = Sum(RecoPIDKaon>=2 || RecoPIDPion>=2 || RecoPIDProton>=2)
-               if (isKaonTag || isPionTag || isProtonTag)
-                  ++NchTag;
+         // Count generator-level kaons and pions using PDG ID
+         for (int i = 0; i < ngen; ++i)
+         {
+            const int pdg    = static_cast<int>(M->GenID[i]);
+            const int absPdg = (pdg >= 0 ? pdg : -pdg);
 
-               if (isKaonTag)
-                  ++nK;
-               if (isPionTag)
-                  ++nPi;
+            // Charged kaons: K+, K-
+            if (absPdg == 321)
+               ++nK;
 
-               // Accumulate PID efficiency / fake-rate info for global 2×2 matrix
-               //
-               // The RecoEfficiencyXAsY arrays are defined as:
-               //   e.g. PiAsPi: probability for a *true pion* in this (pT, theta)
-               //   bin to be tagged as a pion.
-               //
-               // They come from MC calibration and are stored per track as a
-               // function of its kinematics.  We don't know the true species
-               // in data, but we can average these calibration functions over
-               // all charged tracks to build an effective K/π matrix.
-               //
-               // To keep things simple and general for both MC and future data,
-               // we do *not* use truth here; we just average over all charged
-               // tracks that we consider "taggable".
-               if (M->RecoCharge[i] != 0.0)
-               {
-                  sumKAsK   += M->RecoEfficiencyKAsK[i];
-                  sumKAsPi  += M->RecoEfficiencyKAsPi[i];
-                  sumPiAsK  += M->RecoEfficiencyPiAsK[i];
-                  sumPiAsPi += M->RecoEfficiencyPiAsPi[i];
-                  ++countEffTracks;
-               }
+            // Charged pions: pi+, pi-
+            if (absPdg == 211)
+               ++nPi;
+         }
+      }
+      else
+      {
+         // Reco-based PID counting (to be corrected later)
+         for (int i = 0; i < nreco; ++i)
+         {
+            bool isKaonTag   = (M->RecoPIDKaon[i] >= 2);
+            bool isPionTag   = (M->RecoPIDPion[i] >= 2);
+            bool isProtonTag = (M->RecoPIDProton[i] >= 2);
+
+            // NchTag = Sum(RecoPIDKaon>=2 || RecoPIDPion>=2 || RecoPIDProton>=2)
+            if (isKaonTag || isPionTag || isProtonTag)
+               ++NchTag;
+
+            if (isKaonTag)
+               ++nK;
+            if (isPionTag)
+               ++nPi;
+
+            // Accumulate PID efficiency / fake-rate info for global 2×2 matrix
+            //
+            // The RecoEfficiencyXAsY arrays are defined as:
+            //   e.g. PiAsPi: probability for a *true pion* in this (pT, theta)
+            //   bin to be tagged as a pion.
+            //
+            // They come from MC calibration and are stored per track as a
+            // function of its kinematics.  We don't know the true species
+            // in data, but we can average these calibration functions over
+            // all charged tracks to build an effective K/π matrix.
+            //
+            // To keep things simple and general for both MC and future data,
+            // we do *not* use truth here; we just average over all charged
+            // tracks that we consider "taggable".
+            if (M->RecoCharge[i] != 0.0)
+            {
+               sumKAsK   += M->RecoEfficiencyKAsK[i];
+               sumKAsPi  += M->RecoEfficiencyKAsPi[i];
+               sumPiAsK  += M->RecoEfficiencyPiAsK[i];
+               sumPiAsPi += M->RecoEfficiencyPiAsPi[i];
+               ++countEffTracks;
             }
          }
+      }
 
-         // Put overflow NchTag into the last bin
-         if (NchTag > par.MaxNchTag)
-            NchTag = par.MaxNchTag;
+      // Put overflow NchTag into the last bin
+      if (NchTag > par.MaxNchTag)
+         NchTag = par.MaxNchTag;
 
-         // Fill event-wise yields (raw)
-         hK->Fill(NchTag, nK);
-         hPi->Fill(NchTag, nPi);
-      }
+      // Fill event-wise yields (raw)
+      hK->Fill(NchTag, nK);
+      hPi->Fill(NchTag, nPi);
+   }
 
-      cout << endl << "Event loop finished." << endl;
+   // Titles, ratio and PID correction after the event loop
+   void finish()
+   {
+      outf->cd();
 
       //-------------------------
       // Update titles depending on mode
@@ -473,6 +541,9 @@ public:
 
    void writeHistograms()
    {
+      if (genCompanion != nullptr)
+         genCompanion->writeHistograms();
+
       if (outf == nullptr)
          return;
 
@@ -535,8 +606,19 @@ int main(int argc, char *argv[])
    par.MinTheta       = MinThetaDeg * TMath::Pi() / 180.0;
    par.MaxTheta       = MaxThetaDeg * TMath::Pi() / 180.0;
 
-   // Generator-level flag: IsGen=true/false or 1/0 or yes/no (case-insensitive)
+   // Generator-level flag: IsGen=true/false or 1/0 or yes/no (case-insensitive), or "both"
+   // for reco and generator level from one pass (generator level goes to GenOutput)
    std::string isGenStr = CL.Get("IsGen", std::string("false"));
+   par.FillGenToo = (isGenStr == "both" || isGenStr == "Both" || isGenStr == "BOTH");
+   par.GenOutput  = CL.Get("GenOutput", par.GenOutput);
+   if (par.FillGenToo && (par.GenOutput.empty() || par.GenOutput == par.output))
+   {
+      std::string stem = par.output;
+      if (stem.size() > 5 && stem.compare(stem.size() - 5, 5, ".root") == 0)
+         stem.erase(stem.size() - 5);
+      par.GenOutput = stem + "_Gen.root";
+   }
+
    if (isGenStr == "1" || isGenStr == "true" || isGenStr == "True" ||
        isGenStr == "TRUE" || isGenStr == "yes" || isGenStr == "Yes" ||
        isGenStr == "YES")
@@ -557,12 +639,16 @@ int main(int argc, char *argv[])
    cout << "  MinNch      = " << par.MinNch     << endl;
    cout << "  MinThetaDeg = " << MinThetaDeg    << endl;
    cout << "  MaxThetaDeg = " << MaxThetaDeg    << endl;
-   cout << "  IsGen       = " << (par.IsGen ? "true" : "false") << endl;
+   cout << "  IsGen       = " << (par.FillGenToo ? "both" : (par.IsGen ? "true" : "false")) << endl;
+   if (par.FillGenToo)
+      cout << "  GenOutput   = " << par.GenOutput << endl;
 
    KtoPiAnalyzer analyzer(par);
    analyzer.analyze();
    analyzer.writeHistograms();
 
    cout << "Done. Output written to " << par.output << endl;
+   if (par.FillGenToo)
+      cout << "Generator level written to " << par.GenOutput << endl;
    return 0;
 }
@@ -1,3 +1,2 @@
-./ExecuteKtoPiAnalysis  --IsGen true  --Input sample/Strangeness/merged_mc_v2.root --Output output/KtoPi-MC-Gen.root
-./ExecuteKtoPiAnalysis  --IsGen false --Input sample/Strangeness/merged_mc_v2.root --Output output/KtoPi-MC-Reco.root
+./ExecuteKtoPiAnalysis  --IsGen both  --Input sample/Strangeness/merged_mc_v2.root --Output output/KtoPi-MC-Reco.root --GenOutput output/KtoPi-MC-Gen.root
 ./ExecuteKtoPiAnalysis  --IsGen false --Input sample/Strangeness/merged_data_v2.root --Output output/KtoPi-Data-Reco.root
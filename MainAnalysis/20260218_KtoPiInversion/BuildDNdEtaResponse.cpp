@@ -1,11 +1,14 @@
 #include <cmath>
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "TFile.h"
 #include "TH1D.h"
 #include "TH2D.h"
 #include "TMath.h"
+#include "TParameter.h"
 
 #include "ProgressBar.h"
 #include "StrangenessMessenger.h"
@@ -17,6 +20,30 @@ bool IsChargedPDG(long long pdg)
 {
    return TruthCountingPolicy::IsCountedChargedForActivity(pdg);
 }
+
+// The summary stores counts for fixed thresholds; only use it if they are the ones used here
+bool SummaryMatches(const std::string &summary, const std::vector<std::pair<std::string, double>> &expected)
+{
+   const std::vector<std::string> files = StrangenessTreeMessenger::ExpandInputList(summary);
+   if (files.empty())
+      return false;
+   TFile *f = TFile::Open(files[0].c_str(), "READ");
+   if (f == nullptr || f->IsZombie())
+      return false;
+   bool ok = true;
+   for (const auto &item : expected)
+   {
+      TParameter<double> *p = nullptr;
+      f->GetObject(item.first.c_str(), p);
+      if (p == nullptr || std::abs(p->GetVal() - item.second) > 1e-9)
+      {
+         std::cerr << "Summary parameter " << item.first << " does not match " << item.second << std::endl;
+         ok = false;
+      }
+   }
+   f->Close();
+   return ok;
+}
 }
 
 int main(int argc, char *argv[])
@@ -25,6 +52,7 @@ int main(int argc, char *argv[])
    std::string output = "output/DNdEtaResponse_Nominal.root";
    bool useCentralEtaNtag = false;
    bool usePIDFiducial = true;
+   std::string summary = "";   // optional EventSummary friend from tools/build_event_summary_friend
    if (argc > 1)
       input = argv[1];
    if (argc > 2)
@@ -33,6 +61,8 @@ int main(int argc, char *argv[])
       useCentralEtaNtag = (std::string(argv[3]) == "1");
    if (argc > 4)
       usePIDFiducial = (std::string(argv[4]) != "0");
+   if (argc > 5)
+      summary = argv[5];
 
    const double ptMinYield = 0.4;
    const double ntagPtMin = 0.2;
@@ -55,6 +85,20 @@ int main(int argc, char *argv[])
       return 1;
    }
 
+   // With the summary attached, only the event-level scalars are read from the main tree
+   const bool useSummary = (summary != "");
+   if (useSummary)
+   {
+      if (!SummaryMatches(summary, {{"NtagPtMin", ntagPtMin}, {"YieldPtMin", ptMinYield}, {"YieldPtMax", ptMaxYield},
+                                    {"PIDAbsCosMin", pidTrackAbsCosMin}, {"PIDAbsCosMax", pidTrackAbsCosMax}}))
+         return 1;
+      if (!M.AttachSummary(summary) || !M.EnableOnlyBranches({"PassAll", "NReco", "NGen"}))
+      {
+         std::cerr << "Cannot use summary " << summary << std::endl;
+         return 1;
+      }
+   }
+
    const int nbins = maxNchTag + 1;
    const double xmin = -0.5;
    const double xmax = maxNchTag + 0.5;
@@ -123,68 +167,78 @@ int main(int argc, char *argv[])
          continue;
 
       int nTagReco = 0;
-      for (int i = 0; i < M.NReco; ++i)
-      {
-         if (M.RecoGoodTrack[i] != 1)
-            continue;
-         if (M.RecoCharge[i] == 0.0)
-            continue;
-         const double pxr = M.RecoPx[i];
-         const double pyr = M.RecoPy[i];
-         const double pzr = M.RecoPz[i];
-         const double ptr = std::sqrt(pxr * pxr + pyr * pyr);
-         if (ptr < ntagPtMin)
-            continue;
-         if (useCentralEtaNtag)
-         {
-            if (ptr <= 0.0)
-               continue;
-            const double etaReco = std::asinh(pzr / ptr);
-            if (std::abs(etaReco) >= 0.5)
-               continue;
-         }
-         ++nTagReco;
-      }
-      if (nTagReco > maxNchTag)
-         nTagReco = maxNchTag;
-
       int nChEta05 = 0;
       int nKgenEvt = 0;
       int nPigenEvt = 0;
       int nPgenEvt = 0;
-      for (int i = 0; i < M.NGen; ++i)
+      if (useSummary)
       {
-         const long long pdg = M.GenID[i];
-         const long long apdg = (pdg >= 0 ? pdg : -pdg);
-         if (M.GenStatus[i] != 1)
-            continue;
-         if (!IsChargedPDG(pdg))
-            continue;
-
-         const double px = M.GenPx[i];
-         const double py = M.GenPy[i];
-         const double pz = M.GenPz[i];
-         const double pt = std::sqrt(px * px + py * py);
-
-         if (pt > 0.0)
+         const EventSummary &S = M.Summary;
+         nTagReco = useCentralEtaNtag ? S.NchTagRecoCentral : S.NchTagReco;
+         nChEta05 = S.NchEta05True;
+         nKgenEvt = usePIDFiducial ? S.NKTrue : S.NKTrueNoFid;
+         nPigenEvt = usePIDFiducial ? S.NPiTrue : S.NPiTrueNoFid;
+         nPgenEvt = usePIDFiducial ? S.NPTrue : S.NPTrueNoFid;
+      }
+      else
+      {
+         for (int i = 0; i < M.NReco; ++i)
          {
-            const double eta = std::asinh(pz / pt);
-            if (std::abs(eta) < 0.5)
-               ++nChEta05;
+            if (M.RecoGoodTrack[i] != 1)
+               continue;
+            if (M.RecoCharge[i] == 0.0)
+               continue;
+            const double pxr = M.RecoPx[i];
+            const double pyr = M.RecoPy[i];
+            const double pzr = M.RecoPz[i];
+            const double ptr = std::sqrt(pxr * pxr + pyr * pyr);
+            if (ptr < ntagPtMin)
+               continue;
+            if (useCentralEtaNtag)
+            {
+               if (ptr <= 0.0)
+                  continue;
+               const double etaReco = std::asinh(pzr / ptr);
+               if (std::abs(etaReco) >= 0.5)
+                  continue;
+            }
+            ++nTagReco;
          }
+         for (int i = 0; i < M.NGen; ++i)
+         {
+            const long long pdg = M.GenID[i];
+            const long long apdg = (pdg >= 0 ? pdg : -pdg);
+            if (M.GenStatus[i] != 1)
+               continue;
+            if (!IsChargedPDG(pdg))
+               continue;
 
-         if (pt < ptMinYield || pt >= ptMaxYield)
-            continue;
-         if (!passPIDFiducialFromMom(px, py, pz))
-            continue;
-         if (apdg == 321)
-            ++nKgenEvt;
-         if (apdg == 211)
-            ++nPigenEvt;
-         if (apdg == 2212)
-            ++nPgenEvt;
-      }
+            const double px = M.GenPx[i];
+            const double py = M.GenPy[i];
+            const double pz = M.GenPz[i];
+            const double pt = std::sqrt(px * px + py * py);
+
+            if (pt > 0.0)
+            {
+               const double eta = std::asinh(pz / pt);
+               if (std::abs(eta) < 0.5)
+                  ++nChEta05;
+            }
 
+            if (pt < ptMinYield || pt >= ptMaxYield)
+               continue;
+            if (!passPIDFiducialFromMom(px, py, pz))
+               continue;
+            if (apdg == 321)
+               ++nKgenEvt;
+            if (apdg == 211)
+               ++nPigenEvt;
+            if (apdg == 2212)
+               ++nPgenEvt;
+         }
+      }
+      if (nTagReco > maxNchTag)
+         nTagReco = maxNchTag;
       if (nChEta05 > maxNchTag)
          nChEta05 = maxNchTag;
       const double dNdEtaTrue = static_cast<double>(nChEta05);
@@ -24,6 +24,7 @@
 // we still count K/π/p at truth level as a cross–check.
 //============================================================
 
+#include <array>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -32,6 +33,8 @@
 #include <cstdlib>
 #include <algorithm>
 #include <unordered_map>
+#include <memory>
+#include <fstream>
 
 // ROOT
 #include "TFile.h"
@@ -41,16 +44,24 @@
 #include "TCanvas.h"
 #include "TMath.h"
 #include "TNtuple.h"
+#include "TParameter.h"
+#include "TSystem.h"
 
 // Project common code
 #include "utilities.h"      // smartWrite, etc.
 #include "helpMessage.h"    // printHelpMessage()
 #include "CommandLine.h"    // CommandLine parser
 #include "ProgressBar.h"    // nice progress bar
+#include "ParallelProcessor.h"
+#include "EntryRange.h"
 
 // Strangeness tree messenger
 #include "StrangenessMessenger.h"
 #include "TruthCountingPolicy.h"
+#include "BinnedFill.h"
+#include "TaggingMatrixBatch.h"
+#include "PoissonBootstrap.h"
+#include "ActivityEstimator.h"
 
 using namespace std;
 
@@ -101,15 +112,23 @@ struct KtoPiParameters
 {
    std::string input;
    std::string output;
+   std::string variation;   // name in multi-variation mode (--Variations), empty otherwise
 
    int    MaxNchTag;   // max Nch_tag, overflow goes into last bin
    int    MaxEvents;   // max events to process (-1 = all)
+   int    Threads;     // > 1: event loop split over this many threads (ParallelProcessor)
+   double Fraction;    // entry range of this job, see EntryRange.h: first Fraction of the
+   long long FirstEntry;   // MaxEvents entries, then FirstEntry / NEntries, then block Shard
+   long long NEntries;
+   std::string Shard;      // "i/N"
    double EcmRef;      // reference energy in GeV (91.2)
    int    MinNch;      // Nch >= MinNch
    double MinTheta;    // in radians
    double MaxTheta;    // in radians
 
    bool   IsGen;       // if true, count K/pi/p at generator level
+   bool   FillGenToo;  // reco mode plus the generator-level spectra into GenOutput, same pass (--IsGen both)
+   std::string GenOutput;
    bool   UseMCTruthMatrix;  // if true, build PID matrix from MC truth matching (closure mode)
    bool   UsePassAllSelection; // if true, use archived event-selection bit instead of recomputing cuts
    bool   UseCentralEtaNtag; // if true, define reco Ntag using |eta|<0.5 tracks
@@ -118,6 +137,9 @@ struct KtoPiParameters
    double PIDTrackAbsCosMax; // upper edge for |cos(theta_track)|
    int    PIDTieMode;        // 0=legacy priority K>pi>p, 1=ties become untagged
    bool   UseInclusivePIDObservation; // if true, fill all K/pi/p candidates with PID>=2
+   bool   PropagateMatrixErrors;      // if true, corrected errors add the lookup spread of the tagging probabilities (not the map uncertainty)
+   int    BootstrapReplicas;          // > 0: Poisson bootstrap replicas of the corrected ratios
+   int    BootstrapSeed;              // replica weights are a function of (seed, Run, Event)
 
    // pT binning
    int    NPtBins;           // number of pT bins (uniform mode)
@@ -126,16 +148,30 @@ struct KtoPiParameters
    double NtagPtMin;         // min pT for Ntag counting
    std::vector<double> PtBinEdges;  // if non-empty, overrides NPtBins/PtMin/PtMax
 
+   std::string TimingSummary; // if non-empty, write throughput and stage timing here (.json or .csv)
+   std::string Summary;       // EventSummary friend (tools/build_event_summary_friend): activity
+                              // counts and truth yields from it instead of the track loops
+   std::string Finalize;      // merged shard outputs (MergeShards) to correct instead of reading
+                              // the tree, see KtoPiAnalyzer::finalizeShards()
+
    KtoPiParameters()
       : input("sample/Strangeness/merged_pythia_v2.5.root")
       , output("output/KtoPi.root")
+      , variation("")
       , MaxNchTag(60)
       , MaxEvents(-1)
+      , Threads(1)
+      , Fraction(1.0)
+      , FirstEntry(0)
+      , NEntries(-1)
+      , Shard("0/1")
       , EcmRef(91.2)
       , MinNch(7)
       , MinTheta(30.0 * TMath::Pi() / 180.0)
       , MaxTheta(150.0 * TMath::Pi() / 180.0)
       , IsGen(false)
+      , FillGenToo(false)
+      , GenOutput("")
       , UseMCTruthMatrix(false)
       , UsePassAllSelection(true)
       , UseCentralEtaNtag(false)
@@ -144,10 +180,16 @@ struct KtoPiParameters
       , PIDTrackAbsCosMax(0.675)
       , PIDTieMode(0)
       , UseInclusivePIDObservation(false)
+      , PropagateMatrixErrors(false)
+      , BootstrapReplicas(0)
+      , BootstrapSeed(1)
       , NPtBins(12)
       , PtMin(0.4)
       , PtMax(5.0)
       , NtagPtMin(0.2)
+      , TimingSummary("")
+      , Summary("")
+      , Finalize("")
    {
    }
 };
@@ -157,21 +199,130 @@ static bool IsChargedPDG(long long pdg)
    return TruthCountingPolicy::IsCountedChargedForActivity(pdg);
 }
 
-static bool ComputeAxisRapidity(double px, double py, double pz, double e,
-                                double ax, double ay, double az, double &rapidity)
+// The summary stores counts for fixed thresholds; only use it if they are the ones used here
+static bool SummaryMatches(const std::string &summary, const std::vector<std::pair<std::string, double>> &expected)
 {
-   const double norm = std::sqrt(ax * ax + ay * ay + az * az);
-   if (norm <= 0.0 || e <= 0.0)
+   const std::vector<std::string> files = StrangenessTreeMessenger::ExpandInputList(summary);
+   if (files.empty())
       return false;
-
-   const double pLong = (px * ax + py * ay + pz * az) / norm;
-   const double plus = e + pLong;
-   const double minus = e - pLong;
-   if (plus <= 0.0 || minus <= 0.0)
+   TFile *f = TFile::Open(files[0].c_str(), "READ");
+   if (f == nullptr || f->IsZombie())
       return false;
+   bool ok = true;
+   for (const auto &item : expected)
+   {
+      TParameter<double> *p = nullptr;
+      f->GetObject(item.first.c_str(), p);
+      if (p == nullptr || std::abs(p->GetVal() - item.second) > 1e-9)
+      {
+         cerr << "Summary parameter " << item.first << " does not match " << item.second << endl;
+         ok = false;
+      }
+   }
+   f->Close();
+   return ok;
+}
+
+//------------------------------------------------------------
+// Activity estimators, in output order.  Each one gets the raw and PID-corrected spectra, the
+// ratios and the MC response histograms; the first one is also the axis of the generator-level
+// mode.  A new estimator is one more entry here.
+//------------------------------------------------------------
+static std::vector<Activity::Estimator> BuildActivityEstimators(const KtoPiParameters &par)
+{
+   const int maxNchTag = par.MaxNchTag;
+   const int nbinsNch  = maxNchTag / 4 + 1;   // same choice as original macro
+   const double ntagPtMin = par.NtagPtMin;
+   const bool centralEta = par.UseCentralEtaNtag;
+
+   std::vector<Activity::Estimator> estimators;
+
+   // Nch_tag: charged tracks above NtagPtMin, optionally restricted to |eta| < 0.5
+   Activity::Estimator ntag;
+   ntag.Name = "";
+   ntag.ResponseName = "Ntag";
+   ntag.TrueYieldName = "Ntag";
+   ntag.Label = "N_{ch}^{tag}";
+   ntag.RatioLabel = "N_{ch}^{tag}";
+   ntag.Quantity = "N_{tag}^{ch}";
+   ntag.Region = "";
+   ntag.ResponseRegion = "";
+   ntag.RecoTitle = "N_{ch}^{tag}";
+   ntag.ResponseRecoTitle = "N_{tag,reco}^{ch}";
+   ntag.TrueTitle = "N_{tag,true}^{ch}";
+   ntag.NBins = nbinsNch;
+   ntag.Min = -0.5;
+   ntag.Max = maxNchTag + 0.5;
+   ntag.MaxCount = maxNchTag;
+   ntag.Reco = [ntagPtMin, centralEta](const Activity::Particle &p)
+   {
+      if (p.Pt < ntagPtMin)
+         return false;
+      return !centralEta || (p.HasEta && std::abs(p.Eta) < 0.5);
+   };
+   ntag.Gen = [ntagPtMin, centralEta](const Activity::Particle &p)
+   {
+      if (p.Pt < ntagPtMin)
+         return false;
+      return !centralEta || !p.HasEta || std::abs(p.Eta) < 0.5;
+   };
+   ntag.SummaryReco = [centralEta](const EventSummary &s) {return centralEta ? s.NchTagRecoCentral : s.NchTagReco;};
+   ntag.SummaryGen = [centralEta](const EventSummary &s) {return centralEta ? s.NchTagTrueCentral : s.NchTagTrue;};
+   estimators.push_back(ntag);
+
+   // dNch/deta: all charged tracks in |eta| < 0.5, no PID or pT threshold, same variable at
+   // reco and generator level for the unfolding
+   Activity::Estimator dndeta;
+   dndeta.Name = "DNdEta";
+   dndeta.ResponseName = "DNdEta";
+   dndeta.TrueYieldName = "dNdEta";
+   dndeta.Label = "reco dN_{ch}/d#eta(|#eta|<0.5)";
+   dndeta.RatioLabel = "reco dN_{ch}/d#eta";
+   dndeta.Quantity = "dN_{ch}/d#eta";
+   dndeta.Region = " (|#eta|<0.5)";
+   dndeta.ResponseRegion = "";
+   dndeta.RecoTitle = "dN_{ch}/d#eta (reco, |#eta|<0.5)";
+   dndeta.ResponseRecoTitle = dndeta.RecoTitle;
+   dndeta.TrueTitle = "dN_{ch}/d#eta (true, |#eta|<0.5)";
+   dndeta.NBins = nbinsNch;
+   dndeta.Min = -0.5;
+   dndeta.Max = maxNchTag + 0.5;
+   dndeta.MaxCount = maxNchTag;
+   dndeta.Reco = [](const Activity::Particle &p) {return p.HasEta && std::abs(p.Eta) < 0.5;};
+   dndeta.Gen = dndeta.Reco;
+   dndeta.SummaryReco = [](const EventSummary &s) {return s.NchEta05Reco;};
+   dndeta.SummaryGen = [](const EventSummary &s) {return s.NchEta05True;};
+   estimators.push_back(dndeta);
+
+   // dNch/dy: charged tracks with |y| < 0.5 along the thrust axis; at generator level the
+   // central-eta Nch_tag option also drops particles with |eta| >= 0.5, as it always has
+   Activity::Estimator dndy;
+   dndy.Name = "DNdY";
+   dndy.ResponseName = "DNdY";
+   dndy.TrueYieldName = "dNdY";
+   dndy.Label = "reco dN_{ch}/dy(|y_{T}|<0.5)";
+   dndy.RatioLabel = "reco dN_{ch}/dy";
+   dndy.Quantity = "dN_{ch}/dy";
+   dndy.Region = " wrt thrust axis (|y_{T}|<0.5)";
+   dndy.ResponseRegion = " wrt thrust axis";
+   dndy.RecoTitle = "dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5)";
+   dndy.ResponseRecoTitle = dndy.RecoTitle;
+   dndy.TrueTitle = "dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5)";
+   dndy.Edges = BuildDefaultDNdYBinEdges(nbinsNch, std::min(maxNchTag, 30));
+   dndy.MaxCount = static_cast<int>(std::floor(dndy.Edges.back() - 0.5));
+   dndy.Reco = [](const Activity::Particle &p) {return p.HasThrustRapidity && std::abs(p.ThrustRapidity) < 0.5;};
+   dndy.Gen = [centralEta](const Activity::Particle &p)
+   {
+      if (centralEta && p.HasEta && std::abs(p.Eta) >= 0.5)
+         return false;
+      return p.HasThrustRapidity && std::abs(p.ThrustRapidity) < 0.5;
+   };
+   dndy.SummaryReco = [](const EventSummary &s) {return s.NchY05Reco;};
+   if (!centralEta)   // the summary has no central-eta dN/dy count
+      dndy.SummaryGen = [](const EventSummary &s) {return s.NchY05True;};
+   estimators.push_back(dndy);
 
-   rapidity = 0.5 * std::log(plus / minus);
-   return std::isfinite(rapidity);
+   return estimators;
 }
 
 //============================================================
@@ -185,280 +336,221 @@ public:
    StrangenessTreeMessenger *M;
    bool HasRecoMatchingBranches;
    bool HasGenMatchingBranches;
-   double RecoEfficiencyKExtra[STRANGE_MAX_RECO];
-   double RecoEfficiencyPiExtra[STRANGE_MAX_RECO];
-   double RecoEfficiencyPExtra[STRANGE_MAX_RECO];
-   double RecoGenEfficiencyKExtra[STRANGE_MAX_RECO];
-   double RecoGenEfficiencyPiExtra[STRANGE_MAX_RECO];
-   double RecoGenEfficiencyPExtra[STRANGE_MAX_RECO];
-
-   // 1D raw (uncorrected) yields vs Nch_tag
-   TH1D *hK;
-   TH1D *hPi;
-   TH1D *hP;
-   TH1D *hKoverPi;
-   TH1D *hPoverPi;
-
-   // 1D PID–corrected yields vs Nch_tag (pT–integrated)
-   TH1D *hKCorrected;
-   TH1D *hPiCorrected;
-   TH1D *hPCorrected;
-   TH1D *hKoverPiCorrected;
-   TH1D *hPoverPiCorrected;
-
-   // 1D raw / corrected yields vs reco dNch/deta(|eta|<0.5)
-   TH1D *hKDNdEta;
-   TH1D *hPiDNdEta;
-   TH1D *hPDNdEta;
-   TH1D *hKoverPiDNdEta;
-   TH1D *hPoverPiDNdEta;
-   TH1D *hKCorrectedDNdEta;
-   TH1D *hPiCorrectedDNdEta;
-   TH1D *hPCorrectedDNdEta;
-   TH1D *hKoverPiCorrectedDNdEta;
-   TH1D *hPoverPiCorrectedDNdEta;
-   TH1D *hKDNdY;
-   TH1D *hPiDNdY;
-   TH1D *hPDNdY;
-   TH1D *hKoverPiDNdY;
-   TH1D *hPoverPiDNdY;
-   TH1D *hKCorrectedDNdY;
-   TH1D *hPiCorrectedDNdY;
-   TH1D *hPCorrectedDNdY;
-   TH1D *hKoverPiCorrectedDNdY;
-   TH1D *hPoverPiCorrectedDNdY;
-
-   // 2D pT spectra: x = Nch_tag, y = pT
-   TH2D *hKPt;
-   TH2D *hPiPt;
-   TH2D *hPPt;
-   TH2D *hUPt;
-
-   // 2D PID–corrected pT spectra
-   TH2D *hKPtCorrected;
-   TH2D *hPiPtCorrected;
-   TH2D *hPPtCorrected;
-
-   // 2D pT spectra: x = reco dNch/deta(|eta|<0.5), y = pT
-   TH2D *hKPtDNdEta;
-   TH2D *hPiPtDNdEta;
-   TH2D *hPPtDNdEta;
-   TH2D *hUPtDNdEta;
-   TH2D *hKPtCorrectedDNdEta;
-   TH2D *hPiPtCorrectedDNdEta;
-   TH2D *hPPtCorrectedDNdEta;
-   TH2D *hKPtDNdY;
-   TH2D *hPiPtDNdY;
-   TH2D *hPPtDNdY;
-   TH2D *hUPtDNdY;
-   TH2D *hKPtCorrectedDNdY;
-   TH2D *hPiPtCorrectedDNdY;
-   TH2D *hPPtCorrectedDNdY;
-
-   // MC-only response and truth-yield histograms for Ntag unfolding
-   TH2D *hNtagResponse;   // x=true Ntag, y=reco Ntag
-   TH2D *hNtagResponseK;  // x=true Ntag, y=reco Ntag (K-yield weighted)
-   TH2D *hNtagResponsePi; // x=true Ntag, y=reco Ntag (pi-yield weighted)
-   TH2D *hNtagResponseP;  // x=true Ntag, y=reco Ntag (p-yield weighted)
-   TH1D *hNtagTrue;
-   TH1D *hNtagReco;
-   TH1D *hKTrueNtag;
-   TH1D *hPiTrueNtag;
-   TH1D *hPTrueNtag;
-   TH2D *hDNdEtaResponse;   // x=true dNch/deta(|eta|<0.5), y=reco dNch/deta(|eta|<0.5)
-   TH2D *hDNdEtaResponseK;  // K-yield weighted
-   TH2D *hDNdEtaResponsePi; // pi-yield weighted
-   TH2D *hDNdEtaResponseP;  // p-yield weighted
-   TH1D *hDNdEtaTrue;
-   TH1D *hDNdEtaReco;
-   TH1D *hKTruedNdEta;
-   TH1D *hPiTruedNdEta;
-   TH1D *hPTruedNdEta;
-   TH2D *hDNdYResponse;
-   TH2D *hDNdYResponseK;
-   TH2D *hDNdYResponsePi;
-   TH2D *hDNdYResponseP;
-   TH1D *hDNdYTrue;
-   TH1D *hDNdYReco;
-   TH1D *hKTruedNdY;
-   TH1D *hPiTruedNdY;
-   TH1D *hPTruedNdY;
+
+   // Everything booked and filled per activity estimator.  Species 0 = K, 1 = pi, 2 = p,
+   // 3 = untagged (pT spectra only); ratio 0 = K/pi, 1 = p/pi; covariance pair 0 = (K, pi),
+   // 1 = (p, pi), 2 = (K, p).
+   struct ActivityAxis
+   {
+      Activity::Estimator Estimator;
+      int NBins;
+      int CellOffset;                  // first (activity, pT) cell of this axis in Accumulator
+      BinnedFill::CountLookup Bins;    // count -> bin along the activity axis
+
+      TH1D *hRaw[3];                   // raw yields vs activity (sum over tracks)
+      TH1D *hRatio[2];                 // raw ratios, made in correct()
+      TH2D *hPt[4];                    // raw pT spectra: x = activity, y = pT
+      TH1D *hCorrected[3];             // PID-corrected, pT-integrated
+      TH1D *hRatioCorrected[2];        // made in correct()
+      TH2D *hPtCorrected[3];           // PID-corrected pT spectra
+
+      // Species covariance of the corrected yields per (activity, pT) bin and pT-integrated;
+      // the variances are the bin errors.  Count and lookup-spread terms only: the
+      // efficiency-map uncertainty, which correlates pT and activity bins, is not included.
+      TH2D *hCovPtCorrected[3];
+      TH1D *hCovCorrected[3];
+
+      // Bootstrap of the corrected ratios (BootstrapReplicas > 0): nominal value with the
+      // standard deviation over replicas as error, and the value of every replica
+      // (x = activity, y = replica)
+      TH1D *hRatioBootstrap[2];
+      TH2D *hRatioReplicas[2];
+
+      // MC-only response (x = true, y = reco count; unweighted and K / pi / p-yield weighted),
+      // count distributions and generator-level yields vs the true count, for the unfolding
+      TH2D *hResponse[4];
+      // Cross term of the weighted responses of the ratio pairs (K, pi) and (p, pi): filled with
+      // the product of the two species yields, so a cell holds the covariance of that cell in
+      // the two species responses (both come from the same events)
+      TH2D *hResponseCross[2];
+      TH1D *hTrue;
+      TH1D *hReco;
+      TH1D *hTrueYield[3];
+
+      // Fill by bin of hPt and hRaw, see flushFills()
+      BinnedFill::Hist2D PtFill[4];
+      BinnedFill::Hist1D RawFill[3];
+
+      // Current event
+      int RecoCount;
+      int GenCount;
+      int Bin;                         // of RecoCount, 1..NBins
+
+      explicit ActivityAxis(const Activity::Estimator &estimator)
+         : Estimator(estimator), NBins(estimator.GetNBins()), CellOffset(0)
+         , hRaw(), hRatio(), hPt(), hCorrected(), hRatioCorrected(), hPtCorrected()
+         , hCovPtCorrected(), hCovCorrected(), hRatioBootstrap(), hRatioReplicas()
+         , hResponse(), hResponseCross(), hTrue(nullptr), hReco(nullptr), hTrueYield()
+         , RecoCount(0), GenCount(0), Bin(1)
+      {
+      }
+
+      // Histograms processEvent fills, for the per-thread reduction
+      std::vector<TH1 *> accumulated() const
+      {
+         return {hRaw[0], hRaw[1], hRaw[2], hPt[0], hPt[1], hPt[2], hPt[3],
+                 hResponse[0], hResponse[1], hResponse[2], hResponse[3], hResponseCross[0], hResponseCross[1],
+                 hTrue, hReco, hTrueYield[0], hTrueYield[1], hTrueYield[2]};
+      }
+
+      // Everything owned, including the histograms made in correct()
+      std::vector<TH1 *> owned() const
+      {
+         std::vector<TH1 *> list = accumulated();
+         list.insert(list.end(), {hRatio[0], hRatio[1], hRatioCorrected[0], hRatioCorrected[1],
+                                  hCorrected[0], hCorrected[1], hCorrected[2],
+                                  hPtCorrected[0], hPtCorrected[1], hPtCorrected[2],
+                                  hCovPtCorrected[0], hCovPtCorrected[1], hCovPtCorrected[2],
+                                  hCovCorrected[0], hCovCorrected[1], hCovCorrected[2],
+                                  hRatioBootstrap[0], hRatioBootstrap[1],
+                                  hRatioReplicas[0], hRatioReplicas[1]});
+         return list;
+      }
+   };
+
+   // One per estimator of BuildActivityEstimators(), in the same order
+   std::vector<ActivityAxis> Axes;
 
    // Parameters
    KtoPiParameters par;
 
    // pT binning (copied from par and finalized in ctor)
    std::vector<double> PtBinEdges; // size = NPtBins+1
-   std::vector<double> DNdYBinEdges;
    int NPtBins;
-   int NNchBins;                   // number of Nch_tag bins in histograms
-   int MaxDNdYCount;
+   int TotalCells;                 // (activity, pT) cells of all axes
 
-   // Per-(Nch_tag, pT) averages of PID efficiencies (3×3 matrix)
-   //
-   // Indexing convention:
-   //   flatIndex = (iNchBin-1)*NPtBins + (iPtBin-1)
+   // pT -> bin along the y axis of the pT spectra, built in book()
+   BinnedFill::EdgeLocator PtBins;
+
+   // Per-(axis, activity bin, pT bin) sums of the per-track PID efficiencies (3×3 matrix), the
+   // matching efficiencies and the number of tracks summed, averaged in correct().  One
+   // contiguous block; a cell holds the AccComponents values of one (axis, activity, pT) bin:
    //
-   // Stored entries correspond to:
-   //   KAsK  etc = Prob(tag==K | true==K) etc.
+   //   Accumulator[(axis.CellOffset + flatIndex(axis, iBin, iPtBin))*AccComponents + c]
    //
-   std::vector<double> SumKAsK;
-   std::vector<double> SumKAsPi;
-   std::vector<double> SumKAsP;
-
-   std::vector<double> SumPiAsK;
-   std::vector<double> SumPiAsPi;
-   std::vector<double> SumPiAsP;
-
-   std::vector<double> SumPAsK;
-   std::vector<double> SumPAsPi;
-   std::vector<double> SumPAsP;
-   std::vector<double> SumRecoEffK;
-   std::vector<double> SumRecoEffPi;
-   std::vector<double> SumRecoEffP;
-   std::vector<double> SumGenEffK;
-   std::vector<double> SumGenEffPi;
-   std::vector<double> SumGenEffP;
-
-   std::vector<double> SumKAsKDNdEta;
-   std::vector<double> SumKAsPiDNdEta;
-   std::vector<double> SumKAsPDNdEta;
-
-   std::vector<double> SumPiAsKDNdEta;
-   std::vector<double> SumPiAsPiDNdEta;
-   std::vector<double> SumPiAsPDNdEta;
-
-   std::vector<double> SumPAsKDNdEta;
-   std::vector<double> SumPAsPiDNdEta;
-   std::vector<double> SumPAsPDNdEta;
-   std::vector<double> SumRecoEffKDNdEta;
-   std::vector<double> SumRecoEffPiDNdEta;
-   std::vector<double> SumRecoEffPDNdEta;
-   std::vector<double> SumGenEffKDNdEta;
-   std::vector<double> SumGenEffPiDNdEta;
-   std::vector<double> SumGenEffPDNdEta;
-   std::vector<double> SumKAsKDNdY;
-   std::vector<double> SumKAsPiDNdY;
-   std::vector<double> SumKAsPDNdY;
-   std::vector<double> SumPiAsKDNdY;
-   std::vector<double> SumPiAsPiDNdY;
-   std::vector<double> SumPiAsPDNdY;
-   std::vector<double> SumPAsKDNdY;
-   std::vector<double> SumPAsPiDNdY;
-   std::vector<double> SumPAsPDNdY;
-   std::vector<double> SumRecoEffKDNdY;
-   std::vector<double> SumRecoEffPiDNdY;
-   std::vector<double> SumRecoEffPDNdY;
-   std::vector<double> SumGenEffKDNdY;
-   std::vector<double> SumGenEffPiDNdY;
-   std::vector<double> SumGenEffPDNdY;
-
-   std::vector<long long> CountEffTracks;
-   std::vector<long long> CountTrueK;
-   std::vector<long long> CountTruePi;
-   std::vector<long long> CountTrueP;
-   std::vector<long long> CountGenK;
-   std::vector<long long> CountGenPi;
-   std::vector<long long> CountGenP;
-   std::vector<long long> CountEffTracksDNdEta;
-   std::vector<long long> CountEffTracksDNdY;
+   // see accumulatorCell().  KAsPi etc = Prob(tag==pi | true==K) etc.
+   enum AccumulatorComponent
+   {
+      AccKAsK, AccKAsPi, AccKAsP,
+      AccPiAsK, AccPiAsPi, AccPiAsP,
+      AccPAsK, AccPAsPi, AccPAsP,
+      AccRecoEffK, AccRecoEffPi, AccRecoEffP,
+      AccGenEffK, AccGenEffPi, AccGenEffP,
+      AccTracks,
+      AccKAsK2, AccKAsPi2, AccKAsP2,        // sums of squares of the 9 tagging probabilities
+      AccPiAsK2, AccPiAsPi2, AccPiAsP2,
+      AccPAsK2, AccPAsPi2, AccPAsP2,
+      AccComponents
+   };
+   // Element (row = observed tag, column = true species) of the tagging matrix, row-major
+   static constexpr int MatrixComponent[9] = {
+      AccKAsK, AccPiAsK, AccPAsK,
+      AccKAsPi, AccPiAsPi, AccPAsPi,
+      AccKAsP, AccPiAsP, AccPAsP};
+   static constexpr double MinTaggingDeterminant = 1.0e-10;
+   static constexpr int CovariancePairSpecies[3][2] = {{0, 1}, {2, 1}, {0, 2}};
+   static constexpr TaggingMatrixBatch::CovarianceIndex CovariancePair[3] = {
+      TaggingMatrixBatch::Cov01, TaggingMatrixBatch::Cov12, TaggingMatrixBatch::Cov02};
+   std::vector<double> Accumulator;
+
+   // Bootstrap replicas: Poisson(1) weights of the current event, the replicas where it is
+   // non-zero, and per replica a copy of Accumulator and of the raw K, pi, p counts per cell,
+   //   ReplicaAccumulator[(replica*TotalCells + axis.CellOffset + flatIndex)*AccComponents + c]
+   //   ReplicaSpectra[(replica*TotalCells + axis.CellOffset + flatIndex)*3 + species]
+   std::vector<double> ReplicaWeight;
+   std::vector<int> ReplicaActive;
+   std::vector<double> ReplicaAccumulator;
+   std::vector<double> ReplicaSpectra;
+
+   // Fixed-block reduction of the floating point sums.  The event loop fills the efficiency and
+   // replica sums of the current block of ReductionBlock entries into BlockAccumulator and
+   // BlockReplicaAccumulator (and the pT moments into the fillers), and foldBlock() adds them to
+   // the totals above in block order, in the serial loop and with threads alike, so the output
+   // does not depend on the thread count.  Integer sums (histogram contents, replica spectra)
+   // are exact in any order and are merged directly.
+   static constexpr long long ReductionBlock = 4096;
+   std::vector<double> BlockAccumulator;
+   std::vector<double> BlockReplicaAccumulator;
+
    long long NPIDPassTagTracks;
    long long NPIDTieTracks;
 
+   // Activity counts and truth yields come from the EventSummary friend par.Summary, attached
+   // to the messenger; set when the summary matches par, see summaryCompatible()
+   bool UseSummary;
+
+   // Further parameter sets filled in the same pass over the tree (--Variations); each one
+   // has its own histograms and output file but reads the entries loaded by this analyzer
+   std::vector<std::unique_ptr<KtoPiAnalyzer>> Variations;
+
+   // Throughput and wall time per stage of analyze(), see writeTimingSummary()
+   ProgressBar Bar;
+   StageTimer Timing;
+   int StageIO;
+   int StageSelection;
+   int StageMultiplicity;
+   int StageTracks;
+   int StageCorrection;
+   int StageVariations;
+
+   // Entries read by analyze(), written to every output as ShardInfo for MergeShards
+   EntryRange Range;
+
 public:
-   KtoPiAnalyzer(const KtoPiParameters &apar)
+   // With master != nullptr this is a per-thread accumulator for analyze(): no files, same
+   // binning, histograms not attached to any directory.
+   KtoPiAnalyzer(const KtoPiParameters &apar, const KtoPiAnalyzer *master = nullptr)
       : inf(nullptr)
       , outf(nullptr)
       , M(nullptr)
       , HasRecoMatchingBranches(false)
       , HasGenMatchingBranches(false)
-      , hK(nullptr)
-      , hPi(nullptr)
-      , hP(nullptr)
-      , hKoverPi(nullptr)
-      , hPoverPi(nullptr)
-      , hKCorrected(nullptr)
-      , hPiCorrected(nullptr)
-      , hPCorrected(nullptr)
-      , hKoverPiCorrected(nullptr)
-      , hPoverPiCorrected(nullptr)
-      , hKDNdEta(nullptr)
-      , hPiDNdEta(nullptr)
-      , hPDNdEta(nullptr)
-      , hKoverPiDNdEta(nullptr)
-      , hPoverPiDNdEta(nullptr)
-      , hKCorrectedDNdEta(nullptr)
-      , hPiCorrectedDNdEta(nullptr)
-      , hPCorrectedDNdEta(nullptr)
-      , hKoverPiCorrectedDNdEta(nullptr)
-      , hPoverPiCorrectedDNdEta(nullptr)
-      , hKDNdY(nullptr)
-      , hPiDNdY(nullptr)
-      , hPDNdY(nullptr)
-      , hKoverPiDNdY(nullptr)
-      , hPoverPiDNdY(nullptr)
-      , hKCorrectedDNdY(nullptr)
-      , hPiCorrectedDNdY(nullptr)
-      , hPCorrectedDNdY(nullptr)
-      , hKoverPiCorrectedDNdY(nullptr)
-      , hPoverPiCorrectedDNdY(nullptr)
-      , hKPt(nullptr)
-      , hPiPt(nullptr)
-      , hPPt(nullptr)
-      , hUPt(nullptr)
-      , hKPtCorrected(nullptr)
-      , hPiPtCorrected(nullptr)
-      , hPPtCorrected(nullptr)
-      , hKPtDNdEta(nullptr)
-      , hPiPtDNdEta(nullptr)
-      , hPPtDNdEta(nullptr)
-      , hUPtDNdEta(nullptr)
-      , hKPtCorrectedDNdEta(nullptr)
-      , hPiPtCorrectedDNdEta(nullptr)
-      , hPPtCorrectedDNdEta(nullptr)
-      , hKPtDNdY(nullptr)
-      , hPiPtDNdY(nullptr)
-      , hPPtDNdY(nullptr)
-      , hUPtDNdY(nullptr)
-      , hKPtCorrectedDNdY(nullptr)
-      , hPiPtCorrectedDNdY(nullptr)
-      , hPPtCorrectedDNdY(nullptr)
-      , hNtagResponse(nullptr)
-      , hNtagResponseK(nullptr)
-      , hNtagResponsePi(nullptr)
-      , hNtagResponseP(nullptr)
-      , hNtagTrue(nullptr)
-      , hNtagReco(nullptr)
-      , hKTrueNtag(nullptr)
-      , hPiTrueNtag(nullptr)
-      , hPTrueNtag(nullptr)
-      , hDNdEtaResponse(nullptr)
-      , hDNdEtaResponseK(nullptr)
-      , hDNdEtaResponsePi(nullptr)
-      , hDNdEtaResponseP(nullptr)
-      , hDNdEtaTrue(nullptr)
-      , hDNdEtaReco(nullptr)
-      , hKTruedNdEta(nullptr)
-      , hPiTruedNdEta(nullptr)
-      , hPTruedNdEta(nullptr)
-      , hDNdYResponse(nullptr)
-      , hDNdYResponseK(nullptr)
-      , hDNdYResponsePi(nullptr)
-      , hDNdYResponseP(nullptr)
-      , hDNdYTrue(nullptr)
-      , hDNdYReco(nullptr)
-      , hKTruedNdY(nullptr)
-      , hPiTruedNdY(nullptr)
-      , hPTruedNdY(nullptr)
       , NPIDPassTagTracks(0)
       , NPIDTieTracks(0)
+      , UseSummary(false)
       , par(apar)
       , PtBinEdges()
-      , DNdYBinEdges()
       , NPtBins(0)
-      , NNchBins(0)
-      , MaxDNdYCount(0)
+      , TotalCells(0)
+      , Bar(cout)
+      , StageIO(Timing.Register("IO"))
+      , StageSelection(Timing.Register("Selection"))
+      , StageMultiplicity(Timing.Register("Multiplicity"))
+      , StageTracks(Timing.Register("Tracks"))
+      , StageCorrection(Timing.Register("Correction"))
+      , StageVariations(Timing.Register("Variations"))
+      , Range(0)
    {
+      if (master != nullptr)
+      {
+         HasRecoMatchingBranches = master->HasRecoMatchingBranches;
+         HasGenMatchingBranches = master->HasGenMatchingBranches;
+         UseSummary = master->UseSummary;
+         const bool addDirectory = TH1::AddDirectoryStatus();
+         TH1::AddDirectory(false);
+         book();
+         TH1::AddDirectory(addDirectory);
+         return;
+      }
+
+      // Merged shard outputs instead of the tree: only the output and the binning here
+      if (!par.Finalize.empty())
+      {
+         if (openOutput())
+            book();
+         return;
+      }
+
       // Open input
       inf = new TFile(par.input.c_str());
       if (inf == nullptr || inf->IsZombie())
@@ -471,13 +563,8 @@ public:
       M = new StrangenessTreeMessenger(*inf, std::string("Tree"));
 
       // Open output
-      outf = new TFile(par.output.c_str(), "RECREATE");
-      if (outf == nullptr || outf->IsZombie())
-      {
-         cerr << "Error: cannot create output file '" << par.output << "'" << endl;
+      if (!openOutput())
          return;
-      }
-      outf->cd();
 
       // v2.2 trees provide species-dependent matching efficiencies.
       if (M != nullptr && M->Tree != nullptr)
@@ -489,22 +576,72 @@ public:
          bool hasRecPi = (M->Tree->GetBranch("RecoEfficiencyPi") != nullptr);
          bool hasRecP  = (M->Tree->GetBranch("RecoEfficiencyP")  != nullptr);
 
-         if (hasRecK && hasRecPi && hasRecP)
-         {
-            HasRecoMatchingBranches = true;
-            M->Tree->SetBranchAddress("RecoEfficiencyK",  RecoEfficiencyKExtra);
-            M->Tree->SetBranchAddress("RecoEfficiencyPi", RecoEfficiencyPiExtra);
-            M->Tree->SetBranchAddress("RecoEfficiencyP",  RecoEfficiencyPExtra);
-         }
-         if (hasGenK && hasGenPi && hasGenP)
+         // Read through the messenger's own RecoEfficiency* / RecoGenEfficiency* arrays
+         HasRecoMatchingBranches = (hasRecK && hasRecPi && hasRecP);
+         HasGenMatchingBranches = (hasGenK && hasGenPi && hasGenP);
+      }
+
+      book();
+
+      if (!par.Summary.empty())
+      {
+         UseSummary = summaryCompatible() && M->AttachSummary(par.Summary);
+         if (!UseSummary)
+            cerr << "Warning: not using summary '" << par.Summary << "', counting from the tracks" << endl;
+      }
+   }
+
+   // The summary counts are the estimator counts only for the thresholds it was written with,
+   // and only for estimators that name a summary count (not the central-eta dN/dy truth count)
+   bool summaryCompatible() const
+   {
+      for (const ActivityAxis &axis : Axes)
+      {
+         if (!axis.Estimator.SummaryReco || !axis.Estimator.SummaryGen)
          {
-            HasGenMatchingBranches = true;
-            M->Tree->SetBranchAddress("RecoGenEfficiencyK",  RecoGenEfficiencyKExtra);
-            M->Tree->SetBranchAddress("RecoGenEfficiencyPi", RecoGenEfficiencyPiExtra);
-            M->Tree->SetBranchAddress("RecoGenEfficiencyP",  RecoGenEfficiencyPExtra);
+            cerr << "Summary has no " << axis.Estimator.Quantity << " count for these settings" << endl;
+            return false;
          }
       }
+      // The truth yields also require pT >= NtagPtMin, which the summary yields do not
+      if (par.NtagPtMin > PtBinEdges.front())
+      {
+         cerr << "NtagPtMin is above the first pT edge; the summary yields have no NtagPtMin cut" << endl;
+         return false;
+      }
+      std::vector<std::pair<std::string, double>> expected = {
+         {"NtagPtMin", par.NtagPtMin}, {"YieldPtMin", PtBinEdges.front()}, {"YieldPtMax", PtBinEdges.back()}};
+      if (par.UsePIDFiducial)
+         expected.insert(expected.end(), {{"PIDAbsCosMin", par.PIDTrackAbsCosMin}, {"PIDAbsCosMax", par.PIDTrackAbsCosMax}});
+      return SummaryMatches(par.Summary, expected);
+   }
+
+   bool openOutput()
+   {
+      outf = new TFile(par.output.c_str(), "RECREATE");
+      if (outf == nullptr || outf->IsZombie())
+      {
+         cerr << "Error: cannot create output file '" << par.output << "'" << endl;
+         return false;
+      }
+      outf->cd();
+      return true;
+   }
+
+   // Adds a parameter set filled from the same entries as this one, written to vpar.output.
+   // Input, MaxEvents, the entry range and Threads of vpar are ignored.
+   bool addVariation(const KtoPiParameters &vpar)
+   {
+      Variations.emplace_back(new KtoPiAnalyzer(vpar, this));
+      KtoPiAnalyzer &v = *Variations.back();
+      if (UseSummary)
+         v.UseSummary = v.summaryCompatible();
+      return v.openOutput();
+   }
 
+   // Binning, histograms and efficiency accumulators; depends on par only
+   void book()
+   {
       //--------------------------------------------------
       // Finalize pT binning
       //--------------------------------------------------
@@ -532,536 +669,152 @@ public:
       NPtBins = static_cast<int>(PtBinEdges.size()) - 1;
 
       //--------------------------------------------------
-      // Book 1D histograms vs Nch_tag
+      // Histograms of every activity estimator
       //--------------------------------------------------
-      const int maxNchTag = par.MaxNchTag;
-      const int nbinsNch  = maxNchTag / 4 + 1;   // same choice as original macro
-
-      NNchBins = nbinsNch;
-      DNdYBinEdges = BuildDefaultDNdYBinEdges(nbinsNch, std::min(maxNchTag, 30));
-      MaxDNdYCount = static_cast<int>(std::floor(DNdYBinEdges.back() - 0.5));
-      const double *dndyEdgesArray = &(DNdYBinEdges[0]);
-
-      // Kaon, Proton and Pion Spectra vs NchTag
-      hK = new TH1D("hK",
-                    "Kaon candidates vs N_{ch}^{tag};N_{ch}^{tag};Yield (sum over tracks)",
-                    nbinsNch, -0.5, maxNchTag + 0.5);
-
-      hPi = (TH1D *)hK->Clone("hPi");
-      hPi->SetTitle("Pion candidates vs N_{ch}^{tag};N_{ch}^{tag};Yield (sum over tracks)");
-
-      hP = (TH1D *)hK->Clone("hP");
-      hP->SetTitle("Proton candidates vs N_{ch}^{tag};N_{ch}^{tag};Yield (sum over tracks)");
-
-      hK->Sumw2();
-      hPi->Sumw2();
-      hP->Sumw2();
-
-      hKoverPi = nullptr;
-      hPoverPi = nullptr;
-
-      // Corrected 1D histograms (will be filled after matrix inversion)
-      hKCorrected = (TH1D *)hK->Clone("hKCorrected");
-      hKCorrected->SetTitle("PID-corrected K yield vs N_{ch}^{tag};N_{ch}^{tag};Corrected N_{K}");
-      hKCorrected->Reset();
-      hKCorrected->Sumw2();
-
-      hPiCorrected = (TH1D *)hK->Clone("hPiCorrected");
-      hPiCorrected->SetTitle("PID-corrected #pi yield vs N_{ch}^{tag};N_{ch}^{tag};Corrected N_{#pi}");
-      hPiCorrected->Reset();
-      hPiCorrected->Sumw2();
-
-      hPCorrected = (TH1D *)hK->Clone("hPCorrected");
-      hPCorrected->SetTitle("PID-corrected p yield vs N_{ch}^{tag};N_{ch}^{tag};Corrected N_{p}");
-      hPCorrected->Reset();
-      hPCorrected->Sumw2();
-
-      hKoverPiCorrected = nullptr;
-      hPoverPiCorrected = nullptr;
-
-      hKDNdEta = (TH1D *)hK->Clone("hKDNdEta");
-      hKDNdEta->SetTitle("Kaon candidates vs reco dN_{ch}/d#eta(|#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5);Yield (sum over tracks)");
-      hKDNdEta->Reset();
-      hKDNdEta->Sumw2();
-
-      hPiDNdEta = (TH1D *)hKDNdEta->Clone("hPiDNdEta");
-      hPiDNdEta->SetTitle("Pion candidates vs reco dN_{ch}/d#eta(|#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5);Yield (sum over tracks)");
+      Axes.clear();
+      for (const Activity::Estimator &estimator : BuildActivityEstimators(par))
+         Axes.emplace_back(estimator);
 
-      hPDNdEta = (TH1D *)hKDNdEta->Clone("hPDNdEta");
-      hPDNdEta->SetTitle("Proton candidates vs reco dN_{ch}/d#eta(|#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5);Yield (sum over tracks)");
-
-      hKoverPiDNdEta = nullptr;
-      hPoverPiDNdEta = nullptr;
-
-      hKCorrectedDNdEta = (TH1D *)hKDNdEta->Clone("hKCorrectedDNdEta");
-      hKCorrectedDNdEta->SetTitle("PID-corrected K yield vs reco dN_{ch}/d#eta(|#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5);Corrected N_{K}");
-      hKCorrectedDNdEta->Reset();
-      hKCorrectedDNdEta->Sumw2();
-
-      hPiCorrectedDNdEta = (TH1D *)hKDNdEta->Clone("hPiCorrectedDNdEta");
-      hPiCorrectedDNdEta->SetTitle("PID-corrected #pi yield vs reco dN_{ch}/d#eta(|#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5);Corrected N_{#pi}");
-      hPiCorrectedDNdEta->Reset();
-      hPiCorrectedDNdEta->Sumw2();
-
-      hPCorrectedDNdEta = (TH1D *)hKDNdEta->Clone("hPCorrectedDNdEta");
-      hPCorrectedDNdEta->SetTitle("PID-corrected p yield vs reco dN_{ch}/d#eta(|#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5);Corrected N_{p}");
-      hPCorrectedDNdEta->Reset();
-      hPCorrectedDNdEta->Sumw2();
-
-      hKoverPiCorrectedDNdEta = nullptr;
-      hPoverPiCorrectedDNdEta = nullptr;
-
-      hKDNdY = new TH1D("hKDNdY",
-                        "Kaon candidates vs reco dN_{ch}/dy(|y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);Yield (sum over tracks)",
-                        static_cast<int>(DNdYBinEdges.size()) - 1, dndyEdgesArray);
-      hKDNdY->SetTitle("Kaon candidates vs reco dN_{ch}/dy(|y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);Yield (sum over tracks)");
-      hKDNdY->Reset();
-      hKDNdY->Sumw2();
-
-      hPiDNdY = (TH1D *)hKDNdY->Clone("hPiDNdY");
-      hPiDNdY->SetTitle("Pion candidates vs reco dN_{ch}/dy(|y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);Yield (sum over tracks)");
-
-      hPDNdY = (TH1D *)hKDNdY->Clone("hPDNdY");
-      hPDNdY->SetTitle("Proton candidates vs reco dN_{ch}/dy(|y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);Yield (sum over tracks)");
-
-      hKoverPiDNdY = nullptr;
-      hPoverPiDNdY = nullptr;
-
-      hKCorrectedDNdY = (TH1D *)hKDNdY->Clone("hKCorrectedDNdY");
-      hKCorrectedDNdY->SetTitle("PID-corrected K yield vs reco dN_{ch}/dy(|y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);Corrected N_{K}");
-      hKCorrectedDNdY->Reset();
-      hKCorrectedDNdY->Sumw2();
-
-      hPiCorrectedDNdY = (TH1D *)hKDNdY->Clone("hPiCorrectedDNdY");
-      hPiCorrectedDNdY->SetTitle("PID-corrected #pi yield vs reco dN_{ch}/dy(|y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);Corrected N_{#pi}");
-      hPiCorrectedDNdY->Reset();
-      hPiCorrectedDNdY->Sumw2();
-
-      hPCorrectedDNdY = (TH1D *)hKDNdY->Clone("hPCorrectedDNdY");
-      hPCorrectedDNdY->SetTitle("PID-corrected p yield vs reco dN_{ch}/dy(|y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);Corrected N_{p}");
-      hPCorrectedDNdY->Reset();
-      hPCorrectedDNdY->Sumw2();
-
-      hKoverPiCorrectedDNdY = nullptr;
-      hPoverPiCorrectedDNdY = nullptr;
+      TotalCells = 0;
+      for (ActivityAxis &axis : Axes)
+      {
+         bookAxis(axis);
+         axis.CellOffset = TotalCells;
+         TotalCells += axis.NBins * NPtBins;
+      }
+      PtBins.Build(PtBinEdges);
 
       //--------------------------------------------------
-      // Book 2D pT spectra: x = Nch_tag, y = pT
+      // Allocate per-(axis, activity, pT) efficiency accumulators
       //--------------------------------------------------
-      const double nchMin = hK->GetXaxis()->GetXmin();
-      const double nchMax = hK->GetXaxis()->GetXmax();
+      const int nReplicas = std::max(par.BootstrapReplicas, 0);
+      Accumulator.assign(TotalCells * AccComponents, 0.0);
+      ReplicaWeight.assign(nReplicas, 0.0);
+      ReplicaActive.clear();
+      ReplicaActive.reserve(nReplicas);
+      ReplicaAccumulator.assign(nReplicas * Accumulator.size(), 0.0);
+      ReplicaSpectra.assign(nReplicas * TotalCells * 3, 0.0);
+      BlockAccumulator.assign(Accumulator.size(), 0.0);
+      BlockReplicaAccumulator.assign(ReplicaAccumulator.size(), 0.0);
+   }
+
+   static constexpr const char *SpeciesName[4] = {"K", "Pi", "P", "U"};
+   static constexpr const char *SpeciesTitle[3] = {"K", "#pi", "p"};
+   static constexpr const char *CandidateTitle[4] = {
+      "Kaon candidates", "Pion candidates", "Proton candidates", "Untagged charged tracks"};
+   static constexpr const char *RatioName[2] = {"KoverPi", "PoverPi"};
+   static constexpr const char *RatioTitle[2] = {"K/#pi", "p/#pi"};
+   static constexpr int RatioSpecies[2] = {0, 2};   // numerator; the denominator is pi
+
+   // Raw, corrected, covariance, bootstrap and MC response histograms of one estimator, x axis
+   // binned as the estimator says
+   void bookAxis(ActivityAxis &axis)
+   {
+      const Activity::Estimator &e = axis.Estimator;
+      const bool variable = !e.Edges.empty();
+      const double *edges = variable ? &(e.Edges[0]) : nullptr;
       const double *ptEdgesArray = &(PtBinEdges[0]);
 
-      hKPt = new TH2D("hKPt",
-                      "Kaon candidates;N_{ch}^{tag};p_{T} (GeV/c)",
-                      nbinsNch, nchMin, nchMax,
-                      NPtBins, ptEdgesArray);
-
-      hPiPt = new TH2D("hPiPt",
-                       "Pion candidates;N_{ch}^{tag};p_{T} (GeV/c)",
-                       nbinsNch, nchMin, nchMax,
-                       NPtBins, ptEdgesArray);
-
-      hPPt = new TH2D("hPPt",
-                      "Proton candidates;N_{ch}^{tag};p_{T} (GeV/c)",
-                      nbinsNch, nchMin, nchMax,
-                      NPtBins, ptEdgesArray);
-      hUPt = new TH2D("hUPt",
-                      "Untagged charged tracks;N_{ch}^{tag};p_{T} (GeV/c)",
-                      nbinsNch, nchMin, nchMax,
-                      NPtBins, ptEdgesArray);
-
-      hKPt->Sumw2();
-      hPiPt->Sumw2();
-      hPPt->Sumw2();
-      hUPt->Sumw2();
-
-      hKPtCorrected = (TH2D *)hKPt->Clone("hKPtCorrected");
-      hKPtCorrected->SetTitle("PID-corrected K p_{T} spectrum;N_{ch}^{tag};p_{T} (GeV/c)");
-      hKPtCorrected->Reset();
-      hKPtCorrected->Sumw2();
-
-      hPiPtCorrected = (TH2D *)hPiPt->Clone("hPiPtCorrected");
-      hPiPtCorrected->SetTitle("PID-corrected #pi p_{T} spectrum;N_{ch}^{tag};p_{T} (GeV/c)");
-      hPiPtCorrected->Reset();
-      hPiPtCorrected->Sumw2();
-
-      hPPtCorrected = (TH2D *)hPPt->Clone("hPPtCorrected");
-      hPPtCorrected->SetTitle("PID-corrected p p_{T} spectrum;N_{ch}^{tag};p_{T} (GeV/c)");
-      hPPtCorrected->Reset();
-      hPPtCorrected->Sumw2();
-
-      hKPtDNdEta = (TH2D *)hKPt->Clone("hKPtDNdEta");
-      hKPtDNdEta->SetTitle("Kaon candidates;dN_{ch}/d#eta (reco, |#eta|<0.5);p_{T} (GeV/c)");
-      hKPtDNdEta->Reset();
-      hKPtDNdEta->Sumw2();
-
-      hPiPtDNdEta = (TH2D *)hPiPt->Clone("hPiPtDNdEta");
-      hPiPtDNdEta->SetTitle("Pion candidates;dN_{ch}/d#eta (reco, |#eta|<0.5);p_{T} (GeV/c)");
-      hPiPtDNdEta->Reset();
-      hPiPtDNdEta->Sumw2();
-
-      hPPtDNdEta = (TH2D *)hPPt->Clone("hPPtDNdEta");
-      hPPtDNdEta->SetTitle("Proton candidates;dN_{ch}/d#eta (reco, |#eta|<0.5);p_{T} (GeV/c)");
-      hPPtDNdEta->Reset();
-      hPPtDNdEta->Sumw2();
-
-      hUPtDNdEta = (TH2D *)hUPt->Clone("hUPtDNdEta");
-      hUPtDNdEta->SetTitle("Untagged charged tracks;dN_{ch}/d#eta (reco, |#eta|<0.5);p_{T} (GeV/c)");
-      hUPtDNdEta->Reset();
-      hUPtDNdEta->Sumw2();
-
-      hKPtCorrectedDNdEta = (TH2D *)hKPtDNdEta->Clone("hKPtCorrectedDNdEta");
-      hKPtCorrectedDNdEta->SetTitle("PID-corrected K p_{T} spectrum;dN_{ch}/d#eta (reco, |#eta|<0.5);p_{T} (GeV/c)");
-      hKPtCorrectedDNdEta->Reset();
-      hKPtCorrectedDNdEta->Sumw2();
-
-      hPiPtCorrectedDNdEta = (TH2D *)hPiPtDNdEta->Clone("hPiPtCorrectedDNdEta");
-      hPiPtCorrectedDNdEta->SetTitle("PID-corrected #pi p_{T} spectrum;dN_{ch}/d#eta (reco, |#eta|<0.5);p_{T} (GeV/c)");
-      hPiPtCorrectedDNdEta->Reset();
-      hPiPtCorrectedDNdEta->Sumw2();
-
-      hPPtCorrectedDNdEta = (TH2D *)hPPtDNdEta->Clone("hPPtCorrectedDNdEta");
-      hPPtCorrectedDNdEta->SetTitle("PID-corrected p p_{T} spectrum;dN_{ch}/d#eta (reco, |#eta|<0.5);p_{T} (GeV/c)");
-      hPPtCorrectedDNdEta->Reset();
-      hPPtCorrectedDNdEta->Sumw2();
-
-      hKPtDNdY = new TH2D("hKPtDNdY",
-                         "Kaon candidates;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)",
-                         static_cast<int>(DNdYBinEdges.size()) - 1, dndyEdgesArray,
-                         NPtBins, ptEdgesArray);
-      hKPtDNdY->SetTitle("Kaon candidates;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)");
-      hKPtDNdY->Reset();
-      hKPtDNdY->Sumw2();
-
-      hPiPtDNdY = new TH2D("hPiPtDNdY",
-                          "Pion candidates;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)",
-                          static_cast<int>(DNdYBinEdges.size()) - 1, dndyEdgesArray,
-                          NPtBins, ptEdgesArray);
-      hPiPtDNdY->SetTitle("Pion candidates;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)");
-      hPiPtDNdY->Reset();
-      hPiPtDNdY->Sumw2();
-
-      hPPtDNdY = new TH2D("hPPtDNdY",
-                         "Proton candidates;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)",
-                         static_cast<int>(DNdYBinEdges.size()) - 1, dndyEdgesArray,
-                         NPtBins, ptEdgesArray);
-      hPPtDNdY->SetTitle("Proton candidates;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)");
-      hPPtDNdY->Reset();
-      hPPtDNdY->Sumw2();
-
-      hUPtDNdY = new TH2D("hUPtDNdY",
-                         "Untagged charged tracks;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)",
-                         static_cast<int>(DNdYBinEdges.size()) - 1, dndyEdgesArray,
-                         NPtBins, ptEdgesArray);
-      hUPtDNdY->SetTitle("Untagged charged tracks;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)");
-      hUPtDNdY->Reset();
-      hUPtDNdY->Sumw2();
-
-      hKPtCorrectedDNdY = (TH2D *)hKPtDNdY->Clone("hKPtCorrectedDNdY");
-      hKPtCorrectedDNdY->SetTitle("PID-corrected K p_{T} spectrum;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)");
-      hKPtCorrectedDNdY->Reset();
-      hKPtCorrectedDNdY->Sumw2();
-
-      hPiPtCorrectedDNdY = (TH2D *)hPiPtDNdY->Clone("hPiPtCorrectedDNdY");
-      hPiPtCorrectedDNdY->SetTitle("PID-corrected #pi p_{T} spectrum;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)");
-      hPiPtCorrectedDNdY->Reset();
-      hPiPtCorrectedDNdY->Sumw2();
-
-      hPPtCorrectedDNdY = (TH2D *)hPPtDNdY->Clone("hPPtCorrectedDNdY");
-      hPPtCorrectedDNdY->SetTitle("PID-corrected p p_{T} spectrum;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p_{T} (GeV/c)");
-      hPPtCorrectedDNdY->Reset();
-      hPPtCorrectedDNdY->Sumw2();
-
-      // MC-only histograms for multiplicity response/unfolding support
-      hNtagResponse = new TH2D("hNtagResponse",
-                               "N_{tag}^{ch} response;N_{tag,true}^{ch};N_{tag,reco}^{ch}",
-                               nbinsNch, nchMin, nchMax,
-                               nbinsNch, nchMin, nchMax);
-      hNtagResponse->Sumw2();
-
-      hNtagResponseK = (TH2D *)hNtagResponse->Clone("hNtagResponseK");
-      hNtagResponseK->SetTitle("K-weighted N_{tag}^{ch} response;N_{tag,true}^{ch};N_{tag,reco}^{ch}");
-      hNtagResponseK->Reset();
-      hNtagResponseK->Sumw2();
-
-      hNtagResponsePi = (TH2D *)hNtagResponse->Clone("hNtagResponsePi");
-      hNtagResponsePi->SetTitle("#pi-weighted N_{tag}^{ch} response;N_{tag,true}^{ch};N_{tag,reco}^{ch}");
-      hNtagResponsePi->Reset();
-      hNtagResponsePi->Sumw2();
-
-      hNtagResponseP = (TH2D *)hNtagResponse->Clone("hNtagResponseP");
-      hNtagResponseP->SetTitle("p-weighted N_{tag}^{ch} response;N_{tag,true}^{ch};N_{tag,reco}^{ch}");
-      hNtagResponseP->Reset();
-      hNtagResponseP->Sumw2();
-
-      hNtagTrue = (TH1D *)hK->Clone("hNtagTrue");
-      hNtagTrue->SetTitle("True N_{tag}^{ch} distribution;N_{tag,true}^{ch};Events");
-      hNtagTrue->Reset();
-      hNtagTrue->Sumw2();
-
-      hNtagReco = (TH1D *)hK->Clone("hNtagReco");
-      hNtagReco->SetTitle("Reco N_{tag}^{ch} distribution;N_{tag,reco}^{ch};Events");
-      hNtagReco->Reset();
-      hNtagReco->Sumw2();
-
-      hKTrueNtag = (TH1D *)hK->Clone("hKTrueNtag");
-      hKTrueNtag->SetTitle("Generator-level K yield vs true N_{tag}^{ch};N_{tag,true}^{ch};N_{K}^{gen}");
-      hKTrueNtag->Reset();
-      hKTrueNtag->Sumw2();
-
-      hPiTrueNtag = (TH1D *)hK->Clone("hPiTrueNtag");
-      hPiTrueNtag->SetTitle("Generator-level #pi yield vs true N_{tag}^{ch};N_{tag,true}^{ch};N_{#pi}^{gen}");
-      hPiTrueNtag->Reset();
-      hPiTrueNtag->Sumw2();
-
-      hPTrueNtag = (TH1D *)hK->Clone("hPTrueNtag");
-      hPTrueNtag->SetTitle("Generator-level p yield vs true N_{tag}^{ch};N_{tag,true}^{ch};N_{p}^{gen}");
-      hPTrueNtag->Reset();
-      hPTrueNtag->Sumw2();
-
-      hDNdEtaResponse = new TH2D("hDNdEtaResponse",
-                                 "dN_{ch}/d#eta response;dN_{ch}/d#eta (true, |#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5)",
-                                 nbinsNch, nchMin, nchMax,
-                                 nbinsNch, nchMin, nchMax);
-      hDNdEtaResponse->Sumw2();
-
-      hDNdEtaResponseK = (TH2D *)hDNdEtaResponse->Clone("hDNdEtaResponseK");
-      hDNdEtaResponseK->SetTitle("K-weighted dN_{ch}/d#eta response;dN_{ch}/d#eta (true, |#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5)");
-      hDNdEtaResponseK->Reset();
-      hDNdEtaResponseK->Sumw2();
-
-      hDNdEtaResponsePi = (TH2D *)hDNdEtaResponse->Clone("hDNdEtaResponsePi");
-      hDNdEtaResponsePi->SetTitle("#pi-weighted dN_{ch}/d#eta response;dN_{ch}/d#eta (true, |#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5)");
-      hDNdEtaResponsePi->Reset();
-      hDNdEtaResponsePi->Sumw2();
-
-      hDNdEtaResponseP = (TH2D *)hDNdEtaResponse->Clone("hDNdEtaResponseP");
-      hDNdEtaResponseP->SetTitle("p-weighted dN_{ch}/d#eta response;dN_{ch}/d#eta (true, |#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5)");
-      hDNdEtaResponseP->Reset();
-      hDNdEtaResponseP->Sumw2();
-
-      hDNdEtaTrue = (TH1D *)hK->Clone("hDNdEtaTrue");
-      hDNdEtaTrue->SetTitle("True dN_{ch}/d#eta distribution (|#eta|<0.5);dN_{ch}/d#eta (true, |#eta|<0.5);Events");
-      hDNdEtaTrue->Reset();
-      hDNdEtaTrue->Sumw2();
-
-      hDNdEtaReco = (TH1D *)hKDNdEta->Clone("hDNdEtaReco");
-      hDNdEtaReco->SetTitle("Reco dN_{ch}/d#eta distribution (|#eta|<0.5);dN_{ch}/d#eta (reco, |#eta|<0.5);Events");
-      hDNdEtaReco->Reset();
-      hDNdEtaReco->Sumw2();
-
-      hKTruedNdEta = (TH1D *)hK->Clone("hKTruedNdEta");
-      hKTruedNdEta->SetTitle("Generator-level K yield vs true dN_{ch}/d#eta;dN_{ch}/d#eta (true, |#eta|<0.5);N_{K}^{gen}");
-      hKTruedNdEta->Reset();
-      hKTruedNdEta->Sumw2();
-
-      hPiTruedNdEta = (TH1D *)hK->Clone("hPiTruedNdEta");
-      hPiTruedNdEta->SetTitle("Generator-level #pi yield vs true dN_{ch}/d#eta;dN_{ch}/d#eta (true, |#eta|<0.5);N_{#pi}^{gen}");
-      hPiTruedNdEta->Reset();
-      hPiTruedNdEta->Sumw2();
-
-      hPTruedNdEta = (TH1D *)hK->Clone("hPTruedNdEta");
-      hPTruedNdEta->SetTitle("Generator-level p yield vs true dN_{ch}/d#eta;dN_{ch}/d#eta (true, |#eta|<0.5);N_{p}^{gen}");
-      hPTruedNdEta->Reset();
-      hPTruedNdEta->Sumw2();
-
-      hDNdYResponse = new TH2D("hDNdYResponse",
-                               "dN_{ch}/dy response wrt thrust axis;dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5)",
-                               static_cast<int>(DNdYBinEdges.size()) - 1, dndyEdgesArray,
-                               static_cast<int>(DNdYBinEdges.size()) - 1, dndyEdgesArray);
-      hDNdYResponse->Sumw2();
-
-      hDNdYResponseK = (TH2D *)hDNdYResponse->Clone("hDNdYResponseK");
-      hDNdYResponseK->SetTitle("K-weighted dN_{ch}/dy response;dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5)");
-      hDNdYResponseK->Reset();
-      hDNdYResponseK->Sumw2();
-
-      hDNdYResponsePi = (TH2D *)hDNdYResponse->Clone("hDNdYResponsePi");
-      hDNdYResponsePi->SetTitle("#pi-weighted dN_{ch}/dy response;dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5)");
-      hDNdYResponsePi->Reset();
-      hDNdYResponsePi->Sumw2();
-
-      hDNdYResponseP = (TH2D *)hDNdYResponse->Clone("hDNdYResponseP");
-      hDNdYResponseP->SetTitle("p-weighted dN_{ch}/dy response;dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5)");
-      hDNdYResponseP->Reset();
-      hDNdYResponseP->Sumw2();
-
-      hDNdYTrue = new TH1D("hDNdYTrue",
-                           "True dN_{ch}/dy distribution wrt thrust axis (|y_{T}|<0.5);dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);Events",
-                           static_cast<int>(DNdYBinEdges.size()) - 1, dndyEdgesArray);
-      hDNdYTrue->SetTitle("True dN_{ch}/dy distribution wrt thrust axis (|y_{T}|<0.5);dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);Events");
-      hDNdYTrue->Reset();
-      hDNdYTrue->Sumw2();
-
-      hDNdYReco = (TH1D *)hKDNdY->Clone("hDNdYReco");
-      hDNdYReco->SetTitle("Reco dN_{ch}/dy distribution wrt thrust axis (|y_{T}|<0.5);dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);Events");
-      hDNdYReco->Reset();
-      hDNdYReco->Sumw2();
-
-      hKTruedNdY = new TH1D("hKTruedNdY",
-                            "Generator-level K yield vs true dN_{ch}/dy;dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);N_{K}^{gen}",
-                            static_cast<int>(DNdYBinEdges.size()) - 1, dndyEdgesArray);
-      hKTruedNdY->SetTitle("Generator-level K yield vs true dN_{ch}/dy;dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);N_{K}^{gen}");
-      hKTruedNdY->Reset();
-      hKTruedNdY->Sumw2();
-
-      hPiTruedNdY = (TH1D *)hKTruedNdY->Clone("hPiTruedNdY");
-      hPiTruedNdY->SetTitle("Generator-level #pi yield vs true dN_{ch}/dy;dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);N_{#pi}^{gen}");
-      hPiTruedNdY->Reset();
-      hPiTruedNdY->Sumw2();
-
-      hPTruedNdY = (TH1D *)hKTruedNdY->Clone("hPTruedNdY");
-      hPTruedNdY->SetTitle("Generator-level p yield vs true dN_{ch}/dy;dN_{ch}/dy (true, thrust axis, |y_{T}|<0.5);N_{p}^{gen}");
-      hPTruedNdY->Reset();
-      hPTruedNdY->Sumw2();
+      auto book1D = [&](const std::string &name, const std::string &title)
+      {
+         TH1D *h = variable
+            ? new TH1D(name.c_str(), title.c_str(), axis.NBins, edges)
+            : new TH1D(name.c_str(), title.c_str(), axis.NBins, e.Min, e.Max);
+         h->Sumw2();
+         return h;
+      };
+      // y = pT, or y = activity as well for the response
+      auto book2D = [&](const std::string &name, const std::string &title, bool response)
+      {
+         TH2D *h = nullptr;
+         if (variable && response)
+            h = new TH2D(name.c_str(), title.c_str(), axis.NBins, edges, axis.NBins, edges);
+         else if (variable)
+            h = new TH2D(name.c_str(), title.c_str(), axis.NBins, edges, NPtBins, ptEdgesArray);
+         else if (response)
+            h = new TH2D(name.c_str(), title.c_str(), axis.NBins, e.Min, e.Max, axis.NBins, e.Min, e.Max);
+         else
+            h = new TH2D(name.c_str(), title.c_str(), axis.NBins, e.Min, e.Max, NPtBins, ptEdgesArray);
+         h->Sumw2();
+         return h;
+      };
 
-      //--------------------------------------------------
-      // Allocate per-(Nch_tag, pT) efficiency accumulators
-      //--------------------------------------------------
-      const int nCells = NNchBins * NPtBins;
-
-      SumKAsK.assign(nCells + 1, 0.0);
-      SumKAsPi.assign(nCells + 1, 0.0);
-      SumKAsP.assign(nCells + 1, 0.0);
-
-      SumPiAsK.assign(nCells + 1, 0.0);
-      SumPiAsPi.assign(nCells + 1, 0.0);
-      SumPiAsP.assign(nCells + 1, 0.0);
-
-      SumPAsK.assign(nCells + 1, 0.0);
-      SumPAsPi.assign(nCells + 1, 0.0);
-      SumPAsP.assign(nCells + 1, 0.0);
-      SumRecoEffK.assign(nCells + 1, 0.0);
-      SumRecoEffPi.assign(nCells + 1, 0.0);
-      SumRecoEffP.assign(nCells + 1, 0.0);
-      SumGenEffK.assign(nCells + 1, 0.0);
-      SumGenEffPi.assign(nCells + 1, 0.0);
-      SumGenEffP.assign(nCells + 1, 0.0);
-      SumKAsKDNdEta.assign(nCells + 1, 0.0);
-      SumKAsPiDNdEta.assign(nCells + 1, 0.0);
-      SumKAsPDNdEta.assign(nCells + 1, 0.0);
-      SumPiAsKDNdEta.assign(nCells + 1, 0.0);
-      SumPiAsPiDNdEta.assign(nCells + 1, 0.0);
-      SumPiAsPDNdEta.assign(nCells + 1, 0.0);
-      SumPAsKDNdEta.assign(nCells + 1, 0.0);
-      SumPAsPiDNdEta.assign(nCells + 1, 0.0);
-      SumPAsPDNdEta.assign(nCells + 1, 0.0);
-      SumRecoEffKDNdEta.assign(nCells + 1, 0.0);
-      SumRecoEffPiDNdEta.assign(nCells + 1, 0.0);
-      SumRecoEffPDNdEta.assign(nCells + 1, 0.0);
-      SumGenEffKDNdEta.assign(nCells + 1, 0.0);
-      SumGenEffPiDNdEta.assign(nCells + 1, 0.0);
-      SumGenEffPDNdEta.assign(nCells + 1, 0.0);
-      SumKAsKDNdY.assign(nCells + 1, 0.0);
-      SumKAsPiDNdY.assign(nCells + 1, 0.0);
-      SumKAsPDNdY.assign(nCells + 1, 0.0);
-      SumPiAsKDNdY.assign(nCells + 1, 0.0);
-      SumPiAsPiDNdY.assign(nCells + 1, 0.0);
-      SumPiAsPDNdY.assign(nCells + 1, 0.0);
-      SumPAsKDNdY.assign(nCells + 1, 0.0);
-      SumPAsPiDNdY.assign(nCells + 1, 0.0);
-      SumPAsPDNdY.assign(nCells + 1, 0.0);
-      SumRecoEffKDNdY.assign(nCells + 1, 0.0);
-      SumRecoEffPiDNdY.assign(nCells + 1, 0.0);
-      SumRecoEffPDNdY.assign(nCells + 1, 0.0);
-      SumGenEffKDNdY.assign(nCells + 1, 0.0);
-      SumGenEffPiDNdY.assign(nCells + 1, 0.0);
-      SumGenEffPDNdY.assign(nCells + 1, 0.0);
-
-      CountEffTracks.assign(nCells + 1, 0);
-      CountEffTracksDNdEta.assign(nCells + 1, 0);
-      CountEffTracksDNdY.assign(nCells + 1, 0);
-      CountTrueK.assign(nCells + 1, 0);
-      CountTruePi.assign(nCells + 1, 0);
-      CountTrueP.assign(nCells + 1, 0);
-      CountGenK.assign(nCells + 1, 0);
-      CountGenPi.assign(nCells + 1, 0);
-      CountGenP.assign(nCells + 1, 0);
+      const std::string &suffix = e.Name;
+      for (int s = 0; s < 4; ++s)
+      {
+         const std::string species = SpeciesName[s];
+         axis.hPt[s] = book2D("h" + species + "Pt" + suffix,
+                              std::string(CandidateTitle[s]) + ";" + e.RecoTitle + ";p_{T} (GeV/c)", false);
+         if (s == 3)
+            continue;
+
+         const std::string title = SpeciesTitle[s];
+         axis.hRaw[s] = book1D("h" + species + suffix,
+            std::string(CandidateTitle[s]) + " vs " + e.Label + ";" + e.RecoTitle + ";Yield (sum over tracks)");
+         axis.hCorrected[s] = book1D("h" + species + "Corrected" + suffix,
+            "PID-corrected " + title + " yield vs " + e.Label + ";" + e.RecoTitle + ";Corrected N_{" + title + "}");
+         axis.hPtCorrected[s] = book2D("h" + species + "PtCorrected" + suffix,
+            "PID-corrected " + title + " p_{T} spectrum;" + e.RecoTitle + ";p_{T} (GeV/c)", false);
+
+         axis.hResponse[1 + s] = book2D("h" + e.ResponseName + "Response" + species,
+            title + "-weighted " + e.Quantity + " response;" + e.TrueTitle + ";" + e.ResponseRecoTitle, true);
+         axis.hTrueYield[s] = book1D("h" + species + "True" + e.TrueYieldName,
+            "Generator-level " + title + " yield vs true " + e.Quantity + ";" + e.TrueTitle + ";N_{" + title + "}^{gen}");
+      }
+
+      axis.hResponse[0] = book2D("h" + e.ResponseName + "Response",
+         e.Quantity + " response" + e.ResponseRegion + ";" + e.TrueTitle + ";" + e.ResponseRecoTitle, true);
+      axis.hTrue = book1D("h" + e.ResponseName + "True",
+         "True " + e.Quantity + " distribution" + e.Region + ";" + e.TrueTitle + ";Events");
+      axis.hReco = book1D("h" + e.ResponseName + "Reco",
+         "Reco " + e.Quantity + " distribution" + e.Region + ";" + e.ResponseRecoTitle + ";Events");
+
+      axis.Bins.Build(axis.hRaw[0]->GetXaxis(), e.MaxCount);
+      for (int s = 0; s < 4; ++s)
+         axis.PtFill[s].Attach(axis.hPt[s]);
+      for (int s = 0; s < 3; ++s)
+         axis.RawFill[s].Attach(axis.hRaw[s]);
+
+      // Species covariance of the corrected yields, same binning as the corrected spectra
+      const char *pairName[3] = {"KPi", "PPi", "KP"};
+      const char *pairTitle[3] = {"cov(K, #pi)", "cov(p, #pi)", "cov(K, p)"};
+      for (int pair = 0; pair < 3; ++pair)
+      {
+         axis.hCovPtCorrected[pair] = book2D(std::string("hCov") + pairName[pair] + "PtCorrected" + suffix,
+            std::string("PID-corrected ") + pairTitle[pair] + ";" + e.RecoTitle + ";p_{T} (GeV/c)", false);
+         axis.hCovCorrected[pair] = book1D(std::string("hCov") + pairName[pair] + "Corrected" + suffix,
+            std::string("PID-corrected ") + pairTitle[pair] + ", p_{T}-integrated;" + e.RecoTitle + ";Covariance");
+         if (pair < 2)
+            axis.hResponseCross[pair] = book2D("h" + e.ResponseName + "Response" + pairName[pair],
+               std::string(pairTitle[pair]) + " of the weighted " + e.Quantity + " responses;" + e.TrueTitle + ";"
+               + e.ResponseRecoTitle, true);
+      }
+
+      const int nReplicas = std::max(par.BootstrapReplicas, 0);
+      for (int ratio = 0; ratio < 2 && nReplicas > 0; ++ratio)
+      {
+         const std::string name = std::string("h") + RatioName[ratio] + "Corrected";
+         axis.hRatioBootstrap[ratio] = book1D(name + "Bootstrap" + suffix,
+            std::string(RatioTitle[ratio]) + " (PID-corrected), bootstrap standard deviation;"
+            + e.RecoTitle + ";" + RatioTitle[ratio]);
+
+         const std::string replicaName = name + "Replicas" + suffix;
+         const std::string replicaTitle = std::string(RatioTitle[ratio]) + " (PID-corrected) per bootstrap replica;"
+            + e.RecoTitle + ";Replica";
+         if (variable)
+            axis.hRatioReplicas[ratio] = new TH2D(replicaName.c_str(), replicaTitle.c_str(),
+               axis.NBins, edges, nReplicas, -0.5, nReplicas - 0.5);
+         else
+            axis.hRatioReplicas[ratio] = new TH2D(replicaName.c_str(), replicaTitle.c_str(),
+               axis.NBins, e.Min, e.Max, nReplicas, -0.5, nReplicas - 0.5);
+      }
    }
 
    ~KtoPiAnalyzer()
    {
-      delete hK;
-      delete hPi;
-      delete hP;
-      delete hKoverPi;
-      delete hPoverPi;
-      delete hKDNdEta;
-      delete hPiDNdEta;
-      delete hPDNdEta;
-      delete hKoverPiDNdEta;
-      delete hPoverPiDNdEta;
-
-      delete hKCorrected;
-      delete hPiCorrected;
-      delete hPCorrected;
-      delete hKoverPiCorrected;
-      delete hPoverPiCorrected;
-      delete hKCorrectedDNdEta;
-      delete hPiCorrectedDNdEta;
-      delete hPCorrectedDNdEta;
-      delete hKoverPiCorrectedDNdEta;
-      delete hPoverPiCorrectedDNdEta;
-      delete hKDNdY;
-      delete hPiDNdY;
-      delete hPDNdY;
-      delete hKoverPiDNdY;
-      delete hPoverPiDNdY;
-      delete hKCorrectedDNdY;
-      delete hPiCorrectedDNdY;
-      delete hPCorrectedDNdY;
-      delete hKoverPiCorrectedDNdY;
-      delete hPoverPiCorrectedDNdY;
-
-      delete hKPt;
-      delete hPiPt;
-      delete hPPt;
-      delete hUPt;
-      delete hKPtCorrected;
-      delete hPiPtCorrected;
-      delete hPPtCorrected;
-      delete hKPtDNdEta;
-      delete hPiPtDNdEta;
-      delete hPPtDNdEta;
-      delete hUPtDNdEta;
-      delete hKPtCorrectedDNdEta;
-      delete hPiPtCorrectedDNdEta;
-      delete hPPtCorrectedDNdEta;
-      delete hKPtDNdY;
-      delete hPiPtDNdY;
-      delete hPPtDNdY;
-      delete hUPtDNdY;
-      delete hKPtCorrectedDNdY;
-      delete hPiPtCorrectedDNdY;
-      delete hPPtCorrectedDNdY;
-      delete hNtagResponse;
-      delete hNtagResponseK;
-      delete hNtagResponsePi;
-      delete hNtagResponseP;
-      delete hNtagTrue;
-      delete hNtagReco;
-      delete hKTrueNtag;
-      delete hPiTrueNtag;
-      delete hPTrueNtag;
-      delete hDNdEtaResponse;
-      delete hDNdEtaResponseK;
-      delete hDNdEtaResponsePi;
-      delete hDNdEtaResponseP;
-      delete hDNdEtaTrue;
-      delete hDNdEtaReco;
-      delete hKTruedNdEta;
-      delete hPiTruedNdEta;
-      delete hPTruedNdEta;
-      delete hDNdYResponse;
-      delete hDNdYResponseK;
-      delete hDNdYResponsePi;
-      delete hDNdYResponseP;
-      delete hDNdYTrue;
-      delete hDNdYReco;
-      delete hKTruedNdY;
-      delete hPiTruedNdY;
-      delete hPTruedNdY;
+      for (const ActivityAxis &axis : Axes)
+         for (TH1 *h : axis.owned())
+            delete h;
 
       if (inf)
       {
@@ -1076,974 +829,1008 @@ public:
       delete M;
    }
 
-   // Map (Nch_bin, pT_bin) -> flat index into vectors
-   inline int flatIndex(int iNchBin, int iPtBin) const
+   // Map (activity bin, pT bin) of one axis -> flat index into its cells
+   inline int flatIndex(const ActivityAxis &axis, int iBin, int iPtBin) const
    {
-      // Safety clamp (bins are 1..NNchBins and 1..NPtBins for histograms)
-      if (iNchBin < 1)        iNchBin = 1;
-      if (iNchBin > NNchBins) iNchBin = NNchBins;
+      // Safety clamp (bins are 1..NBins and 1..NPtBins for histograms)
+      if (iBin < 1)           iBin = 1;
+      if (iBin > axis.NBins)  iBin = axis.NBins;
       if (iPtBin < 1)         iPtBin = 1;
       if (iPtBin > NPtBins)   iPtBin = NPtBins;
 
-      return (iNchBin - 1) * NPtBins + (iPtBin - 1);
+      return (iBin - 1) * NPtBins + (iPtBin - 1);
    }
 
-   // Invert a 3×3 matrix using cofactors.
-   // M[row][col] with row,col = 0..2.
-   // Returns false if determinant is (numerically) zero.
-   bool invert3x3(const double Mmat[3][3], double Minv[3][3], double &det) const
+   // First of the AccComponents block accumulator values of one (axis, activity, pT) bin
+   inline double *accumulatorCell(const ActivityAxis &axis, int iBin, int iPtBin)
    {
-      const double a = Mmat[0][0];
-      const double b = Mmat[0][1];
-      const double c = Mmat[0][2];
-      const double d = Mmat[1][0];
-      const double e = Mmat[1][1];
-      const double f = Mmat[1][2];
-      const double g = Mmat[2][0];
-      const double h = Mmat[2][1];
-      const double i = Mmat[2][2];
-
-      det = a*(e*i - f*h) - b*(d*i - f*g) + c*(d*h - e*g);
-
-      if (std::fabs(det) < 1.0e-10)
-         return false;
+      return &BlockAccumulator[(axis.CellOffset + flatIndex(axis, iBin, iPtBin)) * AccComponents];
+   }
 
-      // Cofactor matrix
-      const double C00 =  (e*i - f*h);
-      const double C01 = -(d*i - f*g);
-      const double C02 =  (d*h - e*g);
+   // Tagging matrices and reco-matched counts of all (activity, pT) cells of one axis, inverted
+   // and propagated in one batch.  accumulator: AccComponents values per cell, raw: observed K,
+   // pi, p counts per cell, both in flatIndex order.  Matrix element spread: standard error of
+   // the mean of the per-track lookups in the cell, not the efficiency-map uncertainty (see
+   // TaggingMatrixBatch.h).
+   void unfoldCells(int nCells, const double *accumulator, const double *raw, bool matrixErrors,
+                    TaggingMatrixBatch::Batch &batch, std::vector<char> &hasTracks,
+                    std::vector<double> &genMatch) const
+   {
+      batch.Resize(nCells);
+      hasTracks.assign(nCells, 0);
+      genMatch.assign(3 * nCells, 0.0);
+      for (int k = 0; k < nCells; ++k)
+      {
+         const double *cell = accumulator + k * AccComponents;
+         if (cell[AccTracks] <= 0)
+            continue;
+
+         const double den = cell[AccTracks];
+         hasTracks[k] = 1;
+         for (int s = 0; s < 3; ++s)
+         {
+            const double recoMatch = std::clamp(cell[AccRecoEffK + s] / den, 0.0, 1.0);
+            batch.Y[s][k] = raw[3 * k + s] * recoMatch;
+            batch.VarY[s][k] = (batch.Y[s][k] > 0.0 ? batch.Y[s][k] : 1.0);
+            genMatch[3 * k + s] = std::clamp(cell[AccGenEffK + s] / den, 0.0, 1.0);
+         }
+         for (int e = 0; e < 9; ++e)
+         {
+            const double mean = cell[MatrixComponent[e]] / den;
+            const double meanSquare = cell[MatrixComponent[e] - AccKAsK + AccKAsK2] / den;
+            batch.M[e][k] = mean;
+            batch.SpreadM[e][k] = std::max(0.0, meanSquare - mean * mean) / den;
+         }
+      }
 
-      const double C10 = -(b*i - c*h);
-      const double C11 =  (a*i - c*g);
-      const double C12 = -(a*h - b*g);
+      TaggingMatrixBatch::Invert(batch, MinTaggingDeterminant);
+      TaggingMatrixBatch::Propagate(batch, matrixErrors);
+   }
 
-      const double C20 =  (b*f - c*e);
-      const double C21 = -(a*f - c*d);
-      const double C22 =  (a*e - b*d);
+   // Corrected K/pi and p/pi of every bootstrap replica, through the same unfolding as the
+   // nominal result (count term only, the spread is the uncertainty), and their spread
+   void bootstrapRatios()
+   {
+      const int nReplicas = par.BootstrapReplicas;
 
-      // Inverse = (1/det) * Cofactor^T
-      const double invDet = 1.0 / det;
+      TaggingMatrixBatch::Batch batch;
+      std::vector<char> hasTracks;
+      std::vector<double> genMatch;
+      for (ActivityAxis &axis : Axes)
+      {
+         const int nBins = axis.NBins;
+         std::vector<double> sum(2 * nBins, 0.0);
+         std::vector<double> sum2(2 * nBins, 0.0);
+         std::vector<int> count(2 * nBins, 0);
+         for (int r = 0; r < nReplicas; ++r)
+         {
+            const size_t block = static_cast<size_t>(r) * TotalCells + axis.CellOffset;
+            unfoldCells(nBins * NPtBins, &ReplicaAccumulator[block * AccComponents], &ReplicaSpectra[block * 3],
+                        false, batch, hasTracks, genMatch);
 
-      Minv[0][0] = C00 * invDet;
-      Minv[0][1] = C10 * invDet;
-      Minv[0][2] = C20 * invDet;
+            for (int iBin = 1; iBin <= nBins; ++iBin)
+            {
+               double yield[3] = {0.0, 0.0, 0.0};
+               for (int iPt = 1; iPt <= NPtBins; ++iPt)
+               {
+                  const int k = flatIndex(axis, iBin, iPt);
+                  if (!hasTracks[k] || !batch.IsInvertible(k, MinTaggingDeterminant))
+                     continue;
+                  for (int s = 0; s < 3; ++s)
+                     if (genMatch[3 * k + s] > 1e-12)
+                        yield[s] += std::max(batch.X[s][k], 0.0) / genMatch[3 * k + s];
+               }
+               if (yield[1] <= 0.0)
+                  continue;
 
-      Minv[1][0] = C01 * invDet;
-      Minv[1][1] = C11 * invDet;
-      Minv[1][2] = C21 * invDet;
+               const double ratio[2] = {yield[0] / yield[1], yield[2] / yield[1]};
+               for (int q = 0; q < 2; ++q)
+               {
+                  axis.hRatioReplicas[q]->SetBinContent(iBin, r + 1, ratio[q]);
+                  sum[2 * (iBin - 1) + q] += ratio[q];
+                  sum2[2 * (iBin - 1) + q] += ratio[q] * ratio[q];
+                  count[2 * (iBin - 1) + q]++;
+               }
+            }
+         }
 
-      Minv[2][0] = C02 * invDet;
-      Minv[2][1] = C12 * invDet;
-      Minv[2][2] = C22 * invDet;
+         for (int iBin = 1; iBin <= nBins; ++iBin)
+         {
+            for (int q = 0; q < 2; ++q)
+            {
+               const int n = count[2 * (iBin - 1) + q];
+               axis.hRatioBootstrap[q]->SetBinContent(iBin, axis.hRatioCorrected[q]->GetBinContent(iBin));
+               if (n < 2)
+                  continue;
+               const double mean = sum[2 * (iBin - 1) + q] / n;
+               const double var = (sum2[2 * (iBin - 1) + q] - n * mean * mean) / (n - 1);
+               axis.hRatioBootstrap[q]->SetBinError(iBin, var > 0.0 ? std::sqrt(var) : 0.0);
+            }
+         }
+      }
 
-      return true;
+      cout << "Bootstrap: " << nReplicas << " replicas, seed " << par.BootstrapSeed
+           << ", spread of the corrected ratios in h*CorrectedBootstrap*" << endl;
    }
 
-   void analyze()
+   // Errors of ratio = num/den (already divided) including the covariance of num and den
+   static void setRatioErrors(TH1D *ratio, const TH1D *num, const TH1D *den, const TH1D *cov)
    {
-      if (M == nullptr || inf == nullptr || outf == nullptr)
-         return;
+      for (int i = 1; i <= ratio->GetNbinsX(); ++i)
+      {
+         const double n = num->GetBinContent(i);
+         const double d = den->GetBinContent(i);
+         if (n <= 0.0 || d <= 0.0)
+            continue;
+         const double en = num->GetBinError(i);
+         const double ed = den->GetBinError(i);
+         const double r = n / d;
+         const double v = r * r * (en * en / (n * n) + ed * ed / (d * d) - 2.0 * cov->GetBinContent(i) / (n * d));
+         ratio->SetBinError(i, v > 0.0 ? std::sqrt(v) : 0.0);
+      }
+   }
 
-      //---------------------------------------------------
-      // Event loop
-      //---------------------------------------------------
-      long long nEntries = M->GetEntries();
-      if (par.MaxEvents > 0 && par.MaxEvents < nEntries)
-         nEntries = par.MaxEvents;
+   bool passPIDFiducialFromMom(double px, double py, double pz) const
+   {
+      return TruthCountingPolicy::PassPIDFiducialFromMom(
+         px, py, pz, par.UsePIDFiducial, par.PIDTrackAbsCosMin, par.PIDTrackAbsCosMax);
+   }
 
-      cout << "Total entries to process: " << nEntries << endl;
-      cout << "Using 3-step correction (reco-match -> 3x3 tagging -> gen-match)." << endl;
-      cout << "  Reco matching branches: " << (HasRecoMatchingBranches ? "RecoEfficiency*" : "fallback=1") << endl;
-      cout << "  Gen matching branches : " << (HasGenMatchingBranches ? "RecoGenEfficiency*" : "fallback=1") << endl;
+   // Estimator counts of the loaded entry from its tracks, before the overflow clamp; MC also
+   // the true counts and the truth yields (nGenEvt: K, pi, p), with the same fiducial
+   // definition as the standalone generator reference so that closure compares identical
+   // quantities
+   void countFromTracks(const StrangenessTreeMessenger &m, int nreco, int ngen, int nGenEvt[3])
+   {
+      const double thrustNorm = std::sqrt(m.ThrustX * m.ThrustX + m.ThrustY * m.ThrustY + m.ThrustZ * m.ThrustZ);
+      const bool hasThrustAxis = (thrustNorm > 0.0);
+      const double thrust[3] = {
+         hasThrustAxis ? (m.ThrustX / thrustNorm) : 0.0,
+         hasThrustAxis ? (m.ThrustY / thrustNorm) : 0.0,
+         hasThrustAxis ? (m.ThrustZ / thrustNorm) : 1.0};
+      const double *thrustAxis = hasThrustAxis ? thrust : nullptr;
+
+      for (ActivityAxis &axis : Axes)
+      {
+         axis.RecoCount = 0;
+         axis.GenCount = 0;
+      }
+      for (int i = 0; i < nreco; ++i)
+      {
+         if (m.RecoGoodTrack[i] != 1)
+            continue;
+         if (m.RecoCharge[i] == 0.0)
+            continue;
+
+         const Activity::Particle track(m.RecoPx[i], m.RecoPy[i], m.RecoPz[i], m.RecoE[i], thrustAxis);
+         for (ActivityAxis &axis : Axes)
+            if (axis.Estimator.Reco(track))
+               ++axis.RecoCount;
+      }
 
-      auto passPIDFiducialFromMom = [&](double px, double py, double pz) -> bool
+      for (int i = 0; i < ngen; ++i)
       {
-         return TruthCountingPolicy::PassPIDFiducialFromMom(
-            px, py, pz, par.UsePIDFiducial, par.PIDTrackAbsCosMin, par.PIDTrackAbsCosMax);
-      };
+         const long long pdg = m.GenID[i];
+         const long long absPdg = (pdg >= 0 ? pdg : -pdg);
+         const long long status = m.GenStatus[i];
+         if (status != 1)
+            continue;
+         if (!IsChargedPDG(pdg))
+            continue;
+
+         const Activity::Particle particle(m.GenPx[i], m.GenPy[i], m.GenPz[i], m.GenE[i], thrustAxis);
+         for (ActivityAxis &axis : Axes)
+            if (axis.Estimator.Gen(particle))
+               ++axis.GenCount;
+
+         // Identified yields: inside the truth Nch_tag acceptance and the PID fiducial
+         if (par.UseCentralEtaNtag && particle.HasEta && std::abs(particle.Eta) >= 0.5)
+            continue;
+         if (particle.Pt < par.NtagPtMin)
+            continue;
+         if (absPdg != 211 && absPdg != 321 && absPdg != 2212)
+            continue;
+         if (particle.Pt < PtBinEdges.front() || particle.Pt >= PtBinEdges.back())
+            continue;
+         if (!passPIDFiducialFromMom(particle.Px, particle.Py, particle.Pz))
+            continue;
+         if (absPdg == 321)  ++nGenEvt[0];
+         if (absPdg == 211)  ++nGenEvt[1];
+         if (absPdg == 2212) ++nGenEvt[2];
+      }
+   }
 
-      ProgressBar Bar(cout, nEntries);
-      Bar.SetStyle(1);
-      long long deltaI = nEntries / 100 + 1;
+   // The same from the EventSummary entry; summaryCompatible() has checked that its thresholds
+   // are ours.  Without truth in the summary everything generator-level stays zero, as with ngen = 0.
+   void countFromSummary(const EventSummary &summary, int nGenEvt[3])
+   {
+      for (ActivityAxis &axis : Axes)
+      {
+         axis.RecoCount = axis.Estimator.SummaryReco(summary);
+         axis.GenCount = axis.Estimator.SummaryGen(summary);
+      }
+      nGenEvt[0] = par.UsePIDFiducial ? summary.NKTrue : summary.NKTrueNoFid;
+      nGenEvt[1] = par.UsePIDFiducial ? summary.NPiTrue : summary.NPiTrueNoFid;
+      nGenEvt[2] = par.UsePIDFiducial ? summary.NPTrue : summary.NPTrueNoFid;
+   }
 
+   // Selection and all fills for the entry currently loaded in m
+   void processEvent(StrangenessTreeMessenger &m, long long ievt)
+   {
       const double EcmRef   = par.EcmRef;
       const int    MinNch   = par.MinNch;
       const double MinTheta = par.MinTheta;
       const double MaxTheta = par.MaxTheta;
 
-      for (long long ievt = 0; ievt < nEntries; ++ievt)
+      // Safety: cap NReco to messenger array size
+      if (m.NReco > STRANGE_MAX_RECO)
       {
-         M->GetEntry(ievt);
-
-         if (ievt % deltaI == 0)
-         {
-            Bar.Update(ievt);
-            Bar.Print();
-         }
-
-         // Safety: cap NReco to messenger array size
-         if (M->NReco > STRANGE_MAX_RECO)
+         cerr << "Warning: NReco = " << m.NReco
+              << " > STRANGE_MAX_RECO = " << STRANGE_MAX_RECO
+              << " at entry " << ievt << ".  Clipping to STRANGE_MAX_RECO."
+              << endl;
+      }
+      int nreco = (m.NReco < STRANGE_MAX_RECO)
+                     ? static_cast<int>(m.NReco)
+                     : STRANGE_MAX_RECO;
+
+      // Prepare NGen when available (MC), needed for:
+      // - IsGen mode
+      // - closure matrix mode
+      // - Ntag response / truth-prior histograms in reco mode
+      int ngen = 0;
+      if (m.NGen > 0)
+      {
+         if (m.NGen > STRANGE_MAX_GEN)
          {
-            cerr << "Warning: NReco = " << M->NReco
-                 << " > STRANGE_MAX_RECO = " << STRANGE_MAX_RECO
-                 << " at entry " << ievt << ".  Clipping to STRANGE_MAX_RECO."
+            cerr << "Warning: NGen = " << m.NGen
+                 << " > STRANGE_MAX_GEN = " << STRANGE_MAX_GEN
+                 << " at entry " << ievt << ".  Clipping to STRANGE_MAX_GEN."
                  << endl;
          }
-         int nreco = (M->NReco < STRANGE_MAX_RECO)
-                        ? static_cast<int>(M->NReco)
-                        : STRANGE_MAX_RECO;
-
-         // Prepare NGen when available (MC), needed for:
-         // - IsGen mode
-         // - closure matrix mode
-         // - Ntag response / truth-prior histograms in reco mode
-         int ngen = 0;
-         if (M->NGen > 0)
-         {
-            if (M->NGen > STRANGE_MAX_GEN)
-            {
-               cerr << "Warning: NGen = " << M->NGen
-                    << " > STRANGE_MAX_GEN = " << STRANGE_MAX_GEN
-                    << " at entry " << ievt << ".  Clipping to STRANGE_MAX_GEN."
-                    << endl;
-            }
-            ngen = (M->NGen < STRANGE_MAX_GEN)
-                      ? static_cast<int>(M->NGen)
-                      : STRANGE_MAX_GEN;
-         }
+         ngen = (m.NGen < STRANGE_MAX_GEN)
+                   ? static_cast<int>(m.NGen)
+                   : STRANGE_MAX_GEN;
+      }
 
-         //-------------------------
-         // Event selection
-         //-------------------------
+      //-------------------------
+      // Event selection
+      //-------------------------
 
-         if (par.UsePassAllSelection)
-         {
-            // Nominal v6+ event preselection: use the archived event-selection bit
-            // written into the open-data trees instead of recomputing the component cuts.
-            if (M->PassAll != 1)
-               continue;
-         }
-         else
-         {
-            // Legacy fallback: recompute the historical selection from the stored
-            // reco observables for debugging and compatibility studies.
-            double sumRecoE = 0.0;
-            for (int i = 0; i < nreco; ++i)
-               sumRecoE += M->RecoE[i];
+      if (par.UsePassAllSelection)
+      {
+         // Nominal v6+ event preselection: use the archived event-selection bit
+         // written into the open-data trees instead of recomputing the component cuts.
+         if (m.PassAll != 1)
+            return;
+      }
+      else
+      {
+         // Legacy fallback: recompute the historical selection from the stored
+         // reco observables for debugging and compatibility studies.
+         double sumRecoE = 0.0;
+         for (int i = 0; i < nreco; ++i)
+            sumRecoE += m.RecoE[i];
+
+         if (sumRecoE / EcmRef <= 0.5)
+            return;
+         if (m.Nch < MinNch)
+            return;
+
+         double theta = std::acos(m.ThrustZ);
+         if (theta <= MinTheta)
+            return;
+         if (theta >= MaxTheta)
+            return;
+      }
 
-            if (sumRecoE / EcmRef <= 0.5)
-               continue;
-            if (M->Nch < MinNch)
-               continue;
+      Timing.Switch(StageMultiplicity);
 
-            double theta = std::acos(M->ThrustZ);
-            if (theta <= MinTheta)
-               continue;
-            if (theta >= MaxTheta)
-               continue;
-         }
+      //-------------------------
+      // Activity of this event along every estimator, true activity and truth yields (MC only)
+      //-------------------------
+      int nGenEvt[3] = {0, 0, 0};
+      if (UseSummary)
+         countFromSummary(m.Summary, nGenEvt);
+      else
+         countFromTracks(m, nreco, ngen, nGenEvt);
 
-         const double thrustNorm = std::sqrt(M->ThrustX * M->ThrustX + M->ThrustY * M->ThrustY + M->ThrustZ * M->ThrustZ);
-         const bool hasThrustAxis = (thrustNorm > 0.0);
-         const double thrustX = hasThrustAxis ? (M->ThrustX / thrustNorm) : 0.0;
-         const double thrustY = hasThrustAxis ? (M->ThrustY / thrustNorm) : 0.0;
-         const double thrustZ = hasThrustAxis ? (M->ThrustZ / thrustNorm) : 1.0;
-
-         //-------------------------
-         // Compute Nch_tag for this event
-         //-------------------------
-         int NchTag = 0;
-         int NchEta05Reco = 0;
-         int NchY05Reco = 0;
-         for (int i = 0; i < nreco; ++i)
+      // Put overflow into the last visible bin
+      for (ActivityAxis &axis : Axes)
+      {
+         axis.RecoCount = std::min(axis.RecoCount, axis.Estimator.MaxCount);
+         axis.Bin = std::clamp(axis.Bins.Find(axis.RecoCount), 1, axis.NBins);
+         axis.GenCount = std::min(axis.GenCount, axis.Estimator.MaxCount);
+      }
+
+      Timing.Switch(StageTracks);
+
+      // Note: reco correction always uses efficiency branches from the tree.
+      // MC generator truth is produced in a separate IsGen=true run.
+
+      //-------------------------
+      // Fill generator-level yields (IsGen mode)
+      //-------------------------
+      if (par.IsGen)
+      {
+         int nKgen  = 0;
+         int nPigen = 0;
+         int nPgen  = 0;
+         // Generator-level spectra vs the true count of the first estimator only
+         ActivityAxis &primary = Axes[0];
+         const int trueNchAxis = primary.GenCount;
+         const int trueNchBin = primary.Bins.Find(trueNchAxis);
+
+         for (int i = 0; i < ngen; ++i)
          {
-            if (M->RecoGoodTrack[i] != 1)
-               continue;
-            if (M->RecoCharge[i] == 0.0)
+            const long long pdg    = m.GenID[i];
+            const long long absPdg = (pdg >= 0 ? pdg : -pdg);
+            const long long status = m.GenStatus[i];
+
+            // Use stable final-state truth for a meaningful closure target
+            if (status != 1)
                continue;
 
-            const double px = M->RecoPx[i];
-            const double py = M->RecoPy[i];
-            const double pz = M->RecoPz[i];
-            const double pt = std::sqrt(px * px + py * py);
+            const double genPt = std::sqrt(m.GenPx[i] * m.GenPx[i] + m.GenPy[i] * m.GenPy[i]);
+            if (genPt < PtBinEdges.front() || genPt >= PtBinEdges.back())
+               continue;
+            if (!passPIDFiducialFromMom(m.GenPx[i], m.GenPy[i], m.GenPz[i]))
+               continue;
 
-            // Same-variable reco activity estimator for the dNch/deta unfolding.
-            // This count uses all charged good tracks in |eta|<0.5 with no PID or pT threshold.
-            if (pt > 0.0)
+            // Charged kaons: K+, K-
+            if (absPdg == 321)
             {
-               const double eta = std::asinh(pz / pt);
-               if (std::abs(eta) < 0.5)
-                  ++NchEta05Reco;
+               ++nKgen;
+               primary.PtFill[0].Fill(trueNchBin, PtBins.Find(genPt), trueNchAxis, genPt);
             }
-            if (hasThrustAxis)
+
+            // Charged pions: pi+, pi-
+            if (absPdg == 211)
             {
-               double yThrust = 0.0;
-               if (ComputeAxisRapidity(px, py, pz, M->RecoE[i], thrustX, thrustY, thrustZ, yThrust) &&
-                   std::abs(yThrust) < 0.5)
-               {
-                  ++NchY05Reco;
-               }
+               ++nPigen;
+               primary.PtFill[1].Fill(trueNchBin, PtBins.Find(genPt), trueNchAxis, genPt);
             }
 
-            if (pt < par.NtagPtMin)
-               continue;
-
-            if (par.UseCentralEtaNtag)
+            // Protons / anti-protons
+            if (absPdg == 2212)
             {
-               if (pt <= 0.0)
-                  continue;
-               const double eta = std::asinh(pz / pt);
-               if (std::abs(eta) >= 0.5)
-                  continue;
+               ++nPgen;
+               primary.PtFill[2].Fill(trueNchBin, PtBins.Find(genPt), trueNchAxis, genPt);
             }
-            ++NchTag;
          }
 
-         // Put overflow NchTag into the last visible bin
-         if (NchTag > par.MaxNchTag)
-            NchTag = par.MaxNchTag;
-         if (NchEta05Reco > par.MaxNchTag)
-            NchEta05Reco = par.MaxNchTag;
-         if (NchY05Reco > MaxDNdYCount)
-            NchY05Reco = MaxDNdYCount;
-
-         // Bin index along Nch_tag axis (1..NNchBins)
-         int nchBin = hK->GetXaxis()->FindBin(static_cast<double>(NchTag));
-         if (nchBin < 1)
-            nchBin = 1;
-         if (nchBin > NNchBins)
-            nchBin = NNchBins;
-
-         int dndetaBin = hKDNdEta->GetXaxis()->FindBin(static_cast<double>(NchEta05Reco));
-         if (dndetaBin < 1)
-            dndetaBin = 1;
-         if (dndetaBin > NNchBins)
-            dndetaBin = NNchBins;
-
-         int dndyBin = hKDNdY->GetXaxis()->FindBin(static_cast<double>(NchY05Reco));
-         if (dndyBin < 1)
-            dndyBin = 1;
-         if (dndyBin > NNchBins)
-            dndyBin = NNchBins;
-
-         // Build true multiplicity and truth yields (MC only) for response/unfolding support.
-         // The truth-side identified yields must use the same fiducial definition as the
-         // standalone generator reference so that closure compares identical quantities.
-         int NchTagTrue = 0;
-         int nKgenEvt = 0;
-         int nPigenEvt = 0;
-         int nPgenEvt = 0;
-         int nChEta05True = 0;
-         int nChY05True = 0;
-         if (ngen > 0)
-         {
-            for (int i = 0; i < ngen; ++i)
-            {
-               const long long pdg = M->GenID[i];
-               const long long absPdg = (pdg >= 0 ? pdg : -pdg);
-               const long long status = M->GenStatus[i];
-               if (status != 1)
-                  continue;
-               if (!IsChargedPDG(pdg))
-                  continue;
+         primary.RawFill[0].Fill(trueNchBin, trueNchAxis, nKgen);
+         primary.RawFill[1].Fill(trueNchBin, trueNchAxis, nPigen);
+         primary.RawFill[2].Fill(trueNchBin, trueNchAxis, nPgen);
 
-               const double genPx = M->GenPx[i];
-               const double genPy = M->GenPy[i];
-               const double genPz = M->GenPz[i];
-               const double genPtAll = std::sqrt(genPx * genPx + genPy * genPy);
-               if (genPtAll > 0.0)
-               {
-                  const double eta = std::asinh(genPz / genPtAll);
-                  if (std::abs(eta) < 0.5)
-                     ++nChEta05True;
+         return; // nothing more to do for this event
+      }
 
-                  if (par.UseCentralEtaNtag && std::abs(eta) >= 0.5)
-                     continue;
-               }
-               if (hasThrustAxis)
-               {
-                  double yThrust = 0.0;
-                  if (ComputeAxisRapidity(genPx, genPy, genPz, M->GenE[i], thrustX, thrustY, thrustZ, yThrust) &&
-                      std::abs(yThrust) < 0.5)
-                  {
-                     ++nChY05True;
-                  }
-               }
+      //-------------------------
+      // Reco-based PID counting and pT spectra (IsGen == false)
+      //-------------------------
+      int nK  = 0;
+      int nPi = 0;
+      int nP  = 0;
 
-               if (genPtAll < par.NtagPtMin)
-                  continue;
-               ++NchTagTrue;
+      if (!ReplicaWeight.empty())
+         setReplicaWeights(m.Run, m.Event);
 
-               if (absPdg != 211 && absPdg != 321 && absPdg != 2212)
-                  continue;
-               const double genPt = genPtAll;
-               if (genPt < PtBinEdges.front() || genPt >= PtBinEdges.back())
-                  continue;
-               if (!passPIDFiducialFromMom(genPx, genPy, genPz))
-                  continue;
-               if (absPdg == 321)  ++nKgenEvt;
-               if (absPdg == 211)  ++nPigenEvt;
-               if (absPdg == 2212) ++nPgenEvt;
-            }
+      for (int i = 0; i < nreco; ++i)
+      {
+         if (m.RecoGoodTrack[i] != 1)
+            continue;
+
+         const int kTag = static_cast<int>(m.RecoPIDKaon[i]);
+         const int piTag = static_cast<int>(m.RecoPIDPion[i]);
+         const int pTag = static_cast<int>(m.RecoPIDProton[i]);
+         const bool passKaonTag = (kTag >= 2);
+         const bool passPionTag = (piTag >= 2);
+         const bool passProtonTag = (pTag >= 2);
+         const bool passTag = (passKaonTag || passPionTag || passProtonTag);
+         if (!passPIDFiducialFromMom(m.RecoPx[i], m.RecoPy[i], m.RecoPz[i]))
+            continue;
+
+         bool isKaonTag = false;
+         bool isPionTag = false;
+         bool isProtonTag = false;
+         bool isUntagged = false;
+
+         if (passTag)
+         {
+            ++NPIDPassTagTracks;
+            const int best = std::max(kTag, std::max(piTag, pTag));
+            const int nBest = (kTag == best) + (piTag == best) + (pTag == best);
+            if (nBest > 1)
+               ++NPIDTieTracks;
+         }
 
-            if (NchTagTrue > par.MaxNchTag)
-               NchTagTrue = par.MaxNchTag;
+         if (par.UseInclusivePIDObservation)
+         {
+            // v5-style observed spectra: every species with PID score >= 2
+            // contributes to its raw spectrum, so duplicate tag counts are
+            // allowed across K/pi/p for the same track.
+            isKaonTag = passKaonTag;
+            isPionTag = passPionTag;
+            isProtonTag = passProtonTag;
+            isUntagged = !passTag;
          }
-         if (nChEta05True > par.MaxNchTag)
-            nChEta05True = par.MaxNchTag;
-         if (nChY05True > MaxDNdYCount)
-            nChY05True = MaxDNdYCount;
-
-         // Note: reco correction always uses efficiency branches from the tree.
-         // MC generator truth is produced in a separate IsGen=true run.
-
-         //-------------------------
-         // Fill generator-level yields (IsGen mode)
-         //-------------------------
-         if (par.IsGen)
+         else
          {
-            int nKgen  = 0;
-            int nPigen = 0;
-            int nPgen  = 0;
-            const int trueNchAxis = NchTagTrue;
-
-            for (int i = 0; i < ngen; ++i)
+            // Exclusive observed PID category: K, pi, p, untagged
+            int obsCat = 3; // untagged
+            if (passTag)
             {
-               const long long pdg    = M->GenID[i];
-               const long long absPdg = (pdg >= 0 ? pdg : -pdg);
-               const long long status = M->GenStatus[i];
-
-               // Use stable final-state truth for a meaningful closure target
-               if (status != 1)
-                  continue;
-
-               const double genPt = std::sqrt(M->GenPx[i] * M->GenPx[i] + M->GenPy[i] * M->GenPy[i]);
-               if (genPt < PtBinEdges.front() || genPt >= PtBinEdges.back())
-                  continue;
-               if (!passPIDFiducialFromMom(M->GenPx[i], M->GenPy[i], M->GenPz[i]))
-                  continue;
-
-               // Charged kaons: K+, K-
-               if (absPdg == 321)
+               const int best = std::max(kTag, std::max(piTag, pTag));
+               const int nBest = (kTag == best) + (piTag == best) + (pTag == best);
+               if (best < 2)
                {
-                  ++nKgen;
-                  hKPt->Fill(trueNchAxis, genPt);
+                  obsCat = 3;
                }
-
-               // Charged pions: pi+, pi-
-               if (absPdg == 211)
+               else if (nBest > 1 && par.PIDTieMode == 1)
                {
-                  ++nPigen;
-                  hPiPt->Fill(trueNchAxis, genPt);
+                  obsCat = 3;
                }
-
-               // Protons / anti-protons
-               if (absPdg == 2212)
+               else
                {
-                  ++nPgen;
-                  hPPt->Fill(trueNchAxis, genPt);
+                  // Legacy deterministic tie handling (priority K > pi > p).
+                  obsCat = 0;
+                  if (piTag > kTag && piTag >= pTag)
+                     obsCat = 1;
+                  if (pTag > kTag && pTag > piTag)
+                     obsCat = 2;
                }
             }
+            isKaonTag = (obsCat == 0);
+            isPionTag = (obsCat == 1);
+            isProtonTag = (obsCat == 2);
+            isUntagged = (obsCat == 3);
+         }
 
-            hK->Fill(trueNchAxis, nKgen);
-            hPi->Fill(trueNchAxis, nPigen);
-            hP->Fill(trueNchAxis, nPgen);
+         // NOTE: you may need to adapt the pT definition below to your
+         // StrangenessMessenger. If you do not have a direct RecoPT[],
+         // replace the line with something like
+         //
+         //   double pt = std::sqrt(m.RecoPx[i]*m.RecoPx[i] +
+         //                         m.RecoPy[i]*m.RecoPy[i]);
+         //
+         // according to your tree content.
+         double pt = sqrt(m.RecoPx[i]*m.RecoPx[i]+m.RecoPy[i]*m.RecoPy[i]);
+
+         // Restrict to the configured pT range
+         if (pt < PtBinEdges.front() || pt >= PtBinEdges.back())
+            continue;
+
+         if (isKaonTag)   ++nK;
+         if (isPionTag)   ++nPi;
+         if (isProtonTag) ++nP;
+
+         int ptBin = PtBins.Find(pt);
+         if (ptBin < 1 || ptBin > NPtBins)
+            continue;
+
+         // Raw reconstructed pT spectra vs every activity estimator
+         const std::array<bool, 4> tagged = {isKaonTag, isPionTag, isProtonTag, isUntagged};
+         for (ActivityAxis &axis : Axes)
+            for (int species = 0; species < 4; ++species)
+               if (tagged[species])
+                  axis.PtFill[species].Fill(axis.Bin, ptBin, axis.RecoCount, pt);
+         if (!ReplicaActive.empty())
+            fillReplicaSpectra(ptBin, tagged);
+
+         // Accumulate PID efficiencies / fake rates
+         if (m.RecoCharge[i] == 0.0)
+            continue;  // only charged tracks are taggable
+
+         // One track adds the same values to its cell on each activity axis
+         double track[AccComponents];
+         track[AccKAsK]  = m.RecoEfficiencyKAsK[i];
+         track[AccKAsPi] = m.RecoEfficiencyKAsPi[i];
+         track[AccKAsP]  = m.RecoEfficiencyKAsP[i];
+         track[AccPiAsK]  = m.RecoEfficiencyPiAsK[i];
+         track[AccPiAsPi] = m.RecoEfficiencyPiAsPi[i];
+         track[AccPiAsP]  = m.RecoEfficiencyPiAsP[i];
+         track[AccPAsK]  = m.RecoEfficiencyPAsK[i];
+         track[AccPAsPi] = m.RecoEfficiencyPAsPi[i];
+         track[AccPAsP]  = m.RecoEfficiencyPAsP[i];
+         track[AccRecoEffK]  = HasRecoMatchingBranches ? m.RecoEfficiencyK[i]  : 1.0;
+         track[AccRecoEffPi] = HasRecoMatchingBranches ? m.RecoEfficiencyPi[i] : 1.0;
+         track[AccRecoEffP]  = HasRecoMatchingBranches ? m.RecoEfficiencyP[i]  : 1.0;
+         track[AccGenEffK]  = HasGenMatchingBranches ? m.RecoGenEfficiencyK[i]  : 1.0;
+         track[AccGenEffPi] = HasGenMatchingBranches ? m.RecoGenEfficiencyPi[i] : 1.0;
+         track[AccGenEffP]  = HasGenMatchingBranches ? m.RecoGenEfficiencyP[i]  : 1.0;
+         track[AccTracks] = 1.0;
+         for (int c = 0; c < 9; ++c)
+            track[AccKAsK2 + c] = track[AccKAsK + c] * track[AccKAsK + c];
+
+         for (const ActivityAxis &axis : Axes)
+         {
+            double *cell = accumulatorCell(axis, axis.Bin, ptBin);
+            for (int c = 0; c < AccComponents; ++c)
+               cell[c] += track[c];
+         }
+         if (!ReplicaActive.empty())
+            fillReplicaAccumulator(ptBin, track);
+      }
 
-            continue; // nothing more to do for this event
+      // Event-wise raw yields integrated over pT (sanity check), and the MC-only response
+      // bookkeeping in reco mode
+      const int nRaw[3] = {nK, nPi, nP};
+      for (ActivityAxis &axis : Axes)
+      {
+         for (int species = 0; species < 3; ++species)
+            axis.RawFill[species].Fill(axis.Bin, axis.RecoCount, nRaw[species]);
+         axis.hReco->Fill(axis.RecoCount);
+
+         if (ngen == 0)
+            continue;
+         axis.hResponse[0]->Fill(axis.GenCount, axis.RecoCount);
+         axis.hTrue->Fill(axis.GenCount);
+         for (int species = 0; species < 3; ++species)
+         {
+            axis.hResponse[1 + species]->Fill(axis.GenCount, axis.RecoCount, nGenEvt[species]);
+            axis.hTrueYield[species]->Fill(axis.GenCount, nGenEvt[species]);
          }
+         for (int pair = 0; pair < 2; ++pair)
+            axis.hResponseCross[pair]->Fill(axis.GenCount, axis.RecoCount,
+               static_cast<double>(nGenEvt[CovariancePairSpecies[pair][0]]) * nGenEvt[CovariancePairSpecies[pair][1]]);
+      }
+   }
 
-         //-------------------------
-         // Reco-based PID counting and pT spectra (IsGen == false)
-         //-------------------------
-         int nK  = 0;
-         int nPi = 0;
-         int nP  = 0;
+   void setReplicaWeights(long long run, long long event)
+   {
+      const uint64_t key = PoissonBootstrap::EventKey(par.BootstrapSeed, run, event);
+      ReplicaActive.clear();
+      for (int r = 0; r < static_cast<int>(ReplicaWeight.size()); ++r)
+      {
+         ReplicaWeight[r] = PoissonBootstrap::Weight(key, r);
+         if (ReplicaWeight[r] > 0)
+            ReplicaActive.push_back(r);
+      }
+   }
 
+   // tagged: K, pi, p, untagged; the replicas only carry the three species
+   void fillReplicaSpectra(int ptBin, const std::array<bool, 4> &tagged)
+   {
+      for (int r : ReplicaActive)
+      {
+         for (const ActivityAxis &axis : Axes)
+         {
+            const size_t k = static_cast<size_t>(r) * TotalCells + axis.CellOffset + flatIndex(axis, axis.Bin, ptBin);
+            double *raw = &ReplicaSpectra[k * 3];
+            for (int s = 0; s < 3; ++s)
+               if (tagged[s])
+                  raw[s] += ReplicaWeight[r];
+         }
+      }
+   }
 
-         for (int i = 0; i < nreco; ++i)
+   void fillReplicaAccumulator(int ptBin, const double *track)
+   {
+      for (int r : ReplicaActive)
+      {
+         const double w = ReplicaWeight[r];
+         for (const ActivityAxis &axis : Axes)
          {
-            if (M->RecoGoodTrack[i] != 1)
-               continue;
+            const size_t k = static_cast<size_t>(r) * TotalCells + axis.CellOffset + flatIndex(axis, axis.Bin, ptBin);
+            double *cell = &BlockReplicaAccumulator[k * AccComponents];
+            for (int c = 0; c < AccComponents; ++c)
+               cell[c] += w * track[c];
+         }
+      }
+   }
 
-            const int kTag = static_cast<int>(M->RecoPIDKaon[i]);
-            const int piTag = static_cast<int>(M->RecoPIDPion[i]);
-            const int pTag = static_cast<int>(M->RecoPIDProton[i]);
-            const bool passKaonTag = (kTag >= 2);
-            const bool passPionTag = (piTag >= 2);
-            const bool passProtonTag = (pTag >= 2);
-            const bool passTag = (passKaonTag || passPionTag || passProtonTag);
-            if (!passPIDFiducialFromMom(M->RecoPx[i], M->RecoPy[i], M->RecoPz[i]))
-               continue;
+   // Entries and moments of the histograms filled by bin go back into the histograms; needed
+   // before they are read, added or written.  Can be repeated.
+   void flushFills() const
+   {
+      for (const ActivityAxis &axis : Axes)
+      {
+         for (int species = 0; species < 4; ++species)
+            axis.PtFill[species].Flush();
+         for (int species = 0; species < 3; ++species)
+            axis.RawFill[species].Flush();
+      }
+   }
 
-            bool isKaonTag = false;
-            bool isPionTag = false;
-            bool isProtonTag = false;
-            bool isUntagged = false;
+   // ParallelProcessor worker interface.  The time between two entries is the messenger read.
+   void ProcessEntry(StrangenessTreeMessenger &m, long long ievt)
+   {
+      Timing.Switch(StageSelection);
+      processEvent(m, ievt);
+      processVariations(m, ievt);
+      Timing.Switch(StageIO);
+   }
 
-            if (passTag)
-            {
-               ++NPIDPassTagTracks;
-               const int best = std::max(kTag, std::max(piTag, pTag));
-               const int nBest = (kTag == best) + (piTag == best) + (pTag == best);
-               if (nBest > 1)
-                  ++NPIDTieTracks;
-            }
+   void processVariations(StrangenessTreeMessenger &m, long long ievt)
+   {
+      if (Variations.empty())
+         return;
+      Timing.Switch(StageVariations);
+      for (std::unique_ptr<KtoPiAnalyzer> &v : Variations)
+         v->processEvent(m, ievt);
+   }
 
-            if (par.UseInclusivePIDObservation)
-            {
-               // v5-style observed spectra: every species with PID score >= 2
-               // contributes to its raw spectrum, so duplicate tag counts are
-               // allowed across K/pi/p for the same track.
-               isKaonTag = passKaonTag;
-               isPionTag = passPionTag;
-               isProtonTag = passProtonTag;
-               isUntagged = !passTag;
-            }
-            else
-            {
-               // Exclusive observed PID category: K, pi, p, untagged
-               int obsCat = 3; // untagged
-               if (passTag)
-               {
-                  const int best = std::max(kTag, std::max(piTag, pTag));
-                  const int nBest = (kTag == best) + (piTag == best) + (pTag == best);
-                  if (best < 2)
-                  {
-                     obsCat = 3;
-                  }
-                  else if (nBest > 1 && par.PIDTieMode == 1)
-                  {
-                     obsCat = 3;
-                  }
-                  else
-                  {
-                     // Legacy deterministic tie handling (priority K > pi > p).
-                     obsCat = 0;
-                     if (piTag > kTag && piTag >= pTag)
-                        obsCat = 1;
-                     if (pTag > kTag && pTag > piTag)
-                        obsCat = 2;
-                  }
-               }
-               isKaonTag = (obsCat == 0);
-               isPionTag = (obsCat == 1);
-               isProtonTag = (obsCat == 2);
-               isUntagged = (obsCat == 3);
-            }
+   // Adds the floating point sums of the current block to those of total (this analyzer in the
+   // serial loop, the master with threads) and clears them; variations likewise
+   void foldBlock(KtoPiAnalyzer &total)
+   {
+      for (size_t i = 0; i < BlockAccumulator.size(); ++i)
+         total.Accumulator[i] += BlockAccumulator[i];
+      for (size_t i = 0; i < BlockReplicaAccumulator.size(); ++i)
+         total.ReplicaAccumulator[i] += BlockReplicaAccumulator[i];
+      std::fill(BlockAccumulator.begin(), BlockAccumulator.end(), 0.0);
+      std::fill(BlockReplicaAccumulator.begin(), BlockReplicaAccumulator.end(), 0.0);
+
+      for (size_t a = 0; a < Axes.size(); ++a)
+      {
+         for (int species = 0; species < 4; ++species)
+            Axes[a].PtFill[species].Fold(total.Axes[a].PtFill[species]);
+         for (int species = 0; species < 3; ++species)
+            Axes[a].RawFill[species].Fold(total.Axes[a].RawFill[species]);
+      }
 
-            // NOTE: you may need to adapt the pT definition below to your
-            // StrangenessMessenger. If you do not have a direct RecoPT[],
-            // replace the line with something like
-            //
-            //   double pt = std::sqrt(M->RecoPx[i]*M->RecoPx[i] +
-            //                         M->RecoPy[i]*M->RecoPy[i]);
-            //
-            // according to your tree content.
-            double pt = sqrt(M->RecoPx[i]*M->RecoPx[i]+M->RecoPy[i]*M->RecoPy[i]);
-
-            // Restrict to the configured pT range
-            if (pt < PtBinEdges.front() || pt >= PtBinEdges.back())
-               continue;
+      for (size_t i = 0; i < Variations.size(); ++i)
+         Variations[i]->foldBlock(*total.Variations[i]);
+   }
 
-            if (isKaonTag)   ++nK;
-            if (isPionTag)   ++nPi;
-            if (isProtonTag) ++nP;
+   // Histogram bin contents and counts are sums of integers and come out identical to a
+   // serial run.  The floating point sums have already been folded into the master block by
+   // block (foldBlock), so the worker's are zero here.
+   void Merge(const KtoPiAnalyzer &other)
+   {
+      // TH1::Add needs the statistics of both sides in the histograms
+      flushFills();
+      other.flushFills();
 
-            int ptBin = hKPt->GetYaxis()->FindBin(pt);
-            if (ptBin < 1 || ptBin > NPtBins)
-               continue;
+      for (size_t a = 0; a < Axes.size() && a < other.Axes.size(); ++a)
+      {
+         ActivityAxis &axis = Axes[a];
+         const ActivityAxis &otherAxis = other.Axes[a];
+         const std::vector<TH1 *> mine = axis.accumulated();
+         const std::vector<TH1 *> theirs = otherAxis.accumulated();
+         for (size_t i = 0; i < mine.size(); ++i)
+            if (mine[i] != nullptr && theirs[i] != nullptr)
+               mine[i]->Add(theirs[i]);
+         for (int species = 0; species < 4; ++species)
+            axis.PtFill[species].Add(otherAxis.PtFill[species]);
+         for (int species = 0; species < 3; ++species)
+            axis.RawFill[species].Add(otherAxis.RawFill[species]);
+      }
 
-            // Raw reconstructed pT spectra
-            if (isKaonTag)
-               hKPt->Fill(NchTag, pt);
-            if (isPionTag)
-               hPiPt->Fill(NchTag, pt);
-            if (isProtonTag)
-               hPPt->Fill(NchTag, pt);
-            if (isUntagged)
-               hUPt->Fill(NchTag, pt);
-
-            if (isKaonTag)
-               hKPtDNdEta->Fill(NchEta05Reco, pt);
-            if (isPionTag)
-               hPiPtDNdEta->Fill(NchEta05Reco, pt);
-            if (isProtonTag)
-               hPPtDNdEta->Fill(NchEta05Reco, pt);
-            if (isUntagged)
-               hUPtDNdEta->Fill(NchEta05Reco, pt);
-            if (isKaonTag)
-               hKPtDNdY->Fill(NchY05Reco, pt);
-            if (isPionTag)
-               hPiPtDNdY->Fill(NchY05Reco, pt);
-            if (isProtonTag)
-               hPPtDNdY->Fill(NchY05Reco, pt);
-            if (isUntagged)
-               hUPtDNdY->Fill(NchY05Reco, pt);
-
-            // Accumulate PID efficiencies / fake rates
-            if (M->RecoCharge[i] == 0.0)
-               continue;  // only charged tracks are taggable
-
-            const int idx = flatIndex(nchBin, ptBin);
-            const int idxDNdEta = flatIndex(dndetaBin, ptBin);
-            const int idxDNdY = flatIndex(dndyBin, ptBin);
-
-            // *** IMPORTANT ***
-            // The names below assume that the messenger provides the
-            // full 3×3 set of calibration arrays:
-            //
-            //   RecoEfficiencyKAsK, RecoEfficiencyKAsPi, RecoEfficiencyKAsP
-            //   RecoEfficiencyPiAsK, RecoEfficiencyPiAsPi, RecoEfficiencyPiAsP
-            //   RecoEfficiencyPAsK, RecoEfficiencyPAsPi, RecoEfficiencyPAsP
-            //
-            // If your tree uses slightly different names, just edit the
-            // corresponding lines here.
-
-            // Unified mode: always use per-track efficiency parametrization
-            SumKAsK[idx]   += M->RecoEfficiencyKAsK[i];
-            SumKAsPi[idx]  += M->RecoEfficiencyKAsPi[i];
-            SumKAsP[idx]   += M->RecoEfficiencyKAsP[i];
-            SumKAsKDNdEta[idxDNdEta]  += M->RecoEfficiencyKAsK[i];
-            SumKAsPiDNdEta[idxDNdEta] += M->RecoEfficiencyKAsPi[i];
-            SumKAsPDNdEta[idxDNdEta]  += M->RecoEfficiencyKAsP[i];
-            SumKAsKDNdY[idxDNdY]  += M->RecoEfficiencyKAsK[i];
-            SumKAsPiDNdY[idxDNdY] += M->RecoEfficiencyKAsPi[i];
-            SumKAsPDNdY[idxDNdY]  += M->RecoEfficiencyKAsP[i];
-
-            SumPiAsK[idx]  += M->RecoEfficiencyPiAsK[i];
-            SumPiAsPi[idx] += M->RecoEfficiencyPiAsPi[i];
-            SumPiAsP[idx]  += M->RecoEfficiencyPiAsP[i];
-            SumPiAsKDNdEta[idxDNdEta]  += M->RecoEfficiencyPiAsK[i];
-            SumPiAsPiDNdEta[idxDNdEta] += M->RecoEfficiencyPiAsPi[i];
-            SumPiAsPDNdEta[idxDNdEta]  += M->RecoEfficiencyPiAsP[i];
-            SumPiAsKDNdY[idxDNdY]  += M->RecoEfficiencyPiAsK[i];
-            SumPiAsPiDNdY[idxDNdY] += M->RecoEfficiencyPiAsPi[i];
-            SumPiAsPDNdY[idxDNdY]  += M->RecoEfficiencyPiAsP[i];
-
-            SumPAsK[idx]   += M->RecoEfficiencyPAsK[i];
-            SumPAsPi[idx]  += M->RecoEfficiencyPAsPi[i];
-            SumPAsP[idx]   += M->RecoEfficiencyPAsP[i];
-            SumPAsKDNdEta[idxDNdEta]  += M->RecoEfficiencyPAsK[i];
-            SumPAsPiDNdEta[idxDNdEta] += M->RecoEfficiencyPAsPi[i];
-            SumPAsPDNdEta[idxDNdEta]  += M->RecoEfficiencyPAsP[i];
-            SumPAsKDNdY[idxDNdY]  += M->RecoEfficiencyPAsK[i];
-            SumPAsPiDNdY[idxDNdY] += M->RecoEfficiencyPAsPi[i];
-            SumPAsPDNdY[idxDNdY]  += M->RecoEfficiencyPAsP[i];
-
-            if (HasRecoMatchingBranches)
-            {
-               SumRecoEffK[idx]  += RecoEfficiencyKExtra[i];
-               SumRecoEffPi[idx] += RecoEfficiencyPiExtra[i];
-               SumRecoEffP[idx]  += RecoEfficiencyPExtra[i];
-               SumRecoEffKDNdEta[idxDNdEta]  += RecoEfficiencyKExtra[i];
-               SumRecoEffPiDNdEta[idxDNdEta] += RecoEfficiencyPiExtra[i];
-               SumRecoEffPDNdEta[idxDNdEta]  += RecoEfficiencyPExtra[i];
-               SumRecoEffKDNdY[idxDNdY]  += RecoEfficiencyKExtra[i];
-               SumRecoEffPiDNdY[idxDNdY] += RecoEfficiencyPiExtra[i];
-               SumRecoEffPDNdY[idxDNdY]  += RecoEfficiencyPExtra[i];
-            }
-            else
+      for (size_t i = 0; i < ReplicaSpectra.size(); ++i)
+         ReplicaSpectra[i] += other.ReplicaSpectra[i];
+
+      NPIDPassTagTracks += other.NPIDPassTagTracks;
+      NPIDTieTracks += other.NPIDTieTracks;
+      Timing.Add(other.Timing);
+
+      for (size_t i = 0; i < Variations.size() && i < other.Variations.size(); ++i)
+         Variations[i]->Merge(*other.Variations[i]);
+   }
+
+   // False if the input or an output could not be opened
+   bool analyze()
+   {
+      if (M == nullptr || inf == nullptr || outf == nullptr)
+         return false;
+
+      //---------------------------------------------------
+      // Event loop
+      //---------------------------------------------------
+      long long nEntries = M->GetEntries();
+      if (par.MaxEvents > 0 && par.MaxEvents < nEntries)
+         nEntries = par.MaxEvents;
+
+      int shard = 0, shardCount = 1;
+      EntryRange::ParseShard(par.Shard, shard, shardCount);   // checked in main()
+      Range = EntryRange(nEntries, par.Fraction, par.FirstEntry, par.NEntries, shard, shardCount);
+      for (std::unique_ptr<KtoPiAnalyzer> &v : Variations)
+         v->Range = Range;
+
+      cout << "Total entries to process: " << Range.GetCount();
+      if (Range.IsPartial())
+         cout << " (entries " << Range.Begin << " to " << Range.End << " of " << nEntries
+              << ", shard " << Range.Shard << "/" << Range.ShardCount << ")";
+      cout << endl;
+      cout << "Using 3-step correction (reco-match -> 3x3 tagging -> gen-match)." << endl;
+      cout << "  Reco matching branches: " << (HasRecoMatchingBranches ? "RecoEfficiency*" : "fallback=1") << endl;
+      cout << "  Gen matching branches : " << (HasGenMatchingBranches ? "RecoGenEfficiency*" : "fallback=1") << endl;
+      if (UseSummary)
+         cout << "  Activity counts       : " << par.Summary << endl;
+
+      Bar.SetMax(Range.GetCount());
+      Bar.SetStyle(1);
+      Bar.SetShowRate(true);
+      Bar.SetByteCounter([]() {return (double)TFile::GetFileBytesRead();});
+      Bar.SetStageTimer(&Timing);
+      Bar.ResetTimer();
+      long long deltaI = Range.GetCount() / 100 + 1;
+
+      if (par.Threads > 1)
+      {
+         // One private accumulator per thread; the floating point sums are folded into this one
+         // block by block in entry order, the integer ones merged at the end
+         ParallelProcessor<KtoPiAnalyzer> processor(par.input, "Tree", par.Threads);
+         processor.SetProgress(&cout);
+         bool summaryAttached = true;   // Open() configures the messengers in this thread
+         if (UseSummary)
+            processor.SetConfigure([this, &summaryAttached](StrangenessTreeMessenger &m)
             {
-               SumRecoEffK[idx]  += 1.0;
-               SumRecoEffPi[idx] += 1.0;
-               SumRecoEffP[idx]  += 1.0;
-               SumRecoEffKDNdEta[idxDNdEta]  += 1.0;
-               SumRecoEffPiDNdEta[idxDNdEta] += 1.0;
-               SumRecoEffPDNdEta[idxDNdEta]  += 1.0;
-               SumRecoEffKDNdY[idxDNdY]  += 1.0;
-               SumRecoEffPiDNdY[idxDNdY] += 1.0;
-               SumRecoEffPDNdY[idxDNdY]  += 1.0;
-            }
-            if (HasGenMatchingBranches)
+               if (!m.AttachSummary(par.Summary))
+                  summaryAttached = false;
+            });
+         processor.SetBlockSize(ReductionBlock, [this](KtoPiAnalyzer &worker, long long)
+         {
+            worker.foldBlock(*this);
+         });
+         if (!processor.Open() || !summaryAttached)
+         {
+            cerr << "Error: cannot open '" << par.input << "' for " << par.Threads << " threads" << endl;
+            return false;
+         }
+         KtoPiAnalyzer &merged = processor.Run(
+            [this](int)
             {
-               SumGenEffK[idx]  += RecoGenEfficiencyKExtra[i];
-               SumGenEffPi[idx] += RecoGenEfficiencyPiExtra[i];
-               SumGenEffP[idx]  += RecoGenEfficiencyPExtra[i];
-               SumGenEffKDNdEta[idxDNdEta]  += RecoGenEfficiencyKExtra[i];
-               SumGenEffPiDNdEta[idxDNdEta] += RecoGenEfficiencyPiExtra[i];
-               SumGenEffPDNdEta[idxDNdEta]  += RecoGenEfficiencyPExtra[i];
-               SumGenEffKDNdY[idxDNdY]  += RecoGenEfficiencyKExtra[i];
-               SumGenEffPiDNdY[idxDNdY] += RecoGenEfficiencyPiExtra[i];
-               SumGenEffPDNdY[idxDNdY]  += RecoGenEfficiencyPExtra[i];
-            }
-            else
+               KtoPiAnalyzer *worker = new KtoPiAnalyzer(par, this);
+               for (std::unique_ptr<KtoPiAnalyzer> &v : Variations)
+                  worker->Variations.emplace_back(new KtoPiAnalyzer(v->par, v.get()));
+               return worker;
+            }, Range.Begin, Range.End);
+         Merge(merged);
+
+         // Entry count for the throughput in writeTimingSummary(); the processor drew the bar
+         Bar.Update(Range.GetCount());
+      }
+      else
+      {
+         for (long long ievt = Range.Begin; ievt < Range.End; ++ievt)
+         {
+            // Stages are switched, not scoped: an early return leaves the current stage running
+            // until the next entry switches back to IO.
+            Timing.Switch(StageIO);
+            M->GetEntry(ievt);
+            Timing.Switch(StageSelection);
+
+            if ((ievt - Range.Begin) % deltaI == 0)
             {
-               SumGenEffK[idx]  += 1.0;
-               SumGenEffPi[idx] += 1.0;
-               SumGenEffP[idx]  += 1.0;
-               SumGenEffKDNdEta[idxDNdEta]  += 1.0;
-               SumGenEffPiDNdEta[idxDNdEta] += 1.0;
-               SumGenEffPDNdEta[idxDNdEta]  += 1.0;
-               SumGenEffKDNdY[idxDNdY]  += 1.0;
-               SumGenEffPiDNdY[idxDNdY] += 1.0;
-               SumGenEffPDNdY[idxDNdY]  += 1.0;
+               Bar.Update(ievt - Range.Begin);
+               Bar.Print();
             }
 
-            CountEffTracks[idx]++;
-            CountEffTracksDNdEta[idxDNdEta]++;
-            CountEffTracksDNdY[idxDNdY]++;
-         }
+            processEvent(*M, ievt);
+            processVariations(*M, ievt);
 
-         // Event-wise raw yields integrated over pT (sanity check)
-         hK->Fill(NchTag, nK);
-         hPi->Fill(NchTag, nPi);
-         hP->Fill(NchTag, nP);
-         hKDNdEta->Fill(NchEta05Reco, nK);
-         hPiDNdEta->Fill(NchEta05Reco, nPi);
-         hPDNdEta->Fill(NchEta05Reco, nP);
-         hKDNdY->Fill(NchY05Reco, nK);
-         hPiDNdY->Fill(NchY05Reco, nPi);
-         hPDNdY->Fill(NchY05Reco, nP);
-         if (hNtagReco != nullptr)
-            hNtagReco->Fill(NchTag);
-         if (hDNdEtaReco != nullptr)
-            hDNdEtaReco->Fill(NchEta05Reco);
-         if (hDNdYReco != nullptr)
-            hDNdYReco->Fill(NchY05Reco);
-
-         // MC-only response bookkeeping in reco mode
-         if (ngen > 0 && hNtagResponse != nullptr)
-         {
-            const double dNdEtaTrue = static_cast<double>(nChEta05True);
-            const double dNdYTrue = static_cast<double>(nChY05True);
-            hNtagResponse->Fill(NchTagTrue, NchTag);
-            hNtagResponseK->Fill(NchTagTrue, NchTag, nKgenEvt);
-            hNtagResponsePi->Fill(NchTagTrue, NchTag, nPigenEvt);
-            hNtagResponseP->Fill(NchTagTrue, NchTag, nPgenEvt);
-            hNtagTrue->Fill(NchTagTrue);
-            hKTrueNtag->Fill(NchTagTrue, nKgenEvt);
-            hPiTrueNtag->Fill(NchTagTrue, nPigenEvt);
-            hPTrueNtag->Fill(NchTagTrue, nPgenEvt);
-            hDNdEtaResponse->Fill(dNdEtaTrue, NchEta05Reco);
-            hDNdEtaResponseK->Fill(dNdEtaTrue, NchEta05Reco, nKgenEvt);
-            hDNdEtaResponsePi->Fill(dNdEtaTrue, NchEta05Reco, nPigenEvt);
-            hDNdEtaResponseP->Fill(dNdEtaTrue, NchEta05Reco, nPgenEvt);
-            hDNdEtaTrue->Fill(dNdEtaTrue);
-            hKTruedNdEta->Fill(dNdEtaTrue, nKgenEvt);
-            hPiTruedNdEta->Fill(dNdEtaTrue, nPigenEvt);
-            hPTruedNdEta->Fill(dNdEtaTrue, nPgenEvt);
-            hDNdYResponse->Fill(dNdYTrue, NchY05Reco);
-            hDNdYResponseK->Fill(dNdYTrue, NchY05Reco, nKgenEvt);
-            hDNdYResponsePi->Fill(dNdYTrue, NchY05Reco, nPigenEvt);
-            hDNdYResponseP->Fill(dNdYTrue, NchY05Reco, nPgenEvt);
-            hDNdYTrue->Fill(dNdYTrue);
-            hKTruedNdY->Fill(dNdYTrue, nKgenEvt);
-            hPiTruedNdY->Fill(dNdYTrue, nPigenEvt);
-            hPTruedNdY->Fill(dNdYTrue, nPgenEvt);
+            if ((ievt - Range.Begin + 1) % ReductionBlock == 0)
+               foldBlock(*this);
          }
+         foldBlock(*this);   // last, incomplete block
+
+         Bar.Update(Range.GetCount());
+         Bar.Print();
       }
 
+      Timing.Switch(StageCorrection);
       cout << endl << "Event loop finished." << endl;
 
-      //-------------------------
-      // Update titles depending on mode
-      //-------------------------
-      if (par.IsGen)
-      {
-         hK->SetTitle ("Generator-level kaons vs N_{ch}^{tag};N_{ch}^{tag};N_{K}^{gen}");
-         hPi->SetTitle("Generator-level pions vs N_{ch}^{tag};N_{ch}^{tag};N_{#pi}^{gen}");
-         hP->SetTitle ("Generator-level protons vs N_{ch}^{tag};N_{ch}^{tag};N_{p}^{gen}");
-      }
-      else
+      correct();
+      for (std::unique_ptr<KtoPiAnalyzer> &v : Variations)
       {
-         hK->SetTitle ("Kaon candidates vs N_{ch}^{tag};N_{ch}^{tag};Yield (sum over tracks)");
-         hPi->SetTitle("Pion candidates vs N_{ch}^{tag};N_{ch}^{tag};Yield (sum over tracks)");
-         hP->SetTitle ("Proton candidates vs N_{ch}^{tag};N_{ch}^{tag};Yield (sum over tracks)");
+         cout << "Variation " << v->par.variation << ":" << endl;
+         v->correct();
       }
+      return true;
+   }
 
-      //-------------------------
-      // Build ratios & apply PID correction
-      //-------------------------
+   // A part of the sample meant for MergeShards.  In reco mode a shard writes only sums that add
+   // up across shards (writeShardState) and leaves the correction to finalizeShards(); the
+   // generator-level output is additive as it is.
+   bool isShard() const
+   {
+      return (Range.ShardCount > 1 || par.FirstEntry > 0 || par.NEntries >= 0);
+   }
 
-      // Generator-level case: build raw K/pi and p/pi and stop.
-      if (par.IsGen)
+   // Settings that the sums of a shard depend on; shards and --Finalize must agree on them
+   std::string shardSettings() const
+   {
+      std::stringstream ss;
+      ss << "MaxNchTag " << par.MaxNchTag << ", PtBinEdges";
+      for (double edge : PtBinEdges)
+         ss << " " << edge;
+      ss << ", NtagPtMin " << par.NtagPtMin << ", UseCentralEtaNtag " << par.UseCentralEtaNtag
+         << ", UsePIDFiducial " << par.UsePIDFiducial << " " << par.PIDTrackAbsCosMin << " " << par.PIDTrackAbsCosMax
+         << ", PIDTieMode " << par.PIDTieMode << ", InclusivePID " << par.UseInclusivePIDObservation
+         << ", UseMCTruthMatrix " << par.UseMCTruthMatrix << ", UsePassAllSelection " << par.UsePassAllSelection
+         << ", Bootstrap " << par.BootstrapReplicas << " " << par.BootstrapSeed;
+      return ss.str();
+   }
+
+   // The additive part of the output: raw spectra, MC response, the efficiency and bootstrap
+   // sums as histograms with one bin per value, the PID overlap counts and the settings
+   void writeShardState()
+   {
+      for (const ActivityAxis &axis : Axes)
+         for (TH1 *h : axis.accumulated())
+            smartWrite(h);
+
+      auto writeSums = [](const char *name, const std::vector<double> &values)
+      {
+         TH1D h(name, name, static_cast<int>(values.size()), -0.5, values.size() - 0.5);
+         h.SetDirectory(nullptr);
+         for (size_t i = 0; i < values.size(); ++i)
+            h.SetBinContent(static_cast<int>(i) + 1, values[i]);
+         h.Write();
+      };
+      writeSums("hShardAccumulator", Accumulator);
+      if (par.BootstrapReplicas > 0)
       {
-         hKoverPi = (TH1D *)hK->Clone("hKoverPi");
-         hPoverPi = (TH1D *)hP->Clone("hPoverPi");
+         writeSums("hShardReplicaAccumulator", ReplicaAccumulator);
+         writeSums("hShardReplicaSpectra", ReplicaSpectra);
+      }
+      TParameter<long long>("ShardPIDPassTagTracks", NPIDPassTagTracks).Write();
+      TParameter<long long>("ShardPIDTieTracks", NPIDTieTracks).Write();
+      TNamed("ShardSettings", shardSettings().c_str()).Write();
+      TNamed("ShardFinalize", ("KtoPiAnalysis --Finalize <merged.root> with the options of the shards ("
+                               + shardSettings() + ")").c_str()).Write();
+   }
 
-         hKoverPi->SetTitle("Generator-level K/#pi yield ratio vs N_{ch}^{tag};N_{ch}^{tag};K/#pi (gen)");
-         hPoverPi->SetTitle("Generator-level p/#pi yield ratio vs N_{ch}^{tag};N_{ch}^{tag};p/#pi (gen)");
+   // Corrected results from the merged outputs of reco-mode shards: the sums are read back
+   // and go through correct() as in a single job over the whole range
+   bool finalizeShards()
+   {
+      if (outf == nullptr)
+         return false;
+      TFile *merged = TFile::Open(par.Finalize.c_str(), "READ");
+      if (merged == nullptr || merged->IsZombie())
+      {
+         cerr << "Error: cannot open merged shards '" << par.Finalize << "'" << endl;
+         delete merged;
+         return false;
+      }
+      const bool loaded = loadShardState(*merged);
+      merged->Close();
+      delete merged;
+      if (!loaded)
+         return false;
 
-         hKoverPi->Divide(hPi);
-         hPoverPi->Divide(hPi);
+      correct();
+      return true;
+   }
 
-         return;  // no PID unfolding in generator mode
+   bool loadShardState(TFile &merged)
+   {
+      TNamed *settings = nullptr;
+      TNamed *info = nullptr;
+      merged.GetObject("ShardSettings", settings);
+      merged.GetObject("ShardInfo", info);
+      if (settings == nullptr || info == nullptr || !EntryRange::ParseInfo(info->GetTitle(), Range))
+      {
+         cerr << "Error: '" << par.Finalize << "' is not a merge of reco-mode KtoPiAnalysis shards" << endl;
+         return false;
+      }
+      if (settings->GetTitle() != shardSettings())
+      {
+         cerr << "Error: the shards were run with" << endl << "   " << settings->GetTitle() << endl
+              << "but --Finalize with" << endl << "   " << shardSettings() << endl;
+         return false;
       }
+      if (std::string(info->GetTitle()).find("incomplete") != std::string::npos)
+         cerr << "Warning: " << info->GetTitle() << endl;
 
-      //-------------------------------------------------
-      // 3-step PID correction, pT-dependent (reco mode)
-      //-------------------------------------------------
-      const int nNchBinsLocal = NNchBins;
-
-      // Reset corrected histograms just in case
-      hKPtCorrected->Reset();
-      hPiPtCorrected->Reset();
-      hPPtCorrected->Reset();
-      hKCorrected->Reset();
-      hPiCorrected->Reset();
-      hPCorrected->Reset();
-      hKPtCorrectedDNdEta->Reset();
-      hPiPtCorrectedDNdEta->Reset();
-      hPPtCorrectedDNdEta->Reset();
-      hKCorrectedDNdEta->Reset();
-      hPiCorrectedDNdEta->Reset();
-      hPCorrectedDNdEta->Reset();
-      hKPtCorrectedDNdY->Reset();
-      hPiPtCorrectedDNdY->Reset();
-      hPPtCorrectedDNdY->Reset();
-      hKCorrectedDNdY->Reset();
-      hPiCorrectedDNdY->Reset();
-      hPCorrectedDNdY->Reset();
-
-      auto correctAxis = [&](int axisMode)
-      {
-         TH2D *hRawK2D = (axisMode == 1) ? hKPtDNdEta : ((axisMode == 2) ? hKPtDNdY : hKPt);
-         TH2D *hRawPi2D = (axisMode == 1) ? hPiPtDNdEta : ((axisMode == 2) ? hPiPtDNdY : hPiPt);
-         TH2D *hRawP2D = (axisMode == 1) ? hPPtDNdEta : ((axisMode == 2) ? hPPtDNdY : hPPt);
-         TH2D *hCorrK2D = (axisMode == 1) ? hKPtCorrectedDNdEta : ((axisMode == 2) ? hKPtCorrectedDNdY : hKPtCorrected);
-         TH2D *hCorrPi2D = (axisMode == 1) ? hPiPtCorrectedDNdEta : ((axisMode == 2) ? hPiPtCorrectedDNdY : hPiPtCorrected);
-         TH2D *hCorrP2D = (axisMode == 1) ? hPPtCorrectedDNdEta : ((axisMode == 2) ? hPPtCorrectedDNdY : hPPtCorrected);
-         TH1D *hRawK1D = (axisMode == 1) ? hKDNdEta : ((axisMode == 2) ? hKDNdY : hK);
-         TH1D *hRawPi1D = (axisMode == 1) ? hPiDNdEta : ((axisMode == 2) ? hPiDNdY : hPi);
-         TH1D *hRawP1D = (axisMode == 1) ? hPDNdEta : ((axisMode == 2) ? hPDNdY : hP);
-         TH1D *hCorrK1D = (axisMode == 1) ? hKCorrectedDNdEta : ((axisMode == 2) ? hKCorrectedDNdY : hKCorrected);
-         TH1D *hCorrPi1D = (axisMode == 1) ? hPiCorrectedDNdEta : ((axisMode == 2) ? hPiCorrectedDNdY : hPiCorrected);
-         TH1D *hCorrP1D = (axisMode == 1) ? hPCorrectedDNdEta : ((axisMode == 2) ? hPCorrectedDNdY : hPCorrected);
-         const std::vector<double> *vKAsK = (axisMode == 1) ? &SumKAsKDNdEta : ((axisMode == 2) ? &SumKAsKDNdY : &SumKAsK);
-         const std::vector<double> *vKAsPi = (axisMode == 1) ? &SumKAsPiDNdEta : ((axisMode == 2) ? &SumKAsPiDNdY : &SumKAsPi);
-         const std::vector<double> *vKAsP = (axisMode == 1) ? &SumKAsPDNdEta : ((axisMode == 2) ? &SumKAsPDNdY : &SumKAsP);
-         const std::vector<double> *vPiAsK = (axisMode == 1) ? &SumPiAsKDNdEta : ((axisMode == 2) ? &SumPiAsKDNdY : &SumPiAsK);
-         const std::vector<double> *vPiAsPi = (axisMode == 1) ? &SumPiAsPiDNdEta : ((axisMode == 2) ? &SumPiAsPiDNdY : &SumPiAsPi);
-         const std::vector<double> *vPiAsP = (axisMode == 1) ? &SumPiAsPDNdEta : ((axisMode == 2) ? &SumPiAsPDNdY : &SumPiAsP);
-         const std::vector<double> *vPAsK = (axisMode == 1) ? &SumPAsKDNdEta : ((axisMode == 2) ? &SumPAsKDNdY : &SumPAsK);
-         const std::vector<double> *vPAsPi = (axisMode == 1) ? &SumPAsPiDNdEta : ((axisMode == 2) ? &SumPAsPiDNdY : &SumPAsPi);
-         const std::vector<double> *vPAsP = (axisMode == 1) ? &SumPAsPDNdEta : ((axisMode == 2) ? &SumPAsPDNdY : &SumPAsP);
-         const std::vector<double> *vRecoK = (axisMode == 1) ? &SumRecoEffKDNdEta : ((axisMode == 2) ? &SumRecoEffKDNdY : &SumRecoEffK);
-         const std::vector<double> *vRecoPi = (axisMode == 1) ? &SumRecoEffPiDNdEta : ((axisMode == 2) ? &SumRecoEffPiDNdY : &SumRecoEffPi);
-         const std::vector<double> *vRecoP = (axisMode == 1) ? &SumRecoEffPDNdEta : ((axisMode == 2) ? &SumRecoEffPDNdY : &SumRecoEffP);
-         const std::vector<double> *vGenK = (axisMode == 1) ? &SumGenEffKDNdEta : ((axisMode == 2) ? &SumGenEffKDNdY : &SumGenEffK);
-         const std::vector<double> *vGenPi = (axisMode == 1) ? &SumGenEffPiDNdEta : ((axisMode == 2) ? &SumGenEffPiDNdY : &SumGenEffPi);
-         const std::vector<double> *vGenP = (axisMode == 1) ? &SumGenEffPDNdEta : ((axisMode == 2) ? &SumGenEffPDNdY : &SumGenEffP);
-         const std::vector<long long> *vCount = (axisMode == 1) ? &CountEffTracksDNdEta : ((axisMode == 2) ? &CountEffTracksDNdY : &CountEffTracks);
-         const char *axisLabel = (axisMode == 1) ? "reco dNch/deta" : ((axisMode == 2) ? "reco dNch/dy" : "NchTag");
-
-         for (int iNch = 1; iNch <= nNchBinsLocal; ++iNch)
+      outf->cd();
+      for (ActivityAxis &axis : Axes)
+      {
+         for (TH1 *h : axis.accumulated())
          {
-            for (int iPt = 1; iPt <= NPtBins; ++iPt)
+            TH1 *stored = nullptr;
+            merged.GetObject(h->GetName(), stored);
+            if (stored == nullptr || stored->GetNcells() != h->GetNcells())
             {
-               const int idx = flatIndex(iNch, iPt);
-               if ((*vCount)[idx] <= 0)
-                  continue;
-
-               const double den = static_cast<double>((*vCount)[idx]);
-               const double eKAsK = (*vKAsK)[idx] / den;
-               const double eKAsPi = (*vKAsPi)[idx] / den;
-               const double eKAsP = (*vKAsP)[idx] / den;
-               const double ePiAsK = (*vPiAsK)[idx] / den;
-               const double ePiAsPi = (*vPiAsPi)[idx] / den;
-               const double ePiAsP = (*vPiAsP)[idx] / den;
-               const double ePAsK = (*vPAsK)[idx] / den;
-               const double ePAsPi = (*vPAsPi)[idx] / den;
-               const double ePAsP = (*vPAsP)[idx] / den;
-               const double eRecoK = (*vRecoK)[idx] / den;
-               const double eRecoPi = (*vRecoPi)[idx] / den;
-               const double eRecoP = (*vRecoP)[idx] / den;
-               const double eGenK = (*vGenK)[idx] / den;
-               const double eGenPi = (*vGenPi)[idx] / den;
-               const double eGenP = (*vGenP)[idx] / den;
-
-               const double NKtag = hRawK2D->GetBinContent(iNch, iPt);
-               const double NPiTag = hRawPi2D->GetBinContent(iNch, iPt);
-               const double NPtag = hRawP2D->GetBinContent(iNch, iPt);
-
-               double NtrueReco[3] = {0.0, 0.0, 0.0};
-               double eNtrueReco[3] = {0.0, 0.0, 0.0};
-               double Ntrue[3] = {0.0, 0.0, 0.0};
-               double eNtrue[3] = {0.0, 0.0, 0.0};
-
-               double recoMatch[3] = {
-                  std::clamp(eRecoK, 0.0, 1.0),
-                  std::clamp(eRecoPi, 0.0, 1.0),
-                  std::clamp(eRecoP, 0.0, 1.0)
-               };
-               const double Y[3] = {NKtag * recoMatch[0], NPiTag * recoMatch[1], NPtag * recoMatch[2]};
-
-               double Mmat[3][3];
-               Mmat[0][0] = eKAsK;  Mmat[0][1] = ePiAsK;  Mmat[0][2] = ePAsK;
-               Mmat[1][0] = eKAsPi; Mmat[1][1] = ePiAsPi; Mmat[1][2] = ePAsPi;
-               Mmat[2][0] = eKAsP;  Mmat[2][1] = ePiAsP;  Mmat[2][2] = ePAsP;
-
-               double Minv[3][3];
-               double det = 0.0;
-               if (!invert3x3(Mmat, Minv, det))
-               {
-                  cerr << "Warning: 3x3 tagging matrix near-singular in "
-                       << axisLabel << " bin " << iNch << ", pT bin " << iPt
-                       << " (det = " << det << "). Skipping correction for this bin."
-                       << endl;
-                  continue;
-               }
-
-               for (int s = 0; s < 3; ++s)
-               {
-                  NtrueReco[s] = Minv[s][0] * Y[0] + Minv[s][1] * Y[1] + Minv[s][2] * Y[2];
-                  if (NtrueReco[s] < 0.0)
-                     NtrueReco[s] = 0.0;
-               }
+               cerr << "Error: " << h->GetName() << " is missing or binned differently in " << par.Finalize << endl;
+               return false;
+            }
+            h->Add(stored);
+         }
+         for (int s = 0; s < 4; ++s)
+            axis.PtFill[s].Adopt();
+         for (int s = 0; s < 3; ++s)
+            axis.RawFill[s].Adopt();
+      }
 
-               const double varY[3] = {
-                  (Y[0] > 0.0 ? Y[0] : 1.0),
-                  (Y[1] > 0.0 ? Y[1] : 1.0),
-                  (Y[2] > 0.0 ? Y[2] : 1.0)
-               };
-               for (int s = 0; s < 3; ++s)
-               {
-                  double v = 0.0;
-                  for (int i = 0; i < 3; ++i)
-                     v += Minv[s][i] * Minv[s][i] * varY[i];
-                  eNtrueReco[s] = (v > 0.0 ? std::sqrt(v) : 0.0);
-               }
+      auto readSums = [&merged, this](const char *name, std::vector<double> &values)
+      {
+         TH1 *h = nullptr;
+         merged.GetObject(name, h);
+         if (h == nullptr || h->GetNbinsX() != static_cast<int>(values.size()))
+         {
+            cerr << "Error: " << name << " is missing or has the wrong size in " << par.Finalize << endl;
+            return false;
+         }
+         for (size_t i = 0; i < values.size(); ++i)
+            values[i] = h->GetBinContent(static_cast<int>(i) + 1);
+         return true;
+      };
+      if (!readSums("hShardAccumulator", Accumulator))
+         return false;
+      if (par.BootstrapReplicas > 0 &&
+          (!readSums("hShardReplicaAccumulator", ReplicaAccumulator) || !readSums("hShardReplicaSpectra", ReplicaSpectra)))
+         return false;
 
-               double gMatch[3] = {
-                  std::clamp(eGenK, 0.0, 1.0),
-                  std::clamp(eGenPi, 0.0, 1.0),
-                  std::clamp(eGenP, 0.0, 1.0)
-               };
-               for (int s = 0; s < 3; ++s)
-               {
-                  if (gMatch[s] > 1e-12)
-                  {
-                     Ntrue[s] = NtrueReco[s] / gMatch[s];
-                     eNtrue[s] = eNtrueReco[s] / gMatch[s];
-                  }
-                  else
-                  {
-                     Ntrue[s] = 0.0;
-                     eNtrue[s] = 0.0;
-                  }
-               }
+      TParameter<long long> *passTag = nullptr;
+      TParameter<long long> *tie = nullptr;
+      merged.GetObject("ShardPIDPassTagTracks", passTag);
+      merged.GetObject("ShardPIDTieTracks", tie);
+      NPIDPassTagTracks = (passTag != nullptr) ? passTag->GetVal() : 0;
+      NPIDTieTracks = (tie != nullptr) ? tie->GetVal() : 0;
 
-               hCorrK2D->SetBinContent(iNch, iPt, Ntrue[0]);
-               hCorrK2D->SetBinError(iNch, iPt, eNtrue[0]);
-               hCorrPi2D->SetBinContent(iNch, iPt, Ntrue[1]);
-               hCorrPi2D->SetBinError(iNch, iPt, eNtrue[1]);
-               hCorrP2D->SetBinContent(iNch, iPt, Ntrue[2]);
-               hCorrP2D->SetBinError(iNch, iPt, eNtrue[2]);
-            }
+      cout << "Finalizing " << info->GetTitle() << " from " << par.Finalize << endl;
+      return true;
+   }
 
-            double sumKcorr = 0.0;
-            double sumPicorr = 0.0;
-            double sumPcorr = 0.0;
-            double err2Kcorr = 0.0;
-            double err2Picorr = 0.0;
-            double err2Pcorr = 0.0;
-            double sumKraw = 0.0;
-            double sumPiraw = 0.0;
-            double sumPraw = 0.0;
-            double err2Kraw = 0.0;
-            double err2Piraw = 0.0;
-            double err2Praw = 0.0;
+   // Ratios and the 3-step PID correction from the filled histograms and sums
+   void correct()
+   {
+      flushFills();
 
-            for (int iPt = 1; iPt <= NPtBins; ++iPt)
-            {
-               const double vKc = hCorrK2D->GetBinContent(iNch, iPt);
-               const double vPic = hCorrPi2D->GetBinContent(iNch, iPt);
-               const double vPc = hCorrP2D->GetBinContent(iNch, iPt);
-               const double eKc = hCorrK2D->GetBinError(iNch, iPt);
-               const double ePic = hCorrPi2D->GetBinError(iNch, iPt);
-               const double ePc = hCorrP2D->GetBinError(iNch, iPt);
-
-               sumKcorr += vKc;
-               sumPicorr += vPic;
-               sumPcorr += vPc;
-               err2Kcorr += eKc * eKc;
-               err2Picorr += ePic * ePic;
-               err2Pcorr += ePc * ePc;
-
-               const double vKr = hRawK2D->GetBinContent(iNch, iPt);
-               const double vPir = hRawPi2D->GetBinContent(iNch, iPt);
-               const double vPr = hRawP2D->GetBinContent(iNch, iPt);
-               const double eKr = hRawK2D->GetBinError(iNch, iPt);
-               const double ePir = hRawPi2D->GetBinError(iNch, iPt);
-               const double ePr = hRawP2D->GetBinError(iNch, iPt);
-
-               sumKraw += vKr;
-               sumPiraw += vPir;
-               sumPraw += vPr;
-               err2Kraw += eKr * eKr;
-               err2Piraw += ePir * ePir;
-               err2Praw += ePr * ePr;
-            }
+      // Clones made here belong to this analyzer's own output file
+      if (outf != nullptr)
+         outf->cd();
 
-            hCorrK1D->SetBinContent(iNch, sumKcorr);
-            hCorrK1D->SetBinError(iNch, std::sqrt(err2Kcorr));
-            hCorrPi1D->SetBinContent(iNch, sumPicorr);
-            hCorrPi1D->SetBinError(iNch, std::sqrt(err2Picorr));
-            hCorrP1D->SetBinContent(iNch, sumPcorr);
-            hCorrP1D->SetBinError(iNch, std::sqrt(err2Pcorr));
-            hRawK1D->SetBinContent(iNch, sumKraw);
-            hRawK1D->SetBinError(iNch, std::sqrt(err2Kraw));
-            hRawPi1D->SetBinContent(iNch, sumPiraw);
-            hRawPi1D->SetBinError(iNch, std::sqrt(err2Piraw));
-            hRawP1D->SetBinContent(iNch, sumPraw);
-            hRawP1D->SetBinError(iNch, std::sqrt(err2Praw));
+      // Generator-level case: raw K/pi and p/pi vs the first estimator and stop.
+      if (par.IsGen)
+      {
+         ActivityAxis &primary = Axes[0];
+         const Activity::Estimator &e = primary.Estimator;
+         const char *genTitle[3] = {"kaons", "pions", "protons"};
+         for (int s = 0; s < 3; ++s)
+            primary.hRaw[s]->SetTitle(("Generator-level " + std::string(genTitle[s]) + " vs " + e.Label + ";"
+               + e.RecoTitle + ";N_{" + SpeciesTitle[s] + "}^{gen}").c_str());
+
+         for (int q = 0; q < 2; ++q)
+         {
+            const std::string ratio = RatioTitle[q];
+            primary.hRatio[q] = (TH1D *)primary.hRaw[RatioSpecies[q]]->Clone((std::string("h") + RatioName[q] + e.Name).c_str());
+            primary.hRatio[q]->SetTitle(("Generator-level " + ratio + " yield ratio vs " + e.RatioLabel + ";"
+               + e.RecoTitle + ";" + ratio + " (gen)").c_str());
+            primary.hRatio[q]->Divide(primary.hRaw[1]);
          }
-      };
 
-      correctAxis(0);
-      correctAxis(1);
-      correctAxis(2);
+         return;  // no PID unfolding in generator mode
+      }
+
+      if (isShard())
+         return;  // corrected from the merged sums, see finalizeShards()
 
       //-------------------------------------------------
-      // Raw K/pi and p/pi vs Nch_tag from p_{T}-integrated spectra
+      // 3-step PID correction, pT-dependent (reco mode), and the raw and corrected K/pi and
+      // p/pi from the pT-integrated yields, for every activity estimator
       //-------------------------------------------------
-      hKoverPi = (TH1D *)hK->Clone("hKoverPi");
-      hPoverPi = (TH1D *)hP->Clone("hPoverPi");
-
-      hKoverPi->SetTitle("K/#pi yield ratio vs N_{ch}^{tag};N_{ch}^{tag};K/#pi (reco, raw, p_{T}-integrated)");
-      hPoverPi->SetTitle("p/#pi yield ratio vs N_{ch}^{tag};N_{ch}^{tag};p/#pi (reco, raw, p_{T}-integrated)");
+      for (ActivityAxis &axis : Axes)
+      {
+         correctAxis(axis);
 
-      hKoverPi->Divide(hPi);
-      hPoverPi->Divide(hPi);
+         const Activity::Estimator &e = axis.Estimator;
+         for (int q = 0; q < 2; ++q)
+         {
+            const std::string name = std::string("h") + RatioName[q];
+            const std::string ratio = RatioTitle[q];
+            axis.hRatio[q] = (TH1D *)axis.hRaw[RatioSpecies[q]]->Clone((name + e.Name).c_str());
+            axis.hRatio[q]->SetTitle((ratio + " yield ratio vs " + e.RatioLabel + ";" + e.RecoTitle + ";"
+               + ratio + " (reco, raw, p_{T}-integrated)").c_str());
+            axis.hRatio[q]->Divide(axis.hRaw[1]);
+
+            axis.hRatioCorrected[q] = (TH1D *)axis.hCorrected[RatioSpecies[q]]->Clone((name + "Corrected" + e.Name).c_str());
+            axis.hRatioCorrected[q]->SetTitle((ratio + " vs " + e.RatioLabel + ";" + e.RecoTitle + ";"
+               + ratio + " (PID-corrected, p_{T}-integrated)").c_str());
+            axis.hRatioCorrected[q]->Divide(axis.hCorrected[1]);
+            // pair q: (K, pi) for K/pi, (p, pi) for p/pi
+            setRatioErrors(axis.hRatioCorrected[q], axis.hCorrected[RatioSpecies[q]], axis.hCorrected[1],
+                           axis.hCovCorrected[q]);
+         }
+      }
 
-      //-------------------------------------------------
-      // Corrected K/pi and p/pi vs Nch_tag (from 1D yields)
-      //-------------------------------------------------
-      hKoverPiCorrected = (TH1D *)hKCorrected->Clone("hKoverPiCorrected");
-      hKoverPiCorrected->SetTitle("K/#pi vs N_{ch}^{tag};N_{ch}^{tag};K/#pi (PID-corrected, p_{T}-integrated)");
-      hKoverPiCorrected->Divide(hPiCorrected);
-
-      hPoverPiCorrected = (TH1D *)hPCorrected->Clone("hPoverPiCorrected");
-      hPoverPiCorrected->SetTitle("p/#pi vs N_{ch}^{tag};N_{ch}^{tag};p/#pi (PID-corrected, p_{T}-integrated)");
-      hPoverPiCorrected->Divide(hPiCorrected);
-
-      hKoverPiDNdEta = (TH1D *)hKDNdEta->Clone("hKoverPiDNdEta");
-      hPoverPiDNdEta = (TH1D *)hPDNdEta->Clone("hPoverPiDNdEta");
-      hKoverPiDNdEta->SetTitle("K/#pi yield ratio vs reco dN_{ch}/d#eta;dN_{ch}/d#eta (reco, |#eta|<0.5);K/#pi (reco, raw, p_{T}-integrated)");
-      hPoverPiDNdEta->SetTitle("p/#pi yield ratio vs reco dN_{ch}/d#eta;dN_{ch}/d#eta (reco, |#eta|<0.5);p/#pi (reco, raw, p_{T}-integrated)");
-      hKoverPiDNdEta->Divide(hPiDNdEta);
-      hPoverPiDNdEta->Divide(hPiDNdEta);
-
-      hKoverPiCorrectedDNdEta = (TH1D *)hKCorrectedDNdEta->Clone("hKoverPiCorrectedDNdEta");
-      hPoverPiCorrectedDNdEta = (TH1D *)hPCorrectedDNdEta->Clone("hPoverPiCorrectedDNdEta");
-      hKoverPiCorrectedDNdEta->SetTitle("K/#pi vs reco dN_{ch}/d#eta;dN_{ch}/d#eta (reco, |#eta|<0.5);K/#pi (PID-corrected, p_{T}-integrated)");
-      hPoverPiCorrectedDNdEta->SetTitle("p/#pi vs reco dN_{ch}/d#eta;dN_{ch}/d#eta (reco, |#eta|<0.5);p/#pi (PID-corrected, p_{T}-integrated)");
-      hKoverPiCorrectedDNdEta->Divide(hPiCorrectedDNdEta);
-      hPoverPiCorrectedDNdEta->Divide(hPiCorrectedDNdEta);
-
-      hKoverPiDNdY = (TH1D *)hKDNdY->Clone("hKoverPiDNdY");
-      hPoverPiDNdY = (TH1D *)hPDNdY->Clone("hPoverPiDNdY");
-      hKoverPiDNdY->SetTitle("K/#pi yield ratio vs reco dN_{ch}/dy;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);K/#pi (reco, raw, p_{T}-integrated)");
-      hPoverPiDNdY->SetTitle("p/#pi yield ratio vs reco dN_{ch}/dy;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p/#pi (reco, raw, p_{T}-integrated)");
-      hKoverPiDNdY->Divide(hPiDNdY);
-      hPoverPiDNdY->Divide(hPiDNdY);
-
-      hKoverPiCorrectedDNdY = (TH1D *)hKCorrectedDNdY->Clone("hKoverPiCorrectedDNdY");
-      hPoverPiCorrectedDNdY = (TH1D *)hPCorrectedDNdY->Clone("hPoverPiCorrectedDNdY");
-      hKoverPiCorrectedDNdY->SetTitle("K/#pi vs reco dN_{ch}/dy;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);K/#pi (PID-corrected, p_{T}-integrated)");
-      hPoverPiCorrectedDNdY->SetTitle("p/#pi vs reco dN_{ch}/dy;dN_{ch}/dy (reco, thrust axis, |y_{T}|<0.5);p/#pi (PID-corrected, p_{T}-integrated)");
-      hKoverPiCorrectedDNdY->Divide(hPiCorrectedDNdY);
-      hPoverPiCorrectedDNdY->Divide(hPiCorrectedDNdY);
+      if (par.BootstrapReplicas > 0)
+         bootstrapRatios();
 
       if (!par.IsGen && NPIDPassTagTracks > 0)
       {
@@ -2055,100 +1842,212 @@ public:
       }
    }
 
+   // Corrected pT spectra, pT-integrated corrected yields and their species covariance along
+   // one activity axis; the raw pT-integrated yields are rebuilt from the raw pT spectra
+   void correctAxis(ActivityAxis &axis)
+   {
+      const int nBins = axis.NBins;
+      for (int s = 0; s < 3; ++s)
+      {
+         axis.hPtCorrected[s]->Reset();
+         axis.hCorrected[s]->Reset();
+      }
+
+      // All (activity, pT) cells of this axis in one batch
+      const int nCells = nBins * NPtBins;
+      std::vector<double> raw(3 * nCells, 0.0);
+      for (int iBin = 1; iBin <= nBins; ++iBin)
+      {
+         for (int iPt = 1; iPt <= NPtBins; ++iPt)
+         {
+            const int k = flatIndex(axis, iBin, iPt);
+            for (int s = 0; s < 3; ++s)
+               raw[3 * k + s] = axis.hPt[s]->GetBinContent(iBin, iPt);
+         }
+      }
+      TaggingMatrixBatch::Batch batch;
+      std::vector<char> hasTracks;
+      std::vector<double> genMatch;
+      unfoldCells(nCells, &Accumulator[axis.CellOffset * AccComponents], raw.data(),
+                  par.PropagateMatrixErrors, batch, hasTracks, genMatch);
+
+      const TaggingMatrixBatch::CovarianceIndex variance[3] = {
+         TaggingMatrixBatch::Cov00, TaggingMatrixBatch::Cov11, TaggingMatrixBatch::Cov22};
+      for (int iBin = 1; iBin <= nBins; ++iBin)
+      {
+         for (int iPt = 1; iPt <= NPtBins; ++iPt)
+         {
+            const int k = flatIndex(axis, iBin, iPt);
+            if (!hasTracks[k])
+               continue;
+            if (!batch.IsInvertible(k, MinTaggingDeterminant))
+            {
+               cerr << "Warning: 3x3 tagging matrix near-singular in "
+                    << axis.Estimator.ResponseName << " bin " << iBin << ", pT bin " << iPt
+                    << " (det = " << batch.Det[k] << "). Skipping correction for this bin."
+                    << endl;
+               continue;
+            }
+
+            // Negative unfolded yields are set to zero; then the gen-matching correction
+            const double *gMatch = &genMatch[3 * k];
+            for (int s = 0; s < 3; ++s)
+            {
+               double Ntrue = 0.0;
+               double eNtrue = 0.0;
+               if (gMatch[s] > 1e-12)
+               {
+                  const double v = batch.Cov[variance[s]][k];
+                  Ntrue = std::max(batch.X[s][k], 0.0) / gMatch[s];
+                  eNtrue = (v > 0.0 ? std::sqrt(v) : 0.0) / gMatch[s];
+               }
+               axis.hPtCorrected[s]->SetBinContent(iBin, iPt, Ntrue);
+               axis.hPtCorrected[s]->SetBinError(iBin, iPt, eNtrue);
+            }
+
+            for (int pair = 0; pair < 3; ++pair)
+            {
+               const int a = CovariancePairSpecies[pair][0];
+               const int b = CovariancePairSpecies[pair][1];
+               double cov = 0.0;
+               if (gMatch[a] > 1e-12 && gMatch[b] > 1e-12)
+                  cov = batch.Cov[CovariancePair[pair]][k] / (gMatch[a] * gMatch[b]);
+               axis.hCovPtCorrected[pair]->SetBinContent(iBin, iPt, cov);
+            }
+         }
+
+         for (int s = 0; s < 3; ++s)
+         {
+            double sumCorr = 0.0;
+            double err2Corr = 0.0;
+            double sumRaw = 0.0;
+            double err2Raw = 0.0;
+            for (int iPt = 1; iPt <= NPtBins; ++iPt)
+            {
+               const double eCorr = axis.hPtCorrected[s]->GetBinError(iBin, iPt);
+               const double eRaw = axis.hPt[s]->GetBinError(iBin, iPt);
+               sumCorr += axis.hPtCorrected[s]->GetBinContent(iBin, iPt);
+               err2Corr += eCorr * eCorr;
+               sumRaw += axis.hPt[s]->GetBinContent(iBin, iPt);
+               err2Raw += eRaw * eRaw;
+            }
+            axis.hCorrected[s]->SetBinContent(iBin, sumCorr);
+            axis.hCorrected[s]->SetBinError(iBin, std::sqrt(err2Corr));
+            axis.hRaw[s]->SetBinContent(iBin, sumRaw);
+            axis.hRaw[s]->SetBinError(iBin, std::sqrt(err2Raw));
+         }
+
+         // Sum of the cell covariances (no correlations between the cells of the two terms)
+         for (int pair = 0; pair < 3; ++pair)
+         {
+            double covCorr = 0.0;
+            for (int iPt = 1; iPt <= NPtBins; ++iPt)
+               covCorr += axis.hCovPtCorrected[pair]->GetBinContent(iBin, iPt);
+            axis.hCovCorrected[pair]->SetBinContent(iBin, covCorr);
+         }
+      }
+   }
+
+   // Closes the running stage and reports events/s, compressed MB/s read, peak RSS and
+   // the time spent per stage; also written to par.TimingSummary when set.
+   void writeTimingSummary()
+   {
+      Timing.Stop();
+
+      const double elapsed = Bar.GetElapsed();
+      cout << "Timing: " << elapsed << " s";
+      if (elapsed > 0.0)
+         cout << " (" << Bar.GetRate() << " entries/s, "
+              << Bar.GetBytesRead() / 1024.0 / 1024.0 / elapsed << " MB/s)";
+      cout << ", peak RSS " << ProgressBar::GetPeakRSS() << " MB" << endl;
+      for (int i = 0; i < Timing.GetStageCount(); ++i)
+         cout << "  " << Timing.GetName(i) << ": " << Timing.GetSeconds(i) << " s" << endl;
+
+      if (!par.TimingSummary.empty() && Bar.WriteSummary(par.TimingSummary, "KtoPiAnalysis"))
+         cout << "Timing summary written to " << par.TimingSummary << endl;
+   }
+
    void writeHistograms()
    {
+      for (std::unique_ptr<KtoPiAnalyzer> &v : Variations)
+         v->writeHistograms();
+
       if (outf == nullptr)
          return;
 
       outf->cd();
 
-      // 1D histograms vs Nch_tag
-      smartWrite(hK);
-      smartWrite(hPi);
-      smartWrite(hP);
-      smartWrite(hKoverPi);
-      smartWrite(hPoverPi);
-      smartWrite(hKDNdEta);
-      smartWrite(hPiDNdEta);
-      smartWrite(hPDNdEta);
-      smartWrite(hKoverPiDNdEta);
-      smartWrite(hPoverPiDNdEta);
-      smartWrite(hKDNdY);
-      smartWrite(hPiDNdY);
-      smartWrite(hPDNdY);
-      smartWrite(hKoverPiDNdY);
-      smartWrite(hPoverPiDNdY);
-      smartWrite(hKPt);
-      smartWrite(hPiPt);
-      smartWrite(hPPt);
-      smartWrite(hKPtDNdEta);
-      smartWrite(hPiPtDNdEta);
-      smartWrite(hPPtDNdEta);
-      smartWrite(hKPtDNdY);
-      smartWrite(hPiPtDNdY);
-      smartWrite(hPPtDNdY);
+      if (!par.IsGen && isShard())
+      {
+         writeShardState();
+         Range.Write(outf);
+         return;
+      }
+
+      // Raw yields, ratios and pT spectra vs every activity estimator
+      for (const ActivityAxis &axis : Axes)
+      {
+         for (int s = 0; s < 3; ++s)
+            smartWrite(axis.hRaw[s]);
+         for (int q = 0; q < 2; ++q)
+            smartWrite(axis.hRatio[q]);
+         for (int s = 0; s < 3; ++s)
+            smartWrite(axis.hPt[s]);
+      }
 
       if (!par.IsGen)
       {
-         smartWrite(hKCorrected);
-         smartWrite(hPiCorrected);
-         smartWrite(hPCorrected);
-         smartWrite(hKoverPiCorrected);
-         smartWrite(hPoverPiCorrected);
-         smartWrite(hKCorrectedDNdEta);
-         smartWrite(hPiCorrectedDNdEta);
-         smartWrite(hPCorrectedDNdEta);
-         smartWrite(hKoverPiCorrectedDNdEta);
-         smartWrite(hPoverPiCorrectedDNdEta);
-         smartWrite(hKCorrectedDNdY);
-         smartWrite(hPiCorrectedDNdY);
-         smartWrite(hPCorrectedDNdY);
-         smartWrite(hKoverPiCorrectedDNdY);
-         smartWrite(hPoverPiCorrectedDNdY);
-
-         // 2D pT spectra
-         smartWrite(hUPt);
-         smartWrite(hKPtCorrected);
-         smartWrite(hPiPtCorrected);
-         smartWrite(hPPtCorrected);
-         smartWrite(hUPtDNdEta);
-         smartWrite(hKPtCorrectedDNdEta);
-         smartWrite(hPiPtCorrectedDNdEta);
-         smartWrite(hPPtCorrectedDNdEta);
-         smartWrite(hUPtDNdY);
-         smartWrite(hKPtCorrectedDNdY);
-         smartWrite(hPiPtCorrectedDNdY);
-         smartWrite(hPPtCorrectedDNdY);
-
-         // MC-only histograms used by Ntag unfolding (empty for data)
-         smartWrite(hNtagResponse);
-         smartWrite(hNtagResponseK);
-         smartWrite(hNtagResponsePi);
-         smartWrite(hNtagResponseP);
-         smartWrite(hNtagTrue);
-         smartWrite(hNtagReco);
-         smartWrite(hKTrueNtag);
-         smartWrite(hPiTrueNtag);
-         smartWrite(hPTrueNtag);
-         smartWrite(hDNdEtaResponse);
-         smartWrite(hDNdEtaResponseK);
-         smartWrite(hDNdEtaResponsePi);
-         smartWrite(hDNdEtaResponseP);
-         smartWrite(hDNdEtaTrue);
-         smartWrite(hDNdEtaReco);
-         smartWrite(hKTruedNdEta);
-         smartWrite(hPiTruedNdEta);
-         smartWrite(hPTruedNdEta);
-         smartWrite(hDNdYResponse);
-         smartWrite(hDNdYResponseK);
-         smartWrite(hDNdYResponsePi);
-         smartWrite(hDNdYResponseP);
-         smartWrite(hDNdYTrue);
-         smartWrite(hDNdYReco);
-         smartWrite(hKTruedNdY);
-         smartWrite(hPiTruedNdY);
-         smartWrite(hPTruedNdY);
+         for (const ActivityAxis &axis : Axes)
+         {
+            for (int s = 0; s < 3; ++s)
+               smartWrite(axis.hCorrected[s]);
+            for (int q = 0; q < 2; ++q)
+               smartWrite(axis.hRatioCorrected[q]);
+
+            // 2D pT spectra
+            smartWrite(axis.hPt[3]);
+            for (int s = 0; s < 3; ++s)
+               smartWrite(axis.hPtCorrected[s]);
+
+            // Species covariance of the corrected yields, bootstrap of the corrected ratios
+            for (int pair = 0; pair < 3; ++pair)
+            {
+               smartWrite(axis.hCovPtCorrected[pair]);
+               smartWrite(axis.hCovCorrected[pair]);
+            }
+            for (int q = 0; q < 2; ++q)
+            {
+               smartWrite(axis.hRatioBootstrap[q]);
+               smartWrite(axis.hRatioReplicas[q]);
+            }
+
+            // MC-only histograms used by the activity unfolding (empty for data)
+            for (int w = 0; w < 4; ++w)
+               smartWrite(axis.hResponse[w]);
+            for (int pair = 0; pair < 2; ++pair)
+               smartWrite(axis.hResponseCross[pair]);
+            smartWrite(axis.hTrue);
+            smartWrite(axis.hReco);
+            for (int s = 0; s < 3; ++s)
+               smartWrite(axis.hTrueYield[s]);
+         }
+      }
+
+      // Generator-level shards: MergeShards adds the spectra and rebuilds the ratios of the
+      // first estimator from the sums.  Reco-mode shards have returned above.
+      std::vector<std::string> derived;
+      for (int q = 0; q < 2 && par.IsGen; ++q)
+      {
+         const std::string &suffix = Axes[0].Estimator.Name;
+         const std::string numerator = std::string("h") + SpeciesName[RatioSpecies[q]];
+         derived.push_back(std::string("h") + RatioName[q] + suffix + "=" + numerator + suffix + "/hPi" + suffix);
       }
+      Range.Write(outf, derived);
+
+      TH1D *hKoverPi = Axes[0].hRatio[0];
+      TH1D *hPoverPi = Axes[0].hRatio[1];
+      TH1D *hKoverPiCorrected = Axes[0].hRatioCorrected[0];
+      TH1D *hPoverPiCorrected = Axes[0].hRatioCorrected[1];
 
       // Raw K/π canvas
       TCanvas c1("c1", "K/pi vs NchTag (raw)", 800, 600);
@@ -2185,14 +2084,15 @@ public:
 //============================================================
 // Main analysis
 //============================================================
-int main(int argc, char *argv[])
+static bool IsTrueString(const std::string &value)
 {
-   // if (printHelpMessage(argc, argv))
-   //    return 0;
-
-   CommandLine CL(argc, argv);
-   KtoPiParameters par;
+   return (value == "1" || value == "true" || value == "True" || value == "TRUE" ||
+           value == "yes" || value == "Yes" || value == "YES");
+}
 
+// Reads the analysis options from CL; options that are not given keep their value in par
+static KtoPiParameters ParseParameters(CommandLine &CL, KtoPiParameters par)
+{
    // Basic I/O
    par.input  = CL.Get("Input",  par.input);
    par.output = CL.Get("Output", par.output);
@@ -2200,71 +2100,45 @@ int main(int argc, char *argv[])
    // Physics / binning parameters
    par.MaxNchTag = CL.GetInt   ("MaxNchTag", par.MaxNchTag);
    par.MaxEvents = CL.GetInt   ("MaxEvents", par.MaxEvents);
+   par.Threads   = CL.GetInt   ("Threads",   par.Threads);
+   par.Fraction   = CL.GetDouble("Fraction", par.Fraction);
+   EntryRange::ParseCount(CL.Get("FirstEntry", std::to_string(par.FirstEntry)), par.FirstEntry);   // checked in main()
+   EntryRange::ParseCount(CL.Get("NEntries", std::to_string(par.NEntries)), par.NEntries);
+   par.Shard      = CL.Get("Shard", par.Shard);
    par.EcmRef    = CL.GetDouble("EcmRef",    par.EcmRef);
    par.MinNch    = CL.GetInt   ("MinNch",    par.MinNch);
 
-   double MinThetaDeg = CL.GetDouble("MinThetaDeg", 30.0);
-   double MaxThetaDeg = CL.GetDouble("MaxThetaDeg", 150.0);
+   double MinThetaDeg = CL.GetDouble("MinThetaDeg", par.MinTheta * 180.0 / TMath::Pi());
+   double MaxThetaDeg = CL.GetDouble("MaxThetaDeg", par.MaxTheta * 180.0 / TMath::Pi());
    par.MinTheta       = MinThetaDeg * TMath::Pi() / 180.0;
    par.MaxTheta       = MaxThetaDeg * TMath::Pi() / 180.0;
 
-   // Generator-level flag: IsGen=true/false or 1/0 or yes/no
-   std::string isGenStr = CL.Get("IsGen", std::string("false"));
-   if (isGenStr == "1" || isGenStr == "true" || isGenStr == "True" ||
-       isGenStr == "TRUE" || isGenStr == "yes" || isGenStr == "Yes" ||
-       isGenStr == "YES")
-      par.IsGen = true;
-   else
-      par.IsGen = false;
-
-   std::string useTruthMatrixStr = CL.Get("UseMCTruthMatrix", std::string("false"));
-   if (useTruthMatrixStr == "1" || useTruthMatrixStr == "true" || useTruthMatrixStr == "True" ||
-       useTruthMatrixStr == "TRUE" || useTruthMatrixStr == "yes" || useTruthMatrixStr == "Yes" ||
-       useTruthMatrixStr == "YES")
-      par.UseMCTruthMatrix = true;
-   else
-      par.UseMCTruthMatrix = false;
-
-   std::string useCentralEtaNtagStr = CL.Get("UseCentralEtaNtag", std::string("false"));
-   if (useCentralEtaNtagStr == "1" || useCentralEtaNtagStr == "true" || useCentralEtaNtagStr == "True" ||
-       useCentralEtaNtagStr == "TRUE" || useCentralEtaNtagStr == "yes" || useCentralEtaNtagStr == "Yes" ||
-       useCentralEtaNtagStr == "YES")
-      par.UseCentralEtaNtag = true;
-   else
-      par.UseCentralEtaNtag = false;
-
-   std::string usePassAllSelectionStr = CL.Get("UsePassAllSelection", std::string("true"));
-   if (usePassAllSelectionStr == "1" || usePassAllSelectionStr == "true" || usePassAllSelectionStr == "True" ||
-       usePassAllSelectionStr == "TRUE" || usePassAllSelectionStr == "yes" || usePassAllSelectionStr == "Yes" ||
-       usePassAllSelectionStr == "YES")
-      par.UsePassAllSelection = true;
-   else
-      par.UsePassAllSelection = false;
-
-   std::string usePIDFiducialStr = CL.Get("UsePIDFiducial", std::string("true"));
-   if (usePIDFiducialStr == "1" || usePIDFiducialStr == "true" || usePIDFiducialStr == "True" ||
-       usePIDFiducialStr == "TRUE" || usePIDFiducialStr == "yes" || usePIDFiducialStr == "Yes" ||
-       usePIDFiducialStr == "YES")
-      par.UsePIDFiducial = true;
-   else
-      par.UsePIDFiducial = false;
+   // Generator-level flag: IsGen=true/false or 1/0 or yes/no, or "both" for reco and generator
+   // level from the same read of an MC sample (generator level goes to GenOutput)
+   const std::string isGenStr = CL.Get("IsGen", std::string(par.FillGenToo ? "both" : (par.IsGen ? "true" : "false")));
+   par.FillGenToo = (isGenStr == "both" || isGenStr == "Both" || isGenStr == "BOTH");
+   par.IsGen = IsTrueString(isGenStr);
+   par.GenOutput = CL.Get("GenOutput", par.GenOutput);
+   par.UseMCTruthMatrix = IsTrueString(CL.Get("UseMCTruthMatrix", std::string(par.UseMCTruthMatrix ? "true" : "false")));
+   par.UseCentralEtaNtag = IsTrueString(CL.Get("UseCentralEtaNtag", std::string(par.UseCentralEtaNtag ? "true" : "false")));
+   par.UsePassAllSelection = IsTrueString(CL.Get("UsePassAllSelection", std::string(par.UsePassAllSelection ? "true" : "false")));
+   par.UsePIDFiducial = IsTrueString(CL.Get("UsePIDFiducial", std::string(par.UsePIDFiducial ? "true" : "false")));
    par.PIDTrackAbsCosMin = CL.GetDouble("PIDTrackAbsCosMin", par.PIDTrackAbsCosMin);
    par.PIDTrackAbsCosMax = CL.GetDouble("PIDTrackAbsCosMax", par.PIDTrackAbsCosMax);
-   std::string pidTieMode = CL.Get("PIDTieMode", std::string("legacy"));
+   par.BootstrapReplicas = CL.GetInt("BootstrapReplicas", par.BootstrapReplicas);
+   par.BootstrapSeed = CL.GetInt("BootstrapSeed", par.BootstrapSeed);
+   par.PropagateMatrixErrors = IsTrueString(CL.Get("PropagateMatrixErrors", std::string(par.PropagateMatrixErrors ? "true" : "false")));
+   std::string pidTieMode = CL.Get("PIDTieMode", std::string(par.PIDTieMode == 1 ? "untag" : "legacy"));
    if (pidTieMode == "untag" || pidTieMode == "Untag" || pidTieMode == "UNTAG")
       par.PIDTieMode = 1;
    else
       par.PIDTieMode = 0;
-   std::string pidObservationMode = CL.Get("PIDObservationMode", std::string("exclusive"));
+   std::string pidObservationMode = CL.Get("PIDObservationMode",
+      std::string(par.UseInclusivePIDObservation ? "inclusive" : "exclusive"));
    std::string allowDuplicatePID = CL.Get("AllowDuplicatePIDCandidates", std::string(""));
    if (!allowDuplicatePID.empty())
    {
-      if (allowDuplicatePID == "1" || allowDuplicatePID == "true" || allowDuplicatePID == "True" ||
-          allowDuplicatePID == "TRUE" || allowDuplicatePID == "yes" || allowDuplicatePID == "Yes" ||
-          allowDuplicatePID == "YES")
-         par.UseInclusivePIDObservation = true;
-      else
-         par.UseInclusivePIDObservation = false;
+      par.UseInclusivePIDObservation = IsTrueString(allowDuplicatePID);
    }
    else if (pidObservationMode == "inclusive" || pidObservationMode == "Inclusive" ||
             pidObservationMode == "INCLUSIVE" || pidObservationMode == "duplicate" ||
@@ -2287,22 +2161,59 @@ int main(int argc, char *argv[])
    par.PtMax   = CL.GetDouble("PtMax",   par.PtMax);
    par.NtagPtMin = CL.GetDouble("NtagPtMin", par.NtagPtMin);
 
+   par.TimingSummary = CL.Get("TimingSummary", par.TimingSummary);
+   par.Summary = CL.Get("Summary", par.Summary);
+   par.Finalize = CL.Get("Finalize", par.Finalize);
    const std::string ptEdgesStr = CL.Get("PtBinEdges", std::string(""));
    if (!ptEdgesStr.empty())
    {
       par.PtBinEdges = ParseDoubleList(ptEdgesStr);
    }
 
-   cout << "Running KtoPiAnalysis with parameters:" << endl;
+   return par;
+}
+
+// Generator-level companion of a reco parameter set with FillGenToo: same cuts and binning,
+// IsGen = true, written to GenOutput (default: <output without .root>_Gen.root)
+static KtoPiParameters GenCompanion(KtoPiParameters &par)
+{
+   if (par.GenOutput.empty() || par.GenOutput == par.output)
+   {
+      std::string stem = par.output;
+      if (stem.size() > 5 && stem.substr(stem.size() - 5) == ".root")
+         stem = stem.substr(0, stem.size() - 5);
+      par.GenOutput = stem + "_Gen.root";
+   }
+
+   KtoPiParameters gen = par;
+   gen.IsGen = true;
+   gen.FillGenToo = false;
+   gen.UseMCTruthMatrix = false;
+   gen.output = par.GenOutput;
+   gen.GenOutput = "";
+   gen.variation = par.variation.empty() ? std::string("gen") : par.variation + "_gen";
+   return gen;
+}
+
+static void PrintParameters(const KtoPiParameters &par)
+{
+   if (!par.variation.empty())
+      cout << "  Variation   = " << par.variation << endl;
    cout << "  Input       = " << par.input      << endl;
    cout << "  Output      = " << par.output     << endl;
    cout << "  MaxNchTag   = " << par.MaxNchTag  << endl;
    cout << "  MaxEvents   = " << par.MaxEvents  << endl;
+   cout << "  Threads     = " << par.Threads    << endl;
+   if (par.Fraction != 1.0 || par.FirstEntry != 0 || par.NEntries >= 0 || par.Shard != "0/1")
+      cout << "  Entries     = Fraction " << par.Fraction << ", FirstEntry " << par.FirstEntry
+           << ", NEntries " << par.NEntries << ", Shard " << par.Shard << endl;
    cout << "  EcmRef      = " << par.EcmRef     << endl;
    cout << "  MinNch      = " << par.MinNch     << endl;
-   cout << "  MinThetaDeg = " << MinThetaDeg    << endl;
-   cout << "  MaxThetaDeg = " << MaxThetaDeg    << endl;
-   cout << "  IsGen       = " << (par.IsGen ? "true" : "false") << endl;
+   cout << "  MinThetaDeg = " << par.MinTheta * 180.0 / TMath::Pi() << endl;
+   cout << "  MaxThetaDeg = " << par.MaxTheta * 180.0 / TMath::Pi() << endl;
+   cout << "  IsGen       = " << (par.FillGenToo ? "both" : (par.IsGen ? "true" : "false")) << endl;
+   if (par.FillGenToo)
+      cout << "  GenOutput   = " << par.GenOutput << endl;
    cout << "  UseMCTruthMatrix = " << (par.UseMCTruthMatrix ? "true" : "false") << endl;
    cout << "  UsePassAllSelection = " << (par.UsePassAllSelection ? "true" : "false") << endl;
    cout << "  UseCentralEtaNtag = " << (par.UseCentralEtaNtag ? "true" : "false") << endl;
@@ -2311,7 +2222,16 @@ int main(int argc, char *argv[])
    cout << "  PIDTrackAbsCosMax = " << par.PIDTrackAbsCosMax << endl;
    cout << "  PIDObservationMode = " << (par.UseInclusivePIDObservation ? "inclusive" : "exclusive") << endl;
    cout << "  PIDTieMode = " << (par.PIDTieMode == 1 ? "untag" : "legacy") << endl;
+   cout << "  PropagateMatrixErrors = " << (par.PropagateMatrixErrors ? "true" : "false") << endl;
+   if (par.BootstrapReplicas > 0)
+      cout << "  BootstrapReplicas = " << par.BootstrapReplicas << " (seed " << par.BootstrapSeed << ")" << endl;
    cout << "  NtagPtMin   = " << par.NtagPtMin << endl;
+   if (!par.TimingSummary.empty())
+      cout << "  TimingSummary = " << par.TimingSummary << endl;
+   if (!par.Summary.empty())
+      cout << "  Summary     = " << par.Summary << endl;
+   if (!par.Finalize.empty())
+      cout << "  Finalize    = " << par.Finalize << endl;
 
    if (!par.PtBinEdges.empty())
    {
@@ -2329,11 +2249,177 @@ int main(int argc, char *argv[])
            << ", PtMin=" << par.PtMin
            << ", PtMax=" << par.PtMax << endl;
    }
+}
+
+// Variation list for --Variations: one parameter set per line,
+//    <name> [--Option value ...]
+// with the same options as the command line, applied on top of the command line ones.
+// Blank lines and lines starting with '#' are skipped.  Unless the line sets --Output, the
+// variation is written to <Output>/<name>.root, with --Output naming a directory; with --IsGen
+// both its generator level goes to <Output>/<name>_Gen.root unless the line sets --GenOutput.
+static bool ReadVariations(const std::string &fileName, const KtoPiParameters &base,
+                           std::vector<KtoPiParameters> &variations)
+{
+   std::ifstream in(fileName.c_str());
+   if (!in.is_open())
+   {
+      cerr << "Error: cannot open variation list '" << fileName << "'" << endl;
+      return false;
+   }
+
+   std::string line;
+   while (std::getline(in, line))
+   {
+      std::stringstream ss(line);
+      std::vector<std::string> tokens;
+      std::string token;
+      while (ss >> token)
+         tokens.push_back(token);
+      if (tokens.empty() || tokens[0][0] == '#')
+         continue;
+
+      // CommandLine expects argv, with the program name first
+      std::vector<char *> args;
+      for (std::string &t : tokens)
+         args.push_back(&t[0]);
+      CommandLine VCL(static_cast<int>(args.size()), args.data());
+
+      KtoPiParameters v = ParseParameters(VCL, base);
+      v.variation = tokens[0];
+      v.input     = base.input;
+      v.MaxEvents = base.MaxEvents;
+      v.Fraction  = base.Fraction;
+      v.FirstEntry = base.FirstEntry;
+      v.NEntries  = base.NEntries;
+      v.Shard     = base.Shard;
+      v.Threads   = base.Threads;
+      if (v.output == base.output)
+         v.output = base.output + "/" + v.variation + ".root";
+      // A --GenOutput of the base would be shared by every variation; derive it from v.output
+      if (v.GenOutput == base.GenOutput)
+         v.GenOutput = "";
+
+      for (const KtoPiParameters &other : variations)
+      {
+         if (other.variation == v.variation || other.output == v.output)
+         {
+            cerr << "Error: variation '" << v.variation << "' repeats a name or an output file" << endl;
+            return false;
+         }
+      }
+      variations.push_back(v);
+   }
 
-   KtoPiAnalyzer analyzer(par);
-   analyzer.analyze();
+   if (variations.empty())
+   {
+      cerr << "Error: no variations in '" << fileName << "'" << endl;
+      return false;
+   }
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   // if (printHelpMessage(argc, argv))
+   //    return 0;
+
+   CommandLine CL(argc, argv);
+   KtoPiParameters par = ParseParameters(CL, KtoPiParameters());
+
+   long long count = 0;
+   for (const char *option : {"FirstEntry", "NEntries"})
+   {
+      const std::string text = CL.Get(option, "0");
+      if (!EntryRange::ParseCount(text, count))
+      {
+         cerr << "Error: cannot parse --" << option << " \"" << text << "\", expected a number" << endl;
+         return 1;
+      }
+   }
+
+   int shard = 0, shardCount = 1;
+   if (!EntryRange::ParseShard(par.Shard, shard, shardCount))
+   {
+      cerr << "Error: cannot parse --Shard \"" << par.Shard << "\", expected i/N with 0 <= i < N" << endl;
+      return 1;
+   }
+
+   // Multi-variation mode: all parameter sets are filled in one pass over the input
+   std::vector<KtoPiParameters> variations;
+   std::string outputDirectory;
+   const std::string variationFile = CL.Get("Variations", std::string(""));
+   if (!variationFile.empty())
+   {
+      if (!ReadVariations(variationFile, par, variations))
+         return 1;
+      gSystem->mkdir(par.output.c_str(), true);
+      outputDirectory = par.output;
+   }
+   else
+      variations.push_back(par);
+
+   // --IsGen both: the generator-level spectra are one more parameter set in the same pass
+   std::vector<KtoPiParameters> sets;
+   for (KtoPiParameters &v : variations)
+   {
+      sets.push_back(v);
+      if (v.FillGenToo)
+         sets.push_back(GenCompanion(sets.back()));
+   }
+
+   // Every set, generator-level companions included, needs its own output file
+   for (size_t i = 0; i < sets.size(); ++i)
+   {
+      for (size_t j = 0; j < i; ++j)
+      {
+         if (sets[i].output == sets[j].output)
+         {
+            cerr << "Error: parameter sets '" << sets[j].variation << "' and '" << sets[i].variation
+                 << "' both write " << sets[i].output << endl;
+            return 1;
+         }
+      }
+   }
+
+   cout << "Running KtoPiAnalysis with parameters:" << endl;
+   for (size_t i = 0; i < sets.size(); ++i)
+      PrintParameters(sets[i]);
+
+   // Corrected results from merged reco-mode shards; one parameter set, no event loop
+   if (!par.Finalize.empty())
+   {
+      if (sets.size() > 1 || par.IsGen || par.Shard != "0/1" || par.FirstEntry > 0 || par.NEntries >= 0)
+      {
+         cerr << "Error: --Finalize takes one reco-mode parameter set and no entry range" << endl;
+         return 1;
+      }
+      KtoPiAnalyzer finalizer(par);
+      if (!finalizer.finalizeShards())
+         return 1;
+      finalizer.writeHistograms();
+      cout << "Done. Output written to " << par.output << endl;
+      return 0;
+   }
+
+   KtoPiAnalyzer analyzer(sets[0]);
+   for (size_t i = 1; i < sets.size(); ++i)
+   {
+      if (!analyzer.addVariation(sets[i]))
+         return 1;
+   }
+   if (!analyzer.analyze())
+      return 1;
+   analyzer.writeTimingSummary();
    analyzer.writeHistograms();
 
-   cout << "Done. Output written to " << par.output << endl;
+   if (outputDirectory.empty())
+   {
+      cout << "Done. Output written to " << sets[0].output;
+      if (sets.size() > 1)
+         cout << " and " << sets[1].output;
+      cout << endl;
+   }
+   else
+      cout << "Done. " << sets.size() << " parameter sets written to " << outputDirectory << endl;
    return 0;
 }
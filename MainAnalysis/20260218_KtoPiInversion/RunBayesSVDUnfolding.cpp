@@ -0,0 +1,700 @@
+//============================================================
+// RunBayesSVDUnfolding.cpp
+//
+// Unfolds the PID-corrected K, pi and p yields vs dN_ch/deta or
+// dN_ch/dy to the true activity (iterative Bayes and SVD) and
+// builds the K/pi and p/pi ratios, closures and data / MC double
+// ratios.  One invocation does MC and data, the flat-prior and
+// iteration variations, the refolding and the stress test for
+// all species; the algorithms live in include/UnfoldingEngine.h.
+// Bayes, SVD and their ratios carry the propagated covariance
+// (written as h<ratio>Cov), not sqrt(N) or diagonal errors.  The
+// numerator and the pions are correlated through the species
+// covariance of the corrected yields (hCov<pair>Corrected, one 3x3
+// inversion per bin) and, for Bayes, through the weighted responses
+// filled from the same events (h<Axis>Response<pair>); the Bayes
+// data / MC double ratio takes the response term common to data and
+// MC into account.  The MC reco spectra are treated as independent
+// of the responses.
+//
+// Replaces runDNdEtaUnfolding_BayesSVD.C, runDNdYUnfolding_BayesSVD.C
+// and runDNdEtaUnfolding_PoverPi_BayesSVD.C with the same output
+// histograms.  Build and run with run_bayes_svd_unfolding.sh:
+//
+//   ./run_bayes_svd_unfolding.sh --Axis DNdY --NIter 1 --KReg 8
+//      --MC output/KtoPi-MC-Reco-Nominal.root
+//      --Data output/KtoPi-Data-Reco-Nominal.root
+//      --Output output/DNdYUnfolding_BayesSVD.root --MakePlots false
+//
+// Bayes runs once per spectrum and every iteration is written
+// (h<species><sample>BayesIter<k>, convergence in h<species><sample>
+// BayesChi2 / BayesRelChange).  Chi2PerBin or RelativeChange > 0 pick
+// the nominal as the first iteration >= NIter passing them (at most
+// NIterMax) with the next one as the iteration variation.
+//
+// PtoPiOutput=none skips the proton (inputs without p response).
+// KRegScan=2,3,...  additionally writes the K/pi output for each
+// kReg to <KRegScanOutput><kReg>.root, re-solving only the SVD from
+// one decomposition per species.
+//============================================================
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ROOT
+#include "TCanvas.h"
+#include "TColor.h"
+#include "TFile.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TLegend.h"
+#include "TLine.h"
+#include "TMatrixD.h"
+#include "TParameter.h"
+#include "TStyle.h"
+
+// Project common code
+#include "CommandLine.h"
+
+// Analysis-local helpers
+#include "UnfoldingEngine.h"
+
+using namespace UnfoldingEngine;
+
+// Histogram names and axis titles of one activity axis (see BuildActivityEstimators in
+// KtoPiAnalysis.cpp)
+struct UnfoldingAxis
+{
+   std::string Name;            // hKCorrected<Name>, h<Name>Response<species>, h<Name>Reco
+   std::string TrueYieldName;   // h<species>True<TrueYieldName>
+   std::string Suffix;          // of every output histogram
+   std::string Label;           // for printouts and canvas titles
+   std::string TrueTitle;
+   std::string RecoTitle;
+   std::string MissingHint;
+};
+
+static bool GetAxis(const std::string &name, UnfoldingAxis &axis)
+{
+   if (name == "DNdEta")
+   {
+      axis = {"DNdEta", "dNdEta", "_dNdEta", "dN/deta",
+              "dN_{ch}/d#eta (|#eta|<0.5)", "dN_{ch}^{reco}/d#eta (|#eta|<0.5)",
+              "adding dN/deta response"};
+      return true;
+   }
+   if (name == "DNdY")
+   {
+      axis = {"DNdY", "dNdY", "_dNdY", "dN/dy",
+              "dN_{ch}/dy (|y_{T}|<0.5)", "dN_{ch}^{reco}/dy (|y_{T}|<0.5)",
+              "adding thrust-axis dN/dy histograms"};
+      return true;
+   }
+   return false;
+}
+
+// Species of the batch: name, latex title, slope of the stress-test truth
+enum {SpeciesK, SpeciesPi, SpeciesP, SpeciesCount};
+static const char *SpeciesName[SpeciesCount] = {"K", "Pi", "P"};
+static const char *SpeciesTitle[SpeciesCount] = {"K", "#pi", "p"};
+static const double StressSlope[SpeciesCount] = {+0.18, -0.12, +0.18};
+// Covariance pair with the pions in the KtoPi output (hCov<pair>Corrected, h<Axis>Response<pair>)
+static const char *PairName[SpeciesCount] = {"KPi", "", "PPi"};
+
+static bool IsTrueString(const std::string &value)
+{
+   return (value == "1" || value == "true" || value == "True" || value == "TRUE" ||
+           value == "yes" || value == "Yes" || value == "YES");
+}
+
+static TH1D *GetRecoHist(TFile *f, const std::string &preferred, const std::string &fallback)
+{
+   TH1D *h = dynamic_cast<TH1D *>(f->Get(preferred.c_str()));
+   if (h != nullptr)
+      return h;
+   return dynamic_cast<TH1D *>(f->Get(fallback.c_str()));
+}
+
+static void SetReadableAxisStyle(TH1 *h)
+{
+   h->GetXaxis()->SetTitleSize(0.060);
+   h->GetYaxis()->SetTitleSize(0.060);
+   h->GetXaxis()->SetLabelSize(0.048);
+   h->GetYaxis()->SetLabelSize(0.048);
+   h->GetXaxis()->SetTitleOffset(1.00);
+   h->GetYaxis()->SetTitleOffset(1.00);
+}
+
+static void SetMatrixStyle(TH2 *h)
+{
+   h->GetXaxis()->SetTitleSize(0.055);
+   h->GetYaxis()->SetTitleSize(0.055);
+   h->GetZaxis()->SetTitleSize(0.050);
+   h->GetXaxis()->SetLabelSize(0.045);
+   h->GetYaxis()->SetLabelSize(0.045);
+   h->GetZaxis()->SetLabelSize(0.040);
+   h->GetXaxis()->SetTitleOffset(1.05);
+   h->GetYaxis()->SetTitleOffset(1.22);
+   h->GetZaxis()->SetTitleOffset(1.08);
+}
+
+static void StyleLegend(TLegend &leg)
+{
+   leg.SetBorderSize(0);
+   leg.SetFillColor(kWhite);
+   leg.SetFillStyle(1001);
+   leg.SetLineColor(kWhite);
+}
+
+static void SaveCanvas(TCanvas &c, const std::string &stem)
+{
+   c.SaveAs((stem + ".pdf").c_str());
+   c.SaveAs((stem + ".png").c_str());
+}
+
+// Bayes vs SVD around 1
+static void DrawBayesVsSVD(const std::string &canvasName, const std::string &canvasTitle,
+                           TH1D *hBayes, TH1D *hSVD, const std::string &stem)
+{
+   TCanvas c(canvasName.c_str(), canvasTitle.c_str(), 860, 620);
+   hBayes->SetMarkerStyle(20);
+   hBayes->SetMarkerColor(kBlue + 1);
+   hBayes->SetLineColor(kBlue + 1);
+   hSVD->SetMarkerStyle(21);
+   hSVD->SetMarkerColor(kGreen + 2);
+   hSVD->SetLineColor(kGreen + 2);
+   hBayes->SetMarkerSize(1.15);
+   hSVD->SetMarkerSize(1.15);
+   hBayes->SetLineWidth(2);
+   hSVD->SetLineWidth(2);
+   SetReadableAxisStyle(hBayes);
+   hBayes->SetMinimum(0.6);
+   hBayes->SetMaximum(1.4);
+   hBayes->Draw("E1");
+   TLine line(hBayes->GetXaxis()->GetXmin(), 1.0, hBayes->GetXaxis()->GetXmax(), 1.0);
+   line.SetLineStyle(2);
+   line.SetLineWidth(2);
+   line.Draw("SAME");
+   hBayes->Draw("E1 SAME");
+   hSVD->Draw("E1 SAME");
+   TLegend leg(0.58, 0.74, 0.89, 0.89);
+   StyleLegend(leg);
+   leg.AddEntry(hBayes, "Bayes", "lep");
+   leg.AddEntry(hSVD, "SVD", "lep");
+   leg.Draw();
+   SaveCanvas(c, stem);
+}
+
+// Convergence measures of a Bayes trajectory vs the iteration number
+static void WriteConvergence(const BayesTrajectory &trajectory, const std::string &stem, const std::string &suffix)
+{
+   const int n = trajectory.NIterations();
+   if (n == 0)
+      return;
+   TH1D hChi2((stem + "Chi2" + suffix).c_str(), ";Iteration;#chi^{2}/bin w.r.t. previous iteration", n, 0.5, n + 0.5);
+   TH1D hChange((stem + "RelChange" + suffix).c_str(), ";Iteration;#Sigma|#Deltau|/#Sigmau w.r.t. previous iteration",
+                n, 0.5, n + 0.5);
+   for (int k = 1; k <= n; ++k)
+   {
+      hChi2.SetBinContent(k, trajectory.Chi2PerBin[k - 1]);
+      hChange.SetBinContent(k, trajectory.RelativeChange[k - 1]);
+   }
+   hChi2.Write();
+   hChange.Write();
+}
+
+// Inputs the numerator species shares with the pions: the species covariance of the corrected
+// reco yields per reco bin and sample, and the cross term of the two weighted responses per cell
+// ([t * nReco + r]).  Empty for inputs without them: the two are then taken as independent.
+struct PionCorrelation
+{
+   std::vector<double> RecoCovariance[SampleCount];
+   std::vector<double> ResponseCross;
+};
+
+struct RatioOutput
+{
+   std::string Path;
+   std::string PlotPrefix;   // "" for K/pi, "PtoPi_" for p/pi
+   int Numerator;
+};
+
+// Ratios of one numerator species over pions with everything derived from them, written with
+// the per-species inputs and unfoldings to out.Path
+static void WriteRatioOutput(const RatioOutput &out, const UnfoldingAxis &axis, bool makePlots,
+                             TH2D *hResp, TH2D *hRespNorm,
+                             const std::vector<SpeciesInput> &inputs, const std::vector<SpeciesResult> &results,
+                             const PionCorrelation &correlation, int keepBinsAuto, int keepBins)
+{
+   const SpeciesInput &numIn = inputs[out.Numerator];
+   const SpeciesInput &piIn = inputs[SpeciesPi];
+   const SpeciesResult &num = results[out.Numerator];
+   const SpeciesResult &pi = results[SpeciesPi];
+   const std::string &suffix = axis.Suffix;
+   const std::string ratio = numIn.Title + "/#pi";
+   const std::string trueAxes = ";" + axis.TrueTitle + ";";
+   const std::string recoAxes = ";" + axis.RecoTitle + ";";
+   auto Ratio = [&](const TH1D *a, const TH1D *b, const std::string &name, const std::string &title)
+   {
+      return BuildRatio(a, b, (name + suffix).c_str(), title.c_str());
+   };
+   auto CovarianceRatio = [&](const TH1D *a, const TMatrixD &aCov, const TH1D *b, const TMatrixD &bCov,
+                              const TMatrixD &abCov, const std::string &name, const std::string &title, TMatrixD &cov)
+   {
+      return BuildRatio(a, b, (name + suffix).c_str(), title.c_str(), &aCov, &bCov, &cov, &abCov);
+   };
+
+   // Covariance of the numerator and pion unfoldings of one sample from the shared inputs
+   const int nTrue = numIn.Prior->GetNbinsX();
+   const std::vector<double> none;
+   auto SpeciesCross = [&](int s, const std::vector<double> &jNum, const std::vector<double> &jPi,
+                           const std::vector<double> &jRespNum, const std::vector<double> &jRespPi)
+   {
+      TMatrixD cross = CrossCovariance(jNum, jPi, correlation.RecoCovariance[s], nTrue, nTrue);
+      cross += CrossCovariance(jRespNum, jRespPi, correlation.ResponseCross, nTrue, nTrue);
+      return cross;
+   };
+   auto Difference = [&](const TH1D *a, const TH1D *b, const std::string &name, const std::string &title)
+   {
+      TH1D *h = (TH1D *)a->Clone((name + suffix).c_str());
+      h->SetDirectory(nullptr);
+      h->Add(b, -1.0);
+      h->SetTitle((title + trueAxes + "#Delta double ratio").c_str());
+      return h;
+   };
+
+   TH1D *hRatioTrue = Ratio(numIn.Prior, piIn.Prior, "hRatioMcTrue", "MC truth " + ratio + trueAxes + ratio);
+   TH1D *hRatioReco[SampleCount], *hRatioBayes[SampleCount], *hRatioSVD[SampleCount];
+   TH1D *hRatioPriorVar[SampleCount], *hRatioIterVar[SampleCount], *hRatioRefold[SampleCount];
+   TH1D *hRefoldClosure[SampleCount];
+   TMatrixD ratioBayesCov[SampleCount], ratioSVDCov[SampleCount];
+   for (int s = 0; s < SampleCount; ++s)
+   {
+      const std::string sample = SampleName[s];
+      const std::string title = SampleTitle[s];
+      hRatioReco[s] = Ratio(numIn.Reco[s], piIn.Reco[s], "hRatio" + sample + "Reco",
+                            title + " reco " + ratio + recoAxes + ratio);
+      const TMatrixD bayesCross = SpeciesCross(s, num.BayesMeasJacobian[s], pi.BayesMeasJacobian[s],
+                                               num.BayesResponseJacobian[s], pi.BayesResponseJacobian[s]);
+      const TMatrixD svdCross = SpeciesCross(s, num.SVDMeasJacobian[s], pi.SVDMeasJacobian[s], none, none);
+      hRatioBayes[s] = CovarianceRatio(num.Bayes[s], num.BayesCovariance[s], pi.Bayes[s], pi.BayesCovariance[s],
+                                       bayesCross, "hRatio" + sample + "Bayes",
+                                       title + " " + ratio + " Bayes" + trueAxes + ratio, ratioBayesCov[s]);
+      hRatioSVD[s] = CovarianceRatio(num.SVD[s], num.SVDCovariance[s], pi.SVD[s], pi.SVDCovariance[s],
+                                     svdCross, "hRatio" + sample + "SVD",
+                                     title + " " + ratio + " SVD" + trueAxes + ratio, ratioSVDCov[s]);
+      hRatioPriorVar[s] = Ratio(num.BayesPriorVar[s], pi.BayesPriorVar[s], "hRatio" + sample + "BayesPriorVar",
+                                title + " " + ratio + " Bayes prior-var");
+      hRatioIterVar[s] = Ratio(num.BayesIterVar[s], pi.BayesIterVar[s], "hRatio" + sample + "BayesIterVar",
+                               title + " " + ratio + " Bayes iter-var");
+      hRatioRefold[s] = Ratio(num.BayesRefold[s], pi.BayesRefold[s], "hRatio" + sample + "BayesRefold",
+                              title + " " + ratio + " refolded");
+      hRefoldClosure[s] = Ratio(hRatioRefold[s], hRatioReco[s], "hRefoldRecoClosure" + sample,
+                                recoAxes + "Refolded / reco");
+   }
+
+   TH1D *hRatioStressTruth = Ratio(num.StressTruth, pi.StressTruth, "hRatioStressTruth", "Injected truth " + ratio);
+   TH1D *hRatioStressReco = Ratio(num.StressReco, pi.StressReco, "hRatioStressReco", "Injected reco " + ratio);
+   TH1D *hRatioStressUnfold = Ratio(num.StressUnfold, pi.StressUnfold, "hRatioStressUnfold", "Injected unfolded " + ratio);
+   TH1D *hStressClosure = Ratio(hRatioStressUnfold, hRatioStressTruth, "hStressClosure", trueAxes + "Unfolded / injected");
+
+   TH1D *hClosureBayes = Ratio(hRatioBayes[Mc], hRatioTrue, "hClosureBayes", "Bayes closure" + trueAxes + "Unfolded / MC truth");
+   TH1D *hClosureSVD = Ratio(hRatioSVD[Mc], hRatioTrue, "hClosureSVD", "SVD closure" + trueAxes + "Unfolded / MC truth");
+
+   // Data and MC are unfolded with the same responses, so the response term of the two Bayes
+   // ratios is correlated: ratio Jacobians w.r.t. the numerator and pion response cells, combined
+   // with the cell variances and the cross term of the two responses.  SVD carries no response
+   // term, so its data and MC ratios stay independent.
+   std::vector<double> numRespVar = ResponseErrors(numIn.Response), piRespVar = ResponseErrors(piIn.Response);
+   for (double &e : numRespVar)
+      e = e * e;
+   for (double &e : piRespVar)
+      e = e * e;
+   std::vector<double> jRatioNum[SampleCount], jRatioPi[SampleCount];
+   for (int s = 0; s < SampleCount; ++s)
+   {
+      std::vector<double> dNum, dDen;
+      RatioDerivatives(num.Bayes[s], pi.Bayes[s], dNum, dDen);
+      jRatioNum[s] = ScaleRows(num.BayesResponseJacobian[s], dNum);
+      jRatioPi[s] = ScaleRows(pi.BayesResponseJacobian[s], dDen);
+   }
+   TMatrixD sharedResponse = CrossCovariance(jRatioNum[Data], jRatioNum[Mc], numRespVar, nTrue, nTrue);
+   sharedResponse += CrossCovariance(jRatioPi[Data], jRatioPi[Mc], piRespVar, nTrue, nTrue);
+   sharedResponse += CrossCovariance(jRatioNum[Data], jRatioPi[Mc], correlation.ResponseCross, nTrue, nTrue);
+   sharedResponse += CrossCovariance(jRatioPi[Data], jRatioNum[Mc], correlation.ResponseCross, nTrue, nTrue);
+   const TMatrixD independent(nTrue, nTrue);
+
+   const std::string doubleTitle = "(" + ratio + ")_{Data}/(" + ratio + ")_{MC}" + trueAxes + "Double ratio";
+   TMatrixD dataOverMcBayesCov, dataOverMcSVDCov;
+   TH1D *hDataOverMcBayes = CovarianceRatio(hRatioBayes[Data], ratioBayesCov[Data], hRatioBayes[Mc], ratioBayesCov[Mc],
+                                            sharedResponse, "hDataOverMcBayes", doubleTitle, dataOverMcBayesCov);
+   TH1D *hDataOverMcSVD = CovarianceRatio(hRatioSVD[Data], ratioSVDCov[Data], hRatioSVD[Mc], ratioSVDCov[Mc],
+                                          independent, "hDataOverMcSVD", doubleTitle, dataOverMcSVDCov);
+   TH1D *hDataOverMcPriorVar = Ratio(hRatioPriorVar[Data], hRatioPriorVar[Mc], "hDataOverMcBayesPriorVar", doubleTitle);
+   TH1D *hDataOverMcIterVar = Ratio(hRatioIterVar[Data], hRatioIterVar[Mc], "hDataOverMcBayesIterVar", doubleTitle);
+
+   // Double ratio after every iteration both spectra have
+   std::vector<TH1D *> hDataOverMcIter;
+   const int nIterCommon = std::min(std::min(num.BayesIterations[Mc].size(), num.BayesIterations[Data].size()),
+                                    std::min(pi.BayesIterations[Mc].size(), pi.BayesIterations[Data].size()));
+   for (int k = 1; k <= nIterCommon; ++k)
+   {
+      const std::string iter = "Iter" + std::to_string(k);
+      TH1D *hMc = BuildRatio(num.BayesIterations[Mc][k - 1], pi.BayesIterations[Mc][k - 1], "hRatioMcIter", "");
+      TH1D *hData = BuildRatio(num.BayesIterations[Data][k - 1], pi.BayesIterations[Data][k - 1], "hRatioDataIter", "");
+      hDataOverMcIter.push_back(Ratio(hData, hMc, "hDataOverMcBayes" + iter,
+                                      doubleTitle + " (" + std::to_string(k) + " iterations)"));
+      delete hMc;
+      delete hData;
+   }
+
+   TH1D *hMethodDiff = Difference(hDataOverMcBayes, hDataOverMcSVD, "hMethodDiff_BayesMinusSVD",
+                                  "Unfolding method difference (Bayes-SVD)");
+   TH1D *hPriorDiff = Difference(hDataOverMcPriorVar, hDataOverMcBayes, "hBayesPriorVariationDiff",
+                                 "Bayes prior variation (flat prior - nominal)");
+   TH1D *hIterDiff = Difference(hDataOverMcIterVar, hDataOverMcBayes, "hBayesIterVariationDiff",
+                                "Bayes iteration variation (nIter var - nominal)");
+
+   if (makePlots)
+   {
+      const std::string stem = out.PlotPrefix + axis.Name + "Unfolding_";
+
+      TCanvas cResp(("c" + axis.Name + "Resp").c_str(), (axis.Label + " response").c_str(), 780, 680);
+      cResp.SetLeftMargin(0.14);
+      cResp.SetRightMargin(0.18);
+      cResp.SetBottomMargin(0.14);
+      cResp.SetTopMargin(0.08);
+      SetMatrixStyle(hRespNorm);
+      hRespNorm->Draw("COLZ");
+      SaveCanvas(cResp, stem + "ResponseMatrix");
+
+      DrawBayesVsSVD("c" + axis.Name + "Closure", axis.Label + " closure",
+                     hClosureBayes, hClosureSVD, stem + "MCClosure_BayesVsSVD");
+      DrawBayesVsSVD("c" + axis.Name + "DataMC", axis.Label + " data/mc",
+                     hDataOverMcBayes, hDataOverMcSVD, stem + "DataMC_BayesVsSVD");
+
+      TCanvas cM(("c" + axis.Name + "MethodDiff").c_str(), "method diff", 860, 620);
+      hMethodDiff->SetMarkerStyle(20);
+      hMethodDiff->SetMarkerSize(1.15);
+      hMethodDiff->SetLineWidth(2);
+      SetReadableAxisStyle(hMethodDiff);
+      hMethodDiff->Draw("E1");
+      TLine l0(hMethodDiff->GetXaxis()->GetXmin(), 0.0, hMethodDiff->GetXaxis()->GetXmax(), 0.0);
+      l0.SetLineStyle(2);
+      l0.SetLineWidth(2);
+      l0.Draw("SAME");
+      SaveCanvas(cM, stem + "MethodDifference");
+   }
+
+   TFile *fout = TFile::Open(out.Path.c_str(), "RECREATE");
+   if (fout == nullptr || fout->IsZombie())
+   {
+      std::cerr << "Cannot open output file " << out.Path << std::endl;
+      return;
+   }
+
+   hRespNorm->Write();
+   hResp->Write();
+   for (int species : {out.Numerator, (int)SpeciesPi})
+   {
+      inputs[species].Response->Write();
+      inputs[species].Prior->Write();
+   }
+   for (int species : {out.Numerator, (int)SpeciesPi})
+      for (int s = 0; s < SampleCount; ++s)
+         inputs[species].Reco[s]->Write((std::string("h") + SpeciesName[species] + SampleName[s] + "Reco").c_str());
+
+   for (int species : {out.Numerator, (int)SpeciesPi})
+   {
+      const SpeciesResult &r = results[species];
+      for (int s = 0; s < SampleCount; ++s)
+      {
+         r.Bayes[s]->Write();
+         r.SVD[s]->Write();
+         r.BayesPriorVar[s]->Write();
+         r.BayesIterVar[s]->Write();
+         r.BayesRefold[s]->Write();
+         for (TH1D *hIter : r.BayesIterations[s])
+            hIter->Write();
+         WriteConvergence(r.Trajectory[s], "h" + inputs[species].Name + SampleName[s] + "Bayes", suffix);
+         TParameter<int> pNIter(("nIterUsed" + inputs[species].Name + SampleName[s] + suffix).c_str(), r.NIterUsed[s]);
+         TParameter<int> pNIterVar(("nIterVarUsed" + inputs[species].Name + SampleName[s] + suffix).c_str(),
+                                   r.NIterVarUsed[s]);
+         pNIter.Write();
+         pNIterVar.Write();
+      }
+      r.StressTruth->Write();
+      r.StressReco->Write();
+      r.StressUnfold->Write();
+   }
+
+   hRatioTrue->Write();
+   for (int s = 0; s < SampleCount; ++s)
+   {
+      hRatioReco[s]->Write();
+      hRatioBayes[s]->Write();
+      hRatioSVD[s]->Write();
+      hRatioPriorVar[s]->Write();
+      hRatioIterVar[s]->Write();
+      hRatioRefold[s]->Write();
+   }
+   for (int s = 0; s < SampleCount; ++s)
+      hRefoldClosure[s]->Write();
+   hRatioStressTruth->Write();
+   hRatioStressReco->Write();
+   hRatioStressUnfold->Write();
+   hStressClosure->Write();
+
+   hClosureBayes->Write();
+   hClosureSVD->Write();
+   hDataOverMcBayes->Write();
+   hDataOverMcSVD->Write();
+   hDataOverMcPriorVar->Write();
+   hDataOverMcIterVar->Write();
+   for (TH1D *hIter : hDataOverMcIter)
+      hIter->Write();
+   hMethodDiff->Write();
+   hPriorDiff->Write();
+   hIterDiff->Write();
+
+   // Covariance matrices of the unfolded ratios
+   auto WriteCovariance = [&](const TMatrixD &cov, const TH1D *h, const std::string &title)
+   {
+      TH2D *hCov = CovarianceHist(cov, h, (std::string(h->GetName()) + "Cov").c_str(),
+                                  ("Covariance of " + title + ";" + axis.TrueTitle + ";" + axis.TrueTitle).c_str());
+      hCov->Write();
+      delete hCov;
+   };
+   for (int s = 0; s < SampleCount; ++s)
+   {
+      WriteCovariance(ratioBayesCov[s], hRatioBayes[s], std::string(SampleTitle[s]) + " " + ratio + " Bayes");
+      WriteCovariance(ratioSVDCov[s], hRatioSVD[s], std::string(SampleTitle[s]) + " " + ratio + " SVD");
+   }
+   WriteCovariance(dataOverMcBayesCov, hDataOverMcBayes, "Bayes double ratio");
+   WriteCovariance(dataOverMcSVDCov, hDataOverMcSVD, "SVD double ratio");
+
+   TParameter<int> pKeepBinsAuto(("keepBinsAuto" + suffix).c_str(), keepBinsAuto);
+   TParameter<int> pKeepBinsUsed(("keepBinsUsed" + suffix).c_str(), keepBins);
+   pKeepBinsAuto.Write();
+   pKeepBinsUsed.Write();
+   fout->Close();
+
+   printf("Saved %s unfolding output to %s\n", axis.Label.c_str(), out.Path.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+   CommandLine CL(argc, argv);
+
+   UnfoldingAxis axis;
+   const std::string axisName = CL.Get("Axis", "DNdEta");
+   if (GetAxis(axisName, axis) == false)
+   {
+      std::cerr << "Unknown Axis " << axisName << " (DNdEta or DNdY)" << std::endl;
+      return 1;
+   }
+
+   const std::string mcPath = CL.Get("MC", "output/KtoPi-MC-Reco-Nominal.root");
+   const std::string dataPath = CL.Get("Data", "output/KtoPi-Data-Reco-Nominal.root");
+   const std::string responsePath = CL.Get("Response", "");
+   const std::string output = CL.Get("Output", "output/" + axis.Name + "Unfolding_BayesSVD.root");
+   const std::string ptoPiOutput = CL.Get("PtoPiOutput", "output/PtoPi_" + axis.Name + "Unfolding_BayesSVD.root");
+   const bool doProton = !(ptoPiOutput.empty() || ptoPiOutput == "none");
+   const bool makePlots = IsTrueString(CL.Get("MakePlots", "true"));
+   const int keepBinsOverride = CL.GetInt("KeepBins", -1);
+   const std::vector<int> kRegScan = CL.GetIntVector("KRegScan", std::vector<int>());
+   const std::string kRegScanOutput = CL.Get("KRegScanOutput", "output/" + axis.Name + "Unfolding_BayesSVD_kReg");
+
+   Settings settings;
+   settings.NIter = CL.GetInt("NIter", 1);
+   settings.NIterVar = CL.GetInt("NIterVar", std::max(2, settings.NIter + 1));
+   settings.NIterMax = CL.GetInt("NIterMax", 20);
+   settings.Stopping.MinIter = settings.NIter;
+   settings.Stopping.Chi2PerBin = CL.GetDouble("Chi2PerBin", 0.0);
+   settings.Stopping.RelativeChange = CL.GetDouble("RelativeChange", 0.0);
+   settings.KReg = CL.GetInt("KReg", 8);
+   settings.Suffix = axis.Suffix;
+
+   gStyle->SetOptStat(0);
+   gStyle->SetPalette(kViridis);
+
+   TFile *fMC = TFile::Open(mcPath.c_str(), "READ");
+   TFile *fData = TFile::Open(dataPath.c_str(), "READ");
+   if (fMC == nullptr || fMC->IsZombie() || fData == nullptr || fData->IsZombie())
+   {
+      std::cerr << "Cannot open input files " << mcPath << ", " << dataPath << std::endl;
+      return 1;
+   }
+
+   TFile *fResp = fMC;
+   if (!responsePath.empty())
+   {
+      fResp = TFile::Open(responsePath.c_str(), "READ");
+      if (fResp == nullptr || fResp->IsZombie())
+      {
+         std::cerr << "Cannot open response file " << responsePath << std::endl;
+         return 1;
+      }
+   }
+
+   const int nSpecies = doProton ? SpeciesCount : SpeciesP;
+   TH2D *hRespFineIn = dynamic_cast<TH2D *>(fResp->Get(("h" + axis.Name + "Response").c_str()));
+   TH1D *hRecoCountsFine = dynamic_cast<TH1D *>(fMC->Get(("h" + axis.Name + "Reco").c_str()));
+   std::vector<TH2D *> hSpeciesRespIn(nSpecies, nullptr);
+   std::vector<TH1D *> hPriorIn(nSpecies, nullptr);
+   std::vector<std::vector<TH1D *>> hRecoIn(nSpecies, std::vector<TH1D *>(SampleCount, nullptr));
+   bool missing = (hRespFineIn == nullptr || hRecoCountsFine == nullptr);
+   for (int species = 0; species < nSpecies; ++species)
+   {
+      const std::string name = SpeciesName[species];
+      hSpeciesRespIn[species] = dynamic_cast<TH2D *>(fResp->Get(("h" + axis.Name + "Response" + name).c_str()));
+      hPriorIn[species] = dynamic_cast<TH1D *>(fResp->Get(("h" + name + "True" + axis.TrueYieldName).c_str()));
+      hRecoIn[species][Mc] = GetRecoHist(fMC, "h" + name + "Corrected" + axis.Name, "h" + name + "Corrected");
+      hRecoIn[species][Data] = GetRecoHist(fData, "h" + name + "Corrected" + axis.Name, "h" + name + "Corrected");
+      missing = missing || hSpeciesRespIn[species] == nullptr || hPriorIn[species] == nullptr ||
+                hRecoIn[species][Mc] == nullptr || hRecoIn[species][Data] == nullptr;
+   }
+   if (missing)
+   {
+      std::cerr << "Missing required histograms (did you rerun ExecuteKtoPiAnalysis after "
+                << axis.MissingHint << "?)" << std::endl;
+      return 1;
+   }
+
+   const int keepBinsAuto = DetermineOverflowKeepBins(hRecoCountsFine, 100.0);
+   const int keepBins = (keepBinsOverride > 0)
+      ? std::max(1, std::min(keepBinsOverride, hRecoCountsFine->GetNbinsX()))
+      : keepBinsAuto;
+   printf("%s overflow treatment: auto keepBins=%d, using keepBins=%d, collapsing bins %d..%d into final visible bin %d\n",
+          axis.Label.c_str(), keepBinsAuto, keepBins, keepBins, hRecoCountsFine->GetNbinsX(), keepBins);
+
+   // Collapse the sparse tail, then bring responses and priors to the measurement binning
+   const std::string &suffix = axis.Suffix;
+   std::vector<SpeciesInput> inputs(nSpecies);
+   for (int species = 0; species < nSpecies; ++species)
+   {
+      const std::string name = SpeciesName[species];
+      SpeciesInput &in = inputs[species];
+      in.Name = name;
+      in.Title = SpeciesTitle[species];
+      in.StressSlope = StressSlope[species];
+      for (int s = 0; s < SampleCount; ++s)
+         in.Reco[s] = CollapseTail1D(hRecoIn[species][s], keepBins,
+                                     ("h" + name + SampleName[s] + "RecoCollapsed" + suffix).c_str());
+      TH2D *hRespFine = CollapseTail2D(hSpeciesRespIn[species], keepBins, keepBins,
+                                       ("h" + axis.Name + "Response" + name + "Collapsed").c_str());
+      TH1D *hPriorFine = CollapseTail1D(hPriorIn[species], keepBins,
+                                        ("h" + name + "True" + axis.TrueYieldName + "Collapsed").c_str());
+      in.Response = RebinResponseToMeasurementBinning(hRespFine, in.Reco[Mc],
+                                                      ("h" + axis.Name + "Response" + name + "Rebinned").c_str());
+      in.Prior = RebinPriorToMeasurementBinning(hPriorFine, in.Reco[Mc], ("h" + name + "Prior" + suffix).c_str());
+      delete hRespFine;
+      delete hPriorFine;
+   }
+   TH2D *hRespCollapsed = CollapseTail2D(hRespFineIn, keepBins, keepBins, ("h" + axis.Name + "ResponseCollapsed").c_str());
+   TH2D *hResp = RebinResponseToMeasurementBinning(hRespCollapsed, inputs[SpeciesK].Reco[Mc],
+                                                   ("h" + axis.Name + "ResponseRebinned").c_str());
+   TH2D *hRespNorm = NormalizeResponseRows(hResp, ("h" + axis.Name + "ResponseNormalized").c_str());
+   delete hRespCollapsed;
+
+   // Shared inputs of each numerator species with the pions, on the same binning as the spectra
+   // and responses
+   std::vector<PionCorrelation> correlations(nSpecies);
+   for (int species = 0; species < nSpecies; ++species)
+   {
+      if (species == SpeciesPi)
+         continue;
+      const std::string pair = PairName[species];
+      PionCorrelation &c = correlations[species];
+      TFile *files[SampleCount] = {fMC, fData};
+      for (int s = 0; s < SampleCount; ++s)
+      {
+         TH1D *hCov = GetRecoHist(files[s], "hCov" + pair + "Corrected" + axis.Name, "hCov" + pair + "Corrected");
+         if (hCov == nullptr)
+         {
+            std::cerr << "Warning: no hCov" << pair << "Corrected in the " << SampleTitle[s]
+                      << " input, " << SpeciesName[species] << " and pi yields taken as uncorrelated" << std::endl;
+            continue;
+         }
+         TH1D *h = CollapseTail1D(hCov, keepBins, ("hCov" + pair + SampleName[s] + "Collapsed" + suffix).c_str());
+         c.RecoCovariance[s] = BinValues(h);
+         delete h;
+      }
+      TH2D *hCross = dynamic_cast<TH2D *>(fResp->Get(("h" + axis.Name + "Response" + pair).c_str()));
+      if (hCross == nullptr)
+      {
+         std::cerr << "Warning: no h" << axis.Name << "Response" << pair << ", " << SpeciesName[species]
+                   << " and pi responses taken as uncorrelated" << std::endl;
+         continue;
+      }
+      TH2D *hCrossFine = CollapseTail2D(hCross, keepBins, keepBins, ("h" + axis.Name + "Response" + pair + "Collapsed").c_str());
+      TH2D *hCrossRebinned = RebinResponseToMeasurementBinning(hCrossFine, inputs[species].Reco[Mc],
+                                                               ("h" + axis.Name + "Response" + pair + "Rebinned").c_str());
+      c.ResponseCross = ResponseValues(hCrossRebinned);
+      delete hCrossFine;
+      delete hCrossRebinned;
+   }
+
+   const std::vector<SpeciesResult> results = UnfoldBatch(inputs, settings);
+   for (const SpeciesResult &r : results)
+   {
+      if (r.SVD[Mc] == nullptr || r.SVD[Data] == nullptr)
+      {
+         std::cerr << "SVD unfolding failed" << std::endl;
+         return 1;
+      }
+   }
+   for (int species = 0; species < nSpecies; ++species)
+      for (int s = 0; s < SampleCount; ++s)
+         printf("%s %s Bayes: %d iterations (variation %d)\n", SampleTitle[s], SpeciesName[species],
+                results[species].NIterUsed[s], results[species].NIterVarUsed[s]);
+
+   WriteRatioOutput({output, "", SpeciesK}, axis, makePlots, hResp, hRespNorm,
+                    inputs, results, correlations[SpeciesK], keepBinsAuto, keepBins);
+   if (doProton)
+      WriteRatioOutput({ptoPiOutput, "PtoPi_", SpeciesP}, axis, makePlots, hResp, hRespNorm,
+                       inputs, results, correlations[SpeciesP], keepBinsAuto, keepBins);
+
+   // kReg scan: the Bayes results are shared, the SVD solutions come from one decomposition per
+   // species and one projection per measurement
+   if (!kRegScan.empty())
+   {
+      std::vector<SVDUnfolder> unfolders;
+      std::vector<std::vector<SVDUnfolder::Projection>> projections(nSpecies);
+      unfolders.reserve(nSpecies);
+      for (int species = 0; species < nSpecies; ++species)
+      {
+         unfolders.emplace_back(inputs[species].Response);
+         for (int s = 0; s < SampleCount; ++s)
+            projections[species].push_back(unfolders[species].Project(inputs[species].Reco[s]));
+      }
+
+      for (int kReg : kRegScan)
+      {
+         std::vector<SpeciesResult> scanResults = results;
+         for (int species = 0; species < nSpecies; ++species)
+            for (int s = 0; s < SampleCount; ++s)
+            {
+               scanResults[species].SVD[s] = unfolders[species].Solution(projections[species][s], kReg,
+                                                                          results[species].SVD[s]->GetName(),
+                                                                          &scanResults[species].SVDCovariance[s]);
+               scanResults[species].SVDMeasJacobian[s] = unfolders[species].Jacobian(kReg);
+            }
+         WriteRatioOutput({kRegScanOutput + std::to_string(kReg) + ".root", "", SpeciesK}, axis, false,
+                          hResp, hRespNorm, inputs, scanResults, correlations[SpeciesK], keepBinsAuto, keepBins);
+         for (int species = 0; species < nSpecies; ++species)
+            for (int s = 0; s < SampleCount; ++s)
+               delete scanResults[species].SVD[s];
+      }
+   }
+
+   fMC->Close();
+   fData->Close();
+   if (fResp != fMC)
+      fResp->Close();
+
+   return 0;
+}
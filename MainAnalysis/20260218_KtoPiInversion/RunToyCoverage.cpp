@@ -0,0 +1,405 @@
+//============================================================
+// RunToyCoverage.cpp
+//
+// Toy coverage of the unfolded K/pi (or p/pi) ratio vs activity.
+// Each toy Poisson-fluctuates the MC reco spectra and every cell of
+// the responses (FluctuateResponse, on by default; --FluctuateResponse
+// false keeps the responses fixed), unfolds both species with the
+// production algorithms of
+// include/UnfoldingEngine.h (Bayes or SVD) and compares the ratio
+// with the MC truth ratio.  Writes the summary and per-bin CSVs of
+// study_dndy_toy_coverage.py.
+//
+// Toy i draws from the counter-based stream (Seed, i) and toys are
+// accumulated in fixed blocks summed in block order, so the result
+// is the same for any number of Threads; check_toy_coverage_threads.sh
+// runs 1 and N threads and compares the CSVs.
+//
+// The pulls use the errors the engine propagates (Bayes: measurement
+// and, with FluctuateResponse, response statistics; SVD: measurement).
+//
+// The responses are weighted fills, so a cell with content c and
+// stored error e (sqrt of the sum of w^2) is fluctuated as
+// Poisson(n_eff) * e^2 / c with n_eff = c^2 / e^2 effective entries,
+// and its toy error is sqrt(c_toy * e^2 / c); for unweighted cells
+// this is Poisson(c) with error sqrt(c_toy).
+//
+// Input is an output of RunBayesSVDUnfolding (h<Axis>Response
+// <species>Rebinned, h<species>Prior<suffix>, h<species>McReco).
+// Build and run with run_toy_coverage.sh.
+//============================================================
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ROOT
+#include "TFile.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TMatrixD.h"
+#include "TROOT.h"
+
+// Project common code
+#include "CommandLine.h"
+
+// Analysis-local helpers
+#include "CounterRandom.h"
+#include "UnfoldingEngine.h"
+
+using namespace UnfoldingEngine;
+
+enum ToyMethod {MethodBayes, MethodSVD};
+
+struct ToySpecies
+{
+   std::vector<double> Response;        // [t * nReco + r]
+   std::vector<double> ResponseError;   // stored bin errors, same layout
+   std::vector<double> Truth;      // prior of the unfolding and truth of the pulls
+   std::vector<double> Reco;       // expected reco spectrum
+};
+
+struct ToySettings
+{
+   ToyMethod Method;
+   int NIter;
+   int KReg;
+   bool FluctuateResponse;
+   unsigned long long Seed;
+};
+
+// Per-bin sums over the toys of one block
+struct ToyAccumulator
+{
+   std::vector<long long> NValid;
+   std::vector<double> SumRatio, SumRatio2, SumDeviation2;
+   std::vector<double> SumPull, SumPull2;
+   std::vector<long long> NCov1, NCov2;
+
+   void Resize(int n)
+   {
+      NValid.assign(n, 0);
+      SumRatio.assign(n, 0.0);
+      SumRatio2.assign(n, 0.0);
+      SumDeviation2.assign(n, 0.0);
+      SumPull.assign(n, 0.0);
+      SumPull2.assign(n, 0.0);
+      NCov1.assign(n, 0);
+      NCov2.assign(n, 0);
+   }
+   void Add(const ToyAccumulator &other)
+   {
+      for (size_t i = 0; i < NValid.size(); ++i)
+      {
+         NValid[i] += other.NValid[i];
+         SumRatio[i] += other.SumRatio[i];
+         SumRatio2[i] += other.SumRatio2[i];
+         SumDeviation2[i] += other.SumDeviation2[i];
+         SumPull[i] += other.SumPull[i];
+         SumPull2[i] += other.SumPull2[i];
+         NCov1[i] += other.NCov1[i];
+         NCov2[i] += other.NCov2[i];
+      }
+   }
+};
+
+static bool IsTrueString(const std::string &value)
+{
+   return (value == "1" || value == "true" || value == "True" || value == "TRUE" ||
+           value == "yes" || value == "Yes" || value == "YES");
+}
+
+// Ratio and its uncorrelated error as in study_dndy_toy_coverage.py: zero where the denominator
+// is empty, zero error where the numerator is
+static void BuildRatioArrays(const std::vector<double> &num, const std::vector<double> &numErr,
+                             const std::vector<double> &den, const std::vector<double> &denErr,
+                             std::vector<double> &ratio, std::vector<double> &err)
+{
+   const size_t n = num.size();
+   ratio.assign(n, 0.0);
+   err.assign(n, 0.0);
+   for (size_t i = 0; i < n; ++i)
+   {
+      if (den[i] <= 0.0)
+         continue;
+      ratio[i] = num[i] / den[i];
+      if (num[i] > 0.0)
+         err[i] = ratio[i] * std::sqrt((numErr[i] / num[i]) * (numErr[i] / num[i]) +
+                                       (denErr[i] / den[i]) * (denErr[i] / den[i]));
+   }
+}
+
+// Unfolded spectrum of one species in one toy
+static void UnfoldToySpecies(const ToySpecies &species, const ToySettings &settings,
+                             CounterRandom::Stream &random, std::vector<double> &x, std::vector<double> &err)
+{
+   const int nTrue = static_cast<int>(species.Truth.size());
+   const int nReco = static_cast<int>(species.Reco.size());
+
+   std::vector<double> meas(nReco);
+   for (int r = 0; r < nReco; ++r)
+      meas[r] = static_cast<double>(random.Poisson(std::max(0.0, species.Reco[r])));
+
+   // Weight per effective entry of every cell (0: cell left as it is)
+   std::vector<double> response = species.Response;
+   std::vector<double> entryWeight(response.size(), 0.0);
+   if (settings.FluctuateResponse)
+      for (size_t c = 0; c < response.size(); ++c)
+      {
+         const double content = species.Response[c];
+         const double error = species.ResponseError[c];
+         if (content <= 0.0 || error <= 0.0)
+            continue;
+         entryWeight[c] = error * error / content;
+         response[c] = static_cast<double>(random.Poisson(content / entryWeight[c])) * entryWeight[c];
+      }
+
+   std::vector<double> measErr(nReco);
+   for (int r = 0; r < nReco; ++r)
+      measErr[r] = std::sqrt(meas[r]);
+
+   if (settings.Method == MethodBayes)
+   {
+      // Propagated errors; the response term only when the response is fluctuated too
+      std::vector<double> respErr;
+      if (settings.FluctuateResponse)
+      {
+         respErr.resize(response.size());
+         for (size_t c = 0; c < response.size(); ++c)
+            respErr[c] = std::sqrt(response[c] * entryWeight[c]);
+      }
+      TMatrixD cov;
+      IterativeBayesUnfold(meas, response, species.Truth, settings.NIter, x, &measErr,
+                           settings.FluctuateResponse ? &respErr : nullptr, &cov);
+      err.resize(nTrue);
+      for (int t = 0; t < nTrue; ++t)
+         err[t] = std::sqrt(std::max(0.0, cov(t, t)));
+      return;
+   }
+
+   const SVDUnfolder svd(nTrue, nReco, response);
+   if (!svd.IsValid())
+   {
+      x.assign(nTrue, 0.0);
+      err.assign(nTrue, 0.0);
+      return;
+   }
+   svd.Solve(svd.Project(meas, measErr), settings.KReg, x, err);
+}
+
+static void RunToy(long long toy, const ToySpecies &num, const ToySpecies &den, const ToySettings &settings,
+                   const std::vector<double> &truthRatio, ToyAccumulator &acc)
+{
+   CounterRandom::Stream random(settings.Seed, static_cast<uint64_t>(toy));
+   std::vector<double> numX, numErr, denX, denErr, ratio, ratioErr;
+   UnfoldToySpecies(num, settings, random, numX, numErr);
+   UnfoldToySpecies(den, settings, random, denX, denErr);
+   BuildRatioArrays(numX, numErr, denX, denErr, ratio, ratioErr);
+
+   for (size_t i = 0; i < ratio.size(); ++i)
+   {
+      if (ratioErr[i] <= 0.0)
+         continue;
+      const double pull = (ratio[i] - truthRatio[i]) / ratioErr[i];
+      acc.NValid[i]++;
+      acc.SumRatio[i] += ratio[i];
+      acc.SumRatio2[i] += ratio[i] * ratio[i];
+      acc.SumDeviation2[i] += (ratio[i] - truthRatio[i]) * (ratio[i] - truthRatio[i]);
+      acc.SumPull[i] += pull;
+      acc.SumPull2[i] += pull * pull;
+      if (std::fabs(pull) < 1.0)
+         acc.NCov1[i]++;
+      if (std::fabs(pull) < 2.0)
+         acc.NCov2[i]++;
+   }
+}
+
+static bool ReadSpecies(TFile *f, const std::string &axisName, const std::string &suffix,
+                        const std::string &species, ToySpecies &out)
+{
+   TH2D *hResp = dynamic_cast<TH2D *>(f->Get(("h" + axisName + "Response" + species + "Rebinned").c_str()));
+   TH1D *hTruth = dynamic_cast<TH1D *>(f->Get(("h" + species + "Prior" + suffix).c_str()));
+   TH1D *hReco = dynamic_cast<TH1D *>(f->Get(("h" + species + "McReco").c_str()));
+   if (hResp == nullptr || hTruth == nullptr || hReco == nullptr)
+   {
+      std::cerr << "Missing response, prior or MC reco histogram for " << species << std::endl;
+      return false;
+   }
+   out.Response = ResponseValues(hResp);
+   out.ResponseError = ResponseErrors(hResp);
+   out.Truth = BinValues(hTruth);
+   out.Reco = BinValues(hReco);
+   return true;
+}
+
+// Shortest round-trip representation, with ".0" on integral values like Python's repr
+static std::string FormatFloat(double value)
+{
+   char buffer[64];
+   const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+   std::string text(buffer, result.ptr);
+   if (std::isfinite(value) && text.find_first_of(".en") == std::string::npos)
+      text += ".0";
+   return text;
+}
+
+int main(int argc, char *argv[])
+{
+   CommandLine CL(argc, argv);
+
+   const std::string input = CL.Get("Input", "output/systematics_20260314_dndy/nominal_unfold_dndy.root");
+   const std::string axisName = CL.Get("Axis", "DNdY");
+   const std::string suffix = CL.Get("Suffix", axisName == "DNdEta" ? "_dNdEta" : "_dNdY");
+   const std::string axisLabel = CL.Get("AxisLabel", suffix.substr(1));
+   const std::string numerator = CL.Get("Numerator", "K");
+   const std::string summaryPath = CL.Get("Summary", "toy_coverage_summary.csv");
+   const std::string binsPath = CL.Get("Bins", "toy_coverage_bins.csv");
+   const std::string method = CL.Get("Method", "Bayes");
+   const long long nToys = CL.GetInt("NToys", 400);
+   const int blockSize = std::max(1, CL.GetInt("BlockSize", 64));
+   int threads = CL.GetInt("Threads", 0);
+
+   ToySettings settings;
+   settings.Method = (method == "SVD") ? MethodSVD : MethodBayes;
+   settings.NIter = CL.GetInt("NIter", 1);
+   settings.KReg = CL.GetInt("KReg", 8);
+   settings.FluctuateResponse = IsTrueString(CL.Get("FluctuateResponse", "true"));
+   settings.Seed = static_cast<unsigned long long>(CL.GetInt("Seed", 12345));
+   if (method != "Bayes" && method != "SVD")
+   {
+      std::cerr << "Unknown Method " << method << " (Bayes or SVD)" << std::endl;
+      return 1;
+   }
+
+   TFile *f = TFile::Open(input.c_str(), "READ");
+   if (f == nullptr || f->IsZombie())
+   {
+      std::cerr << "Cannot open " << input << std::endl;
+      return 1;
+   }
+   ToySpecies num, den;
+   if (ReadSpecies(f, axisName, suffix, numerator, num) == false || ReadSpecies(f, axisName, suffix, "Pi", den) == false)
+      return 1;
+   std::vector<double> centers;
+   {
+      TH1D *hTruth = dynamic_cast<TH1D *>(f->Get(("hPiPrior" + suffix).c_str()));
+      for (int i = 1; i <= hTruth->GetNbinsX(); ++i)
+         centers.push_back(hTruth->GetXaxis()->GetBinCenter(i));
+   }
+   f->Close();
+
+   // Truth ratio with sqrt(N) errors on the priors (only the value is used)
+   std::vector<double> truthRatio, truthRatioErr, numTruthErr(num.Truth.size()), denTruthErr(den.Truth.size());
+   for (size_t i = 0; i < num.Truth.size(); ++i)
+      numTruthErr[i] = std::sqrt(std::max(0.0, num.Truth[i]));
+   for (size_t i = 0; i < den.Truth.size(); ++i)
+      denTruthErr[i] = std::sqrt(std::max(0.0, den.Truth[i]));
+   BuildRatioArrays(num.Truth, numTruthErr, den.Truth, denTruthErr, truthRatio, truthRatioErr);
+   const int nBins = static_cast<int>(truthRatio.size());
+
+   // Fixed toy blocks, each with its own accumulator; threads take blocks in any order
+   const long long nBlocks = (nToys + blockSize - 1) / blockSize;
+   std::vector<ToyAccumulator> blocks(nBlocks);
+   for (ToyAccumulator &block : blocks)
+      block.Resize(nBins);
+
+   if (threads <= 0)
+      threads = std::thread::hardware_concurrency();
+   threads = static_cast<int>(std::max(1LL, std::min<long long>(std::max(threads, 1), nBlocks)));
+   if (threads > 1)
+      ROOT::EnableThreadSafety();
+
+   std::atomic<long long> nextBlock(0);
+   auto Work = [&]()
+   {
+      for (long long b = nextBlock++; b < nBlocks; b = nextBlock++)
+      {
+         const long long end = std::min(nToys, (b + 1) * blockSize);
+         for (long long toy = b * blockSize; toy < end; ++toy)
+            RunToy(toy, num, den, settings, truthRatio, blocks[b]);
+      }
+   };
+   if (threads == 1)
+      Work();
+   else
+   {
+      std::vector<std::thread> workers;
+      for (int i = 0; i < threads; ++i)
+         workers.emplace_back(Work);
+      for (std::thread &worker : workers)
+         worker.join();
+   }
+
+   ToyAccumulator total;
+   total.Resize(nBins);
+   for (const ToyAccumulator &block : blocks)
+      total.Add(block);
+
+   // Per-bin statistics over the toys with a valid ratio error; coverage over all toys
+   const double nan = std::numeric_limits<double>::quiet_NaN();
+   std::vector<double> pullMean(nBins, nan), pullWidth(nBins, nan), toyMean(nBins, nan), toyRms(nBins, nan);
+   std::vector<double> toyRmse(nBins, nan), cov1(nBins, 0.0), cov2(nBins, 0.0);
+   for (int i = 0; i < nBins; ++i)
+   {
+      if (nToys > 0)
+      {
+         cov1[i] = static_cast<double>(total.NCov1[i]) / nToys;
+         cov2[i] = static_cast<double>(total.NCov2[i]) / nToys;
+      }
+      const double n = static_cast<double>(total.NValid[i]);
+      if (n <= 0)
+         continue;
+      pullMean[i] = total.SumPull[i] / n;
+      pullWidth[i] = std::sqrt(std::max(0.0, total.SumPull2[i] / n - pullMean[i] * pullMean[i]));
+      toyMean[i] = total.SumRatio[i] / n;
+      toyRms[i] = std::sqrt(std::max(0.0, total.SumRatio2[i] / n - toyMean[i] * toyMean[i]));
+      toyRmse[i] = std::sqrt(total.SumDeviation2[i] / n);
+   }
+
+   double sumAbsBias = 0.0, sumWidth = 0.0, maxWidth = nan;
+   double minCov1 = nan, minCov2 = nan;
+   int nValidBins = 0;
+   for (int i = 0; i < nBins; ++i)
+   {
+      minCov1 = (i == 0) ? cov1[i] : std::min(minCov1, cov1[i]);
+      minCov2 = (i == 0) ? cov2[i] : std::min(minCov2, cov2[i]);
+      if (!std::isfinite(pullMean[i]))
+         continue;
+      sumAbsBias += std::fabs(pullMean[i]);
+      sumWidth += pullWidth[i];
+      maxWidth = (nValidBins == 0) ? pullWidth[i] : std::max(maxWidth, pullWidth[i]);
+      nValidBins++;
+   }
+   const double meanAbsBias = nValidBins > 0 ? sumAbsBias / nValidBins : nan;
+   const double meanWidth = nValidBins > 0 ? sumWidth / nValidBins : nan;
+   auto OrZero = [](double v) {return std::isfinite(v) ? v : 0.0;};
+
+   std::ofstream summary(summaryPath);
+   summary << "axis,mean_abs_pull_bias,mean_pull_width,min_cov1,min_cov2,max_pull_width,n_toys\r\n";
+   summary << axisLabel << "," << FormatFloat(meanAbsBias) << "," << FormatFloat(meanWidth) << ","
+           << FormatFloat(minCov1) << "," << FormatFloat(minCov2) << "," << FormatFloat(maxWidth) << ","
+           << nToys << "\r\n";
+
+   std::ofstream bins(binsPath);
+   bins << "axis,bin,center,truth_ratio,toy_mean,toy_rms_abs,toy_bias_abs,toy_rmse_abs,"
+        << "pull_mean,pull_width,cov1,cov2,n_valid\r\n";
+   for (int i = 0; i < nBins; ++i)
+   {
+      bins << axisLabel << "," << i + 1 << "," << FormatFloat(centers[i]) << "," << FormatFloat(truthRatio[i]) << ","
+           << FormatFloat(OrZero(toyMean[i])) << "," << FormatFloat(OrZero(toyRms[i])) << ","
+           << FormatFloat(OrZero(toyMean[i] - truthRatio[i])) << "," << FormatFloat(OrZero(toyRmse[i])) << ","
+           << FormatFloat(OrZero(pullMean[i])) << "," << FormatFloat(OrZero(pullWidth[i])) << ","
+           << FormatFloat(cov1[i]) << "," << FormatFloat(cov2[i]) << "," << total.NValid[i] << "\r\n";
+   }
+
+   std::cout << "Ran " << nToys << " " << method << " toys on " << threads << " thread(s); wrote "
+             << summaryPath << " and " << binsPath << std::endl;
+   return 0;
+}
@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+# Runs RunToyCoverage with 1 and with N threads (default 8) on the same arguments and checks that
+# the summary and per-bin CSVs come out identical:
+#   ./check_toy_coverage_threads.sh [N] [RunToyCoverage options, eg. --Input ... --NToys 400]
+# --Threads, --Summary and --Bins are set here; the same options given after them are ignored.
+set -euo pipefail
+
+HERE="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+
+NThreads=8
+if [[ $# -gt 0 && "$1" =~ ^[0-9]+$ ]]; then
+  NThreads="$1"
+  shift
+fi
+
+Work="$(mktemp -d)"
+trap 'rm -rf "${Work}"' EXIT
+
+for T in 1 "${NThreads}"; do
+  "${HERE}/run_toy_coverage.sh" --Threads "${T}" \
+    --Summary "${Work}/summary_${T}.csv" --Bins "${Work}/bins_${T}.csv" "$@"
+done
+
+Status=0
+for F in summary bins; do
+  if cmp -s "${Work}/${F}_1.csv" "${Work}/${F}_${NThreads}.csv"; then
+    echo "OK   ${F} CSV identical with 1 and ${NThreads} threads"
+  else
+    echo "FAIL ${F} CSV differs between 1 and ${NThreads} threads:"
+    diff "${Work}/${F}_1.csv" "${Work}/${F}_${NThreads}.csv" | head -20 || true
+    Status=1
+  fi
+done
+exit "${Status}"
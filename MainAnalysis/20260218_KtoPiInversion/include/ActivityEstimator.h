@@ -0,0 +1,96 @@
+#ifndef ACTIVITY_ESTIMATOR_H
+#define ACTIVITY_ESTIMATOR_H
+
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "EventSummary.h"
+#include "Kinematics.h"
+
+// Event-activity estimators of KtoPiAnalysis (N_ch^tag, dN_ch/deta, dN_ch/dy, ...).
+//
+// An estimator counts the charged particles of an event that pass its acceptance, separately
+// for reco tracks and for stable generator particles, and says how the count is binned and how
+// its histograms are named.  KtoPiAnalysis books for every registered estimator the raw and
+// PID-corrected spectra, the ratios, the species covariance, the bootstrap replicas and the
+// MC response / truth histograms, and fills them all in the same pass over the tracks; a new
+// estimator only needs an entry in the registry (BuildActivityEstimators in KtoPiAnalysis.cpp).
+// An estimator whose acceptance is one of the counts of EventSummary can also name that count,
+// so that an attached summary replaces the loops over the tracks.
+
+namespace Activity
+{
+// Rapidity of a particle along the (not necessarily unit) axis (ax, ay, az)
+using Kinematics::AxisRapidity;
+
+// One charged reco track or stable charged generator particle, with the kinematics the
+// estimators select on computed once
+struct Particle
+{
+   double Px, Py, Pz, E;
+   double Pt;
+   bool HasEta;               // Pt > 0
+   double Eta;
+   bool HasThrustRapidity;    // event has a thrust axis and the rapidity along it is finite
+   double ThrustRapidity;
+
+   // thrust: unit thrust axis of the event, nullptr if there is none
+   Particle(double px, double py, double pz, double e, const double *thrust)
+      : Px(px), Py(py), Pz(pz), E(e), Pt(std::sqrt(px * px + py * py)),
+        HasEta(Pt > 0.0), Eta(0.0), HasThrustRapidity(false), ThrustRapidity(0.0)
+   {
+      if (HasEta)
+         Eta = std::asinh(pz / Pt);
+      if (thrust != nullptr)
+         HasThrustRapidity = AxisRapidity(px, py, pz, e, thrust[0], thrust[1], thrust[2], ThrustRapidity);
+   }
+};
+
+typedef std::function<bool(const Particle &)> Acceptance;
+typedef std::function<int(const EventSummary &)> SummaryCount;
+
+struct Estimator
+{
+   // Histogram names: h<species><kind><Name> for the spectra (hKPtDNdEta), h<ResponseName>Response,
+   // h<ResponseName>True / Reco for the MC response, h<species>True<TrueYieldName> for the truth yields
+   std::string Name;
+   std::string ResponseName;
+   std::string TrueYieldName;
+
+   // Titles: "Kaon candidates vs <Label>", "K/#pi vs <RatioLabel>", "<Quantity> response<ResponseRegion>"
+   // (the species-weighted responses carry no region), "True <Quantity> distribution<Region>";
+   // axis titles RecoTitle, TrueTitle and ResponseRecoTitle for the reco axis of the response
+   // and of the reco distribution
+   std::string Label;
+   std::string RatioLabel;
+   std::string Quantity;
+   std::string Region;
+   std::string ResponseRegion;
+   std::string RecoTitle;
+   std::string ResponseRecoTitle;
+   std::string TrueTitle;
+
+   // Binning of the count: Edges if not empty, else NBins from Min to Max.  Counts above
+   // MaxCount go to MaxCount.
+   int NBins;
+   double Min;
+   double Max;
+   std::vector<double> Edges;
+   int MaxCount;
+
+   Acceptance Reco;   // reco tracks (good, charged)
+   Acceptance Gen;    // generator particles (status 1, charged)
+
+   // The same counts from an EventSummary written with the same thresholds; empty if the
+   // summary has no count with this acceptance
+   SummaryCount SummaryReco;
+   SummaryCount SummaryGen;
+
+   Estimator() : NBins(0), Min(0.0), Max(0.0), MaxCount(0) {}
+   int GetNBins() const {return Edges.empty() ? NBins : static_cast<int>(Edges.size()) - 1;}
+};
+}
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef BINNED_FILL_H
+#define BINNED_FILL_H
+
+#include <vector>
+
+#include "TAxis.h"
+#include "TArrayD.h"
+#include "TH1D.h"
+#include "TH2D.h"
+
+// Histogram filling by precomputed bin index for the hot loops of KtoPiAnalysis.
+//
+// CountLookup maps an integer activity count straight to its bin (built once with
+// TAxis::FindBin), EdgeLocator finds the bin of a variable-width axis without branches, and
+// Hist1D / Hist2D fill a histogram by bin while keeping exactly what TH1::Fill would keep:
+// contents, Sumw2, entries and the x / y moments, accumulated in the same order.  The moments
+// live in the filler until Flush() writes them into the histogram; Flush() is idempotent, and
+// must be called before the histogram is read, added or written.  Only in-range bins may be
+// filled this way (the callers cut on the ranges first).
+//
+// For a fixed-block reduction Fold(total) moves the moments and entries filled since the last
+// Fold() into the folded sums of total (the filler itself or the one of another worker), so the
+// moments are summed per block and then block by block, whichever thread filled the block.
+//
+// Adopt() takes over what is already in the histogram (e.g. added from a file) as folded sums,
+// so that a later Flush() keeps it.
+
+namespace BinnedFill
+{
+class CountLookup
+{
+private:
+   std::vector<int> Bins;
+public:
+   void Build(TAxis *axis, int maxCount)
+   {
+      Bins.assign(maxCount + 1, 0);
+      for (int count = 0; count <= maxCount; ++count)
+         Bins[count] = axis->FindBin(static_cast<double>(count));
+   }
+   int Find(int count) const {return Bins[count];}   // 0 <= count <= maxCount
+};
+
+class EdgeLocator
+{
+private:
+   std::vector<double> Edges;
+public:
+   void Build(const std::vector<double> &edges) {Edges = edges;}
+   // Number of edges <= x: the TAxis::FindBin result for a variable-width axis
+   // (0 = underflow, edges.size() = overflow)
+   int Find(double x) const
+   {
+      int bin = 0;
+      for (double edge : Edges)
+         bin += (edge <= x);
+      return bin;
+   }
+};
+
+class Hist1D
+{
+private:
+   TH1D *H;
+   double Stats[4];   // sumw, sumw2, sumwx, sumwx2
+   double Entries;
+   double Folded[4];
+   double FoldedEntries;
+public:
+   Hist1D() : H(nullptr), Stats{0, 0, 0, 0}, Entries(0), Folded{0, 0, 0, 0}, FoldedEntries(0) {}
+   void Attach(TH1D *h)
+   {
+      H = h;
+      for (int i = 0; i < 4; ++i)
+         Stats[i] = Folded[i] = 0;
+      Entries = FoldedEntries = 0;
+   }
+   void Fill(int bin, double x, double w)
+   {
+      Entries++;
+      H->GetSumw2()->fArray[bin] += w * w;
+      H->AddBinContent(bin, w);
+      Stats[0] += w;
+      Stats[1] += w * w;
+      Stats[2] += w * x;
+      Stats[3] += w * x * x;
+   }
+   void Flush() const
+   {
+      if (H == nullptr)
+         return;
+      double stats[4];
+      for (int i = 0; i < 4; ++i)
+         stats[i] = Folded[i] + Stats[i];
+      H->PutStats(stats);
+      H->SetEntries(FoldedEntries + Entries);
+   }
+   void Adopt()
+   {
+      H->GetStats(Folded);
+      FoldedEntries = H->GetEntries();
+      for (int i = 0; i < 4; ++i)
+         Stats[i] = 0;
+      Entries = 0;
+   }
+   // After H->Add(other histogram), so that a later Flush() keeps the sum
+   void Add(const Hist1D &other)
+   {
+      for (int i = 0; i < 4; ++i)
+      {
+         Stats[i] += other.Stats[i];
+         Folded[i] += other.Folded[i];
+      }
+      Entries += other.Entries;
+      FoldedEntries += other.FoldedEntries;
+   }
+   void Fold(Hist1D &total)
+   {
+      for (int i = 0; i < 4; ++i)
+      {
+         total.Folded[i] += Stats[i];
+         Stats[i] = 0;
+      }
+      total.FoldedEntries += Entries;
+      Entries = 0;
+   }
+};
+
+class Hist2D
+{
+private:
+   TH2D *H;
+   int Stride;        // nx + 2
+   double Stats[7];   // sumw, sumw2, sumwx, sumwx2, sumwy, sumwy2, sumwxy
+   double Entries;
+   double Folded[7];
+   double FoldedEntries;
+public:
+   Hist2D() : H(nullptr), Stride(0), Stats{0, 0, 0, 0, 0, 0, 0}, Entries(0),
+              Folded{0, 0, 0, 0, 0, 0, 0}, FoldedEntries(0) {}
+   void Attach(TH2D *h)
+   {
+      H = h;
+      Stride = h->GetXaxis()->GetNbins() + 2;
+      for (int i = 0; i < 7; ++i)
+         Stats[i] = Folded[i] = 0;
+      Entries = FoldedEntries = 0;
+   }
+   void Fill(int binx, int biny, double x, double y)
+   {
+      const int bin = biny * Stride + binx;
+      Entries++;
+      H->AddBinContent(bin);
+      ++H->GetSumw2()->fArray[bin];
+      ++Stats[0];
+      ++Stats[1];
+      Stats[2] += x;
+      Stats[3] += x * x;
+      Stats[4] += y;
+      Stats[5] += y * y;
+      Stats[6] += x * y;
+   }
+   void Flush() const
+   {
+      if (H == nullptr)
+         return;
+      double stats[7];
+      for (int i = 0; i < 7; ++i)
+         stats[i] = Folded[i] + Stats[i];
+      H->PutStats(stats);
+      H->SetEntries(FoldedEntries + Entries);
+   }
+   void Adopt()
+   {
+      H->GetStats(Folded);
+      FoldedEntries = H->GetEntries();
+      for (int i = 0; i < 7; ++i)
+         Stats[i] = 0;
+      Entries = 0;
+   }
+   void Add(const Hist2D &other)
+   {
+      for (int i = 0; i < 7; ++i)
+      {
+         Stats[i] += other.Stats[i];
+         Folded[i] += other.Folded[i];
+      }
+      Entries += other.Entries;
+      FoldedEntries += other.FoldedEntries;
+   }
+   void Fold(Hist2D &total)
+   {
+      for (int i = 0; i < 7; ++i)
+      {
+         total.Folded[i] += Stats[i];
+         Stats[i] = 0;
+      }
+      total.FoldedEntries += Entries;
+      Entries = 0;
+   }
+};
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef COUNTER_RANDOM_H
+#define COUNTER_RANDOM_H
+
+#include <cmath>
+#include <cstdint>
+
+#include "PoissonBootstrap.h"
+
+// Counter-based random streams for toy studies: the n-th number of stream (seed, index) is a
+// pure function of (seed, index, n), with the SplitMix64 finalizer of PoissonBootstrap.h.  A toy
+// that draws from the stream of its own index gets the same numbers whichever thread runs it and
+// however many threads there are.
+
+namespace CounterRandom
+{
+class Stream
+{
+private:
+   uint64_t Key;
+   uint64_t Counter;
+public:
+   Stream(uint64_t seed, uint64_t index)
+      : Key(PoissonBootstrap::Mix(PoissonBootstrap::Mix(seed) ^ index)), Counter(0) {}
+
+   // Uniform in (0, 1) from the top 53 bits
+   double Uniform()
+   {
+      ++Counter;
+      return ((PoissonBootstrap::Mix(Key + 0xD1B54A32D192ED03ULL * Counter) >> 11) + 0.5) * 0x1.0p-53;
+   }
+
+   // Inversion below mean 10, transformed rejection (Hormann's PTRS) above
+   long long Poisson(double mean)
+   {
+      if (!(mean > 0.0))
+         return 0;
+
+      if (mean < 10.0)
+      {
+         const double u = Uniform();
+         double p = std::exp(-mean);
+         double cdf = p;
+         long long k = 0;
+         while (u > cdf && p > 0.0)
+         {
+            ++k;
+            p *= mean / k;
+            cdf += p;
+         }
+         return k;
+      }
+
+      const double slam = std::sqrt(mean);
+      const double loglam = std::log(mean);
+      const double b = 0.931 + 2.53 * slam;
+      const double a = -0.059 + 0.02483 * b;
+      const double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+      const double vr = 0.9277 - 3.6224 / (b - 2.0);
+      while (true)
+      {
+         const double U = Uniform() - 0.5;
+         const double V = Uniform();
+         const double us = 0.5 - std::fabs(U);
+         const long long k = static_cast<long long>(std::floor((2.0 * a / us + b) * U + mean + 0.43));
+         if (us >= 0.07 && V <= vr)
+            return k;
+         if (k < 0 || (us < 0.013 && V > us))
+            continue;
+         if (std::log(V) + std::log(invalpha) - std::log(a / (us * us) + b) <=
+             -mean + k * loglam - std::lgamma(k + 1.0))
+            return k;
+      }
+   }
+};
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef POISSON_BOOTSTRAP_H
+#define POISSON_BOOTSTRAP_H
+
+#include <cmath>
+#include <cstdint>
+
+// Poisson(1) bootstrap weights from a counter-based generator: the weight of an event in a
+// replica is a pure function of (seed, Run, Event, replica), so it does not depend on the order
+// in which events are read, on the thread that reads them, or on which other events were
+// selected.  Replicas are statistically independent resamplings of the event sample.
+
+namespace PoissonBootstrap
+{
+// SplitMix64 finalizer
+inline uint64_t Mix(uint64_t x)
+{
+   x += 0x9E3779B97F4A7C15ULL;
+   x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+   return x ^ (x >> 31);
+}
+
+inline uint64_t EventKey(uint64_t seed, long long run, long long event)
+{
+   return Mix(Mix(Mix(seed) ^ static_cast<uint64_t>(run)) ^ static_cast<uint64_t>(event));
+}
+
+// Uniform in [0, 1) from the top 53 bits
+inline double Uniform(uint64_t key, int replica)
+{
+   return (Mix(key + 0xD1B54A32D192ED03ULL * static_cast<uint64_t>(replica + 1)) >> 11) * 0x1.0p-53;
+}
+
+// Inverse CDF of Poisson(1)
+inline int PoissonOne(double u)
+{
+   double p = std::exp(-1.0);
+   double cdf = p;
+   int k = 0;
+   while (u >= cdf && k < 20)
+   {
+      ++k;
+      p /= k;
+      cdf += p;
+   }
+   return k;
+}
+
+inline int Weight(uint64_t key, int replica)
+{
+   return PoissonOne(Uniform(key, replica));
+}
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef TAGGING_MATRIX_BATCH_H
+#define TAGGING_MATRIX_BATCH_H
+
+#include <cmath>
+#include <vector>
+
+// 3×3 PID unfolding for a whole batch of (activity, pT) cells at once.
+//
+// The batch is a structure of arrays: element (r, c) of the tagging matrix of cell k is
+// M[3*r+c][k], so every step below is one flat loop over k without branches that the compiler
+// can vectorize.  For each cell
+//
+//    X = M^-1 Y
+//    Cov(X_s, X_t) = sum_i Inv[s][i] Inv[t][i] VarY[i]                    (observed counts)
+//                  + sum_a,b Inv[s][a] Inv[t][a] X[b]^2 SpreadM[a][b]     (matrix elements)
+//
+// the second term from dX_s / dM_ab = -Inv[s][a] X[b], treating the nine matrix elements and
+// the three counts of a cell as independent.  SpreadM is whatever variance the caller gives
+// the elements; KtoPiAnalysis uses the spread of the per-track tagging probabilities averaged
+// into the cell, which is not the statistical uncertainty of the efficiency maps those
+// probabilities come from.  The count term is uncorrelated between cells.  The map uncertainty
+// is not: one map bin feeds every cell its tracks fall into, so it correlates cells (and pT and
+// activity bins); that is not included here.  The per-track probabilities are read from the
+// tree without their map-bin errors, so it cannot be added without the maps themselves, and
+// KtoPiAnalysis leaves the spread term off unless --PropagateMatrixErrors true is given.
+
+namespace TaggingMatrixBatch
+{
+enum CovarianceIndex {Cov00, Cov11, Cov22, Cov01, Cov02, Cov12, CovCount};
+
+struct Batch
+{
+   int N;
+   std::vector<double> M[9];       // tagging matrix, row = observed tag, column = true species
+   std::vector<double> SpreadM[9]; // variance given to each element, see above
+   std::vector<double> Y[3];       // observed counts
+   std::vector<double> VarY[3];
+   std::vector<double> Det;
+   std::vector<double> Inv[9];     // zero where |Det| is below the threshold of Invert()
+   std::vector<double> X[3];       // Inv * Y
+   std::vector<double> Cov[CovCount];
+
+   Batch() : N(0) {}
+   void Resize(int n)
+   {
+      N = n;
+      for (int e = 0; e < 9; ++e)
+      {
+         M[e].assign(n, 0.0);
+         SpreadM[e].assign(n, 0.0);
+         Inv[e].assign(n, 0.0);
+      }
+      for (int s = 0; s < 3; ++s)
+      {
+         Y[s].assign(n, 0.0);
+         VarY[s].assign(n, 0.0);
+         X[s].assign(n, 0.0);
+      }
+      for (int c = 0; c < CovCount; ++c)
+         Cov[c].assign(n, 0.0);
+      Det.assign(n, 0.0);
+   }
+   bool IsInvertible(int k, double minDet) const {return std::fabs(Det[k]) >= minDet;}
+};
+
+// Determinants and inverses by cofactors
+inline void Invert(Batch &b, double minDet)
+{
+   const double *a = b.M[0].data(), *bb = b.M[1].data(), *c = b.M[2].data();
+   const double *d = b.M[3].data(), *e = b.M[4].data(), *f = b.M[5].data();
+   const double *g = b.M[6].data(), *h = b.M[7].data(), *i = b.M[8].data();
+   double *det = b.Det.data();
+   double *inv[9];
+   for (int n = 0; n < 9; ++n)
+      inv[n] = b.Inv[n].data();
+
+   for (int k = 0; k < b.N; ++k)
+   {
+      const double C00 =  (e[k] * i[k] - f[k] * h[k]);
+      const double C01 = -(d[k] * i[k] - f[k] * g[k]);
+      const double C02 =  (d[k] * h[k] - e[k] * g[k]);
+      const double C10 = -(bb[k] * i[k] - c[k] * h[k]);
+      const double C11 =  (a[k] * i[k] - c[k] * g[k]);
+      const double C12 = -(a[k] * h[k] - bb[k] * g[k]);
+      const double C20 =  (bb[k] * f[k] - c[k] * e[k]);
+      const double C21 = -(a[k] * f[k] - c[k] * d[k]);
+      const double C22 =  (a[k] * e[k] - bb[k] * d[k]);
+
+      det[k] = a[k] * C00 + bb[k] * C01 + c[k] * C02;
+      const double invDet = (std::fabs(det[k]) < minDet) ? 0.0 : 1.0 / det[k];
+
+      // Inverse = Cofactor^T / det
+      inv[0][k] = C00 * invDet;  inv[1][k] = C10 * invDet;  inv[2][k] = C20 * invDet;
+      inv[3][k] = C01 * invDet;  inv[4][k] = C11 * invDet;  inv[5][k] = C21 * invDet;
+      inv[6][k] = C02 * invDet;  inv[7][k] = C12 * invDet;  inv[8][k] = C22 * invDet;
+   }
+}
+
+// X and Cov from Inv; call after Invert().  Without matrixSpread only the count term is kept.
+inline void Propagate(Batch &b, bool matrixSpread)
+{
+   static const int Pair[CovCount][2] = {{0, 0}, {1, 1}, {2, 2}, {0, 1}, {0, 2}, {1, 2}};
+
+   for (int s = 0; s < 3; ++s)
+   {
+      const double *inv0 = b.Inv[3 * s].data();
+      const double *inv1 = b.Inv[3 * s + 1].data();
+      const double *inv2 = b.Inv[3 * s + 2].data();
+      const double *y0 = b.Y[0].data(), *y1 = b.Y[1].data(), *y2 = b.Y[2].data();
+      double *x = b.X[s].data();
+      for (int k = 0; k < b.N; ++k)
+         x[k] = inv0[k] * y0[k] + inv1[k] * y1[k] + inv2[k] * y2[k];
+   }
+
+   for (int p = 0; p < CovCount; ++p)
+   {
+      const int s = Pair[p][0];
+      const int t = Pair[p][1];
+      double *cov = b.Cov[p].data();
+      for (int k = 0; k < b.N; ++k)
+         cov[k] = 0.0;
+
+      for (int a = 0; a < 3; ++a)
+      {
+         const double *invS = b.Inv[3 * s + a].data();
+         const double *invT = b.Inv[3 * t + a].data();
+         const double *varY = b.VarY[a].data();
+         for (int k = 0; k < b.N; ++k)
+            cov[k] += invS[k] * invT[k] * varY[k];
+
+         if (!matrixSpread)
+            continue;
+         for (int c = 0; c < 3; ++c)
+         {
+            const double *x = b.X[c].data();
+            const double *spreadM = b.SpreadM[3 * a + c].data();
+            for (int k = 0; k < b.N; ++k)
+               cov[k] += invS[k] * invT[k] * x[k] * x[k] * spreadM[k];
+         }
+      }
+   }
+}
+}
+
+#endif
@@ -0,0 +1,1132 @@
+#ifndef UNFOLDING_ENGINE_H
+#define UNFOLDING_ENGINE_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "TAxis.h"
+#include "TDecompSVD.h"
+#include "TError.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TMatrixD.h"
+#include "TVectorD.h"
+
+// Activity unfolding of the PID-corrected species yields (iterative Bayes and truncated SVD).
+//
+// Responses are booked (true activity) x (reco activity), filled with the true species yield of
+// each event.  Histograms are built from bin edges, so fixed-width (dN/deta) and variable-width
+// (dN/dy) axes go through the same code.  UnfoldBatch() runs every unfolding the BayesSVD
+// analysis needs for a set of species (MC and data, nominal / flat prior / nIterVar Bayes, SVD,
+// refolding and the stress test) in one call; RunBayesSVDUnfolding.cpp is the command line front
+// end that reads the inputs and writes the ratios.  Bayes and SVD come with their full covariance
+// matrix and their Jacobians w.r.t. the measurement (and for Bayes the response cells), so that
+// inputs shared between two unfoldings (the K and pi yields of one 3x3 inversion, the species
+// responses filled from the same events, the response common to data and MC) can be turned into
+// cross covariances with CrossCovariance() and carried into the ratios by BuildRatio().
+
+namespace UnfoldingEngine
+{
+enum Sample {Mc, Data, SampleCount};
+static const char *SampleName[SampleCount] = {"Mc", "Data"};
+static const char *SampleTitle[SampleCount] = {"MC", "Data"};
+
+// Edges of the first keepBins bins of axis; with collapseTail the last one extends to the end
+inline std::vector<double> ExtractAxisEdges(const TAxis *axis, int keepBins = -1, bool collapseTail = false)
+{
+   const int nb = axis->GetNbins();
+   if (keepBins <= 0 || keepBins > nb)
+      keepBins = nb;
+
+   std::vector<double> edges;
+   edges.reserve(keepBins + 1);
+   for (int ib = 1; ib <= keepBins; ++ib)
+      edges.push_back(axis->GetBinLowEdge(ib));
+   edges.push_back(collapseTail && keepBins < nb ? axis->GetBinUpEdge(nb) : axis->GetBinUpEdge(keepBins));
+   return edges;
+}
+
+inline TH1D *MakeHist1DWithEdges(const char *name, const char *title, const std::vector<double> &edges)
+{
+   TH1D *h = new TH1D(name, title, static_cast<int>(edges.size()) - 1, edges.data());
+   h->SetDirectory(nullptr);
+   h->Sumw2();
+   return h;
+}
+
+inline TH2D *MakeHist2DWithEdges(const char *name, const char *title,
+                                 const std::vector<double> &xEdges, const std::vector<double> &yEdges)
+{
+   TH2D *h = new TH2D(name, title,
+                      static_cast<int>(xEdges.size()) - 1, xEdges.data(),
+                      static_cast<int>(yEdges.size()) - 1, yEdges.data());
+   h->SetDirectory(nullptr);
+   h->Sumw2();
+   return h;
+}
+
+inline TH1D *CloneEmptyLike(const TH1D *h, const char *name)
+{
+   TH1D *c = (TH1D *)h->Clone(name);
+   c->SetDirectory(nullptr);
+   c->Reset();
+   return c;
+}
+
+// Bins keepBins..N merged into bin keepBins
+inline TH1D *CollapseTail1D(const TH1D *src, int keepBins, const char *name)
+{
+   keepBins = std::max(1, std::min(keepBins, src->GetNbinsX()));
+   TH1D *out = MakeHist1DWithEdges(name, src->GetTitle(), ExtractAxisEdges(src->GetXaxis(), keepBins, true));
+
+   for (int ib = 1; ib <= src->GetNbinsX(); ++ib)
+   {
+      const int b = std::min(ib, keepBins);
+      const double c = src->GetBinContent(ib);
+      const double e = src->GetBinError(ib);
+      out->SetBinContent(b, out->GetBinContent(b) + c);
+      const double err2 = out->GetBinError(b) * out->GetBinError(b) + e * e;
+      out->SetBinError(b, std::sqrt(std::max(0.0, err2)));
+   }
+   return out;
+}
+
+inline TH2D *CollapseTail2D(const TH2D *src, int keepBinsX, int keepBinsY, const char *name)
+{
+   keepBinsX = std::max(1, std::min(keepBinsX, src->GetNbinsX()));
+   keepBinsY = std::max(1, std::min(keepBinsY, src->GetNbinsY()));
+   TH2D *out = MakeHist2DWithEdges(name, src->GetTitle(),
+                                   ExtractAxisEdges(src->GetXaxis(), keepBinsX, true),
+                                   ExtractAxisEdges(src->GetYaxis(), keepBinsY, true));
+
+   for (int ix = 1; ix <= src->GetNbinsX(); ++ix)
+   {
+      const int bx = std::min(ix, keepBinsX);
+      for (int iy = 1; iy <= src->GetNbinsY(); ++iy)
+      {
+         const int by = std::min(iy, keepBinsY);
+         const double c = src->GetBinContent(ix, iy);
+         const double e = src->GetBinError(ix, iy);
+         out->SetBinContent(bx, by, out->GetBinContent(bx, by) + c);
+         const double err2 = out->GetBinError(bx, by) * out->GetBinError(bx, by) + e * e;
+         out->SetBinError(bx, by, std::sqrt(std::max(0.0, err2)));
+      }
+   }
+   return out;
+}
+
+// One bin past the last bin with at least minEvents reco events
+inline int DetermineOverflowKeepBins(const TH1D *recoCounts, double minEvents)
+{
+   const int nb = recoCounts->GetNbinsX();
+   int lastRegular = 0;
+   for (int ib = nb; ib >= 1; --ib)
+   {
+      if (recoCounts->GetBinContent(ib) >= minEvents)
+      {
+         lastRegular = ib;
+         break;
+      }
+   }
+   if (lastRegular <= 0)
+      return nb;
+   return std::min(nb, lastRegular + 1);
+}
+
+inline TH2D *RebinResponseToMeasurementBinning(const TH2D *respFine, const TH1D *measTemplate, const char *name)
+{
+   const int nCoarse = measTemplate->GetNbinsX();
+   TH2D *out = MakeHist2DWithEdges(name, respFine->GetTitle(),
+                                   ExtractAxisEdges(measTemplate->GetXaxis()),
+                                   ExtractAxisEdges(measTemplate->GetXaxis()));
+
+   for (int ix = 1; ix <= respFine->GetNbinsX(); ++ix)
+   {
+      const double x = respFine->GetXaxis()->GetBinCenter(ix);
+      const int bx = out->GetXaxis()->FindBin(x);
+      if (bx < 1 || bx > nCoarse)
+         continue;
+      for (int iy = 1; iy <= respFine->GetNbinsY(); ++iy)
+      {
+         const double y = respFine->GetYaxis()->GetBinCenter(iy);
+         const int by = out->GetYaxis()->FindBin(y);
+         if (by < 1 || by > nCoarse)
+            continue;
+         const double w = respFine->GetBinContent(ix, iy);
+         const double e = respFine->GetBinError(ix, iy);
+         if (w == 0.0 && e == 0.0)
+            continue;
+         out->SetBinContent(bx, by, out->GetBinContent(bx, by) + w);
+         const double err2 = out->GetBinError(bx, by) * out->GetBinError(bx, by) + e * e;
+         out->SetBinError(bx, by, std::sqrt(std::max(0.0, err2)));
+      }
+   }
+   return out;
+}
+
+inline TH1D *RebinPriorToMeasurementBinning(const TH1D *priorFine, const TH1D *measTemplate, const char *name)
+{
+   const int nCoarse = measTemplate->GetNbinsX();
+   TH1D *out = MakeHist1DWithEdges(name, priorFine->GetTitle(), ExtractAxisEdges(measTemplate->GetXaxis()));
+
+   for (int ib = 1; ib <= priorFine->GetNbinsX(); ++ib)
+   {
+      const double x = priorFine->GetXaxis()->GetBinCenter(ib);
+      const int b = out->GetXaxis()->FindBin(x);
+      if (b < 1 || b > nCoarse)
+         continue;
+      const double w = priorFine->GetBinContent(ib);
+      if (w == 0.0)
+         continue;
+      out->SetBinContent(b, out->GetBinContent(b) + w);
+   }
+   return out;
+}
+
+// Each true-activity row scaled to unit sum (for display)
+inline TH2D *NormalizeResponseRows(const TH2D *resp, const char *name)
+{
+   TH2D *h = (TH2D *)resp->Clone(name);
+   h->SetDirectory(nullptr);
+   for (int x = 1; x <= h->GetNbinsX(); ++x)
+   {
+      double sumRow = 0.0;
+      for (int y = 1; y <= h->GetNbinsY(); ++y)
+         sumRow += h->GetBinContent(x, y);
+      if (sumRow > 0.0)
+      {
+         for (int y = 1; y <= h->GetNbinsY(); ++y)
+            h->SetBinContent(x, y, h->GetBinContent(x, y) / sumRow);
+      }
+   }
+   return h;
+}
+
+inline TH1D *BuildFlatPrior(const TH1D *prior, const char *name)
+{
+   TH1D *h = (TH1D *)prior->Clone(name);
+   h->SetDirectory(nullptr);
+   for (int i = 1; i <= h->GetNbinsX(); ++i)
+      h->SetBinContent(i, 1.0);
+   return h;
+}
+
+inline TH1D *BuildRatio(const TH1D *num, const TH1D *den, const char *name, const char *title)
+{
+   TH1D *r = (TH1D *)num->Clone(name);
+   r->SetDirectory(nullptr);
+   r->SetTitle(title);
+   r->Divide(den);
+   return r;
+}
+
+// d(n/d)/dn = 1/d and d(n/d)/dd = -n/d^2 per bin, zero where the denominator is empty
+inline void RatioDerivatives(const TH1D *num, const TH1D *den, std::vector<double> &dNum, std::vector<double> &dDen)
+{
+   const int n = num->GetNbinsX();
+   dNum.assign(n, 0.0);
+   dDen.assign(n, 0.0);
+   for (int i = 0; i < n; ++i)
+   {
+      const double d = den->GetBinContent(i + 1);
+      if (d == 0.0)
+         continue;
+      dNum[i] = 1.0 / d;
+      dDen[i] = -num->GetBinContent(i + 1) / (d * d);
+   }
+}
+
+// Ratio of two spectra with bin-to-bin correlated errors (a null covariance means uncorrelated
+// bins with the histogram errors) and, with numDenCov (Cnd_tu = cov(n_t, d_u)), correlated
+// numerator and denominator:
+//
+//    Cov(R)_tu = Cn_tu / (d_t d_u) + n_t n_u Cd_tu / (d_t^2 d_u^2)
+//                - n_u Cnd_tu / (d_t d_u^2) - n_t Cnd_ut / (d_t^2 d_u)
+//
+// The bin errors are the diagonal (the same as Divide() for diagonal independent inputs);
+// ratioCov, when given, gets the full matrix.  Bins with an empty denominator are zero with no
+// error.
+inline TH1D *BuildRatio(const TH1D *num, const TH1D *den, const char *name, const char *title,
+                        const TMatrixD *numCov, const TMatrixD *denCov, TMatrixD *ratioCov = nullptr,
+                        const TMatrixD *numDenCov = nullptr)
+{
+   TH1D *r = BuildRatio(num, den, name, title);
+   const int n = r->GetNbinsX();
+   std::vector<double> dNum, dDen;
+   RatioDerivatives(num, den, dNum, dDen);
+   auto Cov = [](const TMatrixD *cov, const TH1D *h, int i, int j)
+   {
+      if (cov != nullptr)
+         return (*cov)(i, j);
+      return (i == j) ? h->GetBinError(i + 1) * h->GetBinError(i + 1) : 0.0;
+   };
+
+   if (ratioCov != nullptr)
+      ratioCov->ResizeTo(n, n);
+   for (int i = 0; i < n; ++i)
+   {
+      for (int j = 0; j <= i; ++j)
+      {
+         if (ratioCov == nullptr && j != i)
+            continue;
+         double c = dNum[i] * dNum[j] * Cov(numCov, num, i, j) + dDen[i] * dDen[j] * Cov(denCov, den, i, j);
+         if (numDenCov != nullptr)
+            c += dNum[i] * dDen[j] * (*numDenCov)(i, j) + dDen[i] * dNum[j] * (*numDenCov)(j, i);
+         if (ratioCov != nullptr)
+            (*ratioCov)(i, j) = (*ratioCov)(j, i) = c;
+         if (i == j)
+            r->SetBinError(i + 1, std::sqrt(std::max(0.0, c)));
+      }
+   }
+   return r;
+}
+
+// Covariance matrix as a histogram on the binning of h (for writing out)
+inline TH2D *CovarianceHist(const TMatrixD &cov, const TH1D *h, const char *name, const char *title)
+{
+   const std::vector<double> edges = ExtractAxisEdges(h->GetXaxis());
+   TH2D *out = MakeHist2DWithEdges(name, title, edges, edges);
+   const int n = static_cast<int>(edges.size()) - 1;
+   for (int i = 0; i < n && i < cov.GetNrows(); ++i)
+      for (int j = 0; j < n && j < cov.GetNcols(); ++j)
+         out->SetBinContent(i + 1, j + 1, cov(i, j));
+   return out;
+}
+
+// Covariance of a = J_a x and b = J_b x for inputs x with uncorrelated variances var (one Jacobian
+// row of var.size() entries per output bin):
+//
+//    Cov(a_t, b_u) = sum_i J_a[t][i] var_i J_b[u][i]
+//
+// A missing (empty) Jacobian gives zero: that input does not enter the unfolding.
+inline TMatrixD CrossCovariance(const std::vector<double> &jA, const std::vector<double> &jB,
+                                const std::vector<double> &var, int nA, int nB)
+{
+   TMatrixD cov(nA, nB);
+   const int n = static_cast<int>(var.size());
+   if (jA.size() != static_cast<size_t>(nA) * n || jB.size() != static_cast<size_t>(nB) * n)
+      return cov;
+   for (int t = 0; t < nA; ++t)
+      for (int u = 0; u < nB; ++u)
+      {
+         double c = 0.0;
+         for (int i = 0; i < n; ++i)
+            c += jA[t * n + i] * var[i] * jB[u * n + i];
+         cov(t, u) = c;
+      }
+   return cov;
+}
+
+// Jacobian rows scaled per output bin, d(f_t g_t)/dx = f_t dg_t/dx for f held fixed (chain rule
+// into a ratio with the factors of RatioDerivatives())
+inline std::vector<double> ScaleRows(const std::vector<double> &j, const std::vector<double> &scale)
+{
+   std::vector<double> out(j);
+   const size_t nRow = scale.size();
+   if (nRow == 0 || out.size() % nRow != 0)
+      return out;
+   const size_t n = out.size() / nRow;
+   for (size_t t = 0; t < nRow; ++t)
+      for (size_t i = 0; i < n; ++i)
+         out[t * n + i] *= scale[t];
+   return out;
+}
+
+// Reco spectrum expected from truth: sum_t P(r | t) truth_t
+inline TH1D *FoldTruth1D(const TH1D *truth, const TH2D *respTrueReco, const char *name, const char *title)
+{
+   const int nTrue = respTrueReco->GetNbinsX();
+   const int nReco = respTrueReco->GetNbinsY();
+   TH1D *h = MakeHist1DWithEdges(name, title, ExtractAxisEdges(respTrueReco->GetYaxis()));
+
+   for (int t = 1; t <= nTrue; ++t)
+   {
+      const double truthVal = truth->GetBinContent(t);
+      const double truthErr = truth->GetBinError(t);
+      double colSum = 0.0;
+      for (int r = 1; r <= nReco; ++r)
+         colSum += respTrueReco->GetBinContent(t, r);
+      if (colSum <= 0.0)
+         continue;
+      for (int r = 1; r <= nReco; ++r)
+      {
+         const double prob = respTrueReco->GetBinContent(t, r) / colSum;
+         h->SetBinContent(r, h->GetBinContent(r) + prob * truthVal);
+         const double err2 = h->GetBinError(r) * h->GetBinError(r) + prob * prob * truthErr * truthErr;
+         h->SetBinError(r, std::sqrt(std::max(0.0, err2)));
+      }
+   }
+   return h;
+}
+
+// Truth reweighted by max(0.25, 1 + slope x_norm), x_norm in [-1, 1] across the axis, at fixed
+// integral
+inline TH1D *BuildWeightedTruth(const TH1D *src, double slope, const char *name, const char *title)
+{
+   TH1D *h = (TH1D *)src->Clone(name);
+   h->SetDirectory(nullptr);
+   h->SetTitle(title);
+   const double xmin = h->GetXaxis()->GetXmin();
+   const double xmax = h->GetXaxis()->GetXmax();
+   const double center = 0.5 * (xmin + xmax);
+   const double halfRange = std::max(1e-9, 0.5 * (xmax - xmin));
+   const double origIntegral = h->Integral();
+
+   for (int ib = 1; ib <= h->GetNbinsX(); ++ib)
+   {
+      const double x = h->GetXaxis()->GetBinCenter(ib);
+      const double xnorm = (x - center) / halfRange;
+      const double weight = std::max(0.25, 1.0 + slope * xnorm);
+      h->SetBinContent(ib, h->GetBinContent(ib) * weight);
+      h->SetBinError(ib, h->GetBinError(ib) * weight);
+   }
+
+   const double newIntegral = h->Integral();
+   if (origIntegral > 0.0 && newIntegral > 0.0)
+      h->Scale(origIntegral / newIntegral);
+   return h;
+}
+
+// Bin contents as arrays: in-range bins of a histogram, response as resp[t * nReco + r]
+inline std::vector<double> BinValues(const TH1D *h)
+{
+   std::vector<double> v(h->GetNbinsX());
+   for (int i = 0; i < h->GetNbinsX(); ++i)
+      v[i] = h->GetBinContent(i + 1);
+   return v;
+}
+
+inline std::vector<double> BinErrors(const TH1D *h)
+{
+   std::vector<double> v(h->GetNbinsX());
+   for (int i = 0; i < h->GetNbinsX(); ++i)
+      v[i] = h->GetBinError(i + 1);
+   return v;
+}
+
+inline std::vector<double> ResponseValues(const TH2D *respTrueReco)
+{
+   const int nTrue = respTrueReco->GetNbinsX();
+   const int nReco = respTrueReco->GetNbinsY();
+   std::vector<double> v(nTrue * nReco);
+   for (int t = 0; t < nTrue; ++t)
+      for (int r = 0; r < nReco; ++r)
+         v[t * nReco + r] = respTrueReco->GetBinContent(t + 1, r + 1);
+   return v;
+}
+
+inline std::vector<double> ResponseErrors(const TH2D *respTrueReco)
+{
+   const int nTrue = respTrueReco->GetNbinsX();
+   const int nReco = respTrueReco->GetNbinsY();
+   std::vector<double> v(nTrue * nReco);
+   for (int t = 0; t < nTrue; ++t)
+      for (int r = 0; r < nReco; ++r)
+         v[t * nReco + r] = respTrueReco->GetBinError(t + 1, r + 1);
+   return v;
+}
+
+// Convergence test between successive Bayes iterations k-1 and k:
+//
+//    chi2_k = sum_t (u^k_t - u^(k-1)_t)^2 / var(u^k_t),   change_k = sum_t |u^k_t - u^(k-1)_t| / sum_t u^k_t
+//
+// with the propagated variance when a covariance is computed and u^k_t otherwise; iteration 1
+// is compared with the prior scaled to its total.  Iteration k passes when k >= MinIter and
+// chi2_k / nTrue < Chi2PerBin or change_k < RelativeChange; a non-positive tolerance switches
+// that test off.
+struct BayesStopping
+{
+   int MinIter;
+   double Chi2PerBin;
+   double RelativeChange;
+
+   BayesStopping() : MinIter(1), Chi2PerBin(0.0), RelativeChange(0.0) {}
+   bool Enabled() const {return Chi2PerBin > 0.0 || RelativeChange > 0.0;}
+   bool Passed(int iteration, double chi2PerBin, double relativeChange) const
+   {
+      if (iteration < MinIter)
+         return false;
+      return (Chi2PerBin > 0.0 && chi2PerBin < Chi2PerBin) || (RelativeChange > 0.0 && relativeChange < RelativeChange);
+   }
+};
+
+// Every iteration of one run, entry k-1 after k iterations
+struct BayesTrajectory
+{
+   std::vector<std::vector<double>> Unfolded;
+   std::vector<TMatrixD> Covariance;       // only when the run computes a covariance
+   std::vector<std::vector<double>> MeasJacobian;       // [t * nReco + r], with the covariance
+   std::vector<std::vector<double>> ResponseJacobian;   // [t * nCell + c], with the covariance
+   std::vector<double> Chi2PerBin;
+   std::vector<double> RelativeChange;
+
+   int NIterations() const {return static_cast<int>(Unfolded.size());}
+   // First iteration passing stopping, or the last one
+   int Converged(const BayesStopping &stopping) const
+   {
+      for (int k = 1; k <= NIterations(); ++k)
+         if (stopping.Passed(k, Chi2PerBin[k - 1], RelativeChange[k - 1]))
+            return k;
+      return NIterations();
+   }
+};
+
+// D'Agostini iterative Bayes on arrays: nIter iterations starting from prior (normalized
+// internally; flat if empty), resp[t * nReco + r] with nTrue = prior.size(), nReco = meas.size().
+// With stopping the run ends at the first iteration passing it (nIter is then the maximum);
+// trajectory, when given, gets every iteration of the run (with its covariance and the
+// Jacobians behind it if computed).
+//
+// With a covariance to fill, the derivatives of the result w.r.t. the measurement and the
+// response cells are carried through every iteration (the prior of iteration k depends on both
+// through iteration k-1) and
+//
+//    Cov = J_m diag(measErr^2) J_m^T + J_R diag(respErr^2) J_R^T
+//
+// with uncorrelated bins and cells.  Without measErr / respErr that term is left out;
+// responseCovariance, when given, gets the second term alone.
+inline void IterativeBayesUnfold(const std::vector<double> &meas, const std::vector<double> &resp,
+                                 const std::vector<double> &priorIn, int nIter, std::vector<double> &unfolded,
+                                 const std::vector<double> *measErr = nullptr,
+                                 const std::vector<double> *respErr = nullptr,
+                                 TMatrixD *covariance = nullptr, TMatrixD *responseCovariance = nullptr,
+                                 const BayesStopping *stopping = nullptr, BayesTrajectory *trajectory = nullptr)
+{
+   const int nTrue = static_cast<int>(priorIn.size());
+   const int nReco = static_cast<int>(meas.size());
+   const int nCell = nTrue * nReco;
+   const bool doMeas = (covariance != nullptr && measErr != nullptr);
+   const bool doResp = ((covariance != nullptr || responseCovariance != nullptr) && respErr != nullptr);
+
+   std::vector<double> prior(nTrue, 0.0);
+   double sumPrior = 0.0;
+   for (int t = 0; t < nTrue; ++t)
+   {
+      prior[t] = std::max(0.0, priorIn[t]);
+      sumPrior += prior[t];
+   }
+   if (sumPrior <= 0.0)
+   {
+      for (int t = 0; t < nTrue; ++t)
+         prior[t] = 1.0 / nTrue;
+   }
+   else
+   {
+      for (int t = 0; t < nTrue; ++t)
+         prior[t] /= sumPrior;
+   }
+
+   std::vector<double> P(nCell);
+   for (int i = 0; i < nCell; ++i)
+      P[i] = std::max(0.0, resp[i]);
+
+   // d(unfolded_t)/d(meas_r) and d(unfolded_t)/d(resp_c) of the current iteration, and the same
+   // for its prior; all zero for the input prior
+   std::vector<double> jMeas, jResp, jPriorMeas, jPriorResp;
+   if (doMeas)
+   {
+      jMeas.assign(nTrue * nReco, 0.0);
+      jPriorMeas.assign(nTrue * nReco, 0.0);
+   }
+   if (doResp)
+   {
+      jResp.assign(nTrue * nCell, 0.0);
+      jPriorResp.assign(nTrue * nCell, 0.0);
+   }
+   std::vector<double> M(nCell, 0.0), norm(nReco, 0.0), dPrior(nTrue * nTrue, 0.0);
+
+   // Covariance of the current iteration from its derivatives
+   auto FillCovariance = [&](TMatrixD *cov, TMatrixD *respCov)
+   {
+      if (cov != nullptr)
+         cov->ResizeTo(nTrue, nTrue);
+      if (respCov != nullptr)
+         respCov->ResizeTo(nTrue, nTrue);
+      for (int t = 0; t < nTrue; ++t)
+      {
+         for (int u = 0; u <= t; ++u)
+         {
+            double cMeas = 0.0, cResp = 0.0;
+            if (doMeas)
+               for (int r = 0; r < nReco; ++r)
+                  cMeas += jMeas[t * nReco + r] * jMeas[u * nReco + r] * (*measErr)[r] * (*measErr)[r];
+            if (doResp)
+               for (int c = 0; c < nCell; ++c)
+                  cResp += jResp[t * nCell + c] * jResp[u * nCell + c] * (*respErr)[c] * (*respErr)[c];
+            if (cov != nullptr)
+               (*cov)(t, u) = (*cov)(u, t) = cMeas + cResp;
+            if (respCov != nullptr)
+               (*respCov)(t, u) = (*respCov)(u, t) = cResp;
+         }
+      }
+   };
+
+   const bool track = (trajectory != nullptr || stopping != nullptr);
+   if (trajectory != nullptr)
+      *trajectory = BayesTrajectory();
+   std::vector<double> previous = prior;
+   TMatrixD iterationCovariance;
+
+   unfolded.assign(nTrue, 0.0);
+   std::vector<double> newPrior(nTrue, 0.0);
+   for (int iter = 0; iter < nIter; ++iter)
+   {
+      std::fill(unfolded.begin(), unfolded.end(), 0.0);
+      std::fill(M.begin(), M.end(), 0.0);
+
+      for (int r = 0; r < nReco; ++r)
+      {
+         norm[r] = 0.0;
+         for (int t = 0; t < nTrue; ++t)
+            norm[r] += P[t * nReco + r] * prior[t];
+         if (norm[r] <= 0.0)
+            continue;
+         for (int t = 0; t < nTrue; ++t)
+            M[t * nReco + r] = (P[t * nReco + r] * prior[t]) / norm[r];
+
+         const double mr = std::max(0.0, meas[r]);
+         if (mr == 0.0)
+            continue;
+         for (int t = 0; t < nTrue; ++t)
+            unfolded[t] += M[t * nReco + r] * mr;
+      }
+
+      if (doMeas || doResp)
+      {
+         // d(unfolded_t)/d(prior_s) = delta_ts sum_r m_r P_tr / N_r - sum_r m_r M_tr P_sr / N_r
+         std::fill(dPrior.begin(), dPrior.end(), 0.0);
+         for (int r = 0; r < nReco; ++r)
+         {
+            const double mr = std::max(0.0, meas[r]);
+            if (mr == 0.0 || norm[r] <= 0.0)
+               continue;
+            const double scale = mr / norm[r];
+            for (int t = 0; t < nTrue; ++t)
+            {
+               dPrior[t * nTrue + t] += scale * P[t * nReco + r];
+               for (int s = 0; s < nTrue; ++s)
+                  dPrior[t * nTrue + s] -= scale * M[t * nReco + r] * P[s * nReco + r];
+            }
+         }
+
+         if (doMeas)
+         {
+            std::vector<double> next(nTrue * nReco, 0.0);
+            for (int t = 0; t < nTrue; ++t)
+               for (int r = 0; r < nReco; ++r)
+               {
+                  double v = (meas[r] >= 0.0) ? M[t * nReco + r] : 0.0;
+                  if (iter > 0)
+                     for (int s = 0; s < nTrue; ++s)
+                        v += dPrior[t * nTrue + s] * jPriorMeas[s * nReco + r];
+                  next[t * nReco + r] = v;
+               }
+            jMeas.swap(next);
+         }
+
+         if (doResp)
+         {
+            // direct term d(unfolded_t)/d(resp_ab) = m_b prior_a (delta_ta - M_tb) / N_b
+            std::vector<double> next(nTrue * nCell, 0.0);
+            for (int b = 0; b < nReco; ++b)
+            {
+               const double mb = std::max(0.0, meas[b]);
+               if (mb == 0.0 || norm[b] <= 0.0)
+                  continue;
+               for (int a = 0; a < nTrue; ++a)
+               {
+                  if (resp[a * nReco + b] < 0.0)
+                     continue;
+                  const double scale = mb * prior[a] / norm[b];
+                  for (int t = 0; t < nTrue; ++t)
+                     next[t * nCell + a * nReco + b] = scale * ((t == a ? 1.0 : 0.0) - M[t * nReco + b]);
+               }
+            }
+            if (iter > 0)
+               for (int t = 0; t < nTrue; ++t)
+                  for (int s = 0; s < nTrue; ++s)
+                  {
+                     const double d = dPrior[t * nTrue + s];
+                     if (d == 0.0)
+                        continue;
+                     for (int c = 0; c < nCell; ++c)
+                        next[t * nCell + c] += d * jPriorResp[s * nCell + c];
+                  }
+            jResp.swap(next);
+         }
+      }
+
+      double s = 0.0;
+      for (double v : unfolded)
+         s += std::max(0.0, v);
+      if (s <= 0.0)
+      {
+         std::fill(jMeas.begin(), jMeas.end(), 0.0);
+         std::fill(jResp.begin(), jResp.end(), 0.0);
+         break;
+      }
+
+      if (track)
+      {
+         const bool withCovariance = (covariance != nullptr);
+         if (withCovariance)
+            FillCovariance(&iterationCovariance, nullptr);
+         const double scale = (iter == 0) ? s : 1.0;   // prior of iteration 1 has unit sum
+         double chi2 = 0.0, change = 0.0;
+         for (int t = 0; t < nTrue; ++t)
+         {
+            const double u = std::max(0.0, unfolded[t]);
+            const double d = u - scale * previous[t];
+            const double var = (withCovariance && iterationCovariance(t, t) > 0.0) ? iterationCovariance(t, t) : u;
+            if (var > 0.0)
+               chi2 += d * d / var;
+            change += std::fabs(d);
+            previous[t] = u;
+         }
+         const double chi2PerBin = chi2 / nTrue;
+         change /= s;
+         if (trajectory != nullptr)
+         {
+            trajectory->Unfolded.push_back(previous);
+            if (withCovariance)
+            {
+               trajectory->Covariance.push_back(iterationCovariance);
+               trajectory->MeasJacobian.push_back(jMeas);
+               trajectory->ResponseJacobian.push_back(jResp);
+            }
+            trajectory->Chi2PerBin.push_back(chi2PerBin);
+            trajectory->RelativeChange.push_back(change);
+         }
+         if (stopping != nullptr && stopping->Enabled() && stopping->Passed(iter + 1, chi2PerBin, change))
+            break;
+      }
+      for (int t = 0; t < nTrue; ++t)
+         newPrior[t] = std::max(0.0, unfolded[t]) / s;
+
+      // prior = unfolded / sum(unfolded): d prior_s = (d unfolded_s - prior_s sum_q d unfolded_q) / sum
+      if (doMeas && iter + 1 < nIter)
+         for (int r = 0; r < nReco; ++r)
+         {
+            double total = 0.0;
+            for (int q = 0; q < nTrue; ++q)
+               total += jMeas[q * nReco + r];
+            for (int q = 0; q < nTrue; ++q)
+               jPriorMeas[q * nReco + r] = (jMeas[q * nReco + r] - newPrior[q] * total) / s;
+         }
+      if (doResp && iter + 1 < nIter)
+         for (int c = 0; c < nCell; ++c)
+         {
+            double total = 0.0;
+            for (int q = 0; q < nTrue; ++q)
+               total += jResp[q * nCell + c];
+            for (int q = 0; q < nTrue; ++q)
+               jPriorResp[q * nCell + c] = (jResp[q * nCell + c] - newPrior[q] * total) / s;
+         }
+      prior.swap(newPrior);
+   }
+
+   for (double &v : unfolded)
+      v = std::max(0.0, v);
+   FillCovariance(covariance, responseCovariance);
+}
+
+// Histogram front end.  The bin errors and the covariance, when given, are the propagated ones
+// from the measurement errors and the response bin errors
+inline TH1D *IterativeBayesUnfold1D(const TH1D *meas, const TH2D *respTrueReco, const TH1D *priorHist, int nIter,
+                                    const char *name, TMatrixD *covariance = nullptr)
+{
+   const int nTrue = respTrueReco->GetNbinsX();
+   const int nReco = respTrueReco->GetNbinsY();
+   if (meas->GetNbinsX() != nReco || priorHist->GetNbinsX() != nTrue)
+   {
+      Error("IterativeBayesUnfold1D", "Histogram binning mismatch");
+      return CloneEmptyLike(priorHist, name);
+   }
+
+   std::vector<double> unfolded;
+   const std::vector<double> measErr = BinErrors(meas);
+   const std::vector<double> respErr = ResponseErrors(respTrueReco);
+   TMatrixD localCovariance;
+   TMatrixD &cov = (covariance != nullptr) ? *covariance : localCovariance;
+   IterativeBayesUnfold(BinValues(meas), ResponseValues(respTrueReco), BinValues(priorHist), nIter, unfolded,
+                        &measErr, &respErr, &cov);
+
+   TH1D *h = CloneEmptyLike(priorHist, name);
+   for (int t = 1; t <= nTrue; ++t)
+   {
+      h->SetBinContent(t, unfolded[t - 1]);
+      h->SetBinError(t, std::sqrt(std::max(0.0, cov(t - 1, t - 1))));
+   }
+   return h;
+}
+
+// All iterations 1..maxIter of one Bayes run as histograms <stem>Iter<k><suffix>, with the propagated
+// errors; trajectory gets the arrays, covariances and convergence measures
+inline std::vector<TH1D *> IterativeBayesTrajectory1D(const TH1D *meas, const TH2D *respTrueReco, const TH1D *priorHist,
+                                                      int maxIter, const std::string &stem, const std::string &suffix,
+                                                      BayesTrajectory &trajectory)
+{
+   std::vector<TH1D *> hists;
+   trajectory = BayesTrajectory();
+   if (meas->GetNbinsX() != respTrueReco->GetNbinsY() || priorHist->GetNbinsX() != respTrueReco->GetNbinsX())
+   {
+      Error("IterativeBayesTrajectory1D", "Histogram binning mismatch");
+      return hists;
+   }
+
+   std::vector<double> unfolded;
+   const std::vector<double> measErr = BinErrors(meas);
+   const std::vector<double> respErr = ResponseErrors(respTrueReco);
+   TMatrixD cov;
+   IterativeBayesUnfold(BinValues(meas), ResponseValues(respTrueReco), BinValues(priorHist), maxIter, unfolded,
+                        &measErr, &respErr, &cov, nullptr, nullptr, &trajectory);
+
+   for (int k = 1; k <= trajectory.NIterations(); ++k)
+   {
+      TH1D *h = CloneEmptyLike(priorHist, (stem + "Iter" + std::to_string(k) + suffix).c_str());
+      for (int t = 1; t <= h->GetNbinsX(); ++t)
+      {
+         h->SetBinContent(t, trajectory.Unfolded[k - 1][t - 1]);
+         h->SetBinError(t, std::sqrt(std::max(0.0, trajectory.Covariance[k - 1](t - 1, t - 1))));
+      }
+      hists.push_back(h);
+   }
+   return hists;
+}
+
+// Truncated-SVD unfolding with the decomposition of the response done once.
+//
+// A = U S V^T is the column-normalized response (reco x true).  Keeping the k largest singular
+// values, the solution for a measurement m with errors e is
+//
+//    x_k = sum_{i<k} c_i v_i,           c_i = (u_i . m) / s_i
+//    Cov(x_k) = V_k G_k V_k^T,          G_ij = sum_r u_ri u_rj e_r^2 / (s_i s_j)
+//
+// so Project() does the O(n^2) work for one measurement, and Solution() gives x_k and its full
+// covariance for any k from it.  A kReg scan costs one decomposition per response, one
+// projection per measurement and a few matrix-vector products per k.
+class SVDUnfolder
+{
+public:
+   struct Projection
+   {
+      std::vector<double> Coefficient;   // c_i, zero where s_i is negligible
+      TMatrixD G;
+   };
+
+private:
+   int NTrue;
+   int NReco;
+   bool Valid;
+   std::vector<double> TrueEdges;   // only with the histogram constructor
+   TMatrixD U;
+   TMatrixD V;
+   std::vector<double> Sig;
+
+   void Decompose(const std::vector<double> &resp)
+   {
+      TMatrixD A(NReco, NTrue);
+      for (int t = 0; t < NTrue; ++t)
+      {
+         double colSum = 0.0;
+         for (int r = 0; r < NReco; ++r)
+            colSum += resp[t * NReco + r];
+         if (colSum <= 0.0)
+            continue;
+         for (int r = 0; r < NReco; ++r)
+            A(r, t) = resp[t * NReco + r] / colSum;
+      }
+
+      TDecompSVD svd(A);
+      if (!svd.Decompose())
+      {
+         Error("SVDUnfolder", "SVD decomposition failed");
+         return;
+      }
+      const TVectorD sig = svd.GetSig();
+      U.ResizeTo(NReco, NReco);
+      V.ResizeTo(NTrue, NTrue);
+      U = svd.GetU();
+      V = svd.GetV();
+      Sig.resize(sig.GetNrows());
+      for (int i = 0; i < sig.GetNrows(); ++i)
+         Sig[i] = sig(i);
+      Valid = true;
+   }
+
+public:
+   explicit SVDUnfolder(const TH2D *respTrueReco)
+      : NTrue(respTrueReco->GetNbinsX()), NReco(respTrueReco->GetNbinsY()), Valid(false),
+        TrueEdges(ExtractAxisEdges(respTrueReco->GetXaxis()))
+   {
+      Decompose(ResponseValues(respTrueReco));
+   }
+
+   // resp[t * nReco + r]
+   SVDUnfolder(int nTrue, int nReco, const std::vector<double> &resp)
+      : NTrue(nTrue), NReco(nReco), Valid(false)
+   {
+      Decompose(resp);
+   }
+
+   bool IsValid() const {return Valid;}
+   int GetNTrue() const {return NTrue;}
+   int GetNReco() const {return NReco;}
+   int GetNSig() const {return static_cast<int>(Sig.size());}
+   // Number of singular values kept for a requested kReg
+   int Truncation(int kReg) const {return std::max(1, std::min(kReg, GetNSig()));}
+
+   Projection Project(const std::vector<double> &meas, const std::vector<double> &measErr) const
+   {
+      const int nSig = GetNSig();
+      Projection p;
+      p.Coefficient.assign(nSig, 0.0);
+      p.G.ResizeTo(nSig, nSig);
+
+      std::vector<double> invSig(nSig, 0.0);
+      for (int i = 0; i < nSig; ++i)
+         if (Sig[i] > 1e-12)
+            invSig[i] = 1.0 / Sig[i];
+
+      for (int i = 0; i < nSig; ++i)
+      {
+         if (invSig[i] == 0.0)
+            continue;
+         double dot = 0.0;
+         for (int r = 0; r < NReco; ++r)
+            dot += U(r, i) * meas[r];
+         p.Coefficient[i] = dot * invSig[i];
+
+         for (int j = 0; j <= i; ++j)
+         {
+            if (invSig[j] == 0.0)
+               continue;
+            double g = 0.0;
+            for (int r = 0; r < NReco; ++r)
+               g += U(r, i) * U(r, j) * measErr[r] * measErr[r];
+            p.G(i, j) = p.G(j, i) = g * invSig[i] * invSig[j];
+         }
+      }
+      return p;
+   }
+
+   Projection Project(const TH1D *meas) const {return Project(BinValues(meas), BinErrors(meas));}
+
+   // Solution with kReg singular values, clipped at zero, and its uncertainties; covariance
+   // (NTrue x NTrue) is filled too when given
+   void Solve(const Projection &p, int kReg, std::vector<double> &x, std::vector<double> &err,
+              TMatrixD *covariance = nullptr) const
+   {
+      const int k = Truncation(kReg);
+      x.assign(NTrue, 0.0);
+      err.assign(NTrue, 0.0);
+      for (int t = 0; t < NTrue; ++t)
+      {
+         double v = 0.0;
+         for (int i = 0; i < k; ++i)
+            v += V(t, i) * p.Coefficient[i];
+         x[t] = std::max(0.0, v);
+      }
+
+      if (covariance != nullptr)
+         covariance->ResizeTo(NTrue, NTrue);
+      for (int t = 0; t < NTrue; ++t)
+      {
+         for (int u = 0; u <= t; ++u)
+         {
+            if (covariance == nullptr && u != t)
+               continue;
+            double c = 0.0;
+            for (int i = 0; i < k; ++i)
+               for (int j = 0; j < k; ++j)
+                  c += V(t, i) * p.G(i, j) * V(u, j);
+            if (covariance != nullptr)
+               (*covariance)(t, u) = (*covariance)(u, t) = c;
+            if (u == t)
+               err[t] = std::sqrt(std::max(0.0, c));
+         }
+      }
+   }
+
+   // d x_t / d m_r = sum_{i<k} V_ti U_ri / s_i, [t * NReco + r]: the linear map behind Solve()
+   // (the clipping at zero is not differentiated, as for the covariance)
+   std::vector<double> Jacobian(int kReg) const
+   {
+      const int k = Truncation(kReg);
+      std::vector<double> j(NTrue * NReco, 0.0);
+      for (int i = 0; i < k; ++i)
+      {
+         if (Sig[i] <= 1e-12)
+            continue;
+         for (int t = 0; t < NTrue; ++t)
+            for (int r = 0; r < NReco; ++r)
+               j[t * NReco + r] += V(t, i) * U(r, i) / Sig[i];
+      }
+      return j;
+   }
+
+   // Histogram versions (histogram constructor only)
+   TH1D *Solution(const Projection &p, int kReg, const char *name, TMatrixD *covariance = nullptr) const
+   {
+      std::vector<double> x, err;
+      Solve(p, kReg, x, err, covariance);
+      TH1D *h = MakeHist1DWithEdges(name, name, TrueEdges);
+      for (int t = 0; t < NTrue; ++t)
+      {
+         h->SetBinContent(t + 1, x[t]);
+         h->SetBinError(t + 1, err[t]);
+      }
+      return h;
+   }
+
+   TH1D *Unfold(const TH1D *meas, int kReg, const char *name, TMatrixD *covariance = nullptr) const
+   {
+      if (!Valid)
+         return nullptr;
+      if (meas->GetNbinsX() != NReco)
+      {
+         Error("SVDUnfolder", "Measurement/response binning mismatch");
+         return nullptr;
+      }
+      return Solution(Project(meas), kReg, name, covariance);
+   }
+};
+
+// Pseudo-inverse of the column-normalized response keeping the kReg largest singular values
+inline TH1D *SVDUnfold1D(const TH1D *meas, const TH2D *respTrueReco, int kReg, const char *name)
+{
+   return SVDUnfolder(respTrueReco).Unfold(meas, kReg, name);
+}
+
+// Batch interface --------------------------------------------------------------------------------
+
+// One species, already collapsed and rebinned to the measurement binning
+struct SpeciesInput
+{
+   std::string Name;                  // histogram names: h<Name><Sample>Bayes<Suffix>, ...
+   std::string Title;                 // ROOT latex, "K", "#pi", "p"
+   const TH2D *Response;              // true x reco
+   const TH1D *Prior;                 // MC truth
+   const TH1D *Reco[SampleCount];     // measured spectra
+   double StressSlope;                // slope of the injected truth of the stress test
+
+   SpeciesInput() : Response(nullptr), Prior(nullptr), Reco{nullptr, nullptr}, StressSlope(0.0) {}
+};
+
+// With Stopping enabled the nominal number of Bayes iterations is the first one passing it (at
+// most NIterMax, at least Stopping.MinIter) and the variation is one more; otherwise they are
+// NIter and NIterVar.  Either way all iterations come from one run per spectrum.
+struct Settings
+{
+   int NIter;               // nominal Bayes iterations
+   int NIterVar;            // iteration variation
+   int NIterMax;            // iterations recorded with Stopping
+   BayesStopping Stopping;
+   int KReg;                // SVD truncation
+   std::string Suffix;      // "_dNdEta", "_dNdY"
+
+   Settings() : NIter(1), NIterVar(2), NIterMax(20), KReg(8) {}
+};
+
+struct SpeciesResult
+{
+   TH1D *PriorFlat;
+   TH1D *Bayes[SampleCount];
+   TH1D *BayesPriorVar[SampleCount];   // flat prior
+   TH1D *BayesIterVar[SampleCount];    // NIterVar iterations
+   std::vector<TH1D *> BayesIterations[SampleCount];   // every iteration of the nominal-prior run
+   BayesTrajectory Trajectory[SampleCount];
+   int NIterUsed[SampleCount];
+   int NIterVarUsed[SampleCount];
+   TH1D *SVD[SampleCount];
+   TMatrixD BayesCovariance[SampleCount];   // of Bayes, measurement and response statistics
+   TMatrixD SVDCovariance[SampleCount];     // of SVD, measurement statistics
+   // Jacobians of Bayes (measurement [t * nReco + r], response cells [t * nCell + c]) and SVD
+   // (measurement), for the cross covariances with other unfoldings
+   std::vector<double> BayesMeasJacobian[SampleCount];
+   std::vector<double> BayesResponseJacobian[SampleCount];
+   std::vector<double> SVDMeasJacobian[SampleCount];
+   TH1D *BayesRefold[SampleCount];     // nominal Bayes folded back to reco
+   TH1D *StressTruth;                  // reweighted prior
+   TH1D *StressReco;                   // ... folded to reco
+   TH1D *StressUnfold;                 // ... and unfolded with the nominal prior
+};
+
+inline SpeciesResult UnfoldSpecies(const SpeciesInput &in, const Settings &settings)
+{
+   const std::string h = "h" + in.Name;
+   const std::string &suffix = settings.Suffix;
+   auto Name = [&](const std::string &what) {return h + what + suffix;};
+
+   const SVDUnfolder svd(in.Response);
+   SpeciesResult out;
+   out.PriorFlat = BuildFlatPrior(in.Prior, Name("PriorFlat").c_str());
+
+   // One Bayes run per spectrum covers the nominal and the iteration variation; with a stopping
+   // rule it goes one past NIterMax so that the variation exists for every choice
+   const bool converge = settings.Stopping.Enabled();
+   const int nIterMax = std::max(1, settings.NIterMax);
+   const int nRun = converge ? nIterMax + 1 : std::max(1, std::max(settings.NIter, settings.NIterVar));
+   for (int s = 0; s < SampleCount; ++s)
+   {
+      const std::string sample = SampleName[s];
+      const TH1D *reco = in.Reco[s];
+      out.BayesIterations[s] = IterativeBayesTrajectory1D(reco, in.Response, in.Prior, nRun,
+                                                          h + sample + "Bayes", suffix, out.Trajectory[s]);
+      if (out.BayesIterations[s].empty())   // binning mismatch: an empty result as before
+      {
+         out.BayesIterations[s].push_back(CloneEmptyLike(in.Prior, Name(sample + "BayesIter1").c_str()));
+         out.Trajectory[s].Covariance.push_back(TMatrixD(in.Prior->GetNbinsX(), in.Prior->GetNbinsX()));
+      }
+      const int nAvailable = static_cast<int>(out.BayesIterations[s].size());
+      const int nominal = converge ? std::min(out.Trajectory[s].Converged(settings.Stopping), nIterMax)
+                                   : std::max(1, settings.NIter);
+      out.NIterUsed[s] = std::max(1, std::min(nominal, nAvailable));
+      out.NIterVarUsed[s] = std::max(1, std::min(converge ? out.NIterUsed[s] + 1 : settings.NIterVar, nAvailable));
+
+      out.Bayes[s] = (TH1D *)out.BayesIterations[s][out.NIterUsed[s] - 1]->Clone(Name(sample + "Bayes").c_str());
+      out.Bayes[s]->SetDirectory(nullptr);
+      out.BayesCovariance[s].ResizeTo(in.Prior->GetNbinsX(), in.Prior->GetNbinsX());
+      out.BayesCovariance[s] = out.Trajectory[s].Covariance[out.NIterUsed[s] - 1];
+      if (static_cast<int>(out.Trajectory[s].MeasJacobian.size()) >= out.NIterUsed[s])
+      {
+         out.BayesMeasJacobian[s] = out.Trajectory[s].MeasJacobian[out.NIterUsed[s] - 1];
+         out.BayesResponseJacobian[s] = out.Trajectory[s].ResponseJacobian[out.NIterUsed[s] - 1];
+      }
+      // Only the Jacobians of the nominal iteration are kept (nTrue^3 numbers per iteration)
+      out.Trajectory[s].MeasJacobian.clear();
+      out.Trajectory[s].ResponseJacobian.clear();
+      out.BayesIterVar[s] = (TH1D *)out.BayesIterations[s][out.NIterVarUsed[s] - 1]->Clone(Name(sample + "BayesIterVar").c_str());
+      out.BayesIterVar[s]->SetDirectory(nullptr);
+      out.BayesPriorVar[s] = IterativeBayesUnfold1D(reco, in.Response, out.PriorFlat, out.NIterUsed[s],
+                                                    Name(sample + "BayesPriorVar").c_str());
+      out.SVD[s] = svd.Unfold(reco, settings.KReg, Name(sample + "SVD").c_str(), &out.SVDCovariance[s]);
+      if (svd.IsValid())
+         out.SVDMeasJacobian[s] = svd.Jacobian(settings.KReg);
+      out.BayesRefold[s] = FoldTruth1D(out.Bayes[s], in.Response, Name(sample + "BayesRefold").c_str(),
+                                       (std::string(SampleTitle[s]) + " " + in.Title + " refolded reco").c_str());
+   }
+
+   out.StressTruth = BuildWeightedTruth(in.Prior, in.StressSlope, Name("StressTruth").c_str(),
+                                        ("Injected " + in.Title + " truth").c_str());
+   out.StressReco = FoldTruth1D(out.StressTruth, in.Response, Name("StressReco").c_str(),
+                                ("Injected " + in.Title + " reco").c_str());
+   out.StressUnfold = IterativeBayesUnfold1D(out.StressReco, in.Response, in.Prior, out.NIterUsed[Mc],
+                                             Name("StressUnfold").c_str());
+   return out;
+}
+
+// Every species of the batch with the same settings
+inline std::vector<SpeciesResult> UnfoldBatch(const std::vector<SpeciesInput> &species, const Settings &settings)
+{
+   std::vector<SpeciesResult> results;
+   results.reserve(species.size());
+   for (const SpeciesInput &in : species)
+      results.push_back(UnfoldSpecies(in, settings));
+   return results;
+}
+}
+
+#endif
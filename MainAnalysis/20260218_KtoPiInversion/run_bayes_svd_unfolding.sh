@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+# Builds RunBayesSVDUnfolding when its sources changed and runs it with the given arguments
+set -euo pipefail
+
+HERE="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+ProjectBase="${ProjectBase:-$(cd "${HERE}/../.." && pwd)}"
+
+if ! command -v root-config >/dev/null 2>&1; then
+  source /raid5/root/root-v6.34.04/root/bin/thisroot.sh
+fi
+
+EXE="${HERE}/ExecuteBayesSVDUnfolding"
+SRC="${HERE}/RunBayesSVDUnfolding.cpp"
+HEADER="${HERE}/include/UnfoldingEngine.h"
+
+if [ ! -x "${EXE}" ] || [ "${SRC}" -nt "${EXE}" ] || [ "${HEADER}" -nt "${EXE}" ]; then
+  g++ -O3 -std=c++17 "${SRC}" -o "${EXE}" \
+    -I"${HERE}/include" -I"${ProjectBase}/CommonCode/include" \
+    $(root-config --cflags --libs) -lMatrix
+fi
+
+"${EXE}" "$@"
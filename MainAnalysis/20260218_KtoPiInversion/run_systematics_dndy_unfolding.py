@@ -18,6 +18,7 @@ INPUT_DATA = os.environ.get("KPI_INPUT_DATA", "sample/Strangeness/merged_data_v2
 INPUT_MC = os.environ.get("KPI_INPUT_MC", "sample/Strangeness/merged_pythia_v2.5.root")
 ANALYSIS_EXTRA_ARGS = shlex.split(os.environ.get("KPI_ANALYSIS_EXTRA_ARGS", ""))
 FINALIZE_SCRIPT = os.environ.get("KPI_DNDY_FINALIZER", "finalize_dndy_systematics.py")
+SINGLE_PASS = os.environ.get("KPI_SINGLE_PASS", "1") == "1"
 
 
 @dataclass
@@ -57,6 +58,25 @@ def run_analysis(input_file: str, output_file: str, args: Dict[str, str], requir
     run_cmd(cmd)
 
 
+def run_analysis_variations(input_file: str, outputs: Dict[str, str], variations: List[Variation],
+                            require_hist: str) -> None:
+    """Fill every variation in a single pass over input_file (KtoPiAnalysis --Variations)."""
+    if (not FORCE_RERUN) and all(has_hist(outputs[v.name], require_hist) for v in variations):
+        print("Skipping existing outputs for", input_file)
+        return
+    list_path = os.path.splitext(outputs[variations[0].name])[0] + "_variations.txt"
+    with open(list_path, "w") as f:
+        for v in variations:
+            words = [v.name, "--Output", outputs[v.name]]
+            for k, val in v.args.items():
+                words.extend([f"--{k}", str(val)])
+            f.write(" ".join(words) + "\n")
+    cmd = ["./ExecuteKtoPiAnalysis", "--Input", input_file, "--Output", os.path.dirname(list_path) or ".",
+           "--Variations", list_path]
+    cmd.extend(ANALYSIS_EXTRA_ARGS)
+    run_cmd(cmd)
+
+
 def run_unfold(
     mc_path: str,
     data_path: str,
@@ -71,10 +91,9 @@ def run_unfold(
         has_hist(out_path, "hDataOverMcSVD_dNdY")):
         print("Skipping existing unfolding:", out_path)
         return
-    macro_call = (
-        f'runDNdYUnfolding_BayesSVD.C({niter},{kreg},"{mc_path}","{data_path}","{out_path}","{response_path}",false,{keepbins_override})'
-    )
-    run_cmd(["root", "-l", "-b", "-q", macro_call])
+    run_cmd(["./run_bayes_svd_unfolding.sh", "--Axis", "DNdY", "--NIter", str(niter), "--KReg", str(kreg),
+             "--MC", mc_path, "--Data", data_path, "--Output", out_path, "--Response", response_path,
+             "--MakePlots", "false", "--KeepBins", str(keepbins_override), "--PtoPiOutput", "none"])
 
 
 def main():
@@ -92,12 +111,20 @@ def main():
     input_mc = INPUT_MC
     precomputed_dir = PRECOMPUTED_DIR
 
+    # One pass per sample fills all variations; KPI_SINGLE_PASS=0 runs them one by one
+    data_outs = {v.name: os.path.join(precomputed_dir, f"{v.name}_data.root") for v in variations}
+    mc_outs = {v.name: os.path.join(precomputed_dir, f"{v.name}_mc.root") for v in variations}
+    if SINGLE_PASS:
+        run_analysis_variations(input_data, data_outs, variations, "hKCorrectedDNdY")
+        run_analysis_variations(input_mc, mc_outs, variations, "hKCorrectedDNdY")
+
     unfold_roots: Dict[str, str] = {}
     for v in variations:
-        data_out = os.path.join(precomputed_dir, f"{v.name}_data.root")
-        mc_out = os.path.join(precomputed_dir, f"{v.name}_mc.root")
-        run_analysis(input_data, data_out, v.args, "hKCorrectedDNdY")
-        run_analysis(input_mc, mc_out, v.args, "hKCorrectedDNdY")
+        data_out = data_outs[v.name]
+        mc_out = mc_outs[v.name]
+        if not SINGLE_PASS:
+            run_analysis(input_data, data_out, v.args, "hKCorrectedDNdY")
+            run_analysis(input_mc, mc_out, v.args, "hKCorrectedDNdY")
 
         uf_out = os.path.join(out_dir, f"{v.name}_unfold_dndy.root")
         # Use the variation-specific MC output as the response source so the
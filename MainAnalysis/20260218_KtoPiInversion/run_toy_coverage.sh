@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# Builds RunToyCoverage when its sources changed and runs it with the given arguments
+set -euo pipefail
+
+HERE="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+ProjectBase="${ProjectBase:-$(cd "${HERE}/../.." && pwd)}"
+
+if ! command -v root-config >/dev/null 2>&1; then
+  source /raid5/root/root-v6.34.04/root/bin/thisroot.sh
+fi
+
+EXE="${HERE}/ExecuteToyCoverage"
+SRC="${HERE}/RunToyCoverage.cpp"
+HEADERS=("${HERE}/include/UnfoldingEngine.h" "${HERE}/include/CounterRandom.h" "${HERE}/include/PoissonBootstrap.h")
+
+NeedBuild=0
+[ -x "${EXE}" ] && [ ! "${SRC}" -nt "${EXE}" ] || NeedBuild=1
+for H in "${HEADERS[@]}"; do
+  [ "${H}" -nt "${EXE}" ] && NeedBuild=1
+done
+
+if [ "${NeedBuild}" = 1 ]; then
+  g++ -O3 -std=c++17 -pthread "${SRC}" -o "${EXE}" \
+    -I"${HERE}/include" -I"${ProjectBase}/CommonCode/include" \
+    $(root-config --cflags --libs) -lMatrix
+fi
+
+"${EXE}" "$@"
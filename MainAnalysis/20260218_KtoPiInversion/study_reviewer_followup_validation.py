@@ -38,6 +38,14 @@ def run_root_macro(expr):
     subprocess.run(["bash", "-lc", cmd], cwd=BASE, check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
 
 
+def run_dndeta_unfolding(out_root, kreg=8, keepbins=-1, extra_args=()):
+    cmd = ["./run_bayes_svd_unfolding.sh", "--Axis", "DNdEta", "--NIter", "1", "--KReg", str(kreg),
+           "--MC", "output/KtoPi-MC-Reco-Nominal.root", "--Data", "output/KtoPi-Data-Reco-Nominal.root",
+           "--Output", out_root, "--MakePlots", "false", "--KeepBins", str(keepbins), "--PtoPiOutput", "none"]
+    cmd.extend(extra_args)
+    subprocess.run(cmd, cwd=BASE, check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
 def clone_hist(path, name):
     f = ROOT.TFile.Open(path, "READ")
     if not f or f.IsZombie():
@@ -177,13 +185,8 @@ def perform_keepbins_scan():
     closure_panels = {"K": {}, "Pi": {}}
     for keep in KEEPBINS_VALUES:
         out_root = os.path.join(KEEPBINS_DIR, f"dndeta_keepBins{keep}.root")
-        expr = (
-            'runDNdEtaUnfolding_BayesSVD.C('
-            f'1,8,"output/KtoPi-MC-Reco-Nominal.root","output/KtoPi-Data-Reco-Nominal.root",'
-            f'"{out_root}","",false,{keep})'
-        )
         print(f"  - keepBins={keep}")
-        run_root_macro(expr)
+        run_dndeta_unfolding(out_root, keepbins=keep)
 
         h_refold_mc = clone_hist(out_root, "hRefoldRecoClosureMc_dNdEta")
         h_refold_data = clone_hist(out_root, "hRefoldRecoClosureData_dNdEta")
@@ -452,6 +455,11 @@ def perform_svd_scan():
     print("[svd] running SVD regularization scan")
     ntag_rows = []
     dndeta_rows = []
+    # Every dN/deta kReg from one run: the responses are decomposed once
+    print("  - kReg scan (dNdEta)")
+    run_dndeta_unfolding(os.path.join(SVD_DIR, "dndeta_nominal.root"),
+                         extra_args=["--KRegScan", ",".join(str(k) for k in KREG_VALUES),
+                                     "--KRegScanOutput", os.path.join(SVD_DIR, "dndeta_kreg")])
     for kreg in KREG_VALUES:
         print(f"  - kReg={kreg} (Ntag)")
         run_root_macro(f"runNtagUnfolding_BayesSVD.C(1,{kreg})")
@@ -459,14 +467,7 @@ def perform_svd_scan():
         shutil.copyfile(os.path.join(BASE, "output/NtagUnfolding_BayesSVD.root"), out_path)
         ntag_rows.append(svd_metrics_from_file(out_path, "Ntag", kreg))
 
-        print(f"  - kReg={kreg} (dNdEta)")
         out_path = os.path.join(SVD_DIR, f"dndeta_kreg{kreg}.root")
-        expr = (
-            'runDNdEtaUnfolding_BayesSVD.C('
-            f'1,{kreg},"output/KtoPi-MC-Reco-Nominal.root","output/KtoPi-Data-Reco-Nominal.root",'
-            f'"{out_path}","",false)'
-        )
-        run_root_macro(expr)
         dndeta_rows.append(svd_metrics_from_file(out_path, "dNdEta", kreg))
 
     write_csv(os.path.join(SVD_DIR, "svd_kreg_scan_summary.csv"), ntag_rows + dndeta_rows, list((ntag_rows + dndeta_rows)[0].keys()))
@@ -0,0 +1,237 @@
+#include "TFile.h"
+#include "TNamed.h"
+#include "TParameter.h"
+#include "TTree.h"
+
+#include "EventSummary.h"
+#include "ProgressBar.h"
+#include "StrangenessMessenger.h"
+#include "TruthCountingPolicy.h"
+
+#include <cmath>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Computes the per-event classification quantities once and writes them as an EventSummary
+// tree with one entry per input entry (no event selection, so entries stay aligned):
+//    build_event_summary_friend <input> <output.root> [ntagPtMin=0.2]
+// <input> accepts the messenger input list syntax (file, wildcard, comma list, .txt/.list).
+// Read it back with StrangenessTreeMessenger::AttachSummary.
+
+namespace
+{
+constexpr double kYieldPtMin = 0.4;
+constexpr double kYieldPtMax = 5.0;
+constexpr double kPIDAbsCosMin = 0.15;
+constexpr double kPIDAbsCosMax = 0.675;
+
+bool ComputeAxisRapidity(double px, double py, double pz, double e,
+   double ax, double ay, double az, double &y)
+{
+   const double pLong = px * ax + py * ay + pz * az;
+   const double plus = e + pLong;
+   const double minus = e - pLong;
+   if (plus <= 0.0 || minus <= 0.0)
+      return false;
+   y = 0.5 * std::log(plus / minus);
+   return std::isfinite(y);
+}
+
+void FillReco(const StrangenessTreeMessenger &M, double ntagPtMin, EventSummary &S)
+{
+   for (long long i = 0; i < M.NReco; ++i)
+   {
+      if (M.RecoGoodTrack[i] != 1)
+         continue;
+      if (M.RecoCharge[i] == 0.0)
+         continue;
+      ++S.NchGoodReco;
+
+      const double px = M.RecoPx[i];
+      const double py = M.RecoPy[i];
+      const double pz = M.RecoPz[i];
+      const double pt = std::sqrt(px * px + py * py);
+      const bool central = (pt > 0.0 && std::abs(std::asinh(pz / pt)) < 0.5);
+
+      if (central)
+         ++S.NchEta05Reco;
+      double y = 0.0;
+      if (S.HasThrustAxis == 1 &&
+          ComputeAxisRapidity(px, py, pz, M.RecoE[i], S.ThrustUnitX, S.ThrustUnitY, S.ThrustUnitZ, y) &&
+          std::abs(y) < 0.5)
+         ++S.NchY05Reco;
+
+      if (pt < ntagPtMin)
+         continue;
+      ++S.NchTagReco;
+      if (central)
+         ++S.NchTagRecoCentral;
+   }
+}
+
+void FillTruth(const StrangenessTreeMessenger &M, double ntagPtMin, EventSummary &S)
+{
+   S.HasTruth = 1;
+   for (long long i = 0; i < M.NGen; ++i)
+   {
+      if (M.GenStatus[i] != 1)
+         continue;
+      const long long pdg = M.GenID[i];
+      if (!TruthCountingPolicy::IsCountedChargedForActivity(pdg))
+         continue;
+
+      const double px = M.GenPx[i];
+      const double py = M.GenPy[i];
+      const double pz = M.GenPz[i];
+      const double pt = std::sqrt(px * px + py * py);
+      const bool central = (pt > 0.0 && std::abs(std::asinh(pz / pt)) < 0.5);
+
+      if (central)
+         ++S.NchEta05True;
+      double y = 0.0;
+      if (S.HasThrustAxis == 1 &&
+          ComputeAxisRapidity(px, py, pz, M.GenE[i], S.ThrustUnitX, S.ThrustUnitY, S.ThrustUnitZ, y) &&
+          std::abs(y) < 0.5)
+         ++S.NchY05True;
+
+      if (pt >= ntagPtMin)
+      {
+         ++S.NchTagTrue;
+         if (central)
+            ++S.NchTagTrueCentral;
+      }
+
+      if (!TruthCountingPolicy::PassPtWindow(px, py, kYieldPtMin, kYieldPtMax))
+         continue;
+      const bool fiducial = TruthCountingPolicy::PassPIDFiducialFromMom(px, py, pz, true, kPIDAbsCosMin, kPIDAbsCosMax);
+      const long long apdg = (pdg >= 0 ? pdg : -pdg);
+      if (apdg == 321)
+      {
+         ++S.NKTrueNoFid;
+         if (fiducial)
+            ++S.NKTrue;
+      }
+      if (apdg == 211)
+      {
+         ++S.NPiTrueNoFid;
+         if (fiducial)
+            ++S.NPiTrue;
+      }
+      if (apdg == 2212)
+      {
+         ++S.NPTrueNoFid;
+         if (fiducial)
+            ++S.NPTrue;
+      }
+   }
+}
+}
+
+int main(int argc, char *argv[])
+{
+   if (argc < 3)
+   {
+      std::cerr << "Usage: " << argv[0] << " <input> <output.root> [ntagPtMin=0.2]\n";
+      return 1;
+   }
+
+   const std::string inputPath = argv[1];
+   const std::string outputPath = argv[2];
+   const double ntagPtMin = (argc > 3) ? std::stod(argv[3]) : 0.2;
+
+   StrangenessTreeMessenger M(inputPath, "Tree");
+   if (M.Tree == nullptr)
+   {
+      std::cerr << "Missing Tree in " << inputPath << "\n";
+      return 1;
+   }
+   M.SetBufferMode(StrangenessTreeMessenger::BufferDynamic);
+
+   std::vector<std::string> branches = {"PassAll", "ThrustX", "ThrustY", "ThrustZ",
+      "RecoPx", "RecoPy", "RecoPz", "RecoE", "RecoCharge", "RecoGoodTrack"};
+   const bool isMC = M.HasBranch("GenID");
+   if (isMC)
+      branches.insert(branches.end(), {"GenPx", "GenPy", "GenPz", "GenE", "GenID", "GenStatus"});
+   if (!M.EnableOnlyBranches(branches))
+   {
+      std::cerr << "Input is missing branches needed for the summary\n";
+      return 1;
+   }
+
+   TFile outputFile(outputPath.c_str(), "RECREATE");
+   if (outputFile.IsZombie())
+   {
+      std::cerr << "Cannot create output file: " << outputPath << "\n";
+      return 1;
+   }
+
+   EventSummary S;
+   // Owned by outputFile
+   TTree *tree = new TTree(EVENT_SUMMARY_TREE, "Per-event derived quantities, friend of the strangeness tree");
+   S.CreateBranches(tree);
+
+   const long long nEntries = M.GetEntries();
+   long long nFailed = 0;
+
+   ProgressBar bar(std::cout, nEntries);
+   bar.SetStyle(1);
+   const long long delta = nEntries / 300 + 1;
+
+   for (long long ievt = 0; ievt < nEntries; ++ievt)
+   {
+      if (ievt % delta == 0)
+      {
+         bar.Update(ievt);
+         bar.Print();
+      }
+
+      // Always fill, even for unreadable entries, so the friend stays aligned
+      S.Clear();
+      if (!M.GetEntry(ievt))
+      {
+         ++nFailed;
+         tree->Fill();
+         continue;
+      }
+
+      S.EventPassAll = static_cast<int>(M.PassAll);
+      const double thrustNorm = std::sqrt(M.ThrustX * M.ThrustX + M.ThrustY * M.ThrustY + M.ThrustZ * M.ThrustZ);
+      if (thrustNorm > 0.0)
+      {
+         S.HasThrustAxis = 1;
+         S.ThrustUnitX = M.ThrustX / thrustNorm;
+         S.ThrustUnitY = M.ThrustY / thrustNorm;
+         S.ThrustUnitZ = M.ThrustZ / thrustNorm;
+      }
+
+      FillReco(M, ntagPtMin, S);
+      if (isMC)
+         FillTruth(M, ntagPtMin, S);
+
+      tree->Fill();
+   }
+
+   bar.Update(nEntries);
+   bar.Print();
+   bar.PrintLine();
+
+   time_t now = time(nullptr);
+   char date[64];
+   strftime(date, 64, "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+   tree->Write();
+   TParameter<double>("NtagPtMin", ntagPtMin).Write();
+   TParameter<double>("YieldPtMin", kYieldPtMin).Write();
+   TParameter<double>("YieldPtMax", kYieldPtMax).Write();
+   TParameter<double>("PIDAbsCosMin", kPIDAbsCosMin).Write();
+   TParameter<double>("PIDAbsCosMax", kPIDAbsCosMax).Write();
+   const std::string provenance = "Tool: build_event_summary_friend\nDate: " + std::string(date) +
+      "\nInput: " + inputPath + "\nEntries: " + std::to_string(nEntries) + "\nTruth: " + (isMC ? "yes" : "no");
+   TNamed("SummaryProvenance", provenance.c_str()).Write();
+   outputFile.Close();
+
+   std::cout << "Wrote " << nEntries << " entries (" << nFailed << " unreadable) to " << outputPath << std::endl;
+   return 0;
+}
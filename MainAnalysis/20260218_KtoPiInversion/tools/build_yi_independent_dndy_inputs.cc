@@ -158,7 +158,7 @@ int main(int argc, char *argv[])
    if (argc < 4)
    {
       std::cerr << "Usage: " << argv[0]
-                << " <input.root> <output.root> <mode:data|mc>\n";
+                << " <input.root> <output.root> <mode:data|mc> [summary.root]\n";
       return 1;
    }
 
@@ -166,6 +166,9 @@ int main(int argc, char *argv[])
    const std::string outputPath = argv[2];
    const std::string mode = argv[3];
    const bool isMC = (mode == "mc" || mode == "MC");
+   // Optional EventSummary friend from tools/build_event_summary_friend: the dN/dy counts and
+   // the thrust axis are read from it instead of being recomputed from the track arrays
+   const std::string summaryPath = (argc > 4) ? argv[4] : "";
 
    TFile inputFile(inputPath.c_str(), "READ");
    if (inputFile.IsZombie())
@@ -181,6 +184,13 @@ int main(int argc, char *argv[])
       return 1;
    }
 
+   const bool useSummary = !summaryPath.empty();
+   if (useSummary && !M.AttachSummary(summaryPath))
+   {
+      std::cerr << "Cannot use summary " << summaryPath << "\n";
+      return 1;
+   }
+
    const bool hasRecoEff = (M.Tree->GetBranch("RecoEfficiencyK") != nullptr &&
                             M.Tree->GetBranch("RecoEfficiencyPi") != nullptr &&
                             M.Tree->GetBranch("RecoEfficiencyP") != nullptr);
@@ -235,40 +245,42 @@ int main(int argc, char *argv[])
          continue;
       ++nPassAll;
 
-      const double thrustNorm = std::sqrt(M.ThrustX * M.ThrustX + M.ThrustY * M.ThrustY + M.ThrustZ * M.ThrustZ);
-      if (thrustNorm <= 0.0)
-         continue;
-      const double thrustX = M.ThrustX / thrustNorm;
-      const double thrustY = M.ThrustY / thrustNorm;
-      const double thrustZ = M.ThrustZ / thrustNorm;
-
       const int nreco = static_cast<int>(std::min<long long>(M.NReco, STRANGE_MAX_RECO));
       const int ngen = static_cast<int>(std::min<long long>(M.NGen, STRANGE_MAX_GEN));
 
       int nChY05Reco = 0;
-      for (int i = 0; i < nreco; ++i)
+      int nChY05True = 0;
+      if (useSummary)
       {
-         if (M.RecoGoodTrack[i] != 1)
+         // The |y_T| < 0.5 counts have no pT or PID threshold, so any summary of this input fits
+         const EventSummary &S = M.Summary;
+         if (S.HasThrustAxis != 1)
             continue;
-         if (M.RecoCharge[i] == 0.0)
-            continue;
-         double y = 0.0;
-         if (ComputeAxisRapidity(M.RecoPx[i], M.RecoPy[i], M.RecoPz[i], M.RecoE[i], thrustX, thrustY, thrustZ, y) &&
-             std::abs(y) < 0.5)
-            ++nChY05Reco;
+         nChY05Reco = S.NchY05Reco;
+         nChY05True = S.NchY05True;
       }
-      if (nChY05Reco > kMaxVisibleDNdYCount)
-         nChY05Reco = kMaxVisibleDNdYCount;
-      const int actRecoBin = FindBin(dndyEdges, static_cast<double>(nChY05Reco));
-      if (actRecoBin < 0)
-         continue;
-      hRecoCounts.Fill(static_cast<double>(nChY05Reco));
-
-      int nChY05True = 0;
-      std::vector<int> recoToGen(nreco, -1);
-      if (isMC)
+      else
       {
-         for (int i = 0; i < ngen; ++i)
+         const double thrustNorm = std::sqrt(M.ThrustX * M.ThrustX + M.ThrustY * M.ThrustY + M.ThrustZ * M.ThrustZ);
+         if (thrustNorm <= 0.0)
+            continue;
+         const double thrustX = M.ThrustX / thrustNorm;
+         const double thrustY = M.ThrustY / thrustNorm;
+         const double thrustZ = M.ThrustZ / thrustNorm;
+
+         for (int i = 0; i < nreco; ++i)
+         {
+            if (M.RecoGoodTrack[i] != 1)
+               continue;
+            if (M.RecoCharge[i] == 0.0)
+               continue;
+            double y = 0.0;
+            if (ComputeAxisRapidity(M.RecoPx[i], M.RecoPy[i], M.RecoPz[i], M.RecoE[i], thrustX, thrustY, thrustZ, y) &&
+                std::abs(y) < 0.5)
+               ++nChY05Reco;
+         }
+
+         for (int i = 0; isMC && i < ngen; ++i)
          {
             if (M.GenStatus[i] != 1)
                continue;
@@ -279,8 +291,19 @@ int main(int argc, char *argv[])
                 std::abs(y) < 0.5)
                ++nChY05True;
          }
-         if (nChY05True > kMaxVisibleDNdYCount)
-            nChY05True = kMaxVisibleDNdYCount;
+      }
+      if (nChY05Reco > kMaxVisibleDNdYCount)
+         nChY05Reco = kMaxVisibleDNdYCount;
+      if (nChY05True > kMaxVisibleDNdYCount)
+         nChY05True = kMaxVisibleDNdYCount;
+      const int actRecoBin = FindBin(dndyEdges, static_cast<double>(nChY05Reco));
+      if (actRecoBin < 0)
+         continue;
+      hRecoCounts.Fill(static_cast<double>(nChY05Reco));
+
+      std::vector<int> recoToGen(nreco, -1);
+      if (isMC)
+      {
          for (int i = 0; i < ngen; ++i)
          {
             const int recoIndex = static_cast<int>(M.GenMatchIndex[i]);
@@ -7,6 +7,7 @@ using namespace std;
 
 #include "StrangenessMessenger.h"
 #include "CommandLine.h"
+#include "EntryRange.h"
 #include "ProgressBar.h"
 
 int main(int argc, char *argv[])
@@ -15,9 +16,7 @@ int main(int argc, char *argv[])
 
    string InputFileName = CL.Get("Input", "Trees/merged_mc_v2.2_partial.root");
    string OutputFileName = CL.Get("Output", "EfficiencyClosure.root");
-   double Fraction      = CL.GetDouble("Fraction", 1.00);
 
-   TFile InputFile(InputFileName.c_str());
    TFile OutputFile(OutputFileName.c_str(), "RECREATE");
    
    TH1D HGenPion("HGenPion", ";;", 50, 0, 8);
@@ -35,10 +34,13 @@ int main(int argc, char *argv[])
    TH1D HRecoPionMistagAsKaon("HRecoPionMistagAsKaon", ";;", 50, 0, 8);
    TH1D HRecoProtonMistagAsKaon("HRecoProtonMistagAsKaon", ";;", 50, 0, 8);
    
-   StrangenessTreeMessenger M(InputFile);
+   StrangenessTreeMessenger M(InputFileName);
 
-   int EntryCount = M.GetEntries() * Fraction;
-   for(int iE = 0; iE < EntryCount; iE++)
+   EntryRange Range(CL, M.GetEntries());
+   if(Range.IsValid() == false)
+      return 1;
+
+   for(long long iE = Range.Begin; iE < Range.End; iE++)
    {
       M.GetEntry(iE);
 
@@ -124,8 +126,9 @@ int main(int argc, char *argv[])
    HRecoPionMistagAsKaon.Write();
    HRecoProtonMistagAsKaon.Write();
 
+   Range.Write(&OutputFile);
+
    OutputFile.Close();
-   InputFile.Close();
 
    return 0;
 }
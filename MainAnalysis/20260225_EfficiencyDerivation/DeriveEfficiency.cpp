@@ -7,6 +7,7 @@ using namespace std;
 
 #include "StrangenessMessenger.h"
 #include "CommandLine.h"
+#include "EntryRange.h"
 #include "ProgressBar.h"
 
 int main(int argc, char *argv[])
@@ -15,14 +16,12 @@ int main(int argc, char *argv[])
 
    string InputFileName = CL.Get("Input", "Trees/merged_mc_v2.root");
    string OutputFileName = CL.Get("Output", "Efficiency.root");
-   double Fraction      = CL.GetDouble("Fraction", 1.00);
 
    int NBinsX = 51;
    int NBinsY = 31;
    double BinsX[] = {-1, -0.94, -0.91, -0.82, -0.70, -0.675, -0.65, -0.625, -0.575, -0.55, -0.525, -0.5, -0.475, -0.45, -0.4, -0.375, -0.35, -0.325, -0.3, -0.275, -0.25, -0.225, -0.2, -0.175, -0.15, -0.05, 0.05, 0.15, 0.175, 0.2, 0.225, 0.25, 0.275, 0.3, 0.325, 0.35, 0.375, 0.4, 0.425, 0.45, 0.475, 0.5, 0.525, 0.55, 0.575, 0.6, 0.625, 0.65, 0.675, 0.70, 0.82, 0.91, 0.94, 1.00};
    double BinsY[] = {0, 0.15, 0.25, 0.35, 0.4, 0.5, 0.6, 0.718, 0.8, 0.9, 1.00, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.8, 2.0, 2.3, 2.5, 2.6, 2.8, 2.9, 3.0, 3.5, 4.0, 5.0, 6.0, 7.0, 8.0, 100};
 
-   TFile InputFile(InputFileName.c_str());
    TFile OutputFile(OutputFileName.c_str(), "RECREATE");
    
    TH2D HGenPion("HGenPion", ";;", NBinsX, BinsX, NBinsY, BinsY);
@@ -48,10 +47,13 @@ int main(int argc, char *argv[])
    TH2D HRecoProton("HRecoProton", ";;", NBinsX, BinsX, NBinsY, BinsY);
    TH2D HRecoProtonMatched("HRecoProtonMatched", ";;", NBinsX, BinsX, NBinsY, BinsY);
 
-   StrangenessTreeMessenger M(InputFile);
+   StrangenessTreeMessenger M(InputFileName);
 
-   int EntryCount = M.GetEntries() * Fraction;
-   for(int iE = 0; iE < EntryCount; iE++)
+   EntryRange Range(CL, M.GetEntries());
+   if(Range.IsValid() == false)
+      return 1;
+
+   for(long long iE = Range.Begin; iE < Range.End; iE++)
    {
       M.GetEntry(iE);
 
@@ -222,8 +224,25 @@ int main(int argc, char *argv[])
    HRecoKaonEfficiency->Write();
    HRecoProtonEfficiency->Write();
 
+   // The efficiencies are ratios; MergeShards rebuilds them from the summed counts
+   Range.Write(&OutputFile, {
+      "HGenPionEfficiency=HGenPionMatched/HGenPion",
+      "HGenPionEfficiencyPionTagged=HGenPionMatchedPionTagged/HGenPionMatched",
+      "HGenPionEfficiencyKaonTagged=HGenPionMatchedKaonTagged/HGenPionMatched",
+      "HGenPionEfficiencyProtonTagged=HGenPionMatchedProtonTagged/HGenPionMatched",
+      "HGenKaonEfficiency=HGenKaonMatched/HGenKaon",
+      "HGenKaonEfficiencyPionTagged=HGenKaonMatchedPionTagged/HGenKaonMatched",
+      "HGenKaonEfficiencyKaonTagged=HGenKaonMatchedKaonTagged/HGenKaonMatched",
+      "HGenKaonEfficiencyProtonTagged=HGenKaonMatchedProtonTagged/HGenKaonMatched",
+      "HGenProtonEfficiency=HGenProtonMatched/HGenProton",
+      "HGenProtonEfficiencyPionTagged=HGenProtonMatchedPionTagged/HGenProtonMatched",
+      "HGenProtonEfficiencyKaonTagged=HGenProtonMatchedKaonTagged/HGenProtonMatched",
+      "HGenProtonEfficiencyProtonTagged=HGenProtonMatchedProtonTagged/HGenProtonMatched",
+      "HRecoPionEfficiency=HRecoPionMatched/HRecoPion",
+      "HRecoKaonEfficiency=HRecoKaonMatched/HRecoKaon",
+      "HRecoProtonEfficiency=HRecoProtonMatched/HRecoProton"});
+
    OutputFile.Close();
-   InputFile.Close();
 
    return 0;
 }
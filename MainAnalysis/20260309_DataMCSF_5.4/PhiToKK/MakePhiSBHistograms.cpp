@@ -9,124 +9,77 @@
 #include "TParameter.h"
 #include "TTree.h"
 
+#include "EntryRange.h"
+#include "ParallelProcessor.h"
+#include "StrangenessMessenger.h"
+
 namespace {
-constexpr double kKaonMass = 0.493677;
 constexpr double kPhiMassWindowMin = 0.99;
 constexpr double kPhiMassWindowMax = 1.06;
 constexpr int kPhiMassBins = 280;
 constexpr double kAbsCosMin = 0.15;
 constexpr double kAbsCosMax = 0.675;
 constexpr long long kKaonTagThreshold = 2;
-constexpr int kMaxReco = 10000;
 
 struct TrackKinematics {
   double px = 0.0;
   double py = 0.0;
   double pz = 0.0;
+  double e = 0.0;  // kaon mass hypothesis
   double charge = 0.0;
   long long kaonTag = 0;
 };
 
 double buildMass(const TrackKinematics& t1, const TrackKinematics& t2) {
-  const double p1sq = t1.px * t1.px + t1.py * t1.py + t1.pz * t1.pz;
-  const double p2sq = t2.px * t2.px + t2.py * t2.py + t2.pz * t2.pz;
-  const double e1 = std::sqrt(p1sq + kKaonMass * kKaonMass);
-  const double e2 = std::sqrt(p2sq + kKaonMass * kKaonMass);
-
   const double px = t1.px + t2.px;
   const double py = t1.py + t2.py;
   const double pz = t1.pz + t2.pz;
-  const double e = e1 + e2;
+  const double e = t1.e + t2.e;
   const double m2 = e * e - (px * px + py * py + pz * pz);
   return (m2 > 0.0) ? std::sqrt(m2) : 0.0;
 }
 
-bool passAcceptance(const TrackKinematics& t) {
-  const double p = std::sqrt(t.px * t.px + t.py * t.py + t.pz * t.pz);
-  if (p <= 0.0) return false;
-  const double absCosTheta = std::fabs(t.pz / p);
+// |cos(theta)| comes from the messenger track cache; it is NaN for p == 0, which fails both cuts.
+bool passAcceptance(double absCosTheta) {
   return (absCosTheta >= kAbsCosMin && absCosTheta <= kAbsCosMax);
 }
 
-std::string getArgument(int argc, char* argv[], const std::string& option,
-                        const std::string& defaultValue) {
-  for (int i = 1; i + 1 < argc; ++i)
-    if (argv[i] == option) return argv[i + 1];
-  return defaultValue;
-}
-
-double getDoubleArgument(int argc, char* argv[], const std::string& option, double defaultValue) {
-  const std::string value = getArgument(argc, argv, option, "");
-  return value.empty() ? defaultValue : std::stod(value);
-}
-}  // namespace
-
-int main(int argc, char* argv[]) {
-  const std::string inputFileName =
-      getArgument(argc, argv, "--input", "../../../../Samples/merged_mc_v2.3.root");
-  const std::string outputFileName =
-      getArgument(argc, argv, "--output", "PhiSBHistograms.root");
-  const std::string treeName = getArgument(argc, argv, "--tree", "Tree");
-  const double massMin = getDoubleArgument(argc, argv, "--mass-min", kPhiMassWindowMin);
-  const double massMax = getDoubleArgument(argc, argv, "--mass-max", kPhiMassWindowMax);
-
-  TFile inputFile(inputFileName.c_str(), "READ");
-  if (inputFile.IsZombie()) {
-    std::cerr << "Error: cannot open input file " << inputFileName << std::endl;
-    return 1;
-  }
-
-  TTree* tree = nullptr;
-  inputFile.GetObject(treeName.c_str(), tree);
-  if (tree == nullptr) {
-    std::cerr << "Error: cannot find tree '" << treeName << "' in " << inputFileName << std::endl;
-    return 1;
-  }
-
-  long long nReco = 0;
-  double recoPx[kMaxReco] = {0.0};
-  double recoPy[kMaxReco] = {0.0};
-  double recoPz[kMaxReco] = {0.0};
-  double recoCharge[kMaxReco] = {0.0};
-  long long recoPIDKaon[kMaxReco] = {0};
-  long long recoGoodTrack[kMaxReco] = {0};
-
-  tree->SetBranchAddress("NReco", &nReco);
-  tree->SetBranchAddress("RecoPx", recoPx);
-  tree->SetBranchAddress("RecoPy", recoPy);
-  tree->SetBranchAddress("RecoPz", recoPz);
-  tree->SetBranchAddress("RecoCharge", recoCharge);
-  tree->SetBranchAddress("RecoPIDKaon", recoPIDKaon);
-  tree->SetBranchAddress("RecoGoodTrack", recoGoodTrack);
-
-  TH1D hMass1Tag("hPhiSBMass1Tag",
-                 "#phi same-event reco pairs, 1-tag; m(K^{+}K^{-}) [GeV]; Pairs / bin",
-                 kPhiMassBins, massMin, massMax);
-  TH1D hMass2Tag("hPhiSBMass2Tag",
-                 "#phi same-event reco pairs, 2-tag; m(K^{+}K^{-}) [GeV]; Pairs / bin",
-                 kPhiMassBins, massMin, massMax);
-  TH1D hMassAccepted("hPhiSBMassAccepted",
-                     "#phi same-event reco pairs, accepted; m(K^{+}K^{-}) [GeV]; Pairs / bin",
-                     kPhiMassBins, massMin, massMax);
-
+// Per-thread outputs for ParallelProcessor; merged in thread order at the end.
+struct PhiSBWorker {
+  TH1D hMass1Tag;
+  TH1D hMass2Tag;
+  TH1D hMassAccepted;
   long long acceptedTracks = 0;
   long long totalOppositeSignPairs = 0;
   long long count1Tag = 0;
   long long count2Tag = 0;
+  std::vector<TrackKinematics> tracks;
+
+  PhiSBWorker(double massMin, double massMax)
+      : hMass1Tag("hPhiSBMass1Tag",
+                  "#phi same-event reco pairs, 1-tag; m(K^{+}K^{-}) [GeV]; Pairs / bin",
+                  kPhiMassBins, massMin, massMax),
+        hMass2Tag("hPhiSBMass2Tag",
+                  "#phi same-event reco pairs, 2-tag; m(K^{+}K^{-}) [GeV]; Pairs / bin",
+                  kPhiMassBins, massMin, massMax),
+        hMassAccepted("hPhiSBMassAccepted",
+                      "#phi same-event reco pairs, accepted; m(K^{+}K^{-}) [GeV]; Pairs / bin",
+                      kPhiMassBins, massMin, massMax) {
+    hMass1Tag.SetDirectory(nullptr);
+    hMass2Tag.SetDirectory(nullptr);
+    hMassAccepted.SetDirectory(nullptr);
+  }
 
-  const long long entryCount = tree->GetEntries();
-  for (long long entry = 0; entry < entryCount; ++entry) {
-    tree->GetEntry(entry);
-
-    std::vector<TrackKinematics> tracks;
-    tracks.reserve(nReco);
+  void ProcessEntry(StrangenessTreeMessenger& M, long long) {
+    tracks.clear();
+    const StrangenessTreeMessenger::TrackCache& cache = M.GetTrackCache();
 
-    for (long long i = 0; i < nReco; ++i) {
-      if (recoGoodTrack[i] != 1) continue;
-      if (recoCharge[i] == 0) continue;
-      TrackKinematics t{recoPx[i], recoPy[i], recoPz[i], recoCharge[i], recoPIDKaon[i]};
-      if (!passAcceptance(t)) continue;
-      tracks.push_back(t);
+    for (long long i = 0; i < cache.N; ++i) {
+      if (M.RecoGoodTrack[i] != 1) continue;
+      if (M.RecoCharge[i] == 0) continue;
+      if (!passAcceptance(cache.AbsCos[i])) continue;
+      tracks.push_back(
+          TrackKinematics{M.RecoPx[i], M.RecoPy[i], M.RecoPz[i], cache.EKaon[i], M.RecoCharge[i], M.RecoPIDKaon[i]});
       acceptedTracks++;
     }
 
@@ -155,10 +108,96 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  void Merge(const PhiSBWorker& other) {
+    hMass1Tag.Add(&other.hMass1Tag);
+    hMass2Tag.Add(&other.hMass2Tag);
+    hMassAccepted.Add(&other.hMassAccepted);
+    acceptedTracks += other.acceptedTracks;
+    totalOppositeSignPairs += other.totalOppositeSignPairs;
+    count1Tag += other.count1Tag;
+    count2Tag += other.count2Tag;
+  }
+};
+
+std::string getArgument(int argc, char* argv[], const std::string& option,
+                        const std::string& defaultValue) {
+  for (int i = 1; i + 1 < argc; ++i)
+    if (argv[i] == option) return argv[i + 1];
+  return defaultValue;
+}
+
+double getDoubleArgument(int argc, char* argv[], const std::string& option, double defaultValue) {
+  const std::string value = getArgument(argc, argv, option, "");
+  return value.empty() ? defaultValue : std::stod(value);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const std::string inputFileName =
+      getArgument(argc, argv, "--input", "../../../../Samples/merged_mc_v2.3.root");
+  const std::string outputFileName =
+      getArgument(argc, argv, "--output", "PhiSBHistograms.root");
+  const std::string treeName = getArgument(argc, argv, "--tree", "Tree");
+  const double massMin = getDoubleArgument(argc, argv, "--mass-min", kPhiMassWindowMin);
+  const double massMax = getDoubleArgument(argc, argv, "--mass-max", kPhiMassWindowMax);
+  const int threads = std::stoi(getArgument(argc, argv, "--Threads", "1"));
+  const bool showProgress = (getArgument(argc, argv, "--Progress", "true") != "false");
+
+  // Entry range of this job, same options as the other executables (see EntryRange.h)
+  const double fraction = getDoubleArgument(argc, argv, "--Fraction", 1.0);
+  const std::string firstEntryText = getArgument(argc, argv, "--FirstEntry", "0");
+  const std::string nEntriesText = getArgument(argc, argv, "--NEntries", "-1");
+  const std::string sharding = getArgument(argc, argv, "--Shard", "0/1");
+  long long firstEntry = 0;
+  long long nEntries = -1;
+  if (!EntryRange::ParseCount(firstEntryText, firstEntry) || !EntryRange::ParseCount(nEntriesText, nEntries)) {
+    std::cerr << "Error: cannot parse --FirstEntry \"" << firstEntryText << "\" / --NEntries \"" << nEntriesText
+              << "\", expected numbers" << std::endl;
+    return 1;
+  }
+  int shard = 0;
+  int shardCount = 1;
+  if (!EntryRange::ParseShard(sharding, shard, shardCount)) {
+    std::cerr << "Error: cannot parse --Shard \"" << sharding << "\", expected i/N with 0 <= i < N" << std::endl;
+    return 1;
+  }
+
+  // --input takes a single file, a wildcard, a comma list or a .txt/.list of files;
+  // every thread opens it separately and processes one contiguous block of entries.
+  ParallelProcessor<PhiSBWorker> processor(inputFileName, treeName, threads);
+
+  if (showProgress) processor.SetProgress(&std::cout);
+
+  // Only the six reco columns used below are decompressed; everything else stays off.
+  bool branchesOK = true;
+  processor.SetConfigure([&branchesOK](StrangenessTreeMessenger& M) {
+    if (!M.EnableOnlyBranches({"RecoPx", "RecoPy", "RecoPz", "RecoCharge", "RecoPIDKaon", "RecoGoodTrack"}))
+      branchesOK = false;
+    if (!M.EnableTrackCache(StrangenessTreeMessenger::CacheAbsCos | StrangenessTreeMessenger::CacheEnergies))
+      branchesOK = false;
+  });
+
+  if (!processor.Open()) {
+    std::cerr << "Error: cannot find tree '" << treeName << "' in " << inputFileName << std::endl;
+    return 1;
+  }
+  if (!branchesOK) {
+    std::cerr << "Error: missing reco branches in " << inputFileName << std::endl;
+    return 1;
+  }
+
+  const EntryRange range(processor.GetEntries(), fraction, firstEntry, nEntries, shard, shardCount);
+  if (range.IsPartial())
+    std::cout << "Processing entries " << range.Begin << " to " << range.End << " of " << range.Total
+              << " (shard " << range.Shard << "/" << range.ShardCount << ")" << std::endl;
+
+  const PhiSBWorker& result = processor.Run(
+      [massMin, massMax](int) { return new PhiSBWorker(massMin, massMax); }, range.Begin, range.End);
+
   TFile outputFile(outputFileName.c_str(), "RECREATE");
-  hMass1Tag.Write();
-  hMass2Tag.Write();
-  hMassAccepted.Write();
+  result.hMass1Tag.Write();
+  result.hMass2Tag.Write();
+  result.hMassAccepted.Write();
 
   TNamed selection("SelectionSummary",
                    Form("Reco-only phi S+B pairs from same event: RecoGoodTrack==1, nonzero charge, "
@@ -166,18 +205,19 @@ int main(int argc, char* argv[]) {
                         "on both tracks, tag if RecoPIDKaon>=2, hist range %.3f-%.3f GeV",
                         massMin, massMax));
   selection.Write();
-  TParameter<long long>("AcceptedTracks", acceptedTracks).Write();
-  TParameter<long long>("TotalOppositeSignPairs", totalOppositeSignPairs).Write();
-  TParameter<long long>("Count1Tag", count1Tag).Write();
-  TParameter<long long>("Count2Tag", count2Tag).Write();
+  TParameter<long long>("AcceptedTracks", result.acceptedTracks).Write();
+  TParameter<long long>("TotalOppositeSignPairs", result.totalOppositeSignPairs).Write();
+  TParameter<long long>("Count1Tag", result.count1Tag).Write();
+  TParameter<long long>("Count2Tag", result.count2Tag).Write();
   TParameter<double>("MassMin", massMin).Write();
   TParameter<double>("MassMax", massMax).Write();
+  range.Write(&outputFile);  // everything above is additive for MergeShards
   outputFile.Close();
 
   std::cout << "Wrote " << outputFileName << std::endl;
-  std::cout << "  Accepted tracks:      " << acceptedTracks << std::endl;
-  std::cout << "  Opposite-sign pairs:  " << totalOppositeSignPairs << std::endl;
-  std::cout << "  1-tag pairs:          " << count1Tag << std::endl;
-  std::cout << "  2-tag pairs:          " << count2Tag << std::endl;
+  std::cout << "  Accepted tracks:      " << result.acceptedTracks << std::endl;
+  std::cout << "  Opposite-sign pairs:  " << result.totalOppositeSignPairs << std::endl;
+  std::cout << "  1-tag pairs:          " << result.count1Tag << std::endl;
+  std::cout << "  2-tag pairs:          " << result.count2Tag << std::endl;
   return 0;
 }